@@ -14,87 +14,204 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 /**
- * Simple buffer for passing data between TCP sockets and DPI modules
+ * Lock-free ring buffer for passing data between TCP sockets and DPI modules
+ *
+ * Each buffer has a single producer and a single consumer (one is the host
+ * thread and the other is the server thread). rptr and wptr count the bytes
+ * that have been read and written, wrapping at UINT_MAX. Only the consumer
+ * writes rptr and only the producer writes wptr, so the two threads can use
+ * the buffer at the same time without a lock. size is a power of two.
  */
-#define BUFSIZE_BYTE 256
-
 struct tcp_buf {
   unsigned int rptr;
   unsigned int wptr;
-  char buf[BUFSIZE_BYTE];
+  unsigned int size;
+  char *buf;
 };
 
 /**
  * TCP Server thread context structure
+ *
+ * The server thread sleeps in epoll_wait() until there is something to do.
+ * Before it goes to sleep, it sets a flag for each buffer event that the host
+ * thread should wake it up for, by writing to wake_fd. Similarly, if the host
+ * thread has to wait for space in buf_out, it sets host_wants_space and waits
+ * for the server thread to write to space_fd. Flags are read and written with
+ * atomic builtins.
  */
 struct tcp_server_ctx {
   // Writeable by the host thread
   char *display_name;
   uint16_t listen_port;
   volatile bool socket_run;
+  bool client_close_req;
+  bool host_wants_space;
   // Writeable by the server thread
+  bool server_wants_data;   // waiting for data in buf_out
+  bool server_wants_space;  // waiting for space in buf_in
   struct tcp_buf *buf_in;
   struct tcp_buf *buf_out;
-  int sfd;  // socket fd
-  int cfd;  // client fd
+  int wake_fd;   // eventfd to wake the server thread
+  int space_fd;  // eventfd to wake the host thread
+  int sfd;       // socket fd
+  int cfd;       // client fd
+  int epfd;      // epoll fd
+  uint32_t cfd_events;  // events for cfd in epfd, or 0 if not registered
+  bool send_blocked;    // client's socket buffer full, waiting for EPOLLOUT
   pthread_t sock_thread;
 };
 
-static bool tcp_buffer_is_full(struct tcp_buf *buf) {
-  if (buf->wptr >= buf->rptr) {
-    return (buf->wptr - buf->rptr) == (BUFSIZE_BYTE - 1);
-  } else {
-    return (buf->rptr - buf->wptr) == 1;
+// Return the number of bytes that can be read from buf. Only the consumer
+// should call this.
+static unsigned int tcp_buffer_count(struct tcp_buf *buf) {
+  return __atomic_load_n(&buf->wptr, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&buf->rptr, __ATOMIC_RELAXED);
+}
+
+// Return the number of bytes that can be written to buf. Only the producer
+// should call this.
+static unsigned int tcp_buffer_space(struct tcp_buf *buf) {
+  return buf->size - (__atomic_load_n(&buf->wptr, __ATOMIC_RELAXED) -
+                      __atomic_load_n(&buf->rptr, __ATOMIC_ACQUIRE));
+}
+
+// Fill in iov (which has room for two entries) with the len bytes of buf that
+// start at index pos, returning the number of entries used.
+static int tcp_buffer_iov(struct tcp_buf *buf, unsigned int pos,
+                          unsigned int len, struct iovec *iov) {
+  if (len == 0) {
+    return 0;
+  }
+  unsigned int off = pos & (buf->size - 1);
+  unsigned int first = buf->size - off;
+  if (len <= first) {
+    iov[0].iov_base = buf->buf + off;
+    iov[0].iov_len = len;
+    return 1;
   }
+  iov[0].iov_base = buf->buf + off;
+  iov[0].iov_len = first;
+  iov[1].iov_base = buf->buf;
+  iov[1].iov_len = len - first;
+  return 2;
 }
 
-static bool tcp_buffer_is_empty(struct tcp_buf *buf) {
-  return (buf->wptr == buf->rptr);
+// Get the free space in buf as an iovec array. Call tcp_buffer_produce() once
+// it has been filled. Only the producer should call this.
+static int tcp_buffer_free_iov(struct tcp_buf *buf, struct iovec *iov) {
+  return tcp_buffer_iov(buf, buf->wptr, tcp_buffer_space(buf), iov);
 }
 
-static void tcp_buffer_put_byte(struct tcp_buf *buf, char dat) {
-  bool done = false;
-  while (!done) {
-    if (!tcp_buffer_is_full(buf)) {
-      buf->buf[buf->wptr++] = dat;
-      buf->wptr %= BUFSIZE_BYTE;
-      done = true;
-    }
+static void tcp_buffer_produce(struct tcp_buf *buf, size_t len) {
+  __atomic_store_n(&buf->wptr, buf->wptr + (unsigned int)len,
+                   __ATOMIC_RELEASE);
+}
+
+// Get the data in buf as an iovec array. Call tcp_buffer_consume() once it has
+// been used. Only the consumer should call this.
+static int tcp_buffer_data_iov(struct tcp_buf *buf, struct iovec *iov) {
+  return tcp_buffer_iov(buf, buf->rptr, tcp_buffer_count(buf), iov);
+}
+
+static void tcp_buffer_consume(struct tcp_buf *buf, size_t len) {
+  __atomic_store_n(&buf->rptr, buf->rptr + (unsigned int)len,
+                   __ATOMIC_RELEASE);
+}
+
+// Copy up to len bytes from dat into buf, returning the number copied
+static size_t tcp_buffer_put(struct tcp_buf *buf, const char *dat,
+                             size_t len) {
+  struct iovec iov[2];
+  int n = tcp_buffer_free_iov(buf, iov);
+  size_t done = 0;
+  for (int i = 0; i < n && done < len; ++i) {
+    size_t chunk = len - done < iov[i].iov_len ? len - done : iov[i].iov_len;
+    memcpy(iov[i].iov_base, dat + done, chunk);
+    done += chunk;
   }
+  if (done) {
+    tcp_buffer_produce(buf, done);
+  }
+  return done;
 }
 
-static bool tcp_buffer_get_byte(struct tcp_buf *buf, char *dat) {
-  if (tcp_buffer_is_empty(buf)) {
-    return false;
+// Copy up to len bytes from buf into dat, returning the number copied
+static size_t tcp_buffer_get(struct tcp_buf *buf, char *dat, size_t len) {
+  struct iovec iov[2];
+  int n = tcp_buffer_data_iov(buf, iov);
+  size_t done = 0;
+  for (int i = 0; i < n && done < len; ++i) {
+    size_t chunk = len - done < iov[i].iov_len ? len - done : iov[i].iov_len;
+    memcpy(dat + done, iov[i].iov_base, chunk);
+    done += chunk;
   }
-  *dat = buf->buf[buf->rptr++];
-  buf->rptr %= BUFSIZE_BYTE;
-  return true;
+  if (done) {
+    tcp_buffer_consume(buf, done);
+  }
+  return done;
 }
 
-static struct tcp_buf *tcp_buffer_new(void) {
+static struct tcp_buf *tcp_buffer_new(size_t size) {
+  // Round the size up to a power of two
+  unsigned int rounded = 2;
+  while (rounded < size) {
+    assert(rounded < (1u << 31) && "Buffer size too large.");
+    rounded <<= 1;
+  }
+
   struct tcp_buf *buf_new;
   buf_new = (struct tcp_buf *)malloc(sizeof(struct tcp_buf));
+  if (!buf_new) {
+    return NULL;
+  }
+  buf_new->buf = (char *)malloc(rounded);
+  if (!buf_new->buf) {
+    free(buf_new);
+    return NULL;
+  }
   buf_new->rptr = 0;
   buf_new->wptr = 0;
+  buf_new->size = rounded;
   return buf_new;
 }
 
 static void tcp_buffer_free(struct tcp_buf **buf) {
+  if (*buf) {
+    free((*buf)->buf);
+  }
   free(*buf);
   *buf = NULL;
 }
 
+/**
+ * If *flag is set, clear it and signal the eventfd at fd
+ *
+ * This is called by one thread after changing a buffer, to wake the other
+ * thread if it set flag to say it was waiting for that change. The fence
+ * orders the buffer update before the flag check, pairing with the fence in
+ * the waiting thread between setting the flag and rechecking the buffer.
+ */
+static void wake_if_waiting(bool *flag, int fd) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(flag, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(flag, false, __ATOMIC_SEQ_CST)) {
+    eventfd_write(fd, 1);
+  }
+}
+
 /**
  * Start a TCP server
  *
@@ -208,6 +325,7 @@ static int client_tryaccept(struct tcp_server_ctx *ctx) {
   if (rv != 0) {
     fprintf(stderr, "%s: Unable to make client socket non-blocking: %s (%d)\n",
             ctx->display_name, strerror(errno), errno);
+    close(cfd);
     return -1;
   }
 
@@ -234,64 +352,183 @@ static void stop(struct tcp_server_ctx *ctx) {
 }
 
 /**
- * Receive a byte from a connected client
+ * Disconnect the client (if there is one)
+ *
+ * Must only be called by the server thread.
  *
  * @param ctx context object
- * @param cmd byte received
- * @return true if a byte was read
  */
-static bool get_byte(struct tcp_server_ctx *ctx, char *cmd) {
+static void client_close(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  ssize_t num_read = read(ctx->cfd, cmd, 1);
-
-  if (num_read == 0) {
-    return false;
+  if (!ctx->cfd) {
+    return;
   }
-  if (num_read == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return false;
-    } else if (errno == EBADF) {
-      // Possibly client went away? Accept a new connection.
-      fprintf(stderr, "%s: Client disappeared.\n", ctx->display_name);
-      tcp_server_client_close(ctx);
-      return false;
-    } else {
-      fprintf(stderr, "%s: Error while reading from client: %s (%d)\n",
-              ctx->display_name, strerror(errno), errno);
-      assert(0 && "Error reading from client");
+
+  // Closing the fd also removes it from epfd
+  close(ctx->cfd);
+  ctx->cfd = 0;
+  ctx->cfd_events = 0;
+  ctx->send_blocked = false;
+}
+
+/**
+ * Receive as much data as will fit in buf_in from a connected client
+ *
+ * @param ctx context object
+ */
+static void client_recv(struct tcp_server_ctx *ctx) {
+  while (ctx->cfd) {
+    struct iovec iov[2];
+    int iovcnt = tcp_buffer_free_iov(ctx->buf_in, iov);
+    if (!iovcnt) {
+      return;
+    }
+
+    ssize_t num_read = readv(ctx->cfd, iov, iovcnt);
+
+    if (num_read == 0) {
+      printf("%s: Client disconnected.\n", ctx->display_name);
+      client_close(ctx);
+      return;
+    }
+    if (num_read == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        fprintf(stderr, "%s: Error while reading from client: %s (%d)\n",
+                ctx->display_name, strerror(errno), errno);
+        client_close(ctx);
+        return;
+      }
+    }
+
+    tcp_buffer_produce(ctx->buf_in, num_read);
+
+    // A short read means there's nothing more to read for now
+    if ((size_t)num_read < iov[0].iov_len + (iovcnt > 1 ? iov[1].iov_len : 0)) {
+      return;
     }
   }
-  assert(num_read == 1);
-  return true;
 }
 
 /**
- * Send a byte to a connected client
+ * Send as much of the data in buf_out as the client will accept
  *
  * @param ctx context object
- * @param cmd byte to send
  */
-static void put_byte(struct tcp_server_ctx *ctx, char cmd) {
-  while (1) {
-    ssize_t num_written = send(ctx->cfd, &cmd, sizeof(cmd), MSG_NOSIGNAL);
+static void client_send(struct tcp_server_ctx *ctx) {
+  while (ctx->cfd && !ctx->send_blocked) {
+    struct iovec iov[2];
+    int iovcnt = tcp_buffer_data_iov(ctx->buf_out, iov);
+    if (!iovcnt) {
+      return;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t num_written = sendmsg(ctx->cfd, &msg, MSG_NOSIGNAL);
     if (num_written == -1) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Wait for EPOLLOUT before trying again
+        ctx->send_blocked = true;
+      } else if (errno == EINTR) {
         continue;
-      } else if (errno == EPIPE) {
+      } else if (errno == EPIPE || errno == ECONNRESET) {
         printf("%s: Remote disconnected.\n", ctx->display_name);
-        tcp_server_client_close(ctx);
-        break;
+        client_close(ctx);
       } else {
         fprintf(stderr, "%s: Error while writing to client: %s (%d)\n",
                 ctx->display_name, strerror(errno), errno);
-        assert(0 && "Error writing to client.");
+        client_close(ctx);
       }
+      return;
     }
-    if (num_written >= 1) {
-      break;
-    }
+
+    tcp_buffer_consume(ctx->buf_out, num_written);
+    wake_if_waiting(&ctx->host_wants_space, ctx->space_fd);
+  }
+}
+
+/**
+ * Update the events that epfd watches for on the client fd
+ *
+ * We don't ask for EPOLLIN if buf_in is full (the host thread will wake us
+ * when it has read some data) and only ask for EPOLLOUT if the last send
+ * would have blocked. If there is nothing to wait for, the fd is removed from
+ * epfd altogether, since EPOLLHUP and EPOLLERR are always reported and would
+ * otherwise wake the server thread repeatedly.
+ *
+ * @param ctx context object
+ * @return 0 on success, -1 in case of an error
+ */
+static int update_client_events(struct tcp_server_ctx *ctx) {
+  if (!ctx->cfd) {
+    return 0;
+  }
+
+  uint32_t events = 0;
+  if (tcp_buffer_space(ctx->buf_in)) {
+    events |= EPOLLIN;
+  }
+  if (ctx->send_blocked) {
+    events |= EPOLLOUT;
+  }
+  if (events == ctx->cfd_events) {
+    return 0;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = ctx->cfd;
+
+  int rv;
+  if (!events) {
+    rv = epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, ctx->cfd, &ev);
+  } else if (!ctx->cfd_events) {
+    rv = epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, ctx->cfd, &ev);
+  } else {
+    rv = epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, ctx->cfd, &ev);
+  }
+  if (rv != 0) {
+    fprintf(stderr, "%s: Unable to watch client socket: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+    return -1;
+  }
+
+  ctx->cfd_events = events;
+  return 0;
+}
+
+/**
+ * Tell the host thread what the server thread is about to sleep waiting for
+ *
+ * @param ctx context object
+ * @return false if there is already something to do, so the server thread
+ *         shouldn't sleep
+ */
+static bool prepare_wait(struct tcp_server_ctx *ctx) {
+  bool want_space = ctx->cfd && !tcp_buffer_space(ctx->buf_in);
+  bool want_data = ctx->cfd && !ctx->send_blocked;
+
+  __atomic_store_n(&ctx->server_wants_space, want_space, __ATOMIC_RELAXED);
+  __atomic_store_n(&ctx->server_wants_data, want_data, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if ((want_space && tcp_buffer_space(ctx->buf_in)) ||
+      (want_data && tcp_buffer_count(ctx->buf_out)) ||
+      __atomic_load_n(&ctx->client_close_req, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&ctx->server_wants_space, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->server_wants_data, false, __ATOMIC_RELAXED);
+    return false;
   }
+  return true;
 }
 
 /**
@@ -303,6 +540,13 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
   // Free the buffers
   tcp_buffer_free(&ctx->buf_in);
   tcp_buffer_free(&ctx->buf_out);
+  // Close the eventfds
+  if (ctx->wake_fd > 0) {
+    close(ctx->wake_fd);
+  }
+  if (ctx->space_fd > 0) {
+    close(ctx->space_fd);
+  }
   // Free the display name
   free(ctx->display_name);
   // Free the ctx
@@ -319,7 +563,6 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
 static void *server_create(void *ctx_void) {
   // Cast to a server struct
   struct tcp_server_ctx *ctx = (struct tcp_server_ctx *)ctx_void;
-  struct timeval timeout;
 
   // Start the server
   int rv = start(ctx);
@@ -329,57 +572,82 @@ static void *server_create(void *ctx_void) {
     goto err_cleanup_return;
   }
 
-  // Initialise fd_set
+  // Watch the listening socket and wake_fd. The client fd is added when a
+  // client connects (see update_client_events).
+  ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ctx->epfd < 0) {
+    fprintf(stderr, "%s: Unable to create epoll instance: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+    goto err_cleanup_return;
+  }
+  int watch_fds[] = {ctx->sfd, ctx->wake_fd};
+  for (int i = 0; i < 2; ++i) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = watch_fds[i];
+    if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, watch_fds[i], &ev) != 0) {
+      fprintf(stderr, "%s: Unable to watch socket: %s (%d)\n",
+              ctx->display_name, strerror(errno), errno);
+      goto err_cleanup_return;
+    }
+  }
 
   // Start waiting for connection / data
-  char xfer_data;
   while (ctx->socket_run) {
-    // Initialise structure of fds
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    if (ctx->sfd) {
-      FD_SET(ctx->sfd, &read_fds);
+    // Move as much data as possible in each direction
+    client_recv(ctx);
+    client_send(ctx);
+
+    if (__atomic_exchange_n(&ctx->client_close_req, false, __ATOMIC_SEQ_CST)) {
+      client_close(ctx);
     }
-    if (ctx->cfd) {
-      FD_SET(ctx->cfd, &read_fds);
+
+    if (update_client_events(ctx) != 0) {
+      client_close(ctx);
+      continue;
+    }
+    if (!prepare_wait(ctx)) {
+      continue;
     }
-    // max fd num
-    int mfd = (ctx->cfd > ctx->sfd) ? ctx->cfd : ctx->sfd;
 
-    // Set timeout - 50us gives good performance; do it every time
-    // since select can trash it.
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 50;
+    // Wait for socket activity or a wake-up from the host thread
+    struct epoll_event events[3];
+    int num_events = epoll_wait(ctx->epfd, events, 3, -1);
 
-    // Wait for socket activity or timeout
-    rv = select(mfd + 1, &read_fds, NULL, NULL, &timeout);
+    __atomic_store_n(&ctx->server_wants_space, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->server_wants_data, false, __ATOMIC_RELAXED);
 
-    if (rv < 0) {
+    if (num_events < 0) {
       if (errno == EINTR) {
         // On interrupt we want to retry
         continue;
       }
 
-      printf("%s: Socket read failed, port: %d\n", ctx->display_name,
+      printf("%s: Socket wait failed, port: %d\n", ctx->display_name,
              ctx->listen_port);
-      tcp_server_client_close(ctx);
-    }
-
-    // New connection
-    if (FD_ISSET(ctx->sfd, &read_fds)) {
-      client_tryaccept(ctx);
-    }
-
-    // New client data
-    if (FD_ISSET(ctx->cfd, &read_fds)) {
-      while (!tcp_buffer_is_full(ctx->buf_in) && get_byte(ctx, &xfer_data)) {
-        tcp_buffer_put_byte(ctx->buf_in, xfer_data);
-      }
+      break;
     }
 
-    if (ctx->cfd != 0) {
-      while (tcp_buffer_get_byte(ctx->buf_out, &xfer_data)) {
-        put_byte(ctx, xfer_data);
+    for (int i = 0; i < num_events; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == ctx->sfd) {
+        // New connection
+        client_tryaccept(ctx);
+      } else if (fd == ctx->wake_fd) {
+        eventfd_t val;
+        eventfd_read(ctx->wake_fd, &val);
+      } else if (fd == ctx->cfd &&
+                 (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+        // The client can accept more data. Any new client data (or errors)
+        // will be picked up by client_recv on the next iteration.
+        //
+        // On a hangup or error, stop waiting for EPOLLOUT too: client_send
+        // will fail and close the client if there is data to send. Otherwise
+        // update_client_events drops the fd from epfd while buf_in is full
+        // (rather than having epoll_wait return EPOLLHUP straight away) and
+        // client_recv sees the hangup once there is space.
+        ctx->send_blocked = false;
       }
     }
   }
@@ -387,8 +655,12 @@ static void *server_create(void *ctx_void) {
 err_cleanup_return:
 
   // Simulation done - clean up
-  tcp_server_client_close(ctx);
+  client_close(ctx);
   stop(ctx);
+  if (ctx->epfd > 0) {
+    close(ctx->epfd);
+    ctx->epfd = 0;
+  }
 
   return NULL;
 }
@@ -396,13 +668,20 @@ err_cleanup_return:
 // Abstract interface functions
 struct tcp_server_ctx *tcp_server_create(const char *display_name,
                                          int listen_port) {
+  return tcp_server_create_with_bufsize(display_name, listen_port,
+                                        TCP_SERVER_DEFAULT_BUFSIZE);
+}
+
+struct tcp_server_ctx *tcp_server_create_with_bufsize(const char *display_name,
+                                                      int listen_port,
+                                                      size_t buf_size) {
   struct tcp_server_ctx *ctx =
       (struct tcp_server_ctx *)calloc(1, sizeof(struct tcp_server_ctx));
   assert(ctx);
 
   // Create the buffers
-  struct tcp_buf *buf_in = tcp_buffer_new();
-  struct tcp_buf *buf_out = tcp_buffer_new();
+  struct tcp_buf *buf_in = tcp_buffer_new(buf_size);
+  struct tcp_buf *buf_out = tcp_buffer_new(buf_size);
   assert(buf_in);
   assert(buf_out);
 
@@ -410,6 +689,12 @@ struct tcp_server_ctx *tcp_server_create(const char *display_name,
   ctx->buf_in = buf_in;
   ctx->buf_out = buf_out;
 
+  // Create the eventfds used to wake each thread
+  ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ctx->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(ctx->wake_fd > 0);
+  assert(ctx->space_fd > 0);
+
   // Set up socket details
   ctx->socket_run = true;
   ctx->listen_port = listen_port;
@@ -421,23 +706,61 @@ struct tcp_server_ctx *tcp_server_create(const char *display_name,
     fprintf(stderr, "%s: Unable to create TCP socket thread\n",
             ctx->display_name);
     ctx_free(ctx);
-    free(ctx);
     return NULL;
   }
   return ctx;
 }
 
 bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat) {
-  return tcp_buffer_get_byte(ctx->buf_in, dat);
+  return tcp_server_read_bytes(ctx, dat, 1) == 1;
+}
+
+size_t tcp_server_read_bytes(struct tcp_server_ctx *ctx, char *dat,
+                             size_t len) {
+  size_t num_read = tcp_buffer_get(ctx->buf_in, dat, len);
+  if (num_read) {
+    wake_if_waiting(&ctx->server_wants_space, ctx->wake_fd);
+  }
+  return num_read;
 }
 
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat) {
-  tcp_buffer_put_byte(ctx->buf_out, dat);
+  tcp_server_write_bytes(ctx, &dat, 1);
+}
+
+void tcp_server_write_bytes(struct tcp_server_ctx *ctx, const char *dat,
+                            size_t len) {
+  while (1) {
+    size_t num_written = tcp_buffer_put(ctx->buf_out, dat, len);
+    if (num_written) {
+      wake_if_waiting(&ctx->server_wants_data, ctx->wake_fd);
+    }
+    dat += num_written;
+    len -= num_written;
+    if (!len) {
+      return;
+    }
+
+    // The buffer is full, so wait for the server thread to send some data.
+    // As with prepare_wait, set the flag and then check again in case the
+    // server thread made space in between.
+    __atomic_store_n(&ctx->host_wants_space, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!tcp_buffer_space(ctx->buf_out)) {
+      struct pollfd pfd = {.fd = ctx->space_fd, .events = POLLIN};
+      while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+      }
+      eventfd_t val;
+      eventfd_read(ctx->space_fd, &val);
+    }
+    __atomic_store_n(&ctx->host_wants_space, false, __ATOMIC_RELAXED);
+  }
 }
 
 void tcp_server_close(struct tcp_server_ctx *ctx) {
   // Shut down the socket thread
   ctx->socket_run = false;
+  eventfd_write(ctx->wake_fd, 1);
   pthread_join(ctx->sock_thread, NULL);
   ctx_free(ctx);
 }
@@ -445,10 +768,7 @@ void tcp_server_close(struct tcp_server_ctx *ctx) {
 void tcp_server_client_close(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  if (!ctx->cfd) {
-    return;
-  }
-
-  close(ctx->cfd);
-  ctx->cfd = 0;
+  // The client fd belongs to the server thread, so ask it to do the close
+  __atomic_store_n(&ctx->client_close_req, true, __ATOMIC_SEQ_CST);
+  eventfd_write(ctx->wake_fd, 1);
 }
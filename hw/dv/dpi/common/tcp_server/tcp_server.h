@@ -17,8 +17,14 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Default number of bytes buffered in each direction by tcp_server_create()
+ */
+#define TCP_SERVER_DEFAULT_BUFSIZE 4096
+
 struct tcp_server_ctx;
 
 /**
@@ -30,6 +36,17 @@ struct tcp_server_ctx;
  */
 bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat);
 
+/**
+ * Non-blocking read of up to len bytes from a connected client
+ *
+ * @param ctx tcp server context object
+ * @param dat buffer for the bytes received
+ * @param len size of dat
+ * @return the number of bytes read, which is zero if none were available
+ */
+size_t tcp_server_read_bytes(struct tcp_server_ctx *ctx, char *dat,
+                             size_t len);
+
 /**
  * Write a byte to a connected client
  *
@@ -41,9 +58,24 @@ bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat);
  */
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat);
 
+/**
+ * Write len bytes to a connected client
+ *
+ * Like tcp_server_write(), this only blocks (until the server thread has sent
+ * enough data to the client) if the buffer fills up.
+ *
+ * @param ctx tcp server context object
+ * @param dat bytes to send
+ * @param len number of bytes to send
+ */
+void tcp_server_write_bytes(struct tcp_server_ctx *ctx, const char *dat,
+                            size_t len);
+
 /**
  * Create a new TCP server instance
  *
+ * The server buffers TCP_SERVER_DEFAULT_BUFSIZE bytes in each direction.
+ *
  * @param display_name C string description of server
  * @param listen_port On which port the server should listen
  * @return A pointer to the created context struct
@@ -51,6 +83,19 @@ void tcp_server_write(struct tcp_server_ctx *ctx, char dat);
 struct tcp_server_ctx *tcp_server_create(const char *display_name,
                                          int listen_port);
 
+/**
+ * Create a new TCP server instance with a given buffer size
+ *
+ * @param display_name C string description of server
+ * @param listen_port On which port the server should listen
+ * @param buf_size Number of bytes to buffer in each direction (rounded up to
+ *                 a power of two)
+ * @return A pointer to the created context struct
+ */
+struct tcp_server_ctx *tcp_server_create_with_bufsize(const char *display_name,
+                                                      int listen_port,
+                                                      size_t buf_size);
+
 /**
  * Shut down the server and free all reserved memory
  *
@@ -61,6 +106,9 @@ void tcp_server_close(struct tcp_server_ctx *ctx);
 /**
  * Instruct the server to disconnect a client
  *
+ * The server thread sends any buffered data that the client will accept
+ * without blocking and then closes the connection.
+ *
  * @param ctx tcp server context object
  */
 void tcp_server_client_close(struct tcp_server_ctx *ctx);
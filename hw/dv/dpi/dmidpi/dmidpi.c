@@ -82,10 +82,26 @@ struct dmi_sig_values {
   uint8_t dmi_rst_n;
 };
 
+// Transaction-level DMI requests (see README.md). A request is 'D', then the
+// op, address and data (as 4 little-endian bytes). A response is 'd', then
+// the response code and data (as 4 little-endian bytes).
+#define DMI_TXN_REQ_LEN 7
+#define DMI_TXN_RSP_LEN 6
+
+struct dmi_txn_ctx {
+  // Bytes of the current request received so far (req_len is 0 if none)
+  uint8_t req[DMI_TXN_REQ_LEN];
+  uint8_t req_len;
+  // Set when a transaction-level request has been issued, so that its
+  // response is sent back as a transaction-level response
+  bool outstanding;
+};
+
 struct dmidpi_ctx {
   struct tcp_server_ctx *sock;
   struct jtag_ctx jtag;
   struct dmi_sig_values sig;
+  struct dmi_txn_ctx txn;
 };
 
 /**
@@ -115,16 +131,79 @@ static void set_dr_data(struct dmidpi_ctx *ctx) {
 }
 
 /**
- * Drive a new DMI transaction to the DPI interface
+ * Drive a DMI request with the given fields to the DPI interface
  *
  * @param ctx dmidpi context object
  */
-static void issue_dmi_req(struct dmidpi_ctx *ctx) {
+static void drive_dmi_req(struct dmidpi_ctx *ctx, uint32_t addr, uint32_t op,
+                          uint32_t data) {
   ctx->jtag.dmi_outstanding = 1;
   ctx->sig.dmi_req_valid = 1;
-  ctx->sig.dmi_req_addr = (ctx->jtag.dr_captured >> 34) & 0x7F;
-  ctx->sig.dmi_req_op = ctx->jtag.dr_captured & 0x3;
-  ctx->sig.dmi_req_data = (ctx->jtag.dr_captured >> 2) & 0xFFFFFFFF;
+  ctx->sig.dmi_req_addr = addr & 0x7F;
+  ctx->sig.dmi_req_op = op & 0x3;
+  ctx->sig.dmi_req_data = data;
+}
+
+/**
+ * Drive a new DMI transaction to the DPI interface
+ *
+ * @param ctx dmidpi context object
+ */
+static void issue_dmi_req(struct dmidpi_ctx *ctx) {
+  drive_dmi_req(ctx, (ctx->jtag.dr_captured >> 34) & 0x7F,
+                ctx->jtag.dr_captured & 0x3,
+                (ctx->jtag.dr_captured >> 2) & 0xFFFFFFFF);
+}
+
+/**
+ * Issue a complete transaction-level request
+ *
+ * If the DMI is in reset, this releases the reset and leaves the request to be
+ * issued on the next tick.
+ *
+ * @param ctx dmidpi context object
+ * @return true (the tick's work is done)
+ */
+static bool issue_txn_req(struct dmidpi_ctx *ctx) {
+  assert(ctx->txn.req_len == DMI_TXN_REQ_LEN);
+
+  if (!ctx->sig.dmi_rst_n) {
+    ctx->sig.dmi_rst_n = 1;
+    return true;
+  }
+
+  const uint8_t *req = ctx->txn.req;
+  uint32_t op = req[1];
+  if (op != 1 && op != 2) {
+    fprintf(stderr,
+            "DMI DPI: Protocol violation detected: unsupported DMI op %u\n",
+            (unsigned)op);
+    exit(1);
+  }
+  uint32_t data = (uint32_t)req[3] | ((uint32_t)req[4] << 8) |
+                  ((uint32_t)req[5] << 16) | ((uint32_t)req[6] << 24);
+
+  drive_dmi_req(ctx, req[2], op, data);
+  ctx->txn.outstanding = true;
+  ctx->txn.req_len = 0;
+  return true;
+}
+
+/**
+ * Send the response to a transaction-level request
+ *
+ * @param ctx dmidpi context object
+ */
+static void send_txn_rsp(struct dmidpi_ctx *ctx) {
+  uint32_t data = ctx->sig.dmi_rsp_data;
+  char rsp[DMI_TXN_RSP_LEN] = {'d',
+                               (char)(ctx->sig.dmi_rsp_resp & 0x3),
+                               (char)(data & 0xFF),
+                               (char)((data >> 8) & 0xFF),
+                               (char)((data >> 16) & 0xFF),
+                               (char)((data >> 24) & 0xFF)};
+  tcp_server_write_bytes(ctx->sock, rsp, DMI_TXN_RSP_LEN);
+  ctx->txn.outstanding = false;
 }
 
 /**
@@ -338,8 +417,12 @@ static void process_dmi_inputs(struct dmidpi_ctx *ctx) {
   // Always ready for a resp
   ctx->sig.dmi_rsp_ready = 1;
   if (ctx->sig.dmi_rsp_valid) {
-    ctx->jtag.dr_captured = (uint64_t)ctx->sig.dmi_rsp_data << 2;
-    ctx->jtag.dr_captured |= (uint64_t)ctx->sig.dmi_rsp_resp & 0x3;
+    if (ctx->txn.outstanding) {
+      send_txn_rsp(ctx);
+    } else {
+      ctx->jtag.dr_captured = (uint64_t)ctx->sig.dmi_rsp_data << 2;
+      ctx->jtag.dr_captured |= (uint64_t)ctx->sig.dmi_rsp_resp & 0x3;
+    }
     // Clear req outstanding flag
     ctx->jtag.dmi_outstanding = 0;
   }
@@ -362,6 +445,13 @@ static void update_dmi_state(struct dmidpi_ctx *ctx) {
     return;
   }
 
+  // A transaction-level request might have been held back on the previous
+  // tick to release the DMI reset
+  if (ctx->txn.req_len == DMI_TXN_REQ_LEN) {
+    issue_txn_req(ctx);
+    return;
+  }
+
   char done = 0;
   while (!done) {
     // read a command byte
@@ -369,8 +459,17 @@ static void update_dmi_state(struct dmidpi_ctx *ctx) {
     if (!tcp_server_read(ctx->sock, &cmd)) {
       return;
     }
-    // Process command bytes until a command completes
-    done = process_cmd_byte(ctx, cmd);
+    // Process command bytes until a command completes. A 'D' starts a
+    // transaction-level request (which is never a remote_bitbang command), and
+    // we collect its bytes until it's complete.
+    if (ctx->txn.req_len) {
+      ctx->txn.req[ctx->txn.req_len++] = cmd;
+      done = ctx->txn.req_len == DMI_TXN_REQ_LEN && issue_txn_req(ctx);
+    } else if (cmd == 'D') {
+      ctx->txn.req[ctx->txn.req_len++] = cmd;
+    } else {
+      done = process_cmd_byte(ctx, cmd);
+    }
   }
 }
 
@@ -389,7 +488,8 @@ void *dmidpi_create(const char *display_name, int listen_port) {
       "OpenOCD and the following configuration to connect:\n"
       "  interface remote_bitbang\n"
       "  remote_bitbang_host localhost\n"
-      "  remote_bitbang_port %d\n",
+      "  remote_bitbang_port %d\n"
+      "or use hw/dv/dpi/dmidpi/dmidpi_client.py for direct DMI accesses.\n",
       display_name, listen_port, listen_port);
 
   return (void *)ctx;
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# Copyright lowRISC contributors (OpenTitan project).
+# Licensed under the Apache License, Version 2.0, see LICENSE for details.
+# SPDX-License-Identifier: Apache-2.0
+"""Reference client for the dmidpi transaction-level protocol.
+
+This talks to a dmidpi instance in a running simulation, sending whole DMI
+requests instead of driving a JTAG TAP bit by bit with remote_bitbang. See
+README.md in this directory for a description of the protocol.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+from typing import Iterable, List, Tuple
+
+DMI_OP_READ = 1
+DMI_OP_WRITE = 2
+
+# Debug module registers (from the RISC-V debug specification)
+DM_SBCS = 0x38
+DM_SBADDRESS0 = 0x39
+DM_SBDATA0 = 0x3c
+
+# SBCS fields
+SBCS_SBBUSYERROR = 1 << 22
+SBCS_SBACCESS32 = 2 << 17
+SBCS_SBAUTOINCREMENT = 1 << 16
+SBCS_SBERROR_SHIFT = 12
+SBCS_SBERROR_MASK = 0x7
+
+# The number of requests to send before waiting for their responses
+BATCH_SIZE = 256
+
+REQ = struct.Struct('<cBBI')
+RSP = struct.Struct('<cBI')
+
+
+class DmiError(Exception):
+    pass
+
+
+class DmiClient:
+    """A connection to dmidpi."""
+
+    def __init__(self, host: str, port: int) -> None:
+        self._sock = socket.create_connection((host, port))
+        self._sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    def close(self) -> None:
+        self._sock.close()
+
+    def _recv_exact(self, length: int) -> bytes:
+        data = b''
+        while len(data) < length:
+            chunk = self._sock.recv(length - len(data))
+            if not chunk:
+                raise DmiError('Connection closed by simulation.')
+            data += chunk
+        return data
+
+    def transact(self, reqs: Iterable[Tuple[int, int, int]]) -> List[int]:
+        """Send DMI requests (op, addr, data) and return the data for each.
+
+        Requests are sent in batches without waiting for the responses in
+        between. Raises a DmiError if any request fails.
+        """
+        reqs = list(reqs)
+        ret = []
+        for start in range(0, len(reqs), BATCH_SIZE):
+            batch = reqs[start:start + BATCH_SIZE]
+            self._sock.sendall(b''.join(
+                REQ.pack(b'D', op, addr, data) for op, addr, data in batch))
+            rsps = self._recv_exact(RSP.size * len(batch))
+            for i, (op, addr, _) in enumerate(batch):
+                tag, resp, data = RSP.unpack_from(rsps, i * RSP.size)
+                if tag != b'd':
+                    raise DmiError(f'Bad response tag: {tag!r}')
+                if resp != 0:
+                    raise DmiError(f'DMI op {op} at address {addr:#x} '
+                                   f'failed with response {resp}.')
+                ret.append(data)
+        return ret
+
+    def read(self, addr: int) -> int:
+        return self.transact([(DMI_OP_READ, addr, 0)])[0]
+
+    def write(self, addr: int, data: int) -> None:
+        self.transact([(DMI_OP_WRITE, addr, data)])
+
+    def write_mem(self, addr: int, data: bytes) -> None:
+        """Write data to memory with system bus accesses.
+
+        The data is padded with zeros to a multiple of 4 bytes.
+        """
+        data += b'\0' * (-len(data) % 4)
+        words = struct.unpack(f'<{len(data) // 4}I', data)
+        reqs = [(DMI_OP_WRITE, DM_SBCS,
+                 SBCS_SBACCESS32 | SBCS_SBAUTOINCREMENT),
+                (DMI_OP_WRITE, DM_SBADDRESS0, addr)]
+        reqs += [(DMI_OP_WRITE, DM_SBDATA0, word) for word in words]
+        reqs.append((DMI_OP_READ, DM_SBCS, 0))
+        sbcs = self.transact(reqs)[-1]
+
+        sberror = (sbcs >> SBCS_SBERROR_SHIFT) & SBCS_SBERROR_MASK
+        if sberror or sbcs & SBCS_SBBUSYERROR:
+            raise DmiError(f'System bus access failed (sbcs: {sbcs:#010x}).')
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=44853)
+    subparsers = parser.add_subparsers(dest='cmd', required=True)
+
+    read_parser = subparsers.add_parser('read', help='Read a DMI register')
+    read_parser.add_argument('addr', type=lambda x: int(x, 0))
+
+    write_parser = subparsers.add_parser('write',
+                                         help='Write a DMI register')
+    write_parser.add_argument('addr', type=lambda x: int(x, 0))
+    write_parser.add_argument('data', type=lambda x: int(x, 0))
+
+    load_parser = subparsers.add_parser(
+        'load', help='Load a binary file into memory over the system bus')
+    load_parser.add_argument('file', type=argparse.FileType('rb'))
+    load_parser.add_argument('addr', type=lambda x: int(x, 0))
+
+    args = parser.parse_args()
+
+    client = DmiClient(args.host, args.port)
+    try:
+        if args.cmd == 'read':
+            print(f'{client.read(args.addr):#010x}')
+        elif args.cmd == 'write':
+            client.write(args.addr, args.data)
+        else:
+            client.write_mem(args.addr, args.file.read())
+    except DmiError as err:
+        print(f'Error: {err}', file=sys.stderr)
+        return 1
+    finally:
+        client.close()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
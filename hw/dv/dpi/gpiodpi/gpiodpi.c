@@ -23,9 +23,19 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-// The number of ticks of host_to_device_tick between making syscalls.
+// The default number of ticks of host_to_device_tick between making syscalls.
 #define TICKS_PER_SYSCALL 2048
 
+// Binary host-to-device commands start with this byte (which never appears in
+// a text command), followed by three little-endian 32-bit words: a mask of
+// pins to set, their values and which of them are driven weakly.
+#define BINARY_CMD_MARKER 0x80
+#define BINARY_CMD_LEN 13
+
+// Binary device-to-host updates are two little-endian 32-bit words: the pin
+// values (zero for pins that aren't driven) and the output enables.
+#define BINARY_UPDATE_LEN 8
+
 // This module currently is capable of implementing 32 GPIOs.
 #define NUM_GPIO 32
 
@@ -46,6 +56,27 @@ struct gpiodpi_ctx {
   // A counter of calls into the host_to_device_tick function; used to
   // avoid excessive `read` syscalls to the pipe fd.
   uint32_t counter;
+  // The number of ticks between reads from the host-to-device FIFO.
+  uint32_t poll_interval;
+  // A partial binary command left over from the last read.
+  uint8_t partial_cmd[BINARY_CMD_LEN];
+  uint32_t partial_cmd_len;
+
+  // Whether to send device-to-host updates in the binary format.
+  bool binary_updates;
+  // The number of ticks to wait after a pin changes before sending an update,
+  // so that several changes can be sent together.
+  uint32_t coalesce_ticks;
+  // The last state sent to the host and the state to send next. If
+  // update_pending is true, pending_* is the state to send and it has been
+  // waiting since the tick given by pending_since.
+  uint32_t sent_data;
+  uint32_t sent_oe;
+  bool sent_any;
+  uint32_t pending_data;
+  uint32_t pending_oe;
+  bool update_pending;
+  uint32_t pending_since;
 
   // File descriptors and paths for the device-to-host and host-to-device
   // FIFOs.
@@ -91,7 +122,8 @@ static int open_fifo(char *path_buf, int flags) {
  * @arg wfifo the path to the "write" side (w.r.t the host).
  * @arg n_bits the number of pins supported.
  */
-static void print_usage(char *rfifo, char *wfifo, int n_bits) {
+static void print_usage(char *rfifo, char *wfifo, int n_bits,
+                        bool binary_updates) {
   printf("\n");
   printf(
       "GPIO: FIFO pipes created at %s (read) and %s (write) for %d-bit wide "
@@ -99,7 +131,12 @@ static void print_usage(char *rfifo, char *wfifo, int n_bits) {
       rfifo, wfifo, n_bits);
   printf(
       "GPIO: To measure the values of the pins as driven by the device, run\n");
-  printf("$ cat %s  # '0' low, '1' high, 'X' floating\n", rfifo);
+  if (binary_updates) {
+    printf("$ xxd -c 8 %s  # 32-bit pin values, then 32-bit output enables\n",
+           rfifo);
+  } else {
+    printf("$ cat %s  # '0' low, '1' high, 'X' floating\n", rfifo);
+  }
   printf("GPIO: To drive the pins, run a command like\n");
   printf("$ echo 'h09 l31' > %s  # Pull the pin 9 high, and pin 31 low.\n",
          wfifo);
@@ -107,7 +144,8 @@ static void print_usage(char *rfifo, char *wfifo, int n_bits) {
          wfifo);
 }
 
-void *gpiodpi_create(const char *name, int n_bits) {
+void *gpiodpi_create(const char *name, int n_bits, int poll_interval,
+                     int coalesce_ticks, int binary_updates) {
   struct gpiodpi_ctx *ctx =
       (struct gpiodpi_ctx *)malloc(sizeof(struct gpiodpi_ctx));
   assert(ctx);
@@ -117,9 +155,18 @@ void *gpiodpi_create(const char *name, int n_bits) {
   assert(n_bits <= 32 && "n_bits must be <= 32");
   ctx->n_bits = n_bits;
 
+  assert(poll_interval >= 0 && coalesce_ticks >= 0);
+
   ctx->driven_pin_values = 0;
   ctx->weak_pins = 0;
   ctx->counter = 0;
+  ctx->poll_interval = poll_interval ? poll_interval : TICKS_PER_SYSCALL;
+  ctx->partial_cmd_len = 0;
+
+  ctx->binary_updates = binary_updates != 0;
+  ctx->coalesce_ticks = coalesce_ticks;
+  ctx->sent_any = false;
+  ctx->update_pending = false;
 
   char cwd_buf[PATH_MAX];
   char *cwd = getcwd(cwd_buf, sizeof(cwd_buf));
@@ -145,15 +192,40 @@ void *gpiodpi_create(const char *name, int n_bits) {
   int flags = fcntl(ctx->host_to_dev_fifo, F_GETFL, 0);
   fcntl(ctx->host_to_dev_fifo, F_SETFL, flags | O_NONBLOCK);
 
-  print_usage(ctx->dev_to_host_path, ctx->host_to_dev_path, ctx->n_bits);
+  print_usage(ctx->dev_to_host_path, ctx->host_to_dev_path, ctx->n_bits,
+              ctx->binary_updates);
 
   return (void *)ctx;
 }
 
-void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
-                            svBitVecVal *gpio_oe) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
-  assert(ctx);
+/**
+ * Write the pending pin state to the device-to-host FIFO.
+ */
+static void send_update(struct gpiodpi_ctx *ctx) {
+  assert(ctx->update_pending);
+  ctx->update_pending = false;
+
+  uint32_t data = ctx->pending_data;
+  uint32_t oe = ctx->pending_oe;
+
+  // Don't send an update that matches the last one we sent.
+  if (ctx->sent_any && data == ctx->sent_data && oe == ctx->sent_oe) {
+    return;
+  }
+  ctx->sent_any = true;
+  ctx->sent_data = data;
+  ctx->sent_oe = oe;
+
+  if (ctx->binary_updates) {
+    uint8_t update[BINARY_UPDATE_LEN];
+    for (int i = 0; i < 4; ++i) {
+      update[i] = (data >> (8 * i)) & 0xff;
+      update[4 + i] = (oe >> (8 * i)) & 0xff;
+    }
+    ssize_t written = write(ctx->dev_to_host_fifo, update, BINARY_UPDATE_LEN);
+    assert(written == BINARY_UPDATE_LEN);
+    return;
+  }
 
   // Write 0, 1, or X (when oe is not set) for each GPIO pin, in big endian
   // order (i.e., pin 0 is the last character written). Finish it with a
@@ -161,9 +233,9 @@ void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
   char gpio_str[32 + 1];
   char *pin_char = gpio_str;
   for (int i = ctx->n_bits - 1; i >= 0; --i, ++pin_char) {
-    if (!GET_BIT(gpio_oe[0], i)) {
+    if (!GET_BIT(oe, i)) {
       *pin_char = 'X';
-    } else if (GET_BIT(gpio_data[0], i)) {
+    } else if (GET_BIT(data, i)) {
       *pin_char = '1';
     } else {
       *pin_char = '0';
@@ -175,6 +247,29 @@ void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
   assert(written == ctx->n_bits + 1);
 }
 
+void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
+                            svBitVecVal *gpio_oe) {
+  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  assert(ctx);
+
+  uint32_t mask = ctx->n_bits < 32 ? (1u << ctx->n_bits) - 1 : ~0u;
+  uint32_t oe = gpio_oe[0] & mask;
+  uint32_t data = gpio_data[0] & oe;
+
+  // Note the time of the first change since the last update, so that
+  // host_to_device_tick can send it once coalesce_ticks have passed.
+  if (!ctx->update_pending) {
+    ctx->update_pending = true;
+    ctx->pending_since = ctx->counter;
+  }
+  ctx->pending_data = data;
+  ctx->pending_oe = oe;
+
+  if (!ctx->coalesce_ticks) {
+    send_update(ctx);
+  }
+}
+
 /**
  * Parses an unsigned decimal number from |text|, advancing it forward as
  * necessary.
@@ -217,19 +312,52 @@ uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe,
   struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
   assert(ctx);
 
-  if (ctx->counter % TICKS_PER_SYSCALL == 0) {
+  if (ctx->update_pending &&
+      ctx->counter - ctx->pending_since >= ctx->coalesce_ticks) {
+    send_update(ctx);
+  }
+
+  if (ctx->counter % ctx->poll_interval == 0) {
     char gpio_str[256];
-    ssize_t read_len =
-        read(ctx->host_to_dev_fifo, gpio_str, sizeof(gpio_str) - 1);
+    uint32_t prefix_len = ctx->partial_cmd_len;
+    memcpy(gpio_str, ctx->partial_cmd, prefix_len);
+
+    ssize_t read_len = read(ctx->host_to_dev_fifo, gpio_str + prefix_len,
+                            sizeof(gpio_str) - 1 - prefix_len);
     if (read_len > 0) {
+      read_len += prefix_len;
+      ctx->partial_cmd_len = 0;
       gpio_str[read_len] = '\0';
 
       bool weak = false;
       char *gpio_text = gpio_str;
-      for (; *gpio_text != '\0'; ++gpio_text) {
+      for (; gpio_text < gpio_str + read_len; ++gpio_text) {
         switch (*gpio_text) {
           case '\0':
             goto parse_loop_end;
+          case (char)BINARY_CMD_MARKER: {
+            uint32_t avail = gpio_str + read_len - gpio_text;
+            if (avail < BINARY_CMD_LEN) {
+              // Keep the start of the command for the next read.
+              memcpy(ctx->partial_cmd, gpio_text, avail);
+              ctx->partial_cmd_len = avail;
+              goto parse_loop_end;
+            }
+            uint32_t words[3];
+            for (int i = 0; i < 3; ++i) {
+              const uint8_t *bytes = (const uint8_t *)gpio_text + 1 + 4 * i;
+              words[i] = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                         ((uint32_t)bytes[2] << 16) |
+                         ((uint32_t)bytes[3] << 24);
+            }
+            uint32_t set_mask = words[0];
+            ctx->driven_pin_values =
+                (ctx->driven_pin_values & ~set_mask) | (words[1] & set_mask);
+            ctx->weak_pins =
+                (ctx->weak_pins & ~set_mask) | (words[2] & set_mask);
+            gpio_text += BINARY_CMD_LEN - 1;
+            break;
+          }
           case 'w':
           case 'W': {
             weak = true;
@@ -17,12 +17,24 @@ extern "C" {
  * @param name a name to use when creating the inner FIFO.
  * @param n_bits number of bits to write in each direction; this must be at
  *        most 32 bits.
+ * @param poll_interval number of ticks between reads of host commands, or
+ *        zero for the default.
+ * @param coalesce_ticks number of ticks to wait after a pin change before
+ *        sending an update to the host, so that changes close together are
+ *        sent as one update. Zero sends each change straight away.
+ * @param binary_updates if nonzero, send updates to the host as two
+ *        little-endian 32-bit words (pin values and output enables) rather
+ *        than as text.
  */
-void *gpiodpi_create(const char *name, int n_bits);
+void *gpiodpi_create(const char *name, int n_bits, int poll_interval,
+                     int coalesce_ticks, int binary_updates);
 
 /**
  * Attempt to post the current GPIO state to the outside world.
  *
+ * Nothing is sent if the state (the values of the enabled pins and the output
+ * enables) is the same as the last one that was sent.
+ *
  * Intended to be called from SystemVerilog.
  */
 void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
@@ -37,6 +49,10 @@ void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
  * does the opposite. All other pins at left in an unspecified state. Invalid
  * commands are ignored.
  *
+ * The host can also send a binary command: a 0x80 byte followed by three
+ * little-endian 32-bit words. The first is a mask of the pins to set, the
+ * second their values and the third which of them should be driven weakly.
+ *
  * Intended to be called from SystemVerilog.
  * @return the values to pull the GPIO pins to.
  */
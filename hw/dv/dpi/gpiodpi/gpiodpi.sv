@@ -18,7 +18,9 @@ module gpiodpi
   input  logic [N_GPIO-1:0] gpio_pull_sel
 );
    import "DPI-C" function
-     chandle gpiodpi_create(input string name, input int n_bits);
+     chandle gpiodpi_create(input string name, input int n_bits,
+                            input int poll_interval, input int coalesce_ticks,
+                            input int binary_updates);
 
    import "DPI-C" function
      void gpiodpi_device_to_host(input chandle ctx, input logic [N_GPIO-1:0] gpio_d2p,
@@ -36,8 +38,15 @@ module gpiodpi
    chandle ctx;
 
    function automatic void initialize();
+     int poll_interval = 0;
+     int coalesce_ticks = 0;
+     int binary_updates = 0;
+     void'($value$plusargs("gpiodpi_poll_interval=%0d", poll_interval));
+     void'($value$plusargs("gpiodpi_coalesce_ticks=%0d", coalesce_ticks));
+     void'($value$plusargs("gpiodpi_binary=%0d", binary_updates));
      $display($time, "GPIO: creating gpiodpi");
-     ctx = gpiodpi_create(NAME, N_GPIO);
+     ctx = gpiodpi_create(NAME, N_GPIO, poll_interval, coalesce_ticks,
+                          binary_updates);
    endfunction
 
    // Allow being activated past initial time.
@@ -55,10 +64,11 @@ module gpiodpi
 
    logic eff_clk = clk_i && active;
 
-   logic [N_GPIO-1:0] gpio_d2p_r;
+   logic [N_GPIO-1:0] gpio_d2p_r, gpio_en_d2p_r;
    always_ff @(posedge eff_clk) begin
      gpio_d2p_r <= gpio_d2p;
-     if (gpio_d2p_r != gpio_d2p) begin
+     gpio_en_d2p_r <= gpio_en_d2p;
+     if (gpio_d2p_r != gpio_d2p || gpio_en_d2p_r != gpio_en_d2p) begin
        gpiodpi_device_to_host(ctx, gpio_d2p, gpio_en_d2p);
      end
    end
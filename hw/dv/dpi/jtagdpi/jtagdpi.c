@@ -12,6 +12,12 @@
 
 #include "tcp_server.h"
 
+// Number of remote_bitbang commands that are read from the socket at once
+#define JTAGDPI_CMD_BATCH 4096
+
+// Number of TDO responses that can be queued before they are sent
+#define JTAGDPI_RESP_BATCH 1024
+
 struct jtagdpi_ctx {
   // Server context
   struct tcp_server_ctx *sock;
@@ -22,35 +28,64 @@ struct jtagdpi_ctx {
   uint8_t tdo;
   uint8_t trst_n;
   uint8_t srst_n;
-  // Lookahead buffer - non-zero if valid
-  char cmd;
+  // If true, process commands until TCK changes on each tick
+  bool fast_tck;
+  // Commands read from the socket. Those from cmd_pos to cmd_len have not
+  // been processed yet.
+  char cmds[JTAGDPI_CMD_BATCH];
+  size_t cmd_pos;
+  size_t cmd_len;
+  // TDO responses that haven't been sent yet
+  char resps[JTAGDPI_RESP_BATCH];
+  size_t resp_len;
 };
 
+static void flush_resps(struct jtagdpi_ctx *ctx) {
+  if (ctx->resp_len) {
+    tcp_server_write_bytes(ctx->sock, ctx->resps, ctx->resp_len);
+    ctx->resp_len = 0;
+  }
+}
+
+static void put_resp(struct jtagdpi_ctx *ctx, char resp) {
+  if (ctx->resp_len == JTAGDPI_RESP_BATCH) {
+    flush_resps(ctx);
+  }
+  ctx->resps[ctx->resp_len++] = resp;
+}
+
+static bool peek_cmd(struct jtagdpi_ctx *ctx, char *cmd) {
+  // Return the next command without consuming it. If we have processed the
+  // whole batch, pull everything that's queued from the socket.
+  if (ctx->cmd_pos == ctx->cmd_len) {
+    ctx->cmd_pos = 0;
+    ctx->cmd_len =
+        tcp_server_read_bytes(ctx->sock, ctx->cmds, JTAGDPI_CMD_BATCH);
+    if (!ctx->cmd_len) {
+      return false;
+    }
+  }
+  *cmd = ctx->cmds[ctx->cmd_pos];
+  return true;
+}
+
 static bool lookahead(struct jtagdpi_ctx *ctx) {
-  // Look at the next command if available. Return true if it's an
-  // 'R', otherwise buffer it to return via get_cmd().
+  // Look at the next command if available. Return true (and consume it) if
+  // it's an 'R', otherwise leave it to return via get_cmd().
   char cmd;
-  if (!tcp_server_read(ctx->sock, &cmd)) {
-    return false;
-  }
-  if (cmd == 'R') {
-    return true;
-  } else {
-    ctx->cmd = cmd;
+  if (!peek_cmd(ctx, &cmd) || cmd != 'R') {
     return false;
   }
+  ctx->cmd_pos++;
+  return true;
 }
 
 static bool get_cmd(struct jtagdpi_ctx *ctx, char *cmd) {
-  // Return a buffered command if available, or try to pull one from
-  // the socket.
-  if (ctx->cmd) {
-    *cmd = ctx->cmd;
-    ctx->cmd = 0;
-    return true;
-  } else {
-    return tcp_server_read(ctx->sock, cmd);
+  if (!peek_cmd(ctx, cmd)) {
+    return false;
   }
+  ctx->cmd_pos++;
+  return true;
 }
 
 /**
@@ -83,66 +118,87 @@ static void update_jtag_signals(struct jtagdpi_ctx *ctx) {
    * https://repo.or.cz/openocd.git/blob/HEAD:/doc/manual/jtag/drivers/remote_bitbang.txt
    */
 
-  // read a command byte
+  // Normally, we process one command per tick. In fast TCK mode, we keep
+  // going until a command changes TCK (so every tick gives a TCK edge while
+  // there are commands to process). Commands that don't change TCK can be
+  // merged into the same tick because the TAP only samples TMS and TDI on an
+  // edge. We also stop after anything that changes a reset or after a quit.
   char cmd;
-  if (!get_cmd(ctx, &cmd)) {
-    return;
-  }
-
-  bool act_send_resp = false;
-  bool act_quit = false;
-
-  // parse received command byte
-  if (cmd >= '0' && cmd <= '7') {
-    // JTAG write
-    uint8_t tck = ctx->tck;
-    char cmd_bit = cmd - '0';
-    ctx->tdi = (cmd_bit >> 0) & 0x1;
-    ctx->tms = (cmd_bit >> 1) & 0x1;
-    ctx->tck = (cmd_bit >> 2) & 0x1;
-    // On a rising edge of TCK, we can process a following 'R' command
-    // to sense the current TDO without waiting for the next DPI
-    // callback. Since TDO changes on the falling edge of TCK, it is
-    // already stable and valid.
-    if (!tck && ctx->tck && lookahead(ctx)) {
+  while (get_cmd(ctx, &cmd)) {
+    bool act_send_resp = false;
+    bool act_quit = false;
+    bool end_tick = !ctx->fast_tck;
+
+    // parse received command byte
+    if (cmd >= '0' && cmd <= '7') {
+      // JTAG write
+      uint8_t tck = ctx->tck;
+      char cmd_bit = cmd - '0';
+      ctx->tdi = (cmd_bit >> 0) & 0x1;
+      ctx->tms = (cmd_bit >> 1) & 0x1;
+      ctx->tck = (cmd_bit >> 2) & 0x1;
+      // On a rising edge of TCK, we can process a following 'R' command
+      // to sense the current TDO without waiting for the next DPI
+      // callback. Since TDO changes on the falling edge of TCK, it is
+      // already stable and valid.
+      if (!tck && ctx->tck && lookahead(ctx)) {
+        act_send_resp = true;
+      }
+      // Each TCK edge needs its own tick, so that the design sees it (and
+      // updates TDO after a falling edge) before we carry on.
+      if (tck != ctx->tck) {
+        end_tick = true;
+      }
+    } else if (cmd >= 'r' && cmd <= 'u') {
+      // JTAG reset (active high from OpenOCD)
+      char cmd_bit = cmd - 'r';
+      ctx->srst_n = !((cmd_bit >> 0) & 0x1);
+      ctx->trst_n = !((cmd_bit >> 1) & 0x1);
+      end_tick = true;
+    } else if (cmd == 'R') {
+      // JTAG read
       act_send_resp = true;
+    } else if (cmd == 'B') {
+      // printf("BLINK ON!\n");
+    } else if (cmd == 'b') {
+      // printf("BLINK OFF!\n");
+    } else if (cmd == 'Q') {
+      // quit (client disconnect)
+      act_quit = true;
+      end_tick = true;
+    } else {
+      fprintf(stderr,
+              "JTAG DPI Protocol violation detected: unsupported command %c\n",
+              cmd);
+      exit(1);
+    }
+
+    // queue tdo as response
+    if (act_send_resp) {
+      char tdo_ascii = ctx->tdo + '0';
+      put_resp(ctx, tdo_ascii);
     }
-  } else if (cmd >= 'r' && cmd <= 'u') {
-    // JTAG reset (active high from OpenOCD)
-    char cmd_bit = cmd - 'r';
-    ctx->srst_n = !((cmd_bit >> 0) & 0x1);
-    ctx->trst_n = !((cmd_bit >> 1) & 0x1);
-  } else if (cmd == 'R') {
-    // JTAG read
-    act_send_resp = true;
-  } else if (cmd == 'B') {
-    // printf("BLINK ON!\n");
-  } else if (cmd == 'b') {
-    // printf("BLINK OFF!\n");
-  } else if (cmd == 'Q') {
-    // quit (client disconnect)
-    act_quit = true;
-  } else {
-    fprintf(stderr,
-            "JTAG DPI Protocol violation detected: unsupported command %c\n",
-            cmd);
-    exit(1);
-  }
 
-  // send tdo as response
-  if (act_send_resp) {
-    char tdo_ascii = ctx->tdo + '0';
-    tcp_server_write(ctx->sock, tdo_ascii);
+    if (act_quit) {
+      flush_resps(ctx);
+      printf("JTAG DPI: Remote disconnected.\n");
+      tcp_server_client_close(ctx->sock);
+    }
+
+    if (end_tick) {
+      break;
+    }
   }
 
-  if (act_quit) {
-    printf("JTAG DPI: Remote disconnected.\n");
-    tcp_server_client_close(ctx->sock);
+  // Once we have processed every command we were sent, OpenOCD might be
+  // waiting for the responses before it sends any more.
+  if (ctx->cmd_pos == ctx->cmd_len) {
+    flush_resps(ctx);
   }
 }
 
 void *jtagdpi_create(const char *display_name, int listen_port,
-                     int assert_srst) {
+                     int assert_srst, int fast_tck) {
   struct jtagdpi_ctx *ctx =
       (struct jtagdpi_ctx *)calloc(1, sizeof(struct jtagdpi_ctx));
   assert(ctx);
@@ -151,6 +207,7 @@ void *jtagdpi_create(const char *display_name, int listen_port,
   ctx->sock = tcp_server_create(display_name, listen_port);
 
   reset_jtag_signals(ctx, assert_srst != 0);
+  ctx->fast_tck = fast_tck != 0;
 
   printf(
       "\n"
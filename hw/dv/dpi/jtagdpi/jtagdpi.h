@@ -18,12 +18,20 @@ struct jtagdpi_ctx;
  *
  * Call from a initial block.
  *
+ * If fast_tck is nonzero, each call to jtagdpi_tick() processes queued
+ * remote_bitbang commands until one changes TCK, rather than processing a
+ * single command. This gives a TCK edge on every tick while OpenOCD has
+ * commands queued, rather than spending ticks on commands that only change
+ * TMS or TDI (or that don't change the pins at all).
+ *
  * @param display_name Name of the JTAG interface (for display purposes only)
  * @param listen_port Port to listen on
+ * @param assert_srst If nonzero, srst_n starts out asserted
+ * @param fast_tck If nonzero, use fast TCK mode
  * @return an initialized struct jtagdpi_ctx context object
  */
 void *jtagdpi_create(const char *display_name, int listen_port,
-                     int assert_srst);
+                     int assert_srst, int fast_tck);
 
 /**
  * Destructor: Close all connections and free all resources
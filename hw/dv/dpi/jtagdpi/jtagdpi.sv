@@ -20,7 +20,7 @@ module jtagdpi #(
 
   import "DPI-C"
   function chandle jtagdpi_create(input string name, input int listen_port,
-                                  input int assert_srst);
+                                  input int assert_srst, input int fast_tck);
 
   import "DPI-C"
   function void jtagdpi_tick(input chandle ctx, output bit tck, output bit tms,
@@ -33,7 +33,7 @@ module jtagdpi #(
   chandle ctx;
 
   function automatic void initialize();
-    int port, assert_srst;
+    int port, assert_srst, fast_tck;
 
     assert (ctx == null);
 
@@ -45,7 +45,12 @@ module jtagdpi #(
     assert_srst = 0;
     void'($value$plusargs("jtagdpi_assert_srst=%0d", assert_srst));
 
-    ctx = jtagdpi_create(Name, port, assert_srst);
+    // Fast TCK mode gives a TCK edge on every tick while there are commands
+    // to process (see jtagdpi.h)
+    fast_tck = 0;
+    void'($value$plusargs("jtagdpi_fast_tck=%0d", fast_tck));
+
+    ctx = jtagdpi_create(Name, port, assert_srst, fast_tck);
   endfunction
 
   initial begin
@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,8 +28,40 @@
 #include "verilator_sim_ctrl.h"
 #endif
 
+// The number of bytes in a legacy (unframed) transaction.
+#define LEGACY_TRANSACTION 4
+
+// The header of a framed transaction (see README.md)
+#define FRAME_MAGIC 'S'
+#define FRAME_HEADER_LEN 17
+#define FRAME_ADDR_LANES_SHIFT 0
+#define FRAME_DATA_LANES_SHIFT 2
+#define FRAME_LANES_MASK 0x3
+#define FRAME_NO_OPCODE 0x10
+#define FRAME_KEEP_CSB 0x20
+#define FRAME_FULL_DUPLEX 0x40
+
+// The largest write or read length we accept in a framed transaction.
+#define FRAME_MAX_LEN (16 * 1024 * 1024)
+
+// The number of ticks between reads from the PTY while we are waiting for a
+// command.
+#define SPIDPI_POLL_INTERVAL 256
+
+// A part of a transaction in which every SCK cycle moves the same number of
+// bits.
+struct spi_segment {
+  int lanes;         // 1, 2 or 4
+  bool drive;        // whether the host drives bits from tx
+  bool capture;      // whether the bits from the device go to the host
+  size_t tx_offset;  // where the bits to drive start in tx
+  uint32_t nbits;    // total bits (lanes bits per SCK cycle)
+};
+
+// A transaction has an opcode, address, dummy, write and read segment.
+#define MAX_SEGMENTS 5
+
 // This holds the necessary SPI state.
-#define MAX_TRANSACTION 4
 struct spidpi_ctx {
   int loglevel;
   char ptyname[64];
@@ -39,44 +73,86 @@ struct spidpi_ctx {
   int tick;
   int cpol;
   int cpha;
-  int msbfirst;  // shift direction
-  int nout;
-  int bout;
-  int nin;
-  int bin;
-  int din;
-  int nmax;
-  char driving;
+  // The number of ticks between SCK edges.
+  int half_period;
+  // Whether the host sends framed transactions rather than bare bytes.
+  bool framed;
+  int driving;
   int state;
-  char buf[MAX_TRANSACTION];
+  // The number of ticks until the next SCK edge or CSB change.
+  int wait;
+
+  // Bytes from the host that haven't been used yet.
+  uint8_t *in_buf;
+  size_t in_len;
+  size_t in_cap;
+
+  // Bytes waiting to be written to the host, starting at out_pos.
+  uint8_t *out_buf;
+  size_t out_pos;
+  size_t out_len;
+  size_t out_cap;
+
+  // The transaction that is running. The current beat (SCK cycle) starts at
+  // seg_bit in segs[seg].
+  struct spi_segment segs[MAX_SEGMENTS];
+  int nsegs;
+  int seg;
+  uint32_t seg_bit;
+  uint8_t *tx;
+  size_t tx_cap;
+  bool keep_csb;
+  // Internal SCK (0 when idle, regardless of CPOL).
+  int sck;
+  // A partly captured byte.
+  int din;
+  int din_bits;
 };
 
 // SPI Host States
 #define SP_IDLE 0
-#define SP_CSFALL 1
-#define SP_DMOVE 2
-#define SP_LASTBIT 3
-#define SP_CSRISE 4
-#define SP_FINISH 99
+#define SP_RUN 1
+#define SP_END 2
+#define SP_CSRISE 3
 
 // Enable this define to stop tracing at cycle 4
 // and resume at the first SPI packet
 // #define CONTROL_TRACE
 
-void *spidpi_create(const char *name, int mode, int loglevel) {
-  int i;
+/**
+ * Make sure that *buf (with capacity *cap) can hold len bytes.
+ */
+static void reserve(uint8_t **buf, size_t *cap, size_t len) {
+  if (len <= *cap) {
+    return;
+  }
+  size_t new_cap = *cap ? *cap : 4096;
+  while (new_cap < len) {
+    new_cap *= 2;
+  }
+  *buf = (uint8_t *)realloc(*buf, new_cap);
+  assert(*buf);
+  *cap = new_cap;
+}
+
+void *spidpi_create(const char *name, int mode, int loglevel, int sck_div,
+                    int framed, int monitor) {
+  if (sck_div < 2 || sck_div % 2) {
+    fprintf(stderr,
+            "SPI: SCK divider must be an even number, at least 2 (got %d)\n",
+            sck_div);
+    return NULL;
+  }
+
   struct spidpi_ctx *ctx =
       (struct spidpi_ctx *)calloc(1, sizeof(struct spidpi_ctx));
   assert(ctx);
 
   ctx->loglevel = loglevel;
-  ctx->mon = monitor_spi_init(mode);
+  ctx->mon = monitor ? monitor_spi_init(mode) : NULL;
   ctx->tick = 0;
-  ctx->msbfirst = 1;
-  ctx->nmax = MAX_TRANSACTION;
-  ctx->nin = 0;
-  ctx->nout = 0;
-  ctx->bout = 0;
+  ctx->half_period = sck_div / 2;
+  ctx->framed = framed != 0;
   ctx->state = SP_IDLE;
   /* mode is CPOL << 1 | CPHA
    * cpol = 0 --> external clock matches internal
@@ -109,9 +185,18 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
   printf(
       "\n"
       "SPI: Created %s for %s. Connect to it with any terminal program, e.g.\n"
-      "$ screen %s\n"
-      "NOTE: a SPI transaction is run for every 4 characters entered.\n",
+      "$ screen %s\n",
       ctx->ptyname, name, ctx->ptyname);
+  if (ctx->framed) {
+    printf("NOTE: the host must send framed transactions (see README.md).\n");
+  } else {
+    printf("NOTE: a SPI transaction is run for every %d characters entered.\n",
+           LEGACY_TRANSACTION);
+  }
+
+  if (!ctx->mon) {
+    return (void *)ctx;
+  }
 
   rv = snprintf(ctx->mon_pathname, PATH_MAX, "%s/%s.log", cwd, name);
   assert(rv <= PATH_MAX && rv > 0);
@@ -119,6 +204,10 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
   if (ctx->mon_file == NULL) {
     fprintf(stderr, "SPI: Unable to open file at %s: %s\n", ctx->mon_pathname,
             strerror(errno));
+    close(ctx->host);
+    close(ctx->device);
+    free(ctx->mon);
+    free(ctx);
     return NULL;
   }
   // more useful for tail -f
@@ -131,7 +220,194 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
   return (void *)ctx;
 }
 
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
+static uint32_t get_le32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static void add_segment(struct spidpi_ctx *ctx, int lanes, bool drive,
+                        bool capture, size_t tx_offset, uint32_t nbits) {
+  if (!nbits) {
+    return;
+  }
+  assert(ctx->nsegs < MAX_SEGMENTS);
+  struct spi_segment *seg = &ctx->segs[ctx->nsegs++];
+  seg->lanes = lanes;
+  seg->drive = drive;
+  seg->capture = capture;
+  seg->tx_offset = tx_offset;
+  seg->nbits = nbits;
+}
+
+/**
+ * Set up the next transaction from the bytes in in_buf.
+ *
+ * @return true if there was a complete transaction to start.
+ */
+static bool parse_transaction(struct spidpi_ctx *ctx) {
+  ctx->nsegs = 0;
+  ctx->seg = 0;
+  ctx->seg_bit = 0;
+  ctx->keep_csb = false;
+
+  size_t used;
+  if (!ctx->framed) {
+    if (ctx->in_len < LEGACY_TRANSACTION) {
+      return false;
+    }
+    used = LEGACY_TRANSACTION;
+    reserve(&ctx->tx, &ctx->tx_cap, used);
+    memcpy(ctx->tx, ctx->in_buf, used);
+    add_segment(ctx, 1, true, true, 0, 8 * used);
+  } else {
+    if (ctx->in_len < FRAME_HEADER_LEN) {
+      return false;
+    }
+    const uint8_t *hdr = ctx->in_buf;
+    int flags = hdr[1];
+    int opcode = hdr[2];
+    int addr_bytes = hdr[3];
+    int dummy_cycles = hdr[4];
+    uint32_t addr = get_le32(hdr + 5);
+    uint32_t write_len = get_le32(hdr + 9);
+    uint32_t read_len = get_le32(hdr + 13);
+    int addr_lanes = 1
+                     << ((flags >> FRAME_ADDR_LANES_SHIFT) & FRAME_LANES_MASK);
+    int data_lanes = 1
+                     << ((flags >> FRAME_DATA_LANES_SHIFT) & FRAME_LANES_MASK);
+    bool full_duplex = flags & FRAME_FULL_DUPLEX;
+
+    if (hdr[0] != FRAME_MAGIC || addr_lanes > 4 || data_lanes > 4 ||
+        addr_bytes > 4 || write_len > FRAME_MAX_LEN ||
+        read_len > FRAME_MAX_LEN ||
+        (full_duplex && (addr_lanes != 1 || data_lanes != 1))) {
+      // We can't tell where the next frame starts, so drop everything.
+      fprintf(stderr, "SPI: Bad transaction header; discarding input.\n");
+      ctx->in_len = 0;
+      return false;
+    }
+
+    used = FRAME_HEADER_LEN + write_len;
+    if (ctx->in_len < used) {
+      reserve(&ctx->in_buf, &ctx->in_cap, used);
+      return false;
+    }
+
+    size_t tx_len = 0;
+    reserve(&ctx->tx, &ctx->tx_cap, 1 + addr_bytes + write_len);
+    if (!(flags & FRAME_NO_OPCODE)) {
+      ctx->tx[tx_len++] = opcode;
+      add_segment(ctx, 1, true, full_duplex, 0, 8);
+    }
+    for (int i = addr_bytes - 1; i >= 0; --i) {
+      ctx->tx[tx_len++] = (addr >> (8 * i)) & 0xff;
+    }
+    add_segment(ctx, addr_lanes, true, full_duplex, tx_len - addr_bytes,
+                8 * addr_bytes);
+    add_segment(ctx, data_lanes, false, false, 0, dummy_cycles * data_lanes);
+    memcpy(ctx->tx + tx_len, hdr + FRAME_HEADER_LEN, write_len);
+    add_segment(ctx, data_lanes, true, full_duplex, tx_len, 8 * write_len);
+    add_segment(ctx, data_lanes, false, true, 0, 8 * read_len);
+    ctx->keep_csb = flags & FRAME_KEEP_CSB;
+  }
+
+  ctx->in_len -= used;
+  memmove(ctx->in_buf, ctx->in_buf + used, ctx->in_len);
+  return true;
+}
+
+/**
+ * Read whatever the host has sent, returning false if there was nothing.
+ */
+static bool read_host(struct spidpi_ctx *ctx) {
+  reserve(&ctx->in_buf, &ctx->in_cap, ctx->in_len + 1);
+  ssize_t n = read(ctx->host, ctx->in_buf + ctx->in_len,
+                   ctx->in_cap - ctx->in_len);
+  if (n == -1) {
+    if (errno != EAGAIN) {
+      fprintf(stderr, "Read on SPI FIFO gave %s\n", strerror(errno));
+    }
+    return false;
+  }
+  ctx->in_len += n;
+  return n > 0;
+}
+
+static void flush_host(struct spidpi_ctx *ctx) {
+  ssize_t n = write(ctx->host, ctx->out_buf + ctx->out_pos,
+                    ctx->out_len - ctx->out_pos);
+  if (n < 0) {
+    if (errno != EAGAIN) {
+      fprintf(stderr, "Write on SPI FIFO gave %s\n", strerror(errno));
+    }
+    return;
+  }
+  ctx->out_pos += n;
+  if (ctx->out_pos == ctx->out_len) {
+    ctx->out_pos = 0;
+    ctx->out_len = 0;
+  }
+}
+
+/**
+ * Drive the data lanes for the current beat.
+ */
+static void drive_beat(struct spidpi_ctx *ctx) {
+  const struct spi_segment *seg = &ctx->segs[ctx->seg];
+  int lanes = 0;
+  if (seg->drive) {
+    // Bits go out MSB first, with the earliest bit of each beat on the
+    // highest lane.
+    uint8_t byte = ctx->tx[seg->tx_offset + ctx->seg_bit / 8];
+    int shift = 8 - seg->lanes - ctx->seg_bit % 8;
+    lanes = (byte >> shift) & ((1 << seg->lanes) - 1);
+  }
+  ctx->driving = (ctx->driving & ~P2D_SD_MASK) | (lanes << P2D_SD_SHIFT);
+}
+
+/**
+ * Sample the data lanes for the current beat.
+ */
+static void sample_beat(struct spidpi_ctx *ctx, int d2p) {
+  const struct spi_segment *seg = &ctx->segs[ctx->seg];
+  if (!seg->capture) {
+    return;
+  }
+  // A single-lane device sends on SD1 (SDO); otherwise it uses the lanes
+  // from SD0 upwards.
+  int lanes = seg->lanes == 1 ? (d2p & D2P_SDO ? 1 : 0)
+                              : (d2p >> D2P_SD_SHIFT) & ((1 << seg->lanes) - 1);
+  ctx->din = (ctx->din << seg->lanes) | lanes;
+  ctx->din_bits += seg->lanes;
+  if (ctx->din_bits == 8) {
+    reserve(&ctx->out_buf, &ctx->out_cap, ctx->out_len + 1);
+    ctx->out_buf[ctx->out_len++] = ctx->din;
+    ctx->din = 0;
+    ctx->din_bits = 0;
+  }
+}
+
+/**
+ * Move to the next beat, returning false at the end of the transaction.
+ */
+static bool next_beat(struct spidpi_ctx *ctx) {
+  ctx->seg_bit += ctx->segs[ctx->seg].lanes;
+  if (ctx->seg_bit == ctx->segs[ctx->seg].nbits) {
+    ctx->seg_bit = 0;
+    ++ctx->seg;
+  }
+  return ctx->seg < ctx->nsegs;
+}
+
+static void set_sck(struct spidpi_ctx *ctx, int sck) {
+  ctx->sck = sck;
+  ctx->driving &= ~P2D_SCK;
+  if (sck != ctx->cpol) {
+    ctx->driving |= P2D_SCK;
+  }
+}
+
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
   struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
   assert(ctx);
   int d2p = d2p_data->aval;
@@ -147,105 +423,92 @@ char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
 #endif
 #endif
 
-  monitor_spi(ctx->mon, ctx->mon_file, ctx->loglevel, ctx->tick, ctx->driving,
-              d2p);
+  if (ctx->mon) {
+    monitor_spi(ctx->mon, ctx->mon_file, ctx->loglevel, ctx->tick,
+                ctx->driving, d2p);
+  }
+
+  if (ctx->out_len) {
+    flush_host(ctx);
+  }
 
   if (ctx->state == SP_IDLE) {
-    int n = read(ctx->host, &(ctx->buf[ctx->nin]), ctx->nmax - ctx->nin);
-    if (n == -1) {
-      if (errno != EAGAIN) {
-        fprintf(stderr, "Read on SPI FIFO gave %s\n", strerror(errno));
+    // Look for more input straight after a transaction and every
+    // SPIDPI_POLL_INTERVAL ticks after that.
+    if (!parse_transaction(ctx)) {
+      if (ctx->tick % SPIDPI_POLL_INTERVAL || !read_host(ctx) ||
+          !parse_transaction(ctx)) {
+        return ctx->driving;
       }
-    } else {
-      ctx->nin += n;
-      if (ctx->nin == ctx->nmax) {
-        ctx->nout = 0;
-        ctx->nin = 0;
-        ctx->bout = ctx->msbfirst ? 0x80 : 0x01;
-        ctx->bin = ctx->msbfirst ? 0x80 : 0x01;
-        ctx->din = 0;
-        ctx->state = SP_CSFALL;
+    }
 #ifdef VERILATOR
 #ifdef CONTROL_TRACE
-        VerilatorSimCtrl::GetInstance().TraceOn();
+    VerilatorSimCtrl::GetInstance().TraceOn();
 #endif
 #endif
+    // CSB low. With CPHA = 0, the first bit has to be ready before the first
+    // SCK edge.
+    ctx->driving &= ~P2D_CSB;
+    ctx->din = 0;
+    ctx->din_bits = 0;
+    if (!ctx->nsegs) {
+      ctx->state = SP_END;
+    } else {
+      ctx->state = SP_RUN;
+      if (!ctx->cpha) {
+        drive_beat(ctx);
       }
     }
-  }
-  // SPI clock toggles every 4th tick (i.e. freq=primary_frequency/8)
-  if ((ctx->tick & 3) || (ctx->state == SP_IDLE)) {
+    ctx->wait = ctx->half_period;
     return ctx->driving;
   }
 
-  // Only get here on sck edges when active
-  int internal_sck = (ctx->tick & 4) ? 1 : 0;
-  int set_sck = (internal_sck ? P2D_SCK : 0);
-  if (ctx->cpol) {
-    set_sck ^= P2D_SCK;
+  if (--ctx->wait) {
+    return ctx->driving;
   }
+  ctx->wait = ctx->half_period;
 
-  if (internal_sck == ctx->cpha) {
-    // host driving edge (falling for mode 0)
-    switch (ctx->state) {
-      case SP_DMOVE:
-        // SCLK low, CSB low
-        ctx->driving =
-            set_sck | (ctx->buf[ctx->nout] & ctx->bout) ? P2D_SDI : 0;
-        ctx->bout = (ctx->msbfirst) ? ctx->bout >> 1 : ctx->bout << 1;
-        if ((ctx->bout & 0xff) == 0) {
-          ctx->bout = ctx->msbfirst ? 0x80 : 0x01;
-          ctx->nout++;
-          if (ctx->nout == ctx->nmax) {
-            ctx->state = SP_LASTBIT;
-          }
+  switch (ctx->state) {
+    case SP_RUN:
+      if (!ctx->sck) {
+        // Leading edge (rising for mode 0)
+        if (ctx->cpha) {
+          drive_beat(ctx);
         }
-        break;
-      case SP_LASTBIT:
-        ctx->state = SP_CSRISE;
-        // fallthrough
-      default:
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
-    }
-  } else {
-    // host other edge (rising for mode 0)
-    switch (ctx->state) {
-        // Read input data (opposite edge to sending)
-        // both DMOVE and LASTBIT states are data moving ones!
-      case SP_DMOVE:
-      case SP_LASTBIT:
-        ctx->din = ctx->din | ((d2p & D2P_SDO) ? ctx->bin : 0);
-        ctx->bin = (ctx->msbfirst) ? ctx->bin >> 1 : ctx->bin << 1;
-        if (ctx->bin == 0) {
-          int rv = write(ctx->host, &(ctx->din), 1);
-          assert(rv == 1 && "write() failed.");
-          ctx->bin = (ctx->msbfirst) ? 0x80 : 0x01;
-          ctx->din = 0;
+        set_sck(ctx, 1);
+        if (!ctx->cpha) {
+          sample_beat(ctx, d2p);
         }
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
-      case SP_CSFALL:
-        // CSB low, drive SDI to first bit
-        ctx->driving =
-            (set_sck | (ctx->buf[ctx->nout] & ctx->bout) ? P2D_SDI : 0);
-        ctx->state = SP_DMOVE;
-        break;
-      case SP_CSRISE:
-        // CSB high, clock stopped
-        ctx->driving = P2D_CSB;
+      } else {
+        // Trailing edge (falling for mode 0)
+        set_sck(ctx, 0);
+        if (ctx->cpha) {
+          sample_beat(ctx, d2p);
+        }
+        if (!next_beat(ctx)) {
+          ctx->state = SP_END;
+        } else if (!ctx->cpha) {
+          drive_beat(ctx);
+        }
+      }
+      break;
+    case SP_END:
+      ctx->driving &= ~P2D_SD_MASK;
+      if (ctx->keep_csb) {
         ctx->state = SP_IDLE;
-        break;
-      case SP_FINISH:
-#ifdef VERILATOR
-        VerilatorSimCtrl::GetInstance().RequestStop(true);
-#endif
-        break;
-      default:
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
-    }
+      } else {
+        // CSB high, clock stopped
+        ctx->driving |= P2D_CSB;
+        ctx->state = SP_CSRISE;
+      }
+      break;
+    case SP_CSRISE:
+      ctx->state = SP_IDLE;
+      break;
+    default:
+      break;
   }
+
   return ctx->driving;
 }
 
@@ -254,6 +517,12 @@ void spidpi_close(void *ctx_void) {
   if (!ctx) {
     return;
   }
-  fclose(ctx->mon_file);
+  if (ctx->mon_file) {
+    fclose(ctx->mon_file);
+  }
+  free(ctx->mon);
+  free(ctx->in_buf);
+  free(ctx->out_buf);
+  free(ctx->tx);
   free(ctx);
 }
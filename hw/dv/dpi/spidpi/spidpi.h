@@ -11,17 +11,37 @@
 extern "C" {
 #endif
 
-// Bits in data to C
-#define D2P_SDO 0x2
-#define D2P_SDO_EN 0x1
-
-// Bits in char from C
+// Bits in data to C: the values of SD[3:0] and then their output enables
+#define D2P_SD_SHIFT 0
+#define D2P_SD_EN_SHIFT 4
+// SD1 is SDO for single-lane transfers
+#define D2P_SDO (0x2 << D2P_SD_SHIFT)
+#define D2P_SDO_EN (0x2 << D2P_SD_EN_SHIFT)
+
+// Bits in int from C
 #define P2D_SCK 0x1
 #define P2D_CSB 0x2
-#define P2D_SDI 0x4
-
-void *spidpi_create(const char *name, int mode, int loglevel);
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
+#define P2D_SD_SHIFT 2
+#define P2D_SD_MASK (0xf << P2D_SD_SHIFT)
+// SD0 is SDI for single-lane transfers
+#define P2D_SDI (0x1 << P2D_SD_SHIFT)
+
+/**
+ * Create a SPI host.
+ *
+ * @param name a name for the PTY and the monitor log file.
+ * @param mode the SPI mode (CPOL << 1 | CPHA).
+ * @param loglevel what the monitor logs (see spidpi.sv).
+ * @param sck_div the ratio of the tick frequency to the SCK frequency. This
+ *        must be even and at least 2.
+ * @param framed if nonzero, the host sends framed transactions (see
+ *        README.md). Otherwise, each 4 bytes from the host are sent as one
+ *        single-lane transaction.
+ * @param monitor if zero, don't run the monitor or create its log file.
+ */
+void *spidpi_create(const char *name, int mode, int loglevel, int sck_div,
+                    int framed, int monitor);
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
 void spidpi_close(void *ctx_void);
 
 // monitor
@@ -7,6 +7,11 @@
 // Bits in LOG_LEVEL sets what is output on info socket
 // 0x01 -- monitor packets
 // 0x08 -- bit level
+//
+// Plusargs:
+// +spidpi_sck_div=N  -- run SCK at 1/N of clk_i (N even, at least 2; default 8)
+// +spidpi_framed=1   -- take framed transactions from the host (see README.md)
+// +spidpi_monitor=0  -- don't run the monitor or write its log
 
 module spidpi
   #(
@@ -14,28 +19,36 @@ module spidpi
   parameter int MODE = 0,
   parameter int LOG_LEVEL = 9
   )(
-  input  logic clk_i,
-  input  logic rst_ni,
-  output logic spi_device_sck_o,
-  output logic spi_device_csb_o,
-  output logic spi_device_sdi_o,
-  input  logic spi_device_sdo_i,
-  input  logic spi_device_sdo_en_i
+  input  logic       clk_i,
+  input  logic       rst_ni,
+  output logic       spi_device_sck_o,
+  output logic       spi_device_csb_o,
+  output logic [3:0] spi_device_sd_o,
+  input  logic [3:0] spi_device_sd_i,
+  input  logic [3:0] spi_device_sd_en_i
 
 );
   import "DPI-C" function
-    chandle spidpi_create(input string name, input int mode, input int loglevel);
+    chandle spidpi_create(input string name, input int mode, input int loglevel,
+                          input int sck_div, input int framed,
+                          input int monitor);
 
   import "DPI-C" function
     void spidpi_close(input chandle ctx);
 
   import "DPI-C" function
-    byte spidpi_tick(input chandle ctx_void, input logic [1:0] d2p_data);
+    int spidpi_tick(input chandle ctx_void, input logic [7:0] d2p_data);
 
   chandle ctx;
 
   initial begin
-    ctx = spidpi_create(NAME, MODE, LOG_LEVEL);
+    int sck_div = 8;
+    int framed = 0;
+    int monitor = 1;
+    void'($value$plusargs("spidpi_sck_div=%0d", sck_div));
+    void'($value$plusargs("spidpi_framed=%0d", framed));
+    void'($value$plusargs("spidpi_monitor=%0d", monitor));
+    ctx = spidpi_create(NAME, MODE, LOG_LEVEL, sck_div, framed, monitor);
   end
 
   final begin
@@ -43,16 +56,16 @@ module spidpi
   end
 
   logic       unused_rst = rst_ni;
-  logic [1:0] d2p;
+  logic [7:0] d2p;
   logic       unused_dummy;
 
-  assign d2p = { spi_device_sdo_i, spi_device_sdo_en_i};
+  assign d2p = {spi_device_sd_en_i, spi_device_sd_i};
   always_ff @(posedge clk_i) begin
-    automatic byte p2d = spidpi_tick(ctx, d2p);
+    automatic int p2d = spidpi_tick(ctx, d2p);
     spi_device_sck_o <= p2d[0];
     spi_device_csb_o <= p2d[1];
-    spi_device_sdi_o <= p2d[2];
+    spi_device_sd_o  <= p2d[5:2];
     // stop verilator warning
-    unused_dummy <= |p2d[7:3];
+    unused_dummy <= |p2d[31:6];
   end
 endmodule
@@ -14,25 +14,63 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+// Size of the input and output buffers
+#define UARTDPI_BUF_SIZE 4096
+
+// Number of calls to uartdpi_can_read() between checks for new input (and for
+// output that has been buffered for too long)
+#define UARTDPI_POLL_INTERVAL 256
+
+// Maximum time (in microseconds) that output without a newline stays buffered
+#define UARTDPI_FLUSH_US 20000
+
 // This keeps the necessary uart state.
 struct uartdpi_ctx {
   char ptyname[64];
+  // The fd for the host side of the UART: the PTY master or a client
+  // connected to the Unix socket (or -1 if there isn't one).
   int host;
+  // The PTY slave, or -1 if using a Unix socket
   int device;
-  char tmp_read;
+  // The listening Unix socket, or -1 if using a PTY
+  int listen_fd;
+  char *socket_path;
   FILE *log_file;
+
+  // Input from the host that hasn't been passed to the simulation yet
+  char rx_buf[UARTDPI_BUF_SIZE];
+  size_t rx_pos;
+  size_t rx_len;
+  unsigned int poll_countdown;
+
+  // Output from the simulation that hasn't been written yet. tx_start_us is
+  // the time when the first byte was added to tx_buf. The first tx_logged
+  // bytes have already been written to the log file, but the host hasn't
+  // been ready to take them yet.
+  char tx_buf[UARTDPI_BUF_SIZE];
+  size_t tx_len;
+  size_t tx_logged;
+  uint64_t tx_start_us;
+  bool tx_drop_warned;
 };
 
-void *uartdpi_create(const char *name, const char *log_file_path) {
-  struct uartdpi_ctx *ctx =
-      (struct uartdpi_ctx *)malloc(sizeof(struct uartdpi_ctx));
-  assert(ctx);
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
+// Create a PTY for ctx->host. Returns true on success.
+static bool open_pty(struct uartdpi_ctx *ctx, const char *name) {
   int rv;
 
   // Initialize UART pseudo-terminal
@@ -55,6 +93,164 @@ void *uartdpi_create(const char *name, const char *log_file_path) {
       "UART: Created %s for %s. Connect to it with any terminal program, e.g.\n"
       "$ screen %s\n",
       ctx->ptyname, name, ctx->ptyname);
+  return true;
+}
+
+// Create a Unix socket at path that a host can connect to. Returns true on
+// success.
+static bool open_socket(struct uartdpi_ctx *ctx, const char *name,
+                        const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "UART: Socket path too long: %s\n", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "UART: Unable to create socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  // Remove any stale socket left behind by an earlier simulation
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 1) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+    fprintf(stderr, "UART: Unable to listen on %s: %s\n", path,
+            strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  ctx->listen_fd = fd;
+  ctx->socket_path = strdup(path);
+  assert(ctx->socket_path);
+
+  printf(
+      "\n"
+      "UART: Listening on Unix socket %s for %s. Connect to it with e.g.\n"
+      "$ socat - UNIX-CONNECT:%s\n",
+      path, name, path);
+  return true;
+}
+
+// Accept a connection on the Unix socket (if there isn't a client already)
+static void try_accept(struct uartdpi_ctx *ctx) {
+  if (ctx->listen_fd < 0 || ctx->host >= 0) {
+    return;
+  }
+
+  int fd = accept(ctx->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+    close(fd);
+    return;
+  }
+  ctx->host = fd;
+}
+
+static void close_client(struct uartdpi_ctx *ctx) {
+  assert(ctx->listen_fd >= 0);
+  close(ctx->host);
+  ctx->host = -1;
+}
+
+// Write tx_buf to the log file and as much of it as the host will take. Any
+// bytes that the host isn't ready for stay in tx_buf for the next attempt.
+static void flush_tx(struct uartdpi_ctx *ctx) {
+  if (!ctx->tx_len) {
+    return;
+  }
+
+  if (ctx->log_file && ctx->tx_logged < ctx->tx_len) {
+    size_t len = ctx->tx_len - ctx->tx_logged;
+    size_t rv =
+        fwrite(ctx->tx_buf + ctx->tx_logged, sizeof(char), len, ctx->log_file);
+    assert(rv == len && "Write to log file failed.");
+  }
+
+  size_t done = 0;
+  while (ctx->host >= 0 && done < ctx->tx_len) {
+    ssize_t rv;
+    if (ctx->listen_fd >= 0) {
+      rv = send(ctx->host, ctx->tx_buf + done, ctx->tx_len - done,
+                MSG_NOSIGNAL);
+    } else {
+      rv = write(ctx->host, ctx->tx_buf + done, ctx->tx_len - done);
+    }
+
+    if (rv >= 0) {
+      done += rv;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // The host isn't reading the output at the moment. Keep the rest and
+      // try again on a later poll.
+      break;
+    } else if (ctx->listen_fd >= 0) {
+      close_client(ctx);
+    } else {
+      assert(0 && "Write to pseudo-terminal failed.");
+    }
+  }
+
+  // If there's no host (a socket with no client connected), there's nowhere
+  // for the output to go, so drop it (it's still in the log file, if there is
+  // one).
+  if (ctx->host < 0) {
+    done = ctx->tx_len;
+  }
+
+  memmove(ctx->tx_buf, ctx->tx_buf + done, ctx->tx_len - done);
+  ctx->tx_len -= done;
+  ctx->tx_logged = ctx->tx_len;
+}
+
+// Read as much input as is available into rx_buf, which must be empty
+static void fill_rx(struct uartdpi_ctx *ctx) {
+  assert(ctx->rx_pos == ctx->rx_len);
+  ctx->rx_pos = 0;
+  ctx->rx_len = 0;
+
+  if (ctx->host < 0) {
+    return;
+  }
+
+  ssize_t rv = read(ctx->host, ctx->rx_buf, UARTDPI_BUF_SIZE);
+  if (rv > 0) {
+    ctx->rx_len = rv;
+  } else if (rv == 0 && ctx->listen_fd >= 0) {
+    // The client disconnected
+    close_client(ctx);
+  }
+}
+
+void *uartdpi_create(const char *name, const char *log_file_path,
+                     const char *socket_path) {
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)calloc(1, sizeof(struct uartdpi_ctx));
+  assert(ctx);
+
+  int rv;
+
+  ctx->host = -1;
+  ctx->device = -1;
+  ctx->listen_fd = -1;
+  ctx->poll_countdown = 1;
+
+  // Use a Unix socket if we've been given a path, otherwise a PTY
+  bool opened = strlen(socket_path) != 0
+                    ? open_socket(ctx, name, socket_path)
+                    : open_pty(ctx, name);
+  if (!opened) {
+    free(ctx);
+    return NULL;
+  }
 
   // Open log file (if requested)
   ctx->log_file = NULL;
@@ -93,8 +289,19 @@ void uartdpi_close(void *ctx_void) {
     return;
   }
 
-  close(ctx->host);
-  close(ctx->device);
+  flush_tx(ctx);
+
+  if (ctx->host >= 0) {
+    close(ctx->host);
+  }
+  if (ctx->device >= 0) {
+    close(ctx->device);
+  }
+  if (ctx->listen_fd >= 0) {
+    close(ctx->listen_fd);
+    unlink(ctx->socket_path);
+    free(ctx->socket_path);
+  }
 
   if (ctx->log_file) {
     // Always ensure the log file is flushed (most important when writing
@@ -113,28 +320,72 @@ int uartdpi_can_read(void *ctx_void) {
   if (ctx == NULL) {
     return 0;
   }
-  int rv = read(ctx->host, &ctx->tmp_read, 1);
-  return (rv == 1);
+
+  if (ctx->rx_pos < ctx->rx_len) {
+    return 1;
+  }
+
+  // This is called on every clock cycle while the UART isn't sending, so only
+  // look for new input (and flush old output) every UARTDPI_POLL_INTERVAL
+  // calls.
+  if (--ctx->poll_countdown) {
+    return 0;
+  }
+
+  try_accept(ctx);
+  if (ctx->tx_len && now_us() - ctx->tx_start_us >= UARTDPI_FLUSH_US) {
+    flush_tx(ctx);
+  }
+  fill_rx(ctx);
+
+  // If there was some input, check again as soon as it has all been used,
+  // since more is probably on its way.
+  ctx->poll_countdown = ctx->rx_len ? 1 : UARTDPI_POLL_INTERVAL;
+  return ctx->rx_len != 0;
 }
 
 char uartdpi_read(void *ctx_void) {
   struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  assert(ctx->rx_pos < ctx->rx_len && "uartdpi_can_read() must be true.");
 
-  return ctx->tmp_read;
+  return ctx->rx_buf[ctx->rx_pos++];
 }
 
 void uartdpi_write(void *ctx_void, char c) {
-  int rv;
   struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
   if (ctx == NULL) {
     return;
   }
 
-  rv = write(ctx->host, &c, 1);
-  assert(rv == 1 && "Write to pseudo-terminal failed.");
+  // If the buffer is still full of output that the host hasn't taken, try
+  // once more. If that doesn't make room, drop c rather than blocking the
+  // simulation (it still goes to the log file, if there is one).
+  if (ctx->tx_len == UARTDPI_BUF_SIZE) {
+    flush_tx(ctx);
+  }
+  if (ctx->tx_len == UARTDPI_BUF_SIZE) {
+    if (ctx->log_file) {
+      fputc(c, ctx->log_file);
+    }
+    if (!ctx->tx_drop_warned) {
+      fprintf(stderr,
+              "UART: Output buffer full, dropping output. Is anything "
+              "connected to %s?\n",
+              ctx->listen_fd >= 0 ? ctx->socket_path : ctx->ptyname);
+      ctx->tx_drop_warned = true;
+    }
+    return;
+  }
+
+  if (!ctx->tx_len) {
+    ctx->tx_start_us = now_us();
+  }
+  ctx->tx_buf[ctx->tx_len++] = c;
 
-  if (ctx->log_file) {
-    rv = fwrite(&c, sizeof(char), 1, ctx->log_file);
-    assert(rv == 1 && "Write to log file failed.");
+  // Write complete lines immediately. Anything else is written when the buffer
+  // fills up or (see uartdpi_can_read) once it has waited for
+  // UARTDPI_FLUSH_US.
+  if (c == '\n' || ctx->tx_len == UARTDPI_BUF_SIZE) {
+    flush_tx(ctx);
   }
 }
@@ -9,7 +9,19 @@
 extern "C" {
 #endif
 
-void *uartdpi_create(const char *name, const char *log_file_path);
+/**
+ * Create a UART DPI instance
+ *
+ * The host side of the UART is a new PTY or, if socket_path is not empty, a
+ * Unix socket at socket_path that accepts one connection at a time. Output is
+ * also written to the file at log_file_path (or stdout if it is "-") unless it
+ * is empty.
+ *
+ * Input is read from the host in batches and output is buffered until a
+ * newline, until the buffer fills or for at most a few milliseconds.
+ */
+void *uartdpi_create(const char *name, const char *log_file_path,
+                     const char *socket_path);
 void uartdpi_close(void *ctx_void);
 int uartdpi_can_read(void *ctx_void);
 char uartdpi_read(void *ctx_void);
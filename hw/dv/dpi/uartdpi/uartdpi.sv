@@ -21,7 +21,8 @@ module uartdpi #(
   localparam int CYCLES_PER_SYMBOL = FREQ / BAUD;
 
   import "DPI-C" function
-    chandle uartdpi_create(input string name, input string log_file_path);
+    chandle uartdpi_create(input string name, input string log_file_path,
+                           input string socket_path);
 
   import "DPI-C" function
     void uartdpi_close(input chandle ctx);
@@ -37,10 +38,14 @@ module uartdpi #(
 
   chandle ctx;
   string log_file_path = DEFAULT_LOG_FILE;
+  // Path to a Unix socket to use instead of a PTY (set through the
+  // `UARTDPI_SOCKET_<name>` plusarg).
+  string socket_path = "";
 
   function automatic void initialize();
     $value$plusargs({"UARTDPI_LOG_", NAME, "=%s"}, log_file_path);
-    ctx = uartdpi_create(NAME, log_file_path);
+    $value$plusargs({"UARTDPI_SOCKET_", NAME, "=%s"}, socket_path);
+    ctx = uartdpi_create(NAME, log_file_path, socket_path);
   endfunction
 
   initial begin
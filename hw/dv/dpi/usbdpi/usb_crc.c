@@ -87,26 +87,50 @@ uint32_t CRC5(uint32_t dwInput, int iBitcnt) {
   return crc5;
 }  // CRC5()
 
+// CRC16 (reflected polynomial 0xA001) of each byte value, for processing a
+// byte at a time rather than a bit at a time
+static const uint16_t crc16_table[0x100] = {
+    0x0000U, 0xc0c1U, 0xc181U, 0x0140U, 0xc301U, 0x03c0U, 0x0280U, 0xc241U,
+    0xc601U, 0x06c0U, 0x0780U, 0xc741U, 0x0500U, 0xc5c1U, 0xc481U, 0x0440U,
+    0xcc01U, 0x0cc0U, 0x0d80U, 0xcd41U, 0x0f00U, 0xcfc1U, 0xce81U, 0x0e40U,
+    0x0a00U, 0xcac1U, 0xcb81U, 0x0b40U, 0xc901U, 0x09c0U, 0x0880U, 0xc841U,
+    0xd801U, 0x18c0U, 0x1980U, 0xd941U, 0x1b00U, 0xdbc1U, 0xda81U, 0x1a40U,
+    0x1e00U, 0xdec1U, 0xdf81U, 0x1f40U, 0xdd01U, 0x1dc0U, 0x1c80U, 0xdc41U,
+    0x1400U, 0xd4c1U, 0xd581U, 0x1540U, 0xd701U, 0x17c0U, 0x1680U, 0xd641U,
+    0xd201U, 0x12c0U, 0x1380U, 0xd341U, 0x1100U, 0xd1c1U, 0xd081U, 0x1040U,
+    0xf001U, 0x30c0U, 0x3180U, 0xf141U, 0x3300U, 0xf3c1U, 0xf281U, 0x3240U,
+    0x3600U, 0xf6c1U, 0xf781U, 0x3740U, 0xf501U, 0x35c0U, 0x3480U, 0xf441U,
+    0x3c00U, 0xfcc1U, 0xfd81U, 0x3d40U, 0xff01U, 0x3fc0U, 0x3e80U, 0xfe41U,
+    0xfa01U, 0x3ac0U, 0x3b80U, 0xfb41U, 0x3900U, 0xf9c1U, 0xf881U, 0x3840U,
+    0x2800U, 0xe8c1U, 0xe981U, 0x2940U, 0xeb01U, 0x2bc0U, 0x2a80U, 0xea41U,
+    0xee01U, 0x2ec0U, 0x2f80U, 0xef41U, 0x2d00U, 0xedc1U, 0xec81U, 0x2c40U,
+    0xe401U, 0x24c0U, 0x2580U, 0xe541U, 0x2700U, 0xe7c1U, 0xe681U, 0x2640U,
+    0x2200U, 0xe2c1U, 0xe381U, 0x2340U, 0xe101U, 0x21c0U, 0x2080U, 0xe041U,
+    0xa001U, 0x60c0U, 0x6180U, 0xa141U, 0x6300U, 0xa3c1U, 0xa281U, 0x6240U,
+    0x6600U, 0xa6c1U, 0xa781U, 0x6740U, 0xa501U, 0x65c0U, 0x6480U, 0xa441U,
+    0x6c00U, 0xacc1U, 0xad81U, 0x6d40U, 0xaf01U, 0x6fc0U, 0x6e80U, 0xae41U,
+    0xaa01U, 0x6ac0U, 0x6b80U, 0xab41U, 0x6900U, 0xa9c1U, 0xa881U, 0x6840U,
+    0x7800U, 0xb8c1U, 0xb981U, 0x7940U, 0xbb01U, 0x7bc0U, 0x7a80U, 0xba41U,
+    0xbe01U, 0x7ec0U, 0x7f80U, 0xbf41U, 0x7d00U, 0xbdc1U, 0xbc81U, 0x7c40U,
+    0xb401U, 0x74c0U, 0x7580U, 0xb541U, 0x7700U, 0xb7c1U, 0xb681U, 0x7640U,
+    0x7200U, 0xb2c1U, 0xb381U, 0x7340U, 0xb101U, 0x71c0U, 0x7080U, 0xb041U,
+    0x5000U, 0x90c1U, 0x9181U, 0x5140U, 0x9301U, 0x53c0U, 0x5280U, 0x9241U,
+    0x9601U, 0x56c0U, 0x5780U, 0x9741U, 0x5500U, 0x95c1U, 0x9481U, 0x5440U,
+    0x9c01U, 0x5cc0U, 0x5d80U, 0x9d41U, 0x5f00U, 0x9fc1U, 0x9e81U, 0x5e40U,
+    0x5a00U, 0x9ac1U, 0x9b81U, 0x5b40U, 0x9901U, 0x59c0U, 0x5880U, 0x9841U,
+    0x8801U, 0x48c0U, 0x4980U, 0x8941U, 0x4b00U, 0x8bc1U, 0x8a81U, 0x4a40U,
+    0x4e00U, 0x8ec1U, 0x8f81U, 0x4f40U, 0x8d01U, 0x4dc0U, 0x4c80U, 0x8c41U,
+    0x4400U, 0x84c1U, 0x8581U, 0x4540U, 0x8701U, 0x47c0U, 0x4680U, 0x8641U,
+    0x8201U, 0x42c0U, 0x4380U, 0x8341U, 0x4100U, 0x81c1U, 0x8081U, 0x4040U,
+};
+
 // Added mdhayter
 uint32_t CRC16(const uint8_t *data, int bytes) {
-  const uint32_t poly16 = 0xA001;
   uint32_t crc16 = 0xffff;
   int i;
 
   for (i = 0; i < bytes; i++) {
-    uint32_t udata = data[i];
-    int bit = 8;
-
-    while (bit--) {
-      if ((udata ^ crc16) & 0x01) {
-        crc16 >>= 1;
-        crc16 ^= poly16;
-      } else {
-        crc16 >>= 1;
-      }
-
-      udata >>= 1;
-    }
+    crc16 = (crc16 >> 8) ^ crc16_table[(crc16 ^ data[i]) & 0xff];
   }
   // Invert contents to generate crc field
   crc16 ^= 0xffff;
@@ -4,9 +4,13 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "usb_utils.h"
 #include "usbdpi.h"
@@ -26,6 +30,76 @@ typedef enum { M_NONE = 0, M_HOST, M_DEVICE } usbmon_driver_t;
 // Number of bytes in max output buffer line
 #define MAX_OBUF 80
 
+// Size of the capture ring in bytes; must be a power of two
+#define MON_RING_SIZE (1U << 20)
+
+// Interval at which the capture thread polls an empty ring
+#define MON_POLL_US 1000
+
+// Types of record in the capture ring
+typedef enum {
+  MON_REC_TEXT = 0,
+  MON_REC_PACKET,
+  MON_REC_EVENT
+} usbmon_rec_type_t;
+
+// Bus events reported by verbose logging
+typedef enum {
+  MON_EV_CLASH = 0,
+  MON_EV_IDLE_FS,
+  MON_EV_IDLE_SE0,
+  MON_EV_SOP,
+  MON_EV_BITSTUFF,
+  MON_EV_BAD_PID,
+  MON_EV_PID
+} usbmon_event_t;
+
+// Flags in a packet record
+#define MON_REC_LOG 0x01      // Verbose logging
+#define MON_REC_COMPACT 0x02  // Packet-level logging
+#define MON_REC_PID 0x04      // PID received
+
+/**
+ * Header of a record in the capture ring, followed by len bytes of text or
+ * packet data (excluding the PID). A packet record is made at EOP and holds
+ * everything required to log the packet and write it to the pcap file. An
+ * event record has no data; it is logged at sop_at, with eop_at holding the
+ * d2p signals or the raw bits when the event reports them.
+ */
+typedef struct {
+  uint8_t type;
+  uint8_t flags;
+  uint8_t driver;
+  uint8_t pid;
+  uint8_t lastpid;
+  uint8_t event;
+  uint16_t len;
+  uint32_t sop_at;
+  uint32_t eop_at;
+} usbmon_rec_t;
+
+// pcap file header; the magic number selects nanosecond timestamps
+#define PCAP_MAGIC_NS 0xa1b23c4dU
+#define PCAP_LINKTYPE_USB_2_0 288U
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t network;
+} pcap_hdr_t;
+
+// pcap record header
+typedef struct {
+  uint32_t ts_sec;
+  uint32_t ts_nsec;
+  uint32_t incl_len;
+  uint32_t orig_len;
+} pcap_rec_t;
+
 /**
  * USB monitor context
  */
@@ -34,6 +108,10 @@ struct usb_monitor_ctx {
    * Log file
    */
   FILE *file;
+  /**
+   * pcap capture file, or NULL
+   */
+  FILE *pcap;
   /**
    * Monitor state, reflecting the current state of the USB
    */
@@ -49,6 +127,10 @@ struct usb_monitor_ctx {
   int needbits;
   int sopAt;
   uint8_t lastpid;
+  /**
+   * PID byte of the current packet, valid or not
+   */
+  uint8_t pid;
   /**
    * USB data callback
    */
@@ -65,6 +147,18 @@ struct usb_monitor_ctx {
    * Buffer of collected bytes
    */
   uint8_t bytes[MON_BYTES_SIZE + 2];
+  /**
+   * Capture mode: log lines and packets are put in the ring, and a
+   * background thread formats them and writes them out. rptr and wptr count
+   * the bytes read and written; only the thread writes rptr and only the
+   * simulation writes wptr.
+   */
+  bool capture;
+  bool stop;
+  uint32_t rptr;
+  uint32_t wptr;
+  uint8_t *ring;
+  pthread_t thread;
 };
 
 // Invoke the USB data callback function, if registered
@@ -75,10 +169,103 @@ static inline void data_callback(usb_monitor_ctx_t *mon,
   }
 }
 
+// Copy len bytes into the capture ring at offset ptr
+static void ring_write(usb_monitor_ctx_t *mon, uint32_t ptr, const void *src,
+                       size_t len) {
+  uint32_t off = ptr & (MON_RING_SIZE - 1U);
+  size_t n = MON_RING_SIZE - off;
+  if (n > len) {
+    n = len;
+  }
+  memcpy(&mon->ring[off], src, n);
+  memcpy(mon->ring, (const uint8_t *)src + n, len - n);
+}
+
+// Copy len bytes out of the capture ring from offset ptr
+static void ring_read(usb_monitor_ctx_t *mon, uint32_t ptr, void *dst,
+                      size_t len) {
+  uint32_t off = ptr & (MON_RING_SIZE - 1U);
+  size_t n = MON_RING_SIZE - off;
+  if (n > len) {
+    n = len;
+  }
+  memcpy(dst, &mon->ring[off], n);
+  memcpy((uint8_t *)dst + n, mon->ring, len - n);
+}
+
+// Append a record to the capture ring, waiting for the capture thread if the
+// ring is full
+static void ring_put(usb_monitor_ctx_t *mon, const usbmon_rec_t *rec,
+                     const void *data) {
+  uint32_t need = (uint32_t)sizeof(*rec) + rec->len;
+  uint32_t wptr = mon->wptr;
+  while (MON_RING_SIZE -
+             (wptr - __atomic_load_n(&mon->rptr, __ATOMIC_ACQUIRE)) <
+         need) {
+    sched_yield();
+  }
+  ring_write(mon, wptr, rec, sizeof(*rec));
+  if (rec->len) {
+    ring_write(mon, wptr + (uint32_t)sizeof(*rec), data, rec->len);
+  }
+  __atomic_store_n(&mon->wptr, wptr + need, __ATOMIC_RELEASE);
+}
+
+static void log_packet(FILE *file, const usbmon_rec_t *rec,
+                       const uint8_t *bytes);
+static void pcap_packet(FILE *pcap, const usbmon_rec_t *rec,
+                        const uint8_t *bytes);
+static void log_event(FILE *file, const usbmon_rec_t *rec);
+
+// Format and write out the records in the capture ring, returning the number
+// processed
+static unsigned ring_drain(usb_monitor_ctx_t *mon) {
+  uint32_t rptr = mon->rptr;
+  uint32_t wptr = __atomic_load_n(&mon->wptr, __ATOMIC_ACQUIRE);
+  unsigned n = 0U;
+  while (rptr != wptr) {
+    uint8_t data[MON_BYTES_SIZE + 2];
+    usbmon_rec_t rec;
+    ring_read(mon, rptr, &rec, sizeof(rec));
+    ring_read(mon, rptr + (uint32_t)sizeof(rec), data, rec.len);
+    if (rec.type == MON_REC_TEXT) {
+      fwrite(data, sizeof(char), rec.len, mon->file);
+    } else if (rec.type == MON_REC_EVENT) {
+      log_event(mon->file, &rec);
+    } else {
+      log_packet(mon->file, &rec, data);
+      if (mon->pcap) {
+        pcap_packet(mon->pcap, &rec, data);
+      }
+    }
+    rptr += (uint32_t)sizeof(rec) + rec.len;
+    __atomic_store_n(&mon->rptr, rptr, __ATOMIC_RELEASE);
+    n++;
+  }
+  return n;
+}
+
+// Capture thread; drains the ring until asked to stop
+static void *capture_thread(void *arg) {
+  usb_monitor_ctx_t *mon = (usb_monitor_ctx_t *)arg;
+  while (true) {
+    // Everything written before the stop request is drained before exiting
+    bool stop = __atomic_load_n(&mon->stop, __ATOMIC_ACQUIRE);
+    if (!ring_drain(mon)) {
+      if (stop) {
+        break;
+      }
+      usleep(MON_POLL_US);
+    }
+  }
+  return NULL;
+}
+
 /**
  * Create and initialize a USB monitor instance
  */
 usb_monitor_ctx_t *usb_monitor_init(const char *filename,
+                                    const char *pcap_filename, bool capture,
                                     usb_monitor_data_callback_t data_cb,
                                     void *data_ctx) {
   usb_monitor_ctx_t *mon =
@@ -103,12 +290,40 @@ usb_monitor_ctx_t *usb_monitor_init(const char *filename,
   }
 
   // more useful for tail -f
-  setlinebuf(mon->file);
+  if (!capture) {
+    setlinebuf(mon->file);
+  }
   printf(
       "\nUSBDPI: Monitor output file created at %s. Works well with tail:\n"
       "$ tail -f %s\n",
       filename, filename);
 
+  if (pcap_filename) {
+    mon->pcap = fopen(pcap_filename, "wb");
+    if (mon->pcap) {
+      const pcap_hdr_t hdr = {PCAP_MAGIC_NS,       2U, 4U, 0, 0U,
+                              MON_BYTES_SIZE + 1U, PCAP_LINKTYPE_USB_2_0};
+      fwrite(&hdr, sizeof(hdr), 1U, mon->pcap);
+      printf("USBDPI: Packet capture file created at %s\n", pcap_filename);
+    } else {
+      fprintf(stderr, "USBDPI: Unable to open capture file at %s: %s\n",
+              pcap_filename, strerror(errno));
+    }
+  }
+
+  if (capture) {
+    mon->ring = (uint8_t *)malloc(MON_RING_SIZE);
+    assert(mon->ring);
+    if (pthread_create(&mon->thread, NULL, capture_thread, (void *)mon) == 0) {
+      mon->capture = true;
+    } else {
+      // Carry on, formatting the output inline
+      fprintf(stderr, "USBDPI: Unable to create monitor capture thread\n");
+      free(mon->ring);
+      mon->ring = NULL;
+    }
+  }
+
   return mon;
 }
 
@@ -116,6 +331,14 @@ usb_monitor_ctx_t *usb_monitor_init(const char *filename,
  * Finalize a USB monitor
  */
 void usb_monitor_fin(usb_monitor_ctx_t *mon) {
+  if (mon->capture) {
+    __atomic_store_n(&mon->stop, true, __ATOMIC_RELEASE);
+    pthread_join(mon->thread, NULL);
+    free(mon->ring);
+  }
+  if (mon->pcap) {
+    fclose(mon->pcap);
+  }
   fclose(mon->file);
   free(mon);
 }
@@ -129,8 +352,20 @@ void usb_monitor_log(usb_monitor_ctx_t *ctx, const char *fmt, ...) {
   va_start(ap, fmt);
   int n = vsnprintf(obuf, MAX_OBUF, fmt, ap);
   va_end(ap);
-  size_t written = fwrite(obuf, sizeof(char), (size_t)n, ctx->file);
-  assert(written == (size_t)n);
+  if (n >= MAX_OBUF) {
+    n = MAX_OBUF - 1;
+  }
+  if (ctx->capture) {
+    // Keep the message in order with the packets
+    usbmon_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = MON_REC_TEXT;
+    rec.len = (uint16_t)n;
+    ring_put(ctx, &rec, obuf);
+  } else {
+    size_t written = fwrite(obuf, sizeof(char), (size_t)n, ctx->file);
+    assert(written == (size_t)n);
+  }
 }
 
 #define DR_SIZE 128
@@ -172,6 +407,157 @@ char *pid_2data(int pid, unsigned char d0, unsigned char d1) {
   return dr;
 }
 
+// Log a complete packet at EOP, calculating and checking the CRC16 on any data
+// field
+static void log_packet(FILE *file, const usbmon_rec_t *rec,
+                       const uint8_t *bytes) {
+  bool log = ((rec->flags & MON_REC_LOG) != 0);
+  bool compact = ((rec->flags & MON_REC_COMPACT) != 0);
+  char drv = (rec->driver == M_HOST) ? 'H' : 'D';
+
+  if ((log || compact) && (rec->flags & MON_REC_PID) && (rec->len > 0)) {
+    uint32_t pkt_crc16, comp_crc16;
+
+    if (compact && rec->len == 2) {
+      fprintf(file, "mon: %8d -- %8d: (%c) SOP, PID %s, EOP\n", rec->sop_at,
+              rec->eop_at, drv, pid_2data(rec->lastpid, bytes[0], bytes[1]));
+    } else if (compact && rec->len == 1) {
+      fprintf(file, "mon: %8d -- %8d: (%c) SOP, PID %s %02x EOP\n",
+              rec->sop_at, rec->eop_at, drv, decode_pid(rec->lastpid),
+              bytes[0]);
+    } else {
+      if (compact) {
+        fprintf(file, "mon: %8d -- %8d: (%c) SOP, PID %s, EOP\n", rec->sop_at,
+                rec->eop_at, drv, decode_pid(rec->lastpid));
+      }
+      fprintf(file, "mon:     %s:\n", rec->driver == M_HOST ? "h->d" : "d->h");
+      comp_crc16 = CRC16(bytes, rec->len - 2);
+      pkt_crc16 = bytes[rec->len - 2] | (bytes[rec->len - 1] << 8);
+
+      dump_bytes(file, "mon:          ", bytes, rec->len - 2, 0u);
+
+      // Display the received CRC16 value
+      fprintf(file, "\nmon:          (CRC16 %02x %02x", bytes[rec->len - 2],
+              bytes[rec->len - 1]);
+      if (comp_crc16 == pkt_crc16) {
+        fprintf(file, "%s OK)\n", (rec->len == MON_BYTES_SIZE) ? "..." : "");
+      } else {
+        fprintf(file, "%s BAD)\nmon:           CRC16 %04x BAD expected %04x\n",
+                (rec->len == MON_BYTES_SIZE) ? "..." : "", pkt_crc16,
+                comp_crc16);
+      }
+    }
+  } else if (compact) {
+    fprintf(file, "mon: %8d -- %8d: (%c) SOP, PID %s EOP\n", rec->sop_at,
+            rec->eop_at, drv, decode_pid(rec->lastpid));
+  }
+  if (log) {
+    fprintf(file, "mon: %8d: (%c) EOP\n", rec->eop_at, drv);
+  }
+}
+
+// Write a complete packet to the pcap file, timestamped at its SOP
+static void pcap_packet(FILE *pcap, const usbmon_rec_t *rec,
+                        const uint8_t *bytes) {
+  if (!(rec->flags & MON_REC_PID)) {
+    return;
+  }
+  // Bit intervals are 1/12us
+  uint64_t ns = (uint64_t)rec->sop_at * 250U / 3U;
+  pcap_rec_t hdr;
+  hdr.ts_sec = (uint32_t)(ns / 1000000000U);
+  hdr.ts_nsec = (uint32_t)(ns % 1000000000U);
+  hdr.incl_len = 1U + rec->len;
+  hdr.orig_len = hdr.incl_len;
+  fwrite(&hdr, sizeof(hdr), 1U, pcap);
+  fwrite(&rec->pid, 1U, 1U, pcap);
+  fwrite(bytes, 1U, rec->len, pcap);
+}
+
+// Log a bus event
+static void log_event(FILE *file, const usbmon_rec_t *rec) {
+  char drv = (rec->driver == M_HOST) ? 'H' : 'D';
+
+  switch (rec->event) {
+    case MON_EV_CLASH:
+      fprintf(file, "mon: %8d: Bus clash\n", rec->sop_at);
+      break;
+    case MON_EV_IDLE_FS:
+      fprintf(file, "mon: %8d: Idle, FS resistor (d2p 0x%x)\n", rec->sop_at,
+              rec->eop_at);
+      break;
+    case MON_EV_IDLE_SE0:
+      fprintf(file, "mon: %8d: Idle, SE0\n", rec->sop_at);
+      break;
+    case MON_EV_SOP:
+      fprintf(file, "mon: %8d: (%c) SOP\n", rec->sop_at, drv);
+      break;
+    case MON_EV_BITSTUFF:
+      fprintf(file, "mon: %8d: (%c) Bitstuff error, got 1 after 0x%x\n",
+              rec->sop_at, drv, rec->eop_at);
+      break;
+    case MON_EV_BAD_PID:
+      fprintf(file, "mon: %8d: (%c) BAD PID 0x%x\n", rec->sop_at, drv,
+              rec->pid);
+      break;
+    case MON_EV_PID:
+      fprintf(file, "mon: %8d: (%c) PID %s (0x%x)\n", rec->sop_at, drv,
+              decode_pid(rec->pid), rec->pid);
+      break;
+    default:
+      assert(!"Unknown USB monitor event");
+      break;
+  }
+}
+
+// Report a bus event, logging it or leaving it to the capture thread
+static void monitor_event(usb_monitor_ctx_t *mon, usbmon_event_t event,
+                          uint32_t at, uint32_t value) {
+  usbmon_rec_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.type = MON_REC_EVENT;
+  rec.event = (uint8_t)event;
+  rec.driver = (uint8_t)mon->driver;
+  rec.pid = mon->pid;
+  rec.sop_at = at;
+  rec.eop_at = value;
+
+  if (mon->capture) {
+    ring_put(mon, &rec, NULL);
+  } else {
+    log_event(mon->file, &rec);
+  }
+}
+
+// Complete a packet at EOP, logging it and writing it to the pcap file or
+// leaving both to the capture thread
+static void end_packet(usb_monitor_ctx_t *mon, bool log, bool compact,
+                       uint32_t tick_bits) {
+  if (!log && !compact && !mon->pcap) {
+    return;
+  }
+  usbmon_rec_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.type = MON_REC_PACKET;
+  rec.flags = (log ? MON_REC_LOG : 0U) | (compact ? MON_REC_COMPACT : 0U) |
+              ((mon->state == MS_GET_BYTES) ? MON_REC_PID : 0U);
+  rec.driver = (uint8_t)mon->driver;
+  rec.pid = mon->pid;
+  rec.lastpid = mon->lastpid;
+  rec.len = (mon->state == MS_GET_BYTES) ? mon->byte : 0U;
+  rec.sop_at = (uint32_t)mon->sopAt;
+  rec.eop_at = tick_bits;
+
+  if (mon->capture) {
+    ring_put(mon, &rec, mon->bytes);
+  } else {
+    log_packet(mon->file, &rec, mon->bytes);
+    if (mon->pcap) {
+      pcap_packet(mon->pcap, &rec, mon->bytes);
+    }
+  }
+}
+
 /**
  * Per-cycle monitoring of the USB
  */
@@ -188,7 +574,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
   int dp, dn;
   if ((d2p & D2P_DP_EN) || (d2p & D2P_DN_EN) || (d2p & D2P_D_EN)) {
     if (hdrive) {
-      fprintf(mon->file, "mon: %8d: Bus clash\n", tick_bits);
+      monitor_event(mon, MON_EV_CLASH, tick_bits, 0U);
     }
     if (d2p & D2P_TX_USE_D_SE0) {
       // Single-ended mode uses D and SE0
@@ -224,10 +610,9 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
     if ((mon->driver != M_NONE) || (mon->pu != (d2p & D2P_PU))) {
       if (log) {
         if (d2p & D2P_PU) {
-          fprintf(mon->file, "mon: %8d: Idle, FS resistor (d2p 0x%x)\n",
-                  tick_bits, d2p);
+          monitor_event(mon, MON_EV_IDLE_FS, tick_bits, d2p);
         } else {
-          fprintf(mon->file, "mon: %8d: Idle, SE0\n", tick_bits);
+          monitor_event(mon, MON_EV_IDLE_SE0, tick_bits, 0U);
         }
       }
       mon->driver = M_NONE;
@@ -250,8 +635,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
     if ((mon->line & 0xfff) == ((DK << 10) | (DJ << 8) | (DK << 6) | (DJ << 4) |
                                 (DK << 2) | (DK << 0))) {
       if (log) {
-        fprintf(mon->file, "mon: %8d: (%c) SOP\n", tick_bits,
-                mon->driver == M_HOST ? 'H' : 'D');
+        monitor_event(mon, MON_EV_SOP, tick_bits, 0U);
       }
       mon->sopAt = tick_bits;
       mon->state = MS_GET_PID;
@@ -263,53 +647,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
 
   // EOP detection, calculate and check the CRC16 on any data field
   if ((mon->line & 0x3f) == ((SE0 << 4) | (SE0 << 2) | (DJ << 0))) {
-    if ((log || compact) && (mon->state == MS_GET_BYTES) && (mon->byte > 0)) {
-      uint32_t pkt_crc16, comp_crc16;
-
-      if (compact && mon->byte == 2) {
-        fprintf(mon->file, "mon: %8d -- %8d: (%c) SOP, PID %s, EOP\n",
-                mon->sopAt, tick_bits, mon->driver == M_HOST ? 'H' : 'D',
-                pid_2data(mon->lastpid, mon->bytes[0], mon->bytes[1]));
-      } else if (compact && mon->byte == 1) {
-        fprintf(mon->file, "mon: %8d -- %8d: (%c) SOP, PID %s %02x EOP\n",
-                mon->sopAt, tick_bits, mon->driver == M_HOST ? 'H' : 'D',
-                decode_pid(mon->lastpid), mon->bytes[0]);
-      } else {
-        if (compact) {
-          fprintf(mon->file, "mon: %8d -- %8d: (%c) SOP, PID %s, EOP\n",
-                  mon->sopAt, tick_bits, mon->driver == M_HOST ? 'H' : 'D',
-                  decode_pid(mon->lastpid));
-        }
-        fprintf(mon->file, "mon:     %s:\n",
-                mon->driver == M_HOST ? "h->d" : "d->h");
-        comp_crc16 = CRC16(mon->bytes, mon->byte - 2);
-        pkt_crc16 =
-            mon->bytes[mon->byte - 2] | (mon->bytes[mon->byte - 1] << 8);
-
-        dump_bytes(mon->file, "mon:          ", mon->bytes, mon->byte - 2, 0u);
-
-        // Display the received CRC16 value
-        fprintf(mon->file, "\nmon:          (CRC16 %02x %02x",
-                mon->bytes[mon->byte - 2], mon->bytes[mon->byte - 1]);
-        if (comp_crc16 == pkt_crc16) {
-          fprintf(mon->file, "%s OK)\n",
-                  (mon->byte == MON_BYTES_SIZE) ? "..." : "");
-        } else {
-          fprintf(mon->file,
-                  "%s BAD)\nmon:           CRC16 %04x BAD expected %04x\n",
-                  (mon->byte == MON_BYTES_SIZE) ? "..." : "", pkt_crc16,
-                  comp_crc16);
-        }
-      }
-    } else if (compact) {
-      fprintf(mon->file, "mon: %8d -- %8d: (%c) SOP, PID %s EOP\n", mon->sopAt,
-              tick_bits, mon->driver == M_HOST ? 'H' : 'D',
-              decode_pid(mon->lastpid));
-    }
-    if (log) {
-      fprintf(mon->file, "mon: %8d: (%c) EOP\n", tick_bits,
-              mon->driver == M_HOST ? 'H' : 'D');
-    }
+    end_packet(mon, log, compact, tick_bits);
     mon->state = MS_IDLE;
     data_callback(mon, UsbMon_DataType_EOP, 0U);
     return;
@@ -319,8 +657,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
   mon->rawbits = (mon->rawbits << 1) | newbit;
   if ((mon->rawbits & 0x7e) == 0x7e) {
     if (newbit == 1) {
-      fprintf(mon->file, "mon: %8d: (%c) Bitstuff error, got 1 after 0x%x\n",
-              tick_bits, mon->driver == M_HOST ? 'H' : 'D', mon->rawbits);
+      monitor_event(mon, MON_EV_BITSTUFF, tick_bits, (uint32_t)mon->rawbits);
     }
     /* Ignore bit stuff bit */
     return;
@@ -337,17 +674,16 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
       // Any byte for which the upper nibble is not the exact complement
       // of the lower nibble is invalid
       uint8_t pid = (uint8_t)mon->bits;
+      mon->pid = pid;
       if (((pid ^ 0xf0) >> 4) ^ (pid & 0x0f)) {
         if (log) {
-          fprintf(mon->file, "mon: %8d: (%c) BAD PID 0x%x\n", tick_bits,
-                  mon->driver == M_HOST ? 'H' : 'D', pid);
+          monitor_event(mon, MON_EV_BAD_PID, tick_bits, 0U);
         }
       } else {
         *lastpid = pid;
         mon->lastpid = pid;
         if (log) {
-          fprintf(mon->file, "mon: %8d: (%c) PID %s (0x%x)\n", tick_bits,
-                  mon->driver == M_HOST ? 'H' : 'D', decode_pid(pid), pid);
+          monitor_event(mon, MON_EV_PID, tick_bits, 0U);
         }
       }
       mon->state = MS_GET_BYTES;
@@ -375,6 +711,58 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
   }
 }
 
+/**
+ * Monitoring of a complete packet from the packet-level interface
+ */
+void usb_monitor_packet(usb_monitor_ctx_t *mon, int loglevel, uint32_t sop_at,
+                        uint32_t tick_bits, bool host, const uint8_t *pkt,
+                        unsigned len, uint8_t *lastpid) {
+  bool log = ((loglevel & 0x2) != 0);
+  bool compact = ((loglevel & 0x1) != 0);
+
+  assert(mon);
+
+  mon->driver = host ? M_HOST : M_DEVICE;
+  mon->sopAt = sop_at;
+  if (log) {
+    monitor_event(mon, MON_EV_SOP, sop_at, 0U);
+  }
+  mon->state = MS_GET_PID;
+  data_callback(mon, UsbMon_DataType_Sync, 0U);
+
+  if (len > 0U) {
+    uint8_t pid = pkt[0];
+    mon->pid = pid;
+    if (((pid ^ 0xf0) >> 4) ^ (pid & 0x0f)) {
+      if (log) {
+        monitor_event(mon, MON_EV_BAD_PID, sop_at, 0U);
+      }
+    } else {
+      *lastpid = pid;
+      mon->lastpid = pid;
+      if (log) {
+        monitor_event(mon, MON_EV_PID, sop_at, 0U);
+      }
+    }
+    mon->state = MS_GET_BYTES;
+    mon->byte = 0;
+    data_callback(mon, UsbMon_DataType_PID, pid);
+
+    for (unsigned i = 1U; i < len; i++) {
+      mon->bytes[mon->byte] = pkt[i];
+      if (mon->byte < MON_BYTES_SIZE) {
+        mon->byte++;
+      }
+      data_callback(mon, UsbMon_DataType_Byte, pkt[i]);
+    }
+  }
+
+  end_packet(mon, log, compact, tick_bits);
+  mon->state = MS_IDLE;
+  mon->driver = M_NONE;
+  data_callback(mon, UsbMon_DataType_EOP, 0U);
+}
+
 // Export some internal diagnostic state for visibility in waveforms
 uint32_t usb_monitor_diags(usb_monitor_ctx_t *mon) {
   // Show the PID most recently detected
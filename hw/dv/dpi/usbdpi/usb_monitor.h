@@ -29,12 +29,19 @@ typedef void (*usb_monitor_data_callback_t)(void *ctx_v,
 /**
  * Create and initialize a USB monitor instance
  *
- * @param  filename  Filename to be used for log file
- * @param  data_cb   USB data callback function
- * @param  data_ctx  Context for data callback
- * @return           USB monitor context
+ * In capture mode, log messages and packets are recorded in a ring buffer and
+ * a background thread formats them and writes them out, so that the
+ * simulation does not wait for the output.
+ *
+ * @param  filename       Filename to be used for log file
+ * @param  pcap_filename  Filename for a pcap capture of the packets, or NULL
+ * @param  capture        Defer formatting of the output to a background thread
+ * @param  data_cb        USB data callback function
+ * @param  data_ctx       Context for data callback
+ * @return                USB monitor context
  */
 usb_monitor_ctx_t *usb_monitor_init(const char *filename,
+                                    const char *pcap_filename, bool capture,
                                     usb_monitor_data_callback_t data_cb,
                                     void *data_ctx);
 
@@ -67,6 +74,23 @@ void usb_monitor_log(usb_monitor_ctx_t *mon, const char *fmt, ...);
 void usb_monitor(usb_monitor_ctx_t *mon, int log, uint32_t tick_bits,
                  bool hdrive, uint32_t p2d, uint32_t d2p, uint8_t *lastpid);
 
+/**
+ * Monitoring of a complete packet, for the packet-level interface in which
+ * the bus signals are not seen by the DPI model
+ *
+ * @param mon        USB monitor context
+ * @param loglevel   Level of logging information required
+ * @param sop_at     Start time of the packet in USB bit intervals
+ * @param tick_bits  Elapsed simulation time in USB bit intervals (12Mbps)
+ * @param host       Indicates whether the packet was sent by the host
+ * @param pkt        Packet bytes, starting with the PID
+ * @param len        Length of the packet in bytes
+ * @param lastpid    Receives the PID of the packet, if valid
+ */
+void usb_monitor_packet(usb_monitor_ctx_t *mon, int loglevel, uint32_t sop_at,
+                        uint32_t tick_bits, bool host, const uint8_t *pkt,
+                        unsigned len, uint8_t *lastpid);
+
 /**
  * Export diagnostic state for waveform viewing
  *
@@ -17,6 +17,7 @@ void usb_transfer_setup(usbdpi_ctx_t *ctx) {
     next = &ctx->transfer_pool[idx];
   }
   ctx->free = next;
+  ctx->nfree = USBDPI_MAX_TRANSFERS;
 }
 
 // Allocate and initialize a transfer descriptor
@@ -24,6 +25,7 @@ usbdpi_transfer_t *transfer_alloc(usbdpi_ctx_t *ctx) {
   usbdpi_transfer_t *transfer = ctx->free;
   if (transfer) {
     ctx->free = transfer->next;
+    ctx->nfree--;
     transfer_init(transfer);
   }
   return transfer;
@@ -34,6 +36,7 @@ void transfer_release(usbdpi_ctx_t *ctx, usbdpi_transfer_t *transfer) {
   // Prepend this transfer descriptor to the list of free descriptors
   transfer->next = ctx->free;
   ctx->free = transfer;
+  ctx->nfree++;
 }
 
 // Initialize a transfer descriptor
@@ -78,6 +78,7 @@ void usb_transfer_setup(usbdpi_ctx_t *ctx);
  * Allocate and initialize a transfer descriptor
  *
  * @param  ctx       USB DPI context
+ * @return           Transfer descriptor, or NULL if the pool is exhausted
  */
 usbdpi_transfer_t *transfer_alloc(usbdpi_ctx_t *ctx);
 
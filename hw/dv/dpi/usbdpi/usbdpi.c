@@ -105,7 +105,8 @@ static void usbdpi_data_callback(void *ctx_v, usbmon_data_type_t type,
 /**
  * Create a USB DPI instance, returning a 'chandle' for later use
  */
-void *usbdpi_create(const char *name, int loglevel) {
+void *usbdpi_create(const char *name, int loglevel, svBit capture,
+                    svBit pcap) {
   // Use calloc for zero-initialisation
   usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)calloc(1, sizeof(usbdpi_ctx_t));
   assert(ctx);
@@ -132,7 +133,15 @@ void *usbdpi_create(const char *name, int loglevel) {
   int rv = snprintf(ctx->mon_pathname, FILENAME_MAX, "%s/%s.log", cwd, name);
   assert(rv <= FILENAME_MAX && rv > 0);
 
-  ctx->mon = usb_monitor_init(ctx->mon_pathname, usbdpi_data_callback, ctx);
+  // Packet capture file
+  char pcap_pathname[FILENAME_MAX];
+  if (pcap) {
+    rv = snprintf(pcap_pathname, FILENAME_MAX, "%s/%s.pcap", cwd, name);
+    assert(rv <= FILENAME_MAX && rv > 0);
+  }
+
+  ctx->mon = usb_monitor_init(ctx->mon_pathname, pcap ? pcap_pathname : NULL,
+                              capture != 0, usbdpi_data_callback, ctx);
 
   // Prepare the transfer descriptors for use
   usb_transfer_setup(ctx);
@@ -140,6 +149,71 @@ void *usbdpi_create(const char *name, int loglevel) {
   return (void *)ctx;
 }
 
+// Advance the bus state at the end of a packet from the device
+static void device_eop(usbdpi_ctx_t *ctx) {
+  switch (ctx->bus_state) {
+    // Control Transfers
+    case kUsbControlSetup:
+      ctx->bus_state = kUsbControlSetupAck;
+      break;
+    case kUsbControlDataOut:
+      ctx->bus_state = kUsbControlDataOutAck;
+      break;
+    case kUsbControlStatusInToken:
+      ctx->bus_state = kUsbControlStatusInData;
+      break;
+    case kUsbControlDataInToken:
+      ctx->bus_state = kUsbControlDataInData;
+      break;
+    case kUsbControlStatusOut:
+      ctx->bus_state = kUsbControlStatusOutAck;
+      break;
+
+    // Isochronous Transfers
+    case kUsbIsoInToken:
+      ctx->bus_state = kUsbIsoInData;
+      break;
+
+    // Bulk Transfers
+    case kUsbBulkOut:
+      ctx->bus_state = kUsbBulkOutAck;
+      break;
+    case kUsbBulkInToken:
+      ctx->bus_state = kUsbBulkInData;
+      break;
+
+    // Interrupt Transfers
+    case kUsbInterruptOut:
+      ctx->bus_state = kUsbInterruptOutAck;
+      break;
+    case kUsbInterruptInToken:
+      ctx->bus_state = kUsbInterruptInData;
+      break;
+
+    // TODO - this shall become an error condition; we're not expecting
+    //        a transmission from the device, and thus no EOP either
+    default:
+      break;
+  }
+}
+
+// Check and log the pullups applied by the device
+static void check_pullups(usbdpi_ctx_t *ctx, uint32_t d2p) {
+  if ((d2p & D2P_DNPU) && (d2p & D2P_DPPU)) {
+    printf("[usbdpi] frame 0x%x tick_bits 0x%x error both pullups are driven\n",
+           ctx->frame, ctx->tick_bits);
+  }
+  if ((d2p & D2P_PU) != ctx->last_pu) {
+    usb_monitor_log(ctx->mon, "0x%-3x 0x%-8x Pullup change to %s%s%s\n",
+                    ctx->frame, ctx->tick_bits,
+                    (d2p & D2P_DPPU) ? "DP Pulled up " : "",
+                    (d2p & D2P_DNPU) ? "DN Pulled up " : "",
+                    (d2p & D2P_TX_USE_D_SE0) ? "SingleEnded" : "Differential");
+
+    ctx->last_pu = d2p & D2P_PU;
+  }
+}
+
 void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p) {
   usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
   assert(ctx);
@@ -221,19 +295,7 @@ void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p) {
     }
   }
 
-  if ((d2p & D2P_DNPU) && (d2p & D2P_DPPU)) {
-    printf("[usbdpi] frame 0x%x tick_bits 0x%x error both pullups are driven\n",
-           ctx->frame, ctx->tick_bits);
-  }
-  if ((d2p & D2P_PU) != ctx->last_pu) {
-    usb_monitor_log(ctx->mon, "0x%-3x 0x%-8x Pullup change to %s%s%s\n",
-                    ctx->frame, ctx->tick_bits,
-                    (d2p & D2P_DPPU) ? "DP Pulled up " : "",
-                    (d2p & D2P_DNPU) ? "DN Pulled up " : "",
-                    (d2p & D2P_TX_USE_D_SE0) ? "SingleEnded" : "Differential");
-
-    ctx->last_pu = d2p & D2P_PU;
-  }
+  check_pullups(ctx, d2p);
 
   // TODO - prime candidate for a function
   if (ctx->loglevel & LOG_BIT) {
@@ -255,50 +317,7 @@ void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p) {
 
   // Device-to-Host EOP
   if (ctx->state == ST_GET && dp == 0 && dn == 0) {
-    switch (ctx->bus_state) {
-      // Control Transfers
-      case kUsbControlSetup:
-        ctx->bus_state = kUsbControlSetupAck;
-        break;
-      case kUsbControlDataOut:
-        ctx->bus_state = kUsbControlDataOutAck;
-        break;
-      case kUsbControlStatusInToken:
-        ctx->bus_state = kUsbControlStatusInData;
-        break;
-      case kUsbControlDataInToken:
-        ctx->bus_state = kUsbControlDataInData;
-        break;
-      case kUsbControlStatusOut:
-        ctx->bus_state = kUsbControlStatusOutAck;
-        break;
-
-      // Isochronous Transfers
-      case kUsbIsoInToken:
-        ctx->bus_state = kUsbIsoInData;
-        break;
-
-      // Bulk Transfers
-      case kUsbBulkOut:
-        ctx->bus_state = kUsbBulkOutAck;
-        break;
-      case kUsbBulkInToken:
-        ctx->bus_state = kUsbBulkInData;
-        break;
-
-      // Interrupt Transfers
-      case kUsbInterruptOut:
-        ctx->bus_state = kUsbInterruptOutAck;
-        break;
-      case kUsbInterruptInToken:
-        ctx->bus_state = kUsbInterruptInData;
-        break;
-
-      // TODO - this shall become an error condition; we're not expecting
-      //        a transmission from the device, and thus no EOP either
-      default:
-        break;
-    }
+    device_eop(ctx);
   }
 }
 
@@ -1112,30 +1131,9 @@ uint32_t inv_driving(usbdpi_ctx_t *ctx, uint32_t d2p) {
   return ctx->driving ^ (P2D_DP | P2D_DN | P2D_D);
 }
 
-uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
-  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
-  assert(ctx);
-  int d2p = usb_d2p[0];
-  uint32_t last_driving = ctx->driving;
-  int force_stat = 0;
-  int dat;
-
-  // The 48MHz clock runs at 4 times the bus clock for a full speed (12Mbps)
-  // device
-  //
-  // TODO - vary the phase over the duration of the test to check device
-  //        synchronization
-  ctx->tick++;
-  ctx->tick_bits = ctx->tick >> 2;
-  if (ctx->tick & 3) {
-    return ctx->driving;
-  }
-
-  // Monitor, analyse and record USB bus activity
-  usb_monitor(ctx->mon, ctx->loglevel, ctx->tick_bits,
-              (ctx->state != ST_IDLE) && (ctx->state != ST_GET), ctx->driving,
-              d2p, &(ctx->lastrxpid));
-
+// Bus attachment and frame timing, common to the bit-level and packet-level
+// interfaces; returns false if the host must not transmit in this bit interval
+static bool host_frame(usbdpi_ctx_t *ctx, uint32_t d2p) {
   if (ctx->tick_bits == SENSE_AT) {
     ctx->driving |= P2D_SENSE;
   }
@@ -1145,7 +1143,7 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
     // anticipation of a reconnection
     bus_reset(ctx);
     ctx->recovery_time = ctx->tick + 4 * 48;
-    return ctx->driving;
+    return false;
   }
 
   // Are we allowed to start transmitting yet; device recovery time elapsed?
@@ -1153,7 +1151,7 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
     ctx->driving = set_driving(ctx, d2p, P2D_DP, false);  // J, but not driving
     ctx->state = ST_IDLE;
     ctx->frame_start = ctx->tick_bits;
-    return ctx->driving;
+    return false;
   }
 
   // Time to commence a new bus frame?
@@ -1218,147 +1216,181 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
     }
   }
 
-  switch (ctx->state) {
-    // Host state machine advances when the bit-level activity is idle
-    case ST_IDLE: {
-      // Ensure that a buffer is available for constructing a transfer
-      if (!ctx->sending) {
-        ctx->sending = transfer_alloc(ctx);
-        assert(ctx->sending);
-      }
+  return true;
+}
 
-      switch (ctx->step) {
-        case STEP_BUS_RESET:
-          // Note: this is a placeholder for the more proper Reset and Resume
-          // signaling that has been implemented for suspend-resume testing;
-          // this is sufficient for PinCfg test.
-          switch (ctx->hostSt) {
-            case HS_STARTFRAME:
-              bus_reset(ctx);
-              ctx->wait = ctx->tick_bits + 532;               // HACK
-              ctx->driving = set_driving(ctx, d2p, 0, true);  // SE0
-              ctx->hostSt = HS_NEXTFRAME;
-              break;
-            default:
-              if (ctx->tick_bits >= ctx->wait) {
-                // Let the bus float to Idle, undriven
-                ctx->driving = set_driving(ctx, d2p, P2D_DP, false);  // J
-              }
-              ctx->hostSt = HS_NEXTFRAME;
-              break;
+// Advance the host state machine, which runs only when the bus is idle
+static void host_idle(usbdpi_ctx_t *ctx, uint32_t d2p) {
+  // Ensure that a buffer is available for constructing a transfer
+  if (!ctx->sending) {
+    ctx->sending = transfer_alloc(ctx);
+    assert(ctx->sending);
+  }
+
+  switch (ctx->step) {
+    case STEP_BUS_RESET:
+      // Note: this is a placeholder for the more proper Reset and Resume
+      // signaling that has been implemented for suspend-resume testing;
+      // this is sufficient for PinCfg test.
+      switch (ctx->hostSt) {
+        case HS_STARTFRAME:
+          bus_reset(ctx);
+          ctx->wait = ctx->tick_bits + 532;               // HACK
+          ctx->driving = set_driving(ctx, d2p, 0, true);  // SE0
+          ctx->hostSt = HS_NEXTFRAME;
+          break;
+        default:
+          if (ctx->tick_bits >= ctx->wait) {
+            // Let the bus float to Idle, undriven
+            ctx->driving = set_driving(ctx, d2p, P2D_DP, false);  // J
           }
+          ctx->hostSt = HS_NEXTFRAME;
           break;
+      }
+      break;
 
-        case STEP_SET_DEVICE_ADDRESS:
-          setDeviceAddress(ctx, USBDEV_ADDRESS);
-          break;
+    case STEP_SET_DEVICE_ADDRESS:
+      setDeviceAddress(ctx, USBDEV_ADDRESS);
+      break;
 
-          // TODO - an actual host issues a number of GET_DESCRIPTOR control/
-          //        transfers to read descriptions of the configurations,
-          //        interfaces and endpoints
-
-        case STEP_GET_DEVICE_DESCRIPTOR:
-          // Initially we fetch just the minimal descriptor length of 0x12U
-          // bytes and the returned information will indicate the full length
-          //
-          // TODO - Set the descriptor length to the minimum because the DPI
-          // model does not yet catch and report errors properly
-          ctx->cfg_desc_len = 0x12U;
-          getDescriptor(ctx, USB_DESC_TYPE_DEVICE, 0U, 0x12U);
-          break;
+      // TODO - an actual host issues a number of GET_DESCRIPTOR control/
+      //        transfers to read descriptions of the configurations,
+      //        interfaces and endpoints
+
+    case STEP_GET_DEVICE_DESCRIPTOR:
+      // Initially we fetch just the minimal descriptor length of 0x12U
+      // bytes and the returned information will indicate the full length
+      //
+      // TODO - Set the descriptor length to the minimum because the DPI
+      // model does not yet catch and report errors properly
+      ctx->cfg_desc_len = 0x12U;
+      getDescriptor(ctx, USB_DESC_TYPE_DEVICE, 0U, 0x12U);
+      break;
 
-        case STEP_GET_CONFIG_DESCRIPTOR:
-          getDescriptor(ctx, USB_DESC_TYPE_CONFIGURATION, 0U, 0x9U);
-          break;
+    case STEP_GET_CONFIG_DESCRIPTOR:
+      getDescriptor(ctx, USB_DESC_TYPE_CONFIGURATION, 0U, 0x9U);
+      break;
 
-        case STEP_GET_FULL_CONFIG_DESCRIPTOR: {
-          uint16_t wLength = ctx->cfg_desc_len;
-          if (wLength >= USBDEV_MAX_PACKET_SIZE) {
-            // Note: getDescriptor cannot yet receive multiple packets
-            wLength = USBDEV_MAX_PACKET_SIZE;
-          }
-          getDescriptor(ctx, USB_DESC_TYPE_CONFIGURATION, 0U, wLength);
-        } break;
+    case STEP_GET_FULL_CONFIG_DESCRIPTOR: {
+      uint16_t wLength = ctx->cfg_desc_len;
+      if (wLength >= USBDEV_MAX_PACKET_SIZE) {
+        // Note: getDescriptor cannot yet receive multiple packets
+        wLength = USBDEV_MAX_PACKET_SIZE;
+      }
+      getDescriptor(ctx, USB_DESC_TYPE_CONFIGURATION, 0U, wLength);
+    } break;
 
-          // TODO - we must receive and respond to test configuration at some
-          //        point; perhaps we can make the software advertise itself
-          //        with different vendor/device combinations to indicate the
-          //        testing we must do
+      // TODO - we must receive and respond to test configuration at some
+      //        point; perhaps we can make the software advertise itself
+      //        with different vendor/device combinations to indicate the
+      //        testing we must do
 
-        case STEP_SET_DEVICE_CONFIG:
-          setDeviceConfiguration(ctx, 1);
-          break;
+    case STEP_SET_DEVICE_CONFIG:
+      setDeviceConfiguration(ctx, 1);
+      break;
 
-        // Test configuration and status
-        case STEP_GET_TEST_CONFIG:
-          getTestConfig(ctx, 0x10U);
-          break;
+    // Test configuration and status
+    case STEP_GET_TEST_CONFIG:
+      getTestConfig(ctx, 0x10U);
+      break;
 
-        case STEP_SET_TEST_STATUS:
-          setTestStatus(ctx, ctx->test_status, ctx->test_msg);
-          break;
+    case STEP_SET_TEST_STATUS:
+      setTestStatus(ctx, ctx->test_status, ctx->test_msg);
+      break;
 
-          // These should be at 3 and 4 but the read needs the host
-          // not to be sending (until skip fifo is implemented in in_pe engine)
-          // so for now push later when things are quiet (could also adjust
-          // hello_world to not use the uart until frame 4)
+      // These should be at 3 and 4 but the read needs the host
+      // not to be sending (until skip fifo is implemented in in_pe engine)
+      // so for now push later when things are quiet (could also adjust
+      // hello_world to not use the uart until frame 4)
 
-        case STEP_FIRST_READ:
-          pollRX(ctx, ENDPOINT_SERIAL0, true, true);
-          break;
-        case STEP_READ_BAUD:
-          readBaud(ctx, ENDPOINT_ZERO);
-          break;
-        case STEP_SECOND_READ:
-          pollRX(ctx, ENDPOINT_SERIAL0, true, false);
-          break;
-        case STEP_SET_BAUD:
-          setBaud(ctx, ENDPOINT_ZERO);
-          break;
-        case STEP_THIRD_READ:
-          pollRX(ctx, ENDPOINT_SERIAL0, false, true);
-          break;
-        case STEP_TEST_ISO1:
-          testIso(ctx);
-          break;
-        case STEP_TEST_ISO2:
-          testIso(ctx);
-          break;
+    case STEP_FIRST_READ:
+      pollRX(ctx, ENDPOINT_SERIAL0, true, true);
+      break;
+    case STEP_READ_BAUD:
+      readBaud(ctx, ENDPOINT_ZERO);
+      break;
+    case STEP_SECOND_READ:
+      pollRX(ctx, ENDPOINT_SERIAL0, true, false);
+      break;
+    case STEP_SET_BAUD:
+      setBaud(ctx, ENDPOINT_ZERO);
+      break;
+    case STEP_THIRD_READ:
+      pollRX(ctx, ENDPOINT_SERIAL0, false, true);
+      break;
+    case STEP_TEST_ISO1:
+      testIso(ctx);
+      break;
+    case STEP_TEST_ISO2:
+      testIso(ctx);
+      break;
 
-        // Test each of SETUP, OUT and IN to an unimplemented endpoint
-        case STEP_ENDPT_UNIMPL_SETUP:
-          testUnimplEp(ctx, USB_PID_SETUP, ctx->dev_address,
-                       ENDPOINT_UNIMPLEMENTED);
-          break;
-        case STEP_ENDPT_UNIMPL_OUT:
-          testUnimplEp(ctx, USB_PID_OUT, ctx->dev_address,
-                       ENDPOINT_UNIMPLEMENTED);
-          break;
-        case STEP_ENDPT_UNIMPL_IN:
-          testUnimplEp(ctx, USB_PID_IN, ctx->dev_address,
-                       ENDPOINT_UNIMPLEMENTED);
-          break;
+    // Test each of SETUP, OUT and IN to an unimplemented endpoint
+    case STEP_ENDPT_UNIMPL_SETUP:
+      testUnimplEp(ctx, USB_PID_SETUP, ctx->dev_address,
+                   ENDPOINT_UNIMPLEMENTED);
+      break;
+    case STEP_ENDPT_UNIMPL_OUT:
+      testUnimplEp(ctx, USB_PID_OUT, ctx->dev_address, ENDPOINT_UNIMPLEMENTED);
+      break;
+    case STEP_ENDPT_UNIMPL_IN:
+      testUnimplEp(ctx, USB_PID_IN, ctx->dev_address, ENDPOINT_UNIMPLEMENTED);
+      break;
 
-        // Test SETUP to a different device address
-        case STEP_DEVICE_UK_SETUP:
-          testUnimplEp(ctx, USB_PID_SETUP, UKDEV_ADDRESS, 1u);
-          break;
+    // Test SETUP to a different device address
+    case STEP_DEVICE_UK_SETUP:
+      testUnimplEp(ctx, USB_PID_SETUP, UKDEV_ADDRESS, 1u);
+      break;
 
-        case STEP_STREAM_SERVICE:
-          // After the initial testing of the (current) fixed DPI behavior,
-          // we repeatedly try IN transfers, checking and scrambling any
-          // data packets that we received before sending them straight back
-          // to the device for software to check
-          streams_service(ctx);
-          break;
+    case STEP_STREAM_SERVICE:
+      // After the initial testing of the (current) fixed DPI behavior,
+      // we repeatedly try IN transfers, checking and scrambling any
+      // data packets that we received before sending them straight back
+      // to the device for software to check
+      streams_service(ctx);
+      break;
 
-        default:
-          if (ctx->step < STEP_IDLE_START || ctx->step >= STEP_IDLE_END) {
-            pollRX(ctx, ENDPOINT_SERIAL0, false, false);
-          }
-          break;
+    default:
+      if (ctx->step < STEP_IDLE_START || ctx->step >= STEP_IDLE_END) {
+        pollRX(ctx, ENDPOINT_SERIAL0, false, false);
       }
-    } break;
+      break;
+  }
+}
+
+uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  assert(ctx);
+  int d2p = usb_d2p[0];
+  uint32_t last_driving = ctx->driving;
+  int force_stat = 0;
+  int dat;
+
+  // The 48MHz clock runs at 4 times the bus clock for a full speed (12Mbps)
+  // device
+  //
+  // TODO - vary the phase over the duration of the test to check device
+  //        synchronization
+  ctx->tick++;
+  ctx->tick_bits = ctx->tick >> 2;
+  if (ctx->tick & 3) {
+    return ctx->driving;
+  }
+
+  // Monitor, analyse and record USB bus activity
+  usb_monitor(ctx->mon, ctx->loglevel, ctx->tick_bits,
+              (ctx->state != ST_IDLE) && (ctx->state != ST_GET), ctx->driving,
+              d2p, &(ctx->lastrxpid));
+
+  if (!host_frame(ctx, d2p)) {
+    return ctx->driving;
+  }
+
+  switch (ctx->state) {
+    // Host state machine advances when the bit-level activity is idle
+    case ST_IDLE:
+      host_idle(ctx, d2p);
+      break;
 
     case ST_SYNC:
       dat = ((USB_SYNC & ctx->bit)) ? P2D_DP : P2D_DN;
@@ -1450,6 +1482,110 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
   return ctx->driving;
 }
 
+// Return the offset just beyond the packet that starts at the given offset
+// within a transfer; a transfer holds a token packet and optionally a data
+// packet, or just a single packet
+static unsigned packet_end(const usbdpi_transfer_t *tr, unsigned byte) {
+  if (tr->data_start != USBDPI_NO_DATA_STAGE && byte < tr->data_start) {
+    return tr->data_start;
+  }
+  return tr->num_bytes;
+}
+
+// The shim in usbdpi.sv has finished sending any packet that we handed over
+static void packet_sent(usbdpi_ctx_t *ctx, uint32_t d2p) {
+  if (ctx->state != ST_SEND) {
+    return;
+  }
+
+  const usbdpi_transfer_t *sending = ctx->sending;
+  assert(sending);
+  unsigned end = packet_end(sending, ctx->byte);
+  usb_monitor_packet(ctx->mon, ctx->loglevel, ctx->pkt_sop, ctx->tick_bits,
+                     true, &sending->data[ctx->byte], end - ctx->byte,
+                     &ctx->lastrxpid);
+  ctx->byte = end;
+  // Stop driving: host pulldown to SE0 unless there is a pullup on DP
+  ctx->driving = set_driving(ctx, d2p, (d2p & D2P_PU) ? P2D_DP : 0, false);
+  ctx->state = (end < sending->num_bytes) ? ST_SYNC : ST_IDLE;
+}
+
+uint8_t usbdpi_packet_tick(void *ctx_void, const svBitVecVal *usb_d2p,
+                           unsigned tick, int *tx_len, svBitVecVal *tx_data) {
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  assert(ctx);
+  uint32_t d2p = usb_d2p[0];
+
+  // The shim keeps count of the clock cycles and calls us only at the start
+  // of a bit interval, and never whilst it is sending or receiving a packet
+  ctx->tick = tick;
+  ctx->tick_bits = tick >> 2;
+  *tx_len = 0;
+
+  check_pullups(ctx, d2p);
+  packet_sent(ctx, d2p);
+
+  if (!host_frame(ctx, d2p)) {
+    return ctx->driving;
+  }
+
+  switch (ctx->state) {
+    case ST_IDLE:
+      host_idle(ctx, d2p);
+      break;
+
+    // Hand the next packet of the transfer to the shim for transmission
+    case ST_SYNC: {
+      const usbdpi_transfer_t *sending = ctx->sending;
+      assert(sending);
+      unsigned len = packet_end(sending, ctx->byte) - ctx->byte;
+      assert(len > 0U && len <= USBDPI_PKT_MAX_BYTES);
+      memset(tx_data, 0, USBDPI_PKT_MAX_BYTES);
+      for (unsigned i = 0U; i < len; i++) {
+        tx_data[i >> 2] |= (svBitVecVal)sending->data[ctx->byte + i]
+                           << ((i & 3U) * 8U);
+      }
+      *tx_len = (int)len;
+      // Like the monitor, report the time at which the SYNC pattern ends
+      ctx->pkt_sop = ctx->tick_bits + 8U;
+      ctx->state = ST_SEND;
+    } break;
+
+    default:
+      assert(!"Unknown/invalid USBDPI packet state");
+      break;
+  }
+  return ctx->driving;
+}
+
+void usbdpi_packet_rx(void *ctx_void, const svBitVecVal *usb_d2p,
+                      unsigned tick, unsigned sop, int rx_len,
+                      const svBitVecVal *rx_data) {
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  assert(ctx);
+  assert(rx_len >= 0 && rx_len <= (int)USBDPI_PKT_MAX_BYTES);
+
+  ctx->tick = tick;
+  ctx->tick_bits = tick >> 2;
+
+  // The device may have responded before we were next called
+  packet_sent(ctx, usb_d2p[0]);
+
+  uint8_t pkt[USBDPI_PKT_MAX_BYTES];
+  for (int i = 0; i < rx_len; i++) {
+    pkt[i] = (uint8_t)(rx_data[i >> 2] >> ((i & 3) * 8));
+  }
+
+  // The monitor collects the packet into ctx->recving, just as it does when
+  // decoding the bus signals
+  usbdpi_drv_state_t state = ctx->state;
+  ctx->state = ST_GET;
+  usb_monitor_packet(ctx->mon, ctx->loglevel, sop >> 2, ctx->tick_bits, false,
+                     pkt, (unsigned)rx_len, &ctx->lastrxpid);
+  device_eop(ctx);
+  ctx->state = state;
+}
+
 // Export some internal diagnostic state for visibility in waveforms
 void usbdpi_diags(void *ctx_void, svBitVecVal *diags) {
   usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
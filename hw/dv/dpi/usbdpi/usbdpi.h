@@ -16,6 +16,7 @@
 #if USBDPI_STANDALONE
 // For stricter compilation checks, and building faster standalone
 typedef uint32_t svBitVecVal;
+typedef uint8_t svBit;
 #else
 #include <svdpi.h>
 #endif
@@ -148,6 +149,10 @@ typedef uint32_t svBitVecVal;
 //    whilst there are no further desciptors available)
 #define USBDPI_MAX_TRANSFERS 0x20U
 
+// Maximum length of a packet exchanged with the shim by the packet-level
+// interface (PID, data field and CRC16); must match usbdpi.sv
+#define USBDPI_PKT_MAX_BYTES 72U
+
 // Time intervals for common transactions, in bits
 // (allowing for bit stuffing and bus turnaround etc; for setting timeouts)
 #define USBDPI_INTERVAL_SETUP_STAGE 200U
@@ -336,6 +341,11 @@ struct usbdpi_ctx {
    * Current time in USB bit intervals
    */
   uint32_t tick_bits;
+  /**
+   * Start time of the packet being sent by the packet-level interface (bit
+   * intervals)
+   */
+  uint32_t pkt_sop;
   /**
    * End time of recovery interval (following device attachment)
    */
@@ -388,6 +398,10 @@ struct usbdpi_ctx {
    * Linked-list of free transfer descriptors
    */
   usbdpi_transfer_t *free;
+  /**
+   * Number of transfer descriptors on the free list
+   */
+  unsigned nfree;
 
   /**
    * Small pool of transfer descriptors
@@ -397,8 +411,14 @@ struct usbdpi_ctx {
 
 /**
  * Create a USB DPI instance, returning a 'chandle' for later use
+ *
+ * @param  name      Name of the instance, used for the output files
+ * @param  loglevel  Level of logging information required
+ * @param  capture   Format the monitor output on a background thread
+ * @param  pcap      Write a pcap capture of the packets to <name>.pcap
  */
-void *usbdpi_create(const char *name, int loglevel);
+void *usbdpi_create(const char *name, int loglevel, svBit capture,
+                    svBit pcap);
 /**
  * Close a USB DPI instance
  */
@@ -414,6 +434,22 @@ void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p);
  */
 uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p);
 
+/**
+ * Packet-level interface: update DPI model outputs at the start of a bit
+ * interval whilst the shim in usbdpi.sv is idle, returning in tx_data and
+ * tx_len any packet that the shim shall send
+ */
+uint8_t usbdpi_packet_tick(void *ctx_void, const svBitVecVal *usb_d2p,
+                           unsigned tick, int *tx_len, svBitVecVal *tx_data);
+
+/**
+ * Packet-level interface: accept a packet received from the device by the
+ * shim, which started at clock cycle sop
+ */
+void usbdpi_packet_rx(void *ctx_void, const svBitVecVal *usb_d2p,
+                      unsigned tick, unsigned sop, int rx_len,
+                      const svBitVecVal *rx_data);
+
 /**
  * Return DPI model diagnostic information for viewing in waveforms
  */
@@ -8,6 +8,16 @@
 // 0x01 -- monitor_usb (packet level)
 // 0x02 -- more verbose monitor
 // 0x08 -- bit level
+//
+// With +usbdpi_capture=1 the monitor output is formatted on a background
+// thread, and with +usbdpi_pcap=1 a pcap capture of the packets is written to
+// NAME.pcap.
+//
+// By default the C model drives and samples the bus every clock cycle,
+// performing all of the line coding itself. With +usbdpi_packet=1 the line
+// coding is instead performed by usbdpi_pkt_phy, which exchanges whole packets
+// with the C model; this is much faster, but there is no bit-level logging and
+// the monitor sees only complete packets.
 
 module usbdpi #(
   parameter string NAME = "usb0",
@@ -37,7 +47,8 @@ module usbdpi #(
   input  logic pullupdn_d2p
 );
   import "DPI-C" function
-    chandle usbdpi_create(input string name, input int loglevel);
+    chandle usbdpi_create(input string name, input int loglevel,
+                          input bit capture, input bit pcap);
 
   import "DPI-C" function
     void usbdpi_device_to_host(input chandle ctx, input bit [10:0] d2p);
@@ -51,10 +62,35 @@ module usbdpi #(
   import "DPI-C" function
     void usbdpi_diags(input chandle ctx, output bit [95:0] diags);
 
+  // Maximum packet length for the packet-level interface
+  // Note: MUST be kept consistent with USBDPI_PKT_MAX_BYTES in usbdpi.h
+  localparam int PktMaxBytes = 72;
+
+  import "DPI-C" function
+    byte usbdpi_packet_tick(input chandle ctx, input bit [10:0] d2p,
+                            input int unsigned tick, output int tx_len,
+                            output bit [8*PktMaxBytes-1:0] tx_data);
+
+  import "DPI-C" function
+    void usbdpi_packet_rx(input chandle ctx, input bit [10:0] d2p,
+                          input int unsigned tick, input int unsigned sop,
+                          input int rx_len,
+                          input bit [8*PktMaxBytes-1:0] rx_data);
+
   chandle ctx;
+  int packet_mode = 0;
+  int capture = 0;
+  int pcap = 0;
+  // Count of clock cycles, and start of bit interval, for the packet-level
+  // interface
+  int unsigned tick;
+  logic pkt_bit;
 
   initial begin
-    ctx = usbdpi_create(NAME, LOG_LEVEL);
+    void'($value$plusargs("usbdpi_packet=%0d", packet_mode));
+    void'($value$plusargs("usbdpi_capture=%0d", capture));
+    void'($value$plusargs("usbdpi_pcap=%0d", pcap));
+    ctx = usbdpi_create(NAME, LOG_LEVEL, capture != 0, pcap != 0);
   end
 
   final begin
@@ -207,9 +243,10 @@ module usbdpi #(
   usbdpi_host_state_t c_hostSt;
   usbdpi_drv_state_t c_state;
   always @(posedge clk_48MHz_i)
-    usbdpi_diags(ctx, {c_spare1, c_mon_state, c_mon_bits, c_mon_byte, c_mon_pid,
-                       c_step, c_bus_state, c_tickbits, c_frame, c_hostSt,
-                       c_state});
+    if (packet_mode == 0 || pkt_bit)
+      usbdpi_diags(ctx, {c_spare1, c_mon_state, c_mon_bits, c_mon_byte,
+                         c_mon_pid, c_step, c_bus_state, c_tickbits, c_frame,
+                         c_hostSt, c_state});
 
   logic [10:0] d2p;
   logic [10:0] d2p_r;
@@ -227,6 +264,58 @@ module usbdpi #(
 
   assign d2p = {dp_d2p, dp_en_d2p, dn_d2p, dn_en_d2p, d_d2p, d_en_d2p, se0_d2p, tx_use_d_se0_d2p,
                 pullupdp_d2p, pullupdn_d2p, rx_enable};
+
+  // Packet-level interface; the C model is called only at the start of each
+  // bit interval whilst the bus is idle, and when a packet has been received
+  logic                       pkt_tx_start, pkt_tx_busy, pkt_tx_oe;
+  logic                       pkt_tx_dp, pkt_tx_dn;
+  int                         pkt_tx_len;
+  logic [8*PktMaxBytes-1:0]   pkt_tx_data;
+  logic                       dev_drive, dev_dp, dev_dn;
+  logic                       pkt_rx_busy, pkt_rx_done;
+  int                         pkt_rx_len;
+  logic [8*PktMaxBytes-1:0]   pkt_rx_data;
+  int unsigned                pkt_rx_sop;
+
+  assign pkt_bit = (packet_mode != 0) && enable &&
+                   (!sense_p2d || pullup_detect) && (tick[1:0] == 2'd3);
+
+  // Line state driven by the device, in the usual orientation
+  assign dev_drive = dp_en_d2p || dn_en_d2p || d_en_d2p;
+  always_comb begin
+    if (tx_use_d_se0_d2p) begin
+      dev_dp = d_en_d2p && !se0_d2p && (flip_detect ^ d_d2p);
+      dev_dn = d_en_d2p && !se0_d2p && !(flip_detect ^ d_d2p);
+    end else begin
+      dev_dp = flip_detect ? (dn_en_d2p && dn_d2p) : (dp_en_d2p && dp_d2p);
+      dev_dn = flip_detect ? (dp_en_d2p && dp_d2p) : (dn_en_d2p && dn_d2p);
+    end
+  end
+
+  usbdpi_pkt_phy #(
+    .MaxBytes   (PktMaxBytes)
+  ) u_pkt_phy (
+    .clk_i      (clk_48MHz_i),
+    .rst_ni     (rst_ni),
+    .bit_i      (pkt_bit),
+    .tick_i     (tick + 1),
+    .tx_start_i (pkt_tx_start),
+    .tx_len_i   (pkt_tx_len),
+    .tx_data_i  (pkt_tx_data),
+    .tx_busy_o  (pkt_tx_busy),
+    .tx_oe_o    (pkt_tx_oe),
+    .tx_dp_o    (pkt_tx_dp),
+    .tx_dn_o    (pkt_tx_dn),
+    .rx_drive_i (dev_drive),
+    .rx_dp_i    (dev_dp),
+    .rx_dn_i    (dev_dn),
+    .rx_busy_o  (pkt_rx_busy),
+    .rx_done_o  (pkt_rx_done),
+    .rx_len_o   (pkt_rx_len),
+    .rx_data_o  (pkt_rx_data),
+    .rx_sop_o   (pkt_rx_sop)
+  );
+
   always_ff @(posedge clk_48MHz_i or negedge rst_ni) begin
     if (!rst_ni) begin
       sense_p2d <= 1'b0;
@@ -235,8 +324,39 @@ module usbdpi #(
       d_last <= 0;
       dp_int <= 0;
       dn_int <= 0;
+      tick <= '0;
+      pkt_tx_start <= 1'b0;
+      pkt_tx_len <= 0;
+      pkt_tx_data <= '0;
     end else if (enable) begin
-      if (!sense_p2d || pullup_detect) begin
+      if (packet_mode != 0 && (!sense_p2d || pullup_detect)) begin
+        tick <= tick + 1;
+        d_last <= d_p2d;
+        pkt_tx_start <= 1'b0;
+        if (pkt_rx_done) begin
+          usbdpi_packet_rx(ctx, d2p, tick + 1, pkt_rx_sop, pkt_rx_len,
+                           pkt_rx_data);
+        end else if (pkt_bit && !pkt_tx_busy && !pkt_rx_busy && !dev_drive) begin
+          automatic int tx_len;
+          automatic bit [8*PktMaxBytes-1:0] tx_data;
+          automatic byte p2d = usbdpi_packet_tick(ctx, d2p, tick + 1, tx_len,
+                                                  tx_data);
+          pkt_tx_start <= (tx_len > 0);
+          pkt_tx_len <= tx_len;
+          pkt_tx_data <= tx_data;
+          dp_en_p2d <= p2d[4];
+          dn_en_p2d <= p2d[4];
+          dp_int <= p2d[2];
+          dn_int <= p2d[1];
+          sense_p2d <= p2d[0];
+          unused_dummy <= |p2d[7:5];
+        end else if (pkt_tx_busy) begin
+          dp_en_p2d <= pkt_tx_oe;
+          dn_en_p2d <= pkt_tx_oe;
+          dp_int <= flip_detect ? pkt_tx_dn : pkt_tx_dp;
+          dn_int <= flip_detect ? pkt_tx_dp : pkt_tx_dn;
+        end
+      end else if (!sense_p2d || pullup_detect) begin
         automatic byte p2d = usbdpi_host_to_device(ctx, d2p);
         d_last <= d_p2d;
         dp_en_p2d <= p2d[4];
@@ -0,0 +1,225 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Line coding for the packet-level interface of usbdpi
+//
+// This sends whole packets from the DPI host model to the device, adding the
+// SYNC pattern, bit stuffing, NRZI coding and EOP, and collects whole packets
+// from the device, so that the C model need not see every bit on the bus.
+//
+// Line states are for the usual orientation (J is D+ high); the caller swaps
+// D+ and D- if the device has flipped them.
+
+module usbdpi_pkt_phy #(
+  // Maximum packet length in bytes (PID, data field and CRC16)
+  parameter int MaxBytes = 72
+) (
+  input  logic                  clk_i,
+  input  logic                  rst_ni,
+  // Start of a bit interval (12Mbps), and the count of clock cycles
+  input  logic                  bit_i,
+  input  int unsigned           tick_i,
+
+  // Packet from the host; tx_start_i starts transmission from the next bit
+  // interval
+  input  logic                  tx_start_i,
+  input  int                    tx_len_i,
+  input  logic [8*MaxBytes-1:0] tx_data_i,
+  output logic                  tx_busy_o,
+  output logic                  tx_oe_o,
+  output logic                  tx_dp_o,
+  output logic                  tx_dn_o,
+
+  // Line state driven by the device
+  input  logic                  rx_drive_i,
+  input  logic                  rx_dp_i,
+  input  logic                  rx_dn_i,
+  // Packet from the device; rx_done_o is high for one cycle when it is
+  // complete and rx_sop_o is the cycle count at which its SYNC ended
+  output logic                  rx_busy_o,
+  output logic                  rx_done_o,
+  output int                    rx_len_o,
+  output logic [8*MaxBytes-1:0] rx_data_o,
+  output int unsigned           rx_sop_o
+);
+
+  // SYNC pattern, sent LSB first; a 1 is J and a 0 is K
+  localparam logic [7:0] Sync = 8'h2A;
+
+  // Line states, as {D+, D-}
+  localparam logic [1:0] LineSE0 = 2'b00;
+  localparam logic [1:0] LineK   = 2'b01;
+  localparam logic [1:0] LineJ   = 2'b10;
+
+  // Line states at the end of the SYNC pattern
+  localparam logic [11:0] SyncLines = {LineK, LineJ, LineK, LineJ, LineK, LineK};
+
+  ////////////////////////
+  // Host to device     //
+  ////////////////////////
+
+  typedef enum logic [1:0] {
+    TxIdle,
+    TxSync,
+    TxData,
+    TxEop
+  } tx_state_e;
+
+  tx_state_e             tx_state;
+  logic [8*MaxBytes-1:0] tx_data;
+  int                    tx_len;
+  int                    tx_byte;
+  logic [2:0]            tx_bit;
+  logic [2:0]            tx_ones;
+  logic                  tx_j;
+
+  assign tx_busy_o = (tx_state != TxIdle) || tx_start_i;
+
+  always_ff @(posedge clk_i or negedge rst_ni) begin
+    if (!rst_ni) begin
+      tx_state <= TxIdle;
+      tx_data  <= '0;
+      tx_len   <= 0;
+      tx_byte  <= 0;
+      tx_bit   <= '0;
+      tx_ones  <= '0;
+      tx_j     <= 1'b1;
+      tx_oe_o  <= 1'b0;
+      tx_dp_o  <= 1'b1;
+      tx_dn_o  <= 1'b0;
+    end else if (tx_state == TxIdle) begin
+      if (tx_start_i) begin
+        tx_state <= TxSync;
+        tx_data  <= tx_data_i;
+        tx_len   <= tx_len_i;
+        tx_byte  <= 0;
+        tx_bit   <= '0;
+        // The host is idle (J) before the SYNC
+        tx_j     <= 1'b1;
+      end
+    end else if (bit_i) begin
+      unique case (tx_state)
+        TxSync: begin
+          tx_oe_o <= 1'b1;
+          {tx_dp_o, tx_dn_o} <= Sync[tx_bit] ? LineJ : LineK;
+          tx_j <= Sync[tx_bit];
+          tx_bit <= tx_bit + 3'd1;
+          if (tx_bit == 3'd7) begin
+            // The KK at the end of the SYNC counts for bit stuffing
+            tx_ones  <= 3'd1;
+            tx_state <= TxData;
+          end
+        end
+        TxData: begin
+          if (tx_ones == 3'd6) begin
+            // Stuff a 0 after six 1s
+            {tx_dp_o, tx_dn_o} <= tx_j ? LineK : LineJ;
+            tx_j <= !tx_j;
+            tx_ones <= '0;
+          end else if (tx_byte >= tx_len) begin
+            // First SE0 of the EOP
+            {tx_dp_o, tx_dn_o} <= LineSE0;
+            tx_bit <= '0;
+            tx_state <= TxEop;
+          end else if (tx_data[8 * tx_byte + 32'(tx_bit)]) begin
+            tx_ones <= tx_ones + 3'd1;
+            tx_bit <= tx_bit + 3'd1;
+            if (tx_bit == 3'd7) tx_byte <= tx_byte + 1;
+          end else begin
+            {tx_dp_o, tx_dn_o} <= tx_j ? LineK : LineJ;
+            tx_j <= !tx_j;
+            tx_ones <= '0;
+            tx_bit <= tx_bit + 3'd1;
+            if (tx_bit == 3'd7) tx_byte <= tx_byte + 1;
+          end
+        end
+        TxEop: begin
+          // SE0, SE0 and J, and then stop driving
+          tx_bit <= tx_bit + 3'd1;
+          if (tx_bit == 3'd1) begin
+            {tx_dp_o, tx_dn_o} <= LineJ;
+          end else if (tx_bit == 3'd2) begin
+            tx_oe_o <= 1'b0;
+            tx_state <= TxIdle;
+          end
+        end
+        default: tx_state <= TxIdle;
+      endcase
+    end
+  end
+
+  ////////////////////////
+  // Device to host     //
+  ////////////////////////
+
+  logic [1:0]  rx_line;
+  // The last six line states, for detecting the SYNC pattern (KJKJKK)
+  logic [11:0] rx_hist;
+  logic        rx_se0;
+  int          rx_len;
+  logic [7:0]  rx_byte;
+  logic [2:0]  rx_bit;
+  logic [2:0]  rx_ones;
+
+  assign rx_line = {rx_dp_i, rx_dn_i};
+  assign rx_len_o = rx_len;
+
+  always_ff @(posedge clk_i or negedge rst_ni) begin
+    if (!rst_ni) begin
+      rx_hist   <= '0;
+      rx_busy_o <= 1'b0;
+      rx_done_o <= 1'b0;
+      rx_se0    <= 1'b0;
+      rx_len    <= 0;
+      rx_byte   <= '0;
+      rx_bit    <= '0;
+      rx_ones   <= '0;
+      rx_data_o <= '0;
+      rx_sop_o  <= '0;
+    end else begin
+      rx_done_o <= 1'b0;
+      if (bit_i) begin
+        if (!rx_drive_i) begin
+          // The device may stop driving straight after the SE0s of the EOP
+          rx_done_o <= rx_busy_o && rx_se0;
+          rx_busy_o <= 1'b0;
+          rx_hist <= '0;
+        end else begin
+          rx_hist <= {rx_hist[9:0], rx_line};
+          if (!rx_busy_o) begin
+            if ({rx_hist[9:0], rx_line} == SyncLines) begin
+              rx_busy_o <= 1'b1;
+              rx_se0 <= 1'b0;
+              rx_len <= 0;
+              rx_bit <= '0;
+              rx_ones <= 3'd1;
+              rx_sop_o <= tick_i;
+            end
+          end else if (rx_line == LineSE0) begin
+            rx_se0 <= 1'b1;
+          end else if (rx_se0) begin
+            // J completes the EOP
+            rx_done_o <= 1'b1;
+            rx_busy_o <= 1'b0;
+          end else if (rx_ones == 3'd6) begin
+            // Discard the stuffed bit
+            rx_ones <= '0;
+          end else begin
+            // NRZI: no transition is a 1
+            automatic logic b = (rx_line == rx_hist[1:0]);
+            automatic logic [7:0] byte_d = {b, rx_byte[7:1]};
+            rx_ones <= b ? rx_ones + 3'd1 : '0;
+            rx_byte <= byte_d;
+            rx_bit <= rx_bit + 3'd1;
+            if (rx_bit == 3'd7 && rx_len < MaxBytes) begin
+              rx_data_o[8 * rx_len +: 8] <= byte_d;
+              rx_len <= rx_len + 1;
+            end
+          end
+        end
+      end
+    end
+  end
+
+endmodule
@@ -9,6 +9,10 @@
 #include "usb_utils.h"
 #include "usbdpi.h"
 
+// Every transfer descriptor may end up in the same ring
+static_assert(USBDPI_STREAM_RING >= USBDPI_MAX_TRANSFERS,
+              "Stream ring must be able to hold every transfer descriptor");
+
 // Seed numbers for the LFSR generators in each transfer direction for
 // the given stream number
 #define USBTST_LFSR_SEED(s) (uint8_t)(0x10U + (s)*7U)
@@ -22,6 +26,26 @@
       (uint8_t)((lfsr) << 1) ^ \
       ((((lfsr) >> 1) ^ ((lfsr) >> 2) ^ ((lfsr) >> 3) ^ ((lfsr) >> 7)) & 1U))
 
+// Number of bytes of LFSR output held in each entry of the block table
+#define LFSR_BLOCK_LEN 8U
+
+// The LFSR output for a given starting state, a block at a time, so that
+// stream data can be generated and checked a word at a time rather than
+// stepping the LFSR for every byte
+typedef struct {
+  /**
+   * Output bytes, starting with the initial state itself
+   */
+  uint8_t bytes[LFSR_BLOCK_LEN];
+  /**
+   * LFSR state after the block
+   */
+  uint8_t next;
+} lfsr_block_t;
+
+static lfsr_block_t lfsr_blocks[0x100U];
+static bool lfsr_blocks_ready = false;
+
 // Stream signature words
 #define STREAM_SIGNATURE_HEAD 0x579EA01AU
 #define STREAM_SIGNATURE_TAIL 0x160AE975U
@@ -62,6 +86,76 @@ static usbdpi_transfer_t *stream_data_process(usbdpi_ctx_t *ctx,
 static bool stream_sig_check(usbdpi_ctx_t *ctx, usbdpi_stream_t *s,
                              usbdpi_transfer_t *rx);
 
+// Populate the LFSR block table, if not already done
+static void lfsr_blocks_init(void) {
+  if (lfsr_blocks_ready) {
+    return;
+  }
+  for (unsigned state = 0U; state < 0x100U; state++) {
+    uint8_t lfsr = (uint8_t)state;
+    for (unsigned idx = 0U; idx < LFSR_BLOCK_LEN; idx++) {
+      lfsr_blocks[state].bytes[idx] = lfsr;
+      lfsr = LFSR_ADVANCE(lfsr);
+    }
+    lfsr_blocks[state].next = lfsr;
+  }
+  lfsr_blocks_ready = true;
+}
+
+// Fill a buffer with LFSR output, returning the updated LFSR state
+static uint8_t lfsr_fill(uint8_t lfsr, uint8_t *dp, unsigned len) {
+  for (; len >= LFSR_BLOCK_LEN; len -= LFSR_BLOCK_LEN) {
+    memcpy(dp, lfsr_blocks[lfsr].bytes, LFSR_BLOCK_LEN);
+    dp += LFSR_BLOCK_LEN;
+    lfsr = lfsr_blocks[lfsr].next;
+  }
+  while (len-- > 0U) {
+    *dp++ = lfsr;
+    lfsr = LFSR_ADVANCE(lfsr);
+  }
+  return lfsr;
+}
+
+// XOR data with LFSR output, returning the updated LFSR state
+static uint8_t lfsr_xor(uint8_t lfsr, uint8_t *dp, const uint8_t *sp,
+                        unsigned len) {
+  for (; len >= LFSR_BLOCK_LEN; len -= LFSR_BLOCK_LEN) {
+    uint64_t data, mask;
+    memcpy(&data, sp, LFSR_BLOCK_LEN);
+    memcpy(&mask, lfsr_blocks[lfsr].bytes, LFSR_BLOCK_LEN);
+    data ^= mask;
+    memcpy(dp, &data, LFSR_BLOCK_LEN);
+    sp += LFSR_BLOCK_LEN;
+    dp += LFSR_BLOCK_LEN;
+    lfsr = lfsr_blocks[lfsr].next;
+  }
+  while (len-- > 0U) {
+    *dp++ = *sp++ ^ lfsr;
+    lfsr = LFSR_ADVANCE(lfsr);
+  }
+  return lfsr;
+}
+
+// Return the oldest received transfer of a stream, or NULL if none
+static inline usbdpi_transfer_t *stream_rx_peek(const usbdpi_stream_t *s) {
+  return s->rx_count ? s->rx_ring[s->rx_head] : NULL;
+}
+
+// Append a received transfer to a stream
+static inline void stream_rx_push(usbdpi_stream_t *s, usbdpi_transfer_t *tr) {
+  assert(s->rx_count < USBDPI_STREAM_RING);
+  s->rx_ring[(s->rx_head + s->rx_count++) & (USBDPI_STREAM_RING - 1U)] = tr;
+}
+
+// Remove and return the oldest received transfer of a stream
+static inline usbdpi_transfer_t *stream_rx_pop(usbdpi_stream_t *s) {
+  assert(s->rx_count);
+  usbdpi_transfer_t *tr = s->rx_ring[s->rx_head];
+  s->rx_head = (s->rx_head + 1U) & (USBDPI_STREAM_RING - 1U);
+  s->rx_count--;
+  return tr;
+}
+
 // Determine the next stream for which IN data packets shall be requested
 inline unsigned in_stream_next(usbdpi_ctx_t *ctx) {
   uint8_t id = ctx->stream_in;
@@ -93,6 +187,8 @@ bool streams_init(usbdpi_ctx_t *ctx, unsigned nstreams,
     return false;
   }
 
+  lfsr_blocks_init();
+
   if (verbose) {
     printf("[usbdpi] Stream test running with %u streams(s)\n", nstreams);
     printf("[usbdpi] - retrieve %c checking %c retrying %c send %c\n",
@@ -134,7 +230,8 @@ bool streams_init(usbdpi_ctx_t *ctx, unsigned nstreams,
     ctx->stream[id].retry_lfsr = RETRY_LFSR_SEED(id);
     ctx->stream[id].nretries = 0U;
     // No received packets
-    ctx->stream[id].received = NULL;
+    ctx->stream[id].rx_head = 0U;
+    ctx->stream[id].rx_count = 0U;
   }
   return true;
 }
@@ -197,17 +294,32 @@ bool stream_data_check(usbdpi_ctx_t *ctx, usbdpi_stream_t *s,
         // Note: use a local copy of the LFSR so that we can check the data
         //       field even on those packets that we choose to reject
         uint8_t tst_lfsr = s->tst_lfsr;
-        while (num_bytes-- > 0U) {
-          uint8_t recvd = *sp++;
-          if (recvd != tst_lfsr) {
-            printf(
-                "[usbdpi] %c%u: Mismatched data from device 0x%02x, "
-                "expected 0x%02x\n",
-                xfr_sym[s->xfr_type], s->id, recvd, tst_lfsr);
-            ok = false;
+        while (num_bytes > 0U) {
+          // Compare a block at a time, falling back to individual bytes to
+          // report the mismatches within a block and for any remainder
+          const lfsr_block_t *blk = &lfsr_blocks[tst_lfsr];
+          unsigned len = LFSR_BLOCK_LEN;
+          if (num_bytes >= LFSR_BLOCK_LEN &&
+              !memcmp(sp, blk->bytes, LFSR_BLOCK_LEN)) {
+            tst_lfsr = blk->next;
+          } else {
+            if (len > num_bytes) {
+              len = num_bytes;
+            }
+            for (unsigned idx = 0U; idx < len; idx++) {
+              if (sp[idx] != tst_lfsr) {
+                printf(
+                    "[usbdpi] %c%u: Mismatched data from device 0x%02x, "
+                    "expected 0x%02x\n",
+                    xfr_sym[s->xfr_type], s->id, sp[idx], tst_lfsr);
+                ok = false;
+              }
+              // Advance our local LFSR
+              tst_lfsr = LFSR_ADVANCE(tst_lfsr);
+            }
           }
-          // Advance our local LFSR
-          tst_lfsr = LFSR_ADVANCE(tst_lfsr);
+          sp += len;
+          num_bytes -= len;
         }
 
         // Update the LFSR only if we've accepted valid data and will not
@@ -236,10 +348,7 @@ usbdpi_transfer_t *stream_data_gen(usbdpi_ctx_t *ctx, usbdpi_stream_t *s,
     ctx->ep_in[s->ep_in].next_data = DATA_TOGGLE_ADVANCE(data);
     // ...and that the data is as expected
     uint8_t *dp = transfer_data_start(tr, data, len);
-    for (unsigned idx = 0U; idx < len; idx++) {
-      dp[idx] = s->tst_lfsr;
-      s->tst_lfsr = LFSR_ADVANCE(s->tst_lfsr);
-    }
+    s->tst_lfsr = lfsr_fill(s->tst_lfsr, dp, len);
     transfer_data_end(tr, dp + len);
   }
   return tr;
@@ -301,20 +410,16 @@ usbdpi_transfer_t *stream_data_process(usbdpi_ctx_t *ctx, usbdpi_stream_t *s,
   // failure
   s->dpi_rewind_lfsr = s->dpi_lfsr;
 
-  while (num_bytes-- > 0U) {
-    uint8_t recvd = *sp++;
-
-    // Simply XOR the two LFSR-generated streams together
-    *dp++ = recvd ^ s->dpi_lfsr;
-    if (verbose) {
-      printf("[usbdpi] 0x%02x <- 0x%02x ^ 0x%02x\n", *(dp - 1), recvd,
-             s->dpi_lfsr);
+  // Simply XOR the two LFSR-generated streams together
+  s->dpi_lfsr = lfsr_xor(s->dpi_lfsr, dp, sp, num_bytes);
+  if (verbose) {
+    for (unsigned idx = 0U; idx < num_bytes; idx++) {
+      printf("[usbdpi] 0x%02x <- 0x%02x ^ 0x%02x\n", dp[idx], sp[idx],
+             dp[idx] ^ sp[idx]);
     }
-    // Advance our local copy of the LFSR
-    s->dpi_lfsr = LFSR_ADVANCE(s->dpi_lfsr);
   }
 
-  transfer_data_end(reply, dp);
+  transfer_data_end(reply, dp + num_bytes);
 
   return reply;
 }
@@ -433,8 +538,8 @@ void streams_service(usbdpi_ctx_t *ctx) {
         unsigned id = out_stream_next(ctx);
         usbdpi_stream_t *s = &ctx->stream[id];
         if (verbose) {
-          printf("[usbdpi] OUT considering #%u received %p send %u\n", id,
-                 s->received, s->send ? 1 : 0);
+          printf("[usbdpi] OUT considering #%u received %u send %u\n", id,
+                 s->rx_count, s->send ? 1 : 0);
         }
         // Default to 'nothing to send, try receiving'...
         ctx->hostSt = HS_STREAMIN;
@@ -442,7 +547,8 @@ void streams_service(usbdpi_ctx_t *ctx) {
         if (s->send) {
           // Start by trying to transmit a data packet that we've received, if
           // any
-          if (s->received) {
+          usbdpi_transfer_t *rx = stream_rx_peek(s);
+          if (rx) {
             if (ctx->sending) {
               transfer_release(ctx, ctx->sending);
               ctx->sending = NULL;
@@ -450,7 +556,7 @@ void streams_service(usbdpi_ctx_t *ctx) {
 
             // Scramble the oldest received packet with our LFSR-generated byte
             // stream and send it to the device
-            usbdpi_transfer_t *reply = stream_data_process(ctx, s, s->received);
+            usbdpi_transfer_t *reply = stream_data_process(ctx, s, rx);
             if (reply) {
               ctx->bus_state = kUsbBulkOut;
               switch (s->xfr_type) {
@@ -475,10 +581,8 @@ void streams_service(usbdpi_ctx_t *ctx) {
           }
         } else {
           // We're not sending anything - discard any received data
-          while (s->received) {
-            usbdpi_transfer_t *tr = s->received;
-            s->received = tr->next;
-            transfer_release(ctx, tr);
+          while (s->rx_count) {
+            transfer_release(ctx, stream_rx_pop(s));
           }
         }
       } else {
@@ -560,10 +664,7 @@ void streams_service(usbdpi_ctx_t *ctx) {
       if (accepted) {
         // Transmitted packet was accepted, so we can retire it...
         usbdpi_stream_t *s = &ctx->stream[ctx->stream_out];
-        usbdpi_transfer_t *rx = s->received;
-        assert(rx);
-        s->received = rx->next;
-        transfer_release(ctx, rx);
+        transfer_release(ctx, stream_rx_pop(s));
         // No data toggling for Isochronous
         if (s->xfr_type != USB_TRANSFER_TYPE_ISOCHRONOUS) {
           uint8_t ep_out = s->ep_out;
@@ -593,7 +694,13 @@ void streams_service(usbdpi_ctx_t *ctx) {
           printf("[usbdpi] IN considering #%u retrieve %u\n", id,
                  s->retrieve ? 1 : 0);
         }
-        if (s->retrieve) {
+        // Transfer descriptors required for the IN token and the data packet
+        unsigned needed = (ctx->sending ? 0U : 1U) + (ctx->recving ? 0U : 1U);
+        if (s->retrieve && ctx->nfree < needed) {
+          // All of the descriptors are holding received data, so don't poll
+          // the device until we've sent some of it back
+          ctx->hostSt = HS_STREAMOUT;
+        } else if (s->retrieve) {
           // Ensure that a buffer is available for constructing a transfer
           usbdpi_transfer_t *tr = ctx->sending;
           if (!tr) {
@@ -625,10 +732,13 @@ void streams_service(usbdpi_ctx_t *ctx) {
           // We're not required to poll for IN data, but if we're sending we
           //   must still fake the reception of valid packet data because
           //   the sw test will be expecting valid data
-          if (s->send && !s->received) {
+          if (s->send && !s->rx_count) {
             // For simplicity we just create max length packets
             const unsigned len = USBDEV_MAX_PACKET_SIZE;
-            s->received = stream_data_gen(ctx, s, len);
+            usbdpi_transfer_t *tr = stream_data_gen(ctx, s, len);
+            if (tr) {
+              stream_rx_push(s, tr);
+            }
           }
           ctx->hostSt = HS_STREAMOUT;
         }
@@ -754,14 +864,7 @@ void streams_service(usbdpi_ctx_t *ctx) {
               if (accept) {
                 // Collect the received packets in preparation for later
                 // transmission with modification back to the device
-                usbdpi_transfer_t *tr = s->received;
-                if (tr) {
-                  while (tr->next)
-                    tr = tr->next;
-                  tr->next = rx;
-                } else {
-                  s->received = rx;
-                }
+                stream_rx_push(s, rx);
               } else {
                 transfer_release(ctx, rx);
               }
@@ -12,6 +12,11 @@
 // Forwards declaration of USBDPI context
 typedef struct usbdpi_ctx usbdpi_ctx_t;
 
+// Capacity of the ring of received transfers for each stream; this must be a
+// power of two, and no smaller than the pool of transfer descriptors so that
+// the ring can never overflow
+#define USBDPI_STREAM_RING 0x20U
+
 // Context for streaming data test (usbdev_stream_test)
 typedef struct usbdpi_stream {
   /**
@@ -80,9 +85,18 @@ typedef struct usbdpi_stream {
    */
   uint8_t dpi_rewind_lfsr;
   /**
-   * Linked-list of received transfers
+   * Ring of received transfers, oldest first, awaiting transmission back to
+   * the device
+   */
+  usbdpi_transfer_t *rx_ring[USBDPI_STREAM_RING];
+  /**
+   * Index of the oldest received transfer within the ring
+   */
+  uint8_t rx_head;
+  /**
+   * Number of received transfers within the ring
    */
-  usbdpi_transfer_t *received;
+  uint8_t rx_count;
 } usbdpi_stream_t;
 
 /**
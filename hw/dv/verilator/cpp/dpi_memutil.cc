@@ -6,11 +6,14 @@
 
 #include <cassert>
 #include <cstring>
+#include <exception>
 #include <fcntl.h>
 #include <iostream>
 #include <libelf.h>
 #include <sstream>
 #include <sys/stat.h>
+#include <system_error>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -46,7 +49,9 @@ class ElfFile {
       throw ElfError(path, "could not open file.");
     }
 
-    ptr_ = elf_begin(fd_, ELF_C_READ, NULL);
+    // Map the file rather than reading it, since we only copy out the loadable
+    // segments.
+    ptr_ = elf_begin(fd_, ELF_C_READ_MMAP, NULL);
     if (!ptr_) {
       close(fd_);
       throw ElfError(path, elf_errmsg(-1));
@@ -83,6 +88,19 @@ class ElfFile {
   int fd_;
   Elf *ptr_;
 };
+
+// The writes needed to load the staged data for one memory area
+struct RegionLoad {
+  size_t mem_idx;
+  const std::string *mem_name;
+  const StagedMem *staged_mem;
+
+  // One prepared write for each segment in staged_mem, in order
+  std::vector<MemArea::PreparedWrite> writes;
+
+  // Set if preparing the writes failed
+  std::exception_ptr error;
+};
 }  // namespace
 
 // Convert a string to a MemImageType, throwing a std::runtime_error
@@ -185,7 +203,9 @@ static std::vector<uint8_t> FlattenElfFile(const std::string &filepath) {
   const char *file_data = elf_rawfile(elf.ptr_, &file_size);
   assert(file_data);
 
-  StagedMem ret;
+  // Copy each segment straight to its place in the flat image. Where segments
+  // overlap, later segments overwrite earlier ones.
+  std::vector<uint8_t> ret((size_t)1 + (high - low), 0);
 
   for (size_t i = 0; i < phnum; i++) {
     const Elf32_Phdr &phdr = phdrs[i];
@@ -207,12 +227,75 @@ static std::vector<uint8_t> FlattenElfFile(const std::string &filepath) {
       continue;
 
     uint32_t off = phdr.p_paddr - low;
-    std::vector<uint8_t> seg(phdr.p_filesz, 0);
-    memcpy(&seg[0], file_data + phdr.p_offset, phdr.p_filesz);
-    ret.AddSegment(off, std::move(seg));
+    memcpy(&ret[off], file_data + phdr.p_offset, phdr.p_filesz);
   }
 
-  return ret.GetFlat();
+  return ret;
+}
+
+// Compute the physical memory words for each segment in load->staged_mem,
+// storing any exception in load->error. This runs on a worker thread, so
+// mustn't call into the simulator.
+static void PrepareRegionLoad(RegionLoad *load, const MemArea *mem_area) {
+  try {
+    for (const auto &seg_pr : load->staged_mem->GetSegs()) {
+      const AddrRange<uint32_t> &seg_rng = seg_pr.first;
+
+      assert(seg_rng.lo % mem_area->GetWidthByte() == 0);
+      uint32_t lo_word = seg_rng.lo / mem_area->GetWidthByte();
+
+      load->writes.emplace_back();
+      mem_area->PrepareWrite(&load->writes.back(), lo_word, seg_pr.second);
+    }
+  } catch (...) {
+    load->error = std::current_exception();
+  }
+}
+
+// Load the ELF file at filepath into mem_area (as a flat image starting at
+// word 0), using cache to avoid recomputing its physical words where possible.
+// This must be called from the simulator thread.
+static void WriteElfWithCache(const MemImageCache &cache, bool verbose,
+                              const std::string &name,
+                              const std::string &filepath,
+                              const MemArea &mem_area) {
+  mem_area.StartAccess();
+
+  std::ostringstream params;
+  params << "named " << name << " " << mem_area.GetLayoutId() << " "
+         << MemImageCache::EncodingDigest(mem_area) << "\n";
+  std::string key = cache.MakeKey(filepath, params.str());
+
+  std::unique_ptr<MemImageCache::Entry> entry =
+      cache.Load(key, {mem_area.GetSizeWords()});
+  if (entry) {
+    if (verbose) {
+      std::cout << "Using cached image of `" << filepath << "'." << std::endl;
+    }
+    for (const MemImageCache::Words &words : entry->GetRegions()[0]) {
+      mem_area.CommitWords(words.word_offset, words.phys_addrs, words.bufs,
+                           words.count);
+    }
+    return;
+  }
+
+  std::vector<MemArea::PreparedWrite> writes(1);
+  mem_area.PrepareWrite(&writes[0], 0, FlattenElfFile(filepath));
+  mem_area.CommitWrite(writes[0]);
+  cache.Store(key, {&writes});
+}
+
+// Make an error for a memory region whose scope doesn't exist. lma is the
+// address of the segment that we were loading.
+static std::runtime_error NoMemoryError(const SVScoped::Error &err,
+                                        const std::string &mem_name,
+                                        uint32_t lma) {
+  std::ostringstream oss;
+  oss << "No memory found at `" << err.scope_name_
+      << "' (the scope associated with region `" << mem_name
+      << "', used by a segment that starts at LMA 0x" << std::hex << lma
+      << ").";
+  return std::runtime_error(oss.str());
 }
 
 // Merge seg0 and seg1, overwriting any overlapping data in seg0 with
@@ -401,7 +484,11 @@ void DpiMemUtil::LoadFileToNamedMem(bool verbose, const std::string &name,
   try {
     switch (type) {
       case kMemImageElf:
-        m.Write(0, FlattenElfFile(filepath));
+        if (image_cache_) {
+          WriteElfWithCache(*image_cache_, verbose, name, filepath, m);
+        } else {
+          m.Write(0, FlattenElfFile(filepath));
+        }
         break;
       case kMemImageVmem:
         m.LoadVmem(filepath);
@@ -421,6 +508,16 @@ void DpiMemUtil::LoadElfToMemories(bool verbose, const std::string &filepath) {
   // Load the contents of the ELF file into the staging area
   StageElf(verbose, filepath);
 
+  // If there are several memories to load and we have the cores for it,
+  // compute their contents in parallel. Using the image cache also means
+  // preparing the writes before sending them to the simulator.
+  bool parallel =
+      staging_area_.size() > 1 && std::thread::hardware_concurrency() > 1;
+  if (parallel || image_cache_) {
+    WriteStagedMems(verbose, filepath, parallel);
+    return;
+  }
+
   for (const auto &pr : staging_area_) {
     const std::string &mem_name = pr.first;
     const StagedMem &staged_mem = pr.second;
@@ -440,17 +537,17 @@ void DpiMemUtil::LoadElfToMemories(bool verbose, const std::string &filepath) {
       try {
         mem_area.Write(lo_word, seg_data);
       } catch (const SVScoped::Error &err) {
-        std::ostringstream oss;
-        oss << "No memory found at `" << err.scope_name_
-            << "' (the scope associated with region `" << mem_name
-            << "', used by a segment that starts at LMA 0x" << std::hex
-            << base_addrs_[mem_area_it->second] + seg_rng.lo << ").";
-        throw std::runtime_error(oss.str());
+        throw NoMemoryError(err, mem_name,
+                            base_addrs_[mem_area_it->second] + seg_rng.lo);
       }
     }
   }
 }
 
+void DpiMemUtil::SetImageCacheDir(const std::string &dir) {
+  image_cache_.reset(new MemImageCache(dir));
+}
+
 void DpiMemUtil::StageElf(bool verbose, const std::string &path) {
   // Clear out anything that was in the staging area before
   staging_area_.clear();
@@ -571,3 +668,121 @@ size_t DpiMemUtil::GetRegionForSegment(const std::string &path, int seg_idx,
 
   return mem_area_it->second;
 }
+
+void DpiMemUtil::WriteStagedMems(bool verbose, const std::string &filepath,
+                                 bool parallel) {
+  std::vector<RegionLoad> loads;
+  loads.reserve(staging_area_.size());
+  for (const auto &pr : staging_area_) {
+    auto mem_area_it = name_to_mem_.find(pr.first);
+    assert(mem_area_it != name_to_mem_.end());
+
+    loads.emplace_back();
+    RegionLoad &load = loads.back();
+    load.mem_idx = mem_area_it->second;
+    load.mem_name = &pr.first;
+    load.staged_mem = &pr.second;
+
+    // StartAccess() might need to read state from the design, so has to
+    // happen on this thread.
+    try {
+      mem_areas_[load.mem_idx]->StartAccess();
+    } catch (const SVScoped::Error &err) {
+      uint32_t lo = pr.second.GetBounds().first;
+      throw NoMemoryError(err, pr.first, base_addrs_[load.mem_idx] + lo);
+    }
+  }
+
+  // If the cache has the physical words for this image and these memories,
+  // just send them to the simulator. The key includes the base address,
+  // layout and encoding digest of each memory that the image touches.
+  std::string cache_key;
+  if (image_cache_) {
+    std::ostringstream params;
+    std::vector<uint32_t> region_words;
+    params << "load-elf\n";
+    for (const RegionLoad &load : loads) {
+      const MemArea &mem_area = *mem_areas_[load.mem_idx];
+      params << *load.mem_name << " 0x" << std::hex
+             << base_addrs_[load.mem_idx] << std::dec << " "
+             << mem_area.GetLayoutId() << " "
+             << MemImageCache::EncodingDigest(mem_area) << "\n";
+      region_words.push_back(mem_area.GetSizeWords());
+    }
+    cache_key = image_cache_->MakeKey(filepath, params.str());
+
+    std::unique_ptr<MemImageCache::Entry> entry =
+        image_cache_->Load(cache_key, region_words);
+    if (entry) {
+      if (verbose) {
+        std::cout << "Using cached image of `" << filepath << "'."
+                  << std::endl;
+      }
+      for (size_t i = 0; i < loads.size(); ++i) {
+        const MemArea &mem_area = *mem_areas_[loads[i].mem_idx];
+        for (const MemImageCache::Words &words : entry->GetRegions()[i]) {
+          try {
+            mem_area.CommitWords(words.word_offset, words.phys_addrs,
+                                 words.bufs, words.count);
+          } catch (const SVScoped::Error &err) {
+            throw NoMemoryError(
+                err, *loads[i].mem_name,
+                base_addrs_[loads[i].mem_idx] +
+                    words.word_offset * mem_area.GetWidthByte());
+          }
+        }
+      }
+      return;
+    }
+  }
+
+  // Computing the physical memory words for each region (adding ECC bits and
+  // scrambling) doesn't touch the simulator, so if parallel is true we do it
+  // with a worker thread per region. If we can't start a thread, the
+  // remaining regions are done on this thread instead.
+  std::vector<std::thread> workers;
+  if (parallel) {
+    for (RegionLoad &load : loads) {
+      try {
+        workers.emplace_back(PrepareRegionLoad, &load,
+                             mem_areas_[load.mem_idx]);
+      } catch (const std::system_error &) {
+        break;
+      }
+    }
+  }
+  for (size_t i = workers.size(); i < loads.size(); ++i) {
+    PrepareRegionLoad(&loads[i], mem_areas_[loads[i].mem_idx]);
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  // Now send the prepared writes to the simulator, in the same order that
+  // LoadElfToMemories would write the segments one at a time.
+  for (const RegionLoad &load : loads) {
+    if (load.error) {
+      std::rethrow_exception(load.error);
+    }
+
+    const MemArea &mem_area = *mem_areas_[load.mem_idx];
+    for (const MemArea::PreparedWrite &prep : load.writes) {
+      try {
+        mem_area.CommitWrite(prep);
+      } catch (const SVScoped::Error &err) {
+        throw NoMemoryError(
+            err, *load.mem_name,
+            base_addrs_[load.mem_idx] +
+                prep.word_offset * mem_area.GetWidthByte());
+      }
+    }
+  }
+
+  if (image_cache_) {
+    std::vector<const std::vector<MemArea::PreparedWrite> *> regions;
+    for (const RegionLoad &load : loads) {
+      regions.push_back(&load.writes);
+    }
+    image_cache_->Store(cache_key, regions);
+  }
+}
@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "mem_area.h"
+#include "mem_image_cache.h"
 #include "ranged_map.h"
 
 // Forward declaration for the Elf type from libelf.
@@ -115,10 +116,25 @@ class DpiMemUtil {
   /**
    * Load an ELF file, placing segments in memories by LMA.
    *
-   * Replaces any data currently in the staging area.
+   * Replaces any data currently in the staging area. If the file has data for
+   * more than one memory, the contents of each memory (with any ECC bits and
+   * scrambling) are computed on separate threads.
    */
   void LoadElfToMemories(bool verbose, const std::string &filepath);
 
+  /**
+   * Cache the physical contents of memories loaded from ELF files in dir.
+   *
+   * After this is called, LoadElfToMemories() and LoadFileToNamedMem() (for
+   * ELF files) look up the image in the cache before computing any ECC bits
+   * or scrambling, and store the result if it wasn't there. Entries are keyed
+   * by the contents of the file and by the layout of the memories (including
+   * any scrambling keys), so stale entries are never used.
+   *
+   * Throws a std::runtime_error if dir doesn't exist and can't be created.
+   */
+  void SetImageCacheDir(const std::string &dir);
+
   /**
    * Load an ELF file into a staging area in this object, which can then be
    * accessed with GetMemoryData().
@@ -159,12 +175,27 @@ class DpiMemUtil {
   std::map<std::string, StagedMem> staging_area_;
   const StagedMem empty_;
 
+  // Cache of prepared memory images. Null unless SetImageCacheDir() has been
+  // called.
+  std::unique_ptr<MemImageCache> image_cache_;
+
   /**
    * Find the index of a memory area containing the given segment's addresses.
    * Raises a std::exception if none is found.
    */
   size_t GetRegionForSegment(const std::string &path, int seg_idx, uint32_t lma,
                              uint32_t mem_sz) const;
+
+  /**
+   * Write everything in the staging area (loaded from filepath) to the
+   * memories by preparing the physical contents of each memory and then doing
+   * the DPI writes on this thread. If parallel is true, each memory is
+   * prepared on its own worker thread. If there is an image cache, it is used
+   * instead of preparing the memories where possible. Used by
+   * LoadElfToMemories().
+   */
+  void WriteStagedMems(bool verbose, const std::string &filepath,
+                       bool parallel);
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_DPI_MEMUTIL_H_
@@ -4,6 +4,7 @@
 
 #include "ecc32_mem_area.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
@@ -34,20 +35,27 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
     uint32_t word_offset, uint32_t num_words) const {
   assert(word_offset + num_words <= num_words_);
 
-  // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  // See MemArea::Write for an explanation for these buffers.
+  std::vector<uint8_t> bufs(BatchBufsSize(num_words));
+  uint32_t phys_addrs[SV_MEM_BATCH_WORDS];
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   EccWords ret;
   ret.reserve(num_words);
 
-  for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+  StartAccess();
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBufferWithIntegrity(ret, minibuf, src_word);
+  for (uint32_t i = 0; i < num_words; i += SV_MEM_BATCH_WORDS) {
+    uint32_t count = std::min(num_words - i, (uint32_t)SV_MEM_BATCH_WORDS);
+
+    for (uint32_t j = 0; j < count; ++j) {
+      phys_addrs[j] = ToPhysAddr(word_offset + i + j);
+    }
+    ReadToBufs(bufs.data(), phys_addrs, count);
+    for (uint32_t j = 0; j < count; ++j) {
+      ReadBufferWithIntegrity(ret, &bufs[j * SV_MEM_WIDTH_BYTES],
+                              word_offset + i + j);
+    }
   }
 
   return ret;
@@ -55,10 +63,9 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
 
 void Ecc32MemArea::WriteWithIntegrity(uint32_t word_offset,
                                       const EccWords &data) const {
-  // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  // See MemArea::Write for an explanation for these buffers.
+  uint32_t phys_addrs[SV_MEM_BATCH_WORDS];
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   uint32_t width_32 = width_byte_ / 4;
   uint32_t to_write = data.size() / width_32;
@@ -66,12 +73,20 @@ void Ecc32MemArea::WriteWithIntegrity(uint32_t word_offset,
   assert((data.size() % width_32) == 0);
   assert(word_offset + to_write <= num_words_);
 
-  for (uint32_t i = 0; i < to_write; ++i) {
-    uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
+  std::vector<uint8_t> bufs(BatchBufsSize(to_write));
+
+  StartAccess();
 
-    WriteBufferWithIntegrity(minibuf, data, i * width_32, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
+  for (uint32_t i = 0; i < to_write; i += SV_MEM_BATCH_WORDS) {
+    uint32_t count = std::min(to_write - i, (uint32_t)SV_MEM_BATCH_WORDS);
+
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t dst_word = word_offset + i + j;
+      phys_addrs[j] = ToPhysAddr(dst_word);
+      WriteBufferWithIntegrity(&bufs[j * SV_MEM_WIDTH_BYTES], data,
+                               (i + j) * width_32, dst_word);
+    }
+    WriteFromBufs(phys_addrs, bufs.data(), count, word_offset + i);
   }
 }
 
@@ -159,7 +174,13 @@ void Ecc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                size_t start_idx, uint32_t dst_word) const {
   zero_buffer(buf, width_byte_);
   for (uint32_t i = 0; i < width_byte_ / 4; ++i) {
-    const uint8_t *src_data = &data[start_idx + 4 * i];
+    // If data ends part way through this word, zero-extend it (rather than
+    // reading off the end of the vector)
+    uint8_t src_data[4] = {0};
+    size_t idx = start_idx + 4 * i;
+    if (idx < data.size()) {
+      memcpy(src_data, &data[idx], std::min((size_t)4, data.size() - idx));
+    }
     insert_word(buf, 39 * i, src_data, enc_secded_inv_39_32(src_data));
   }
 }
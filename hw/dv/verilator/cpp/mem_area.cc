@@ -8,6 +8,7 @@
 #include <cassert>
 #include <cstring>
 #include <sstream>
+#include <typeinfo>
 
 #include "sv_scoped.h"
 
@@ -16,6 +17,13 @@ extern "C" {
 void simutil_memload(const char *file);
 int simutil_set_mem(int index, const svBitVecVal *val);
 int simutil_get_mem(int index, svBitVecVal *val);
+
+// These are declared weak so that we can fall back to the functions above if
+// the design was built with an older prim_util_memload.svh.
+int simutil_set_mem_batch(int count, const int *indices,
+                          const svBitVecVal *vals) __attribute__((weak));
+int simutil_get_mem_batch(int count, const int *indices,
+                          svBitVecVal *vals) __attribute__((weak));
 }
 
 MemArea::MemArea(const std::string &scope, uint32_t num_words,
@@ -27,29 +35,75 @@ MemArea::MemArea(const std::string &scope, uint32_t num_words,
 
 void MemArea::Write(uint32_t word_offset,
                     const std::vector<uint8_t> &data) const {
-  // This "mini buffer" is used to transfer each write to SystemVerilog.
-  // `simutil_set_mem` takes a fixed SV_MEM_WIDTH_BITS-bit vector but it will
-  // only use the bits required for the RAM width. As an example, for a 32-bit
-  // wide RAM only elements 3:0 of `minibuf` will be written to memory. Since
-  // the simulator may still read bits from minibuf it does not use, we must
-  // use a fixed allocation of the full bit vector size to avoid an out of
-  // bounds access.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  // These buffers are used to transfer writes to SystemVerilog, one word of
+  // SV_MEM_WIDTH_BYTES bytes at a time. `simutil_set_mem_batch` takes fixed
+  // SV_MEM_WIDTH_BITS-bit vectors but it will only use the bits required for
+  // the RAM width. As an example, for a 32-bit wide RAM only elements 3:0 of
+  // each buffer will be written to memory. Since the simulator may still read
+  // bits that it does not use, each buffer is the full bit vector size. Only
+  // allocate as many buffers as the access needs, since small accesses are
+  // common: WriteFromBufs() and ReadToBufs() pass a short batch to the
+  // simulator through a full-size staging buffer.
+  uint32_t phys_addrs[SV_MEM_BATCH_WORDS];
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
+
+  uint32_t data_words = (data.size() + width_byte_ - 1) / width_byte_;
+  assert(word_offset + data_words <= num_words_);
+
+  std::vector<uint8_t> bufs(BatchBufsSize(data_words));
+
+  StartAccess();
+
+  for (uint32_t i = 0; i < data_words; i += SV_MEM_BATCH_WORDS) {
+    uint32_t count = std::min(data_words - i, (uint32_t)SV_MEM_BATCH_WORDS);
+    FillBufs(phys_addrs, bufs.data(), count, data, i * width_byte_,
+             word_offset + i);
+    WriteFromBufs(phys_addrs, bufs.data(), count, word_offset + i);
+  }
+}
+
+void MemArea::PrepareWrite(PreparedWrite *prep, uint32_t word_offset,
+                           const std::vector<uint8_t> &data) const {
+  assert(prep);
 
   uint32_t data_words = (data.size() + width_byte_ - 1) / width_byte_;
   assert(word_offset + data_words <= num_words_);
 
-  for (uint32_t i = 0; i < data_words; ++i) {
-    uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
+  // As in Write, each buffer is a full SV_MEM_WIDTH_BYTES bytes. There are
+  // only data_words of them: WriteFromBufs() pads a short final batch.
+  prep->word_offset = word_offset;
+  prep->phys_addrs.resize(data_words);
+  prep->bufs.assign((size_t)data_words * SV_MEM_WIDTH_BYTES, 0);
+
+  FillBufs(prep->phys_addrs.data(), prep->bufs.data(), data_words, data, 0,
+           word_offset);
+}
+
+void MemArea::CommitWrite(const PreparedWrite &prep) const {
+  assert(prep.bufs.size() == prep.phys_addrs.size() * SV_MEM_WIDTH_BYTES);
+
+  CommitWords(prep.word_offset, prep.phys_addrs.data(), prep.bufs.data(),
+              prep.phys_addrs.size());
+}
+
+void MemArea::CommitWords(uint32_t word_offset, const uint32_t *phys_addrs,
+                          const uint8_t *bufs, uint32_t count) const {
+  assert(word_offset + count <= num_words_);
 
-    WriteBuffer(minibuf, data, i * width_byte_, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
+  for (uint32_t i = 0; i < count; i += SV_MEM_BATCH_WORDS) {
+    uint32_t batch = std::min(count - i, (uint32_t)SV_MEM_BATCH_WORDS);
+    WriteFromBufs(&phys_addrs[i], &bufs[(size_t)i * SV_MEM_WIDTH_BYTES], batch,
+                  word_offset + i);
   }
 }
 
+std::string MemArea::GetLayoutId() const {
+  std::ostringstream oss;
+  oss << typeid(*this).name() << " " << scope_ << " " << num_words_ << "x"
+      << width_byte_;
+  return oss.str();
+}
+
 std::vector<uint8_t> MemArea::Read(uint32_t word_offset,
                                    uint32_t num_words) const {
   assert(word_offset + num_words <= num_words_);
@@ -57,20 +111,26 @@ std::vector<uint8_t> MemArea::Read(uint32_t word_offset,
   uint32_t num_bytes = width_byte_ * num_words;
   assert(num_words <= num_bytes);
 
-  // See Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  // See Write for an explanation for these buffers.
+  std::vector<uint8_t> bufs(BatchBufsSize(num_words));
+  uint32_t phys_addrs[SV_MEM_BATCH_WORDS];
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   std::vector<uint8_t> ret;
   ret.reserve(num_bytes);
 
-  for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+  StartAccess();
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBuffer(ret, minibuf, src_word);
+  for (uint32_t i = 0; i < num_words; i += SV_MEM_BATCH_WORDS) {
+    uint32_t count = std::min(num_words - i, (uint32_t)SV_MEM_BATCH_WORDS);
+
+    for (uint32_t j = 0; j < count; ++j) {
+      phys_addrs[j] = ToPhysAddr(word_offset + i + j);
+    }
+    ReadToBufs(bufs.data(), phys_addrs, count);
+    for (uint32_t j = 0; j < count; ++j) {
+      ReadBuffer(ret, &bufs[j * SV_MEM_WIDTH_BYTES], word_offset + i + j);
+    }
   }
 
   return ret;
@@ -101,23 +161,87 @@ void MemArea::ReadBuffer(std::vector<uint8_t> &data,
               std::back_inserter(data));
 }
 
-void MemArea::ReadToMinibuf(uint8_t *minibuf, uint32_t phys_addr) const {
+void MemArea::ReadToBufs(uint8_t *bufs, const uint32_t *phys_addrs,
+                         uint32_t count) const {
+  assert(count <= SV_MEM_BATCH_WORDS);
+
   SVScoped scoped(scope_);
-  if (!simutil_get_mem(phys_addr, (svBitVecVal *)minibuf)) {
-    std::ostringstream oss;
-    oss << "Could not read memory word at physical index 0x" << std::hex
-        << phys_addr << ".";
-    throw std::runtime_error(oss.str());
+  if (simutil_get_mem_batch) {
+    int indices[SV_MEM_BATCH_WORDS] = {};
+    std::copy_n(phys_addrs, count, indices);
+
+    // The simulator writes back a whole batch of SV_MEM_BATCH_WORDS buffers,
+    // so a short batch is read into a full-size buffer and copied out.
+    uint8_t staging[SV_MEM_BATCH_WORDS * SV_MEM_WIDTH_BYTES];
+    uint8_t *batch_bufs = (count < SV_MEM_BATCH_WORDS) ? staging : bufs;
+    if (simutil_get_mem_batch(count, indices, (svBitVecVal *)batch_bufs)) {
+      if (batch_bufs != bufs) {
+        memcpy(bufs, staging, (size_t)count * SV_MEM_WIDTH_BYTES);
+      }
+      return;
+    }
+    // If the batch failed, fall through to reading the words one at a time,
+    // which will give a helpful error message for the word that failed.
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    uint8_t *buf = bufs + i * SV_MEM_WIDTH_BYTES;
+    if (!simutil_get_mem(phys_addrs[i], (svBitVecVal *)buf)) {
+      std::ostringstream oss;
+      oss << "Could not read memory word at physical index 0x" << std::hex
+          << phys_addrs[i] << ".";
+      throw std::runtime_error(oss.str());
+    }
   }
 }
 
-void MemArea::WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
-                               uint32_t dst_word) const {
+void MemArea::WriteFromBufs(const uint32_t *phys_addrs, const uint8_t *bufs,
+                            uint32_t count, uint32_t first_dst_word) const {
+  assert(count <= SV_MEM_BATCH_WORDS);
+
   SVScoped scoped(scope_);
-  if (!simutil_set_mem(phys_addr, (const svBitVecVal *)minibuf)) {
-    std::ostringstream oss;
-    oss << "Could not set memory at byte offset 0x" << std::hex
-        << dst_word * width_byte_ << ".";
-    throw std::runtime_error(oss.str());
+  if (simutil_set_mem_batch) {
+    int indices[SV_MEM_BATCH_WORDS] = {};
+    std::copy_n(phys_addrs, count, indices);
+
+    // The simulator copies a whole batch of SV_MEM_BATCH_WORDS buffers, not
+    // just the first count, so a short batch (such as the tail of a
+    // PreparedWrite or a cached image) goes through a full-size buffer.
+    uint8_t staging[SV_MEM_BATCH_WORDS * SV_MEM_WIDTH_BYTES];
+    const uint8_t *batch_bufs = bufs;
+    if (count < SV_MEM_BATCH_WORDS) {
+      size_t len = (size_t)count * SV_MEM_WIDTH_BYTES;
+      memcpy(staging, bufs, len);
+      memset(staging + len, 0, sizeof staging - len);
+      batch_bufs = staging;
+    }
+
+    if (simutil_set_mem_batch(count, indices,
+                              (const svBitVecVal *)batch_bufs)) {
+      return;
+    }
+    // As in ReadToBufs, fall back to writing the words one at a time to
+    // find the word that failed.
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint8_t *buf = bufs + i * SV_MEM_WIDTH_BYTES;
+    if (!simutil_set_mem(phys_addrs[i], (const svBitVecVal *)buf)) {
+      std::ostringstream oss;
+      oss << "Could not set memory at byte offset 0x" << std::hex
+          << (first_dst_word + i) * width_byte_ << ".";
+      throw std::runtime_error(oss.str());
+    }
+  }
+}
+
+void MemArea::FillBufs(uint32_t *phys_addrs, uint8_t *bufs, uint32_t count,
+                       const std::vector<uint8_t> &data, size_t data_idx,
+                       uint32_t first_dst_word) const {
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t dst_word = first_dst_word + i;
+    phys_addrs[i] = ToPhysAddr(dst_word);
+    WriteBuffer(&bufs[i * SV_MEM_WIDTH_BYTES], data, data_idx + i * width_byte_,
+                dst_word);
   }
 }
@@ -5,6 +5,7 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_CPP_MEM_AREA_H_
 #define OPENTITAN_HW_DV_VERILATOR_CPP_MEM_AREA_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -18,6 +19,11 @@
 // using the svBitVecVal type, we have to round up to the next 32-bit word.
 #define SV_MEM_WIDTH_BYTES (4 * ((SV_MEM_WIDTH_BITS + 31) / 32))
 
+// This is the maximum number of memory words that can be transferred with a
+// single call to simutil_set_mem_batch or simutil_get_mem_batch (see
+// prim_util_memload.svh).
+#define SV_MEM_BATCH_WORDS 256
+
 /**
  * A "memory area", representing a memory in the simulated design.
  */
@@ -74,6 +80,74 @@ class MemArea {
   /** Use \c simutil_memload to load a vmem file into the memory */
   virtual void LoadVmem(const std::string &path) const;
 
+  /** The physical memory words for a write, computed by PrepareWrite() */
+  struct PreparedWrite {
+    uint32_t word_offset;
+    std::vector<uint32_t> phys_addrs;
+    // One buffer of SV_MEM_WIDTH_BYTES bytes for each entry of phys_addrs
+    std::vector<uint8_t> bufs;
+  };
+
+  /** Prepare for a read or write of the memory
+   *
+   * This is called at the start of Read() and Write() (and any similar
+   * methods in subclasses) before any calls to ToPhysAddr(), WriteBuffer() or
+   * ReadBuffer(). Subclasses whose layout depends on state in the design
+   * (such as a scrambling key) can fetch that state here, rather than once
+   * per word. The default implementation does nothing.
+   *
+   * Callers of PrepareWrite() must call this first (on the simulator thread).
+   */
+  virtual void StartAccess() const {}
+
+  /** Compute the physical memory words for a write, without sending them to
+   * the simulator
+   *
+   * Calling PrepareWrite() and then CommitWrite() is equivalent to calling
+   * Write() with the same arguments, except that StartAccess() must be called
+   * first. PrepareWrite() doesn't call into the simulator, so it can run on a
+   * worker thread, but two threads must not prepare writes for the same
+   * memory area at the same time.
+   *
+   * @param prep        Gets the physical addresses and data for the write
+   *
+   * @param word_offset The offset, in words, of the first word that should be
+   *                    written.
+   *
+   * @param data        The data that should be written (as for Write()).
+   */
+  void PrepareWrite(PreparedWrite *prep, uint32_t word_offset,
+                    const std::vector<uint8_t> &data) const;
+
+  /** Send a write that was computed by PrepareWrite() to the simulator
+   *
+   * This must be called on the simulator thread and can throw the same
+   * exceptions as Write().
+   */
+  void CommitWrite(const PreparedWrite &prep) const;
+
+  /** Send count prepared words to the simulator
+   *
+   * This is like CommitWrite(), but takes the physical addresses and buffers
+   * (SV_MEM_WIDTH_BYTES bytes per word) as raw arrays. This lets words that
+   * were prepared earlier and stored somewhere else (such as a file) be
+   * written without copying them into a PreparedWrite first.
+   */
+  void CommitWords(uint32_t word_offset, const uint32_t *phys_addrs,
+                   const uint8_t *bufs, uint32_t count) const;
+
+  /** Return a string that identifies how this memory lays out its data
+   *
+   * Two memory areas with the same layout ID will make the same physical
+   * words from the same data. This is used to key cached images (see
+   * MemImageCache), so subclasses whose layout depends on state (such as a
+   * scrambling key) must include that state. The default implementation
+   * gives the dynamic type, scope and geometry of the memory.
+   *
+   * Like PrepareWrite(), this must be called after StartAccess().
+   */
+  virtual std::string GetLayoutId() const;
+
   const std::string &GetScope() const { return scope_; }
   uint32_t GetSizeWords() const { return num_words_; }
   uint32_t GetSizeBytes() const { return num_words_ * width_byte_; }
@@ -131,20 +205,48 @@ class MemArea {
     return logical_addr;
   }
 
-  /** Read the memory word at phys_addr into minibuf
+  /** Size in bytes of the buffers for accessing num_words words
+   *
+   * This is enough for one batch of up to SV_MEM_BATCH_WORDS words (see
+   * ReadToBufs() and WriteFromBufs()), but no more than num_words need. The
+   * batch functions stage a shorter batch in a full-size buffer of their own.
+   */
+  static size_t BatchBufsSize(uint32_t num_words) {
+    return (size_t)std::min(num_words, (uint32_t)SV_MEM_BATCH_WORDS) *
+           SV_MEM_WIDTH_BYTES;
+  }
+
+  /** Read count memory words into bufs
+   *
+   * bufs should hold count buffers, each SV_MEM_WIDTH_BYTES in size, and
+   * phys_addrs should hold the count physical addresses to read. count must be
+   * at most SV_MEM_BATCH_WORDS. This uses \c simutil_get_mem_batch if the
+   * design provides it (reading a shorter batch through a full-size buffer),
+   * falling back to one \c simutil_get_mem call per word if not.
+   */
+  void ReadToBufs(uint8_t *bufs, const uint32_t *phys_addrs,
+                  uint32_t count) const;
+
+  /** Write count memory words from bufs
    *
-   * minibuf should be at least SV_MEM_WIDTH_BYTES in size. See the
-   * implementation of MemArea::Write() for the details.
+   * This is the counterpart to ReadToBufs(), using \c simutil_set_mem_batch
+   * if possible. bufs only needs to hold count buffers: a shorter batch is
+   * copied into a full-size buffer first. The logical addresses of the words
+   * should be consecutive, starting at first_dst_word (these are just used
+   * for error messages).
    */
-  void ReadToMinibuf(uint8_t *minibuf, uint32_t phys_addr) const;
+  void WriteFromBufs(const uint32_t *phys_addrs, const uint8_t *bufs,
+                     uint32_t count, uint32_t first_dst_word) const;
 
-  /** Write from minibuf to the memory word at phys_addr
+  /** Fill in count physical addresses and buffers for a write
    *
-   * minibuf should be at least SV_MEM_WIDTH_BYTES in size. See the
-   * implementation of MemArea::Write() for the details.
+   * The words come from data, starting at index data_idx, and are written to
+   * consecutive logical addresses starting at first_dst_word. This calls
+   * ToPhysAddr() and WriteBuffer() for each word.
    */
-  void WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
-                        uint32_t dst_word) const;
+  void FillBufs(uint32_t *phys_addrs, uint8_t *bufs, uint32_t count,
+                const std::vector<uint8_t> &data, size_t data_idx,
+                uint32_t first_dst_word) const;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_MEM_AREA_H_
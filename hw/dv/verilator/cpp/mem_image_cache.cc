@@ -0,0 +1,283 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "mem_image_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An entry file starts with kMagic, then the format version and
+// SV_MEM_WIDTH_BYTES (as 32-bit words) and then the key (a 32-bit length and
+// then the key itself, padded to a multiple of 4 bytes). This is followed by
+// the number of regions and then, for each region, the number of runs of
+// words. Each run is a word offset and count, the count physical addresses
+// and then count buffers of SV_MEM_WIDTH_BYTES bytes.
+//
+// Everything is in host byte order and each field is 4-byte aligned, so the
+// addresses and buffers can be used in place. Bump kVersion if the format
+// changes. Changes to the physical words for a given layout ID (for example,
+// after a change to the ECC or scrambling code) are caught by the encoding
+// digest in the key.
+static const char kMagic[8] = {'O', 'T', 'M', 'E', 'M', 'I', 'M', 'G'};
+static const uint32_t kVersion = 1;
+
+static_assert(SV_MEM_WIDTH_BYTES % 4 == 0,
+              "Buffers must keep the following fields aligned");
+
+// 64-bit FNV-1a hash of len bytes at data, continuing from hash
+static uint64_t Fnv1a(uint64_t hash, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+static const uint64_t kFnv1aInit = 0xcbf29ce484222325;
+
+// The number of words of test vector used by EncodingDigest()
+static const uint32_t kDigestWords = 4;
+
+namespace {
+// Reads fields from an entry file, checking that they are in bounds
+class EntryReader {
+ public:
+  EntryReader(const uint8_t *data, size_t size)
+      : data_(data), size_(size), pos_(0) {}
+
+  bool GetU32(uint32_t *val) {
+    const uint8_t *ptr = Get(4);
+    if (!ptr)
+      return false;
+    memcpy(val, ptr, 4);
+    return true;
+  }
+
+  // Return a pointer to the next len bytes (padded to a multiple of 4) and
+  // skip over them, or return null if there aren't enough left.
+  const uint8_t *Get(size_t len) {
+    size_t padded = (len + 3) & ~(size_t)3;
+    if (padded < len || size_ - pos_ < padded)
+      return nullptr;
+    const uint8_t *ret = data_ + pos_;
+    pos_ += padded;
+    return ret;
+  }
+
+  bool AtEnd() const { return pos_ == size_; }
+
+ private:
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+};
+}  // namespace
+
+static void PutU32(std::string *dst, uint32_t val) {
+  dst->append(reinterpret_cast<const char *>(&val), 4);
+}
+
+MemImageCache::Entry::~Entry() { munmap(map_, map_size_); }
+
+MemImageCache::MemImageCache(const std::string &dir) : dir_(dir) {
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+    std::ostringstream oss;
+    oss << "Could not create memory image cache directory `" << dir
+        << "': " << strerror(errno);
+    throw std::runtime_error(oss.str());
+  }
+}
+
+std::string MemImageCache::MakeKey(const std::string &image_path,
+                                   const std::string &params) const {
+  int fd = open(image_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::ostringstream oss;
+    oss << "Could not read image file `" << image_path
+        << "': " << strerror(errno);
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error(oss.str());
+  }
+
+  size_t size = st.st_size;
+  uint64_t hash = kFnv1aInit;
+  if (size > 0) {
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      std::ostringstream oss;
+      oss << "Could not map image file `" << image_path
+          << "': " << strerror(errno);
+      close(fd);
+      throw std::runtime_error(oss.str());
+    }
+    hash = Fnv1a(hash, static_cast<const uint8_t *>(data), size);
+    munmap(data, size);
+  }
+  close(fd);
+
+  std::ostringstream oss;
+  oss << "image " << std::hex << std::setfill('0') << std::setw(16) << hash
+      << std::dec << " " << size << "\n"
+      << params;
+  return oss.str();
+}
+
+std::string MemImageCache::EncodingDigest(const MemArea &mem_area) {
+  uint32_t num_words = std::min(kDigestWords, mem_area.GetSizeWords());
+  std::vector<uint8_t> data((size_t)num_words * mem_area.GetWidthByte());
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (uint8_t)(0x5a + 0x3b * i);
+  }
+
+  MemArea::PreparedWrite prep;
+  mem_area.PrepareWrite(&prep, 0, data);
+
+  uint64_t hash = Fnv1a(
+      kFnv1aInit, reinterpret_cast<const uint8_t *>(prep.phys_addrs.data()),
+      prep.phys_addrs.size() * sizeof(uint32_t));
+  hash = Fnv1a(hash, prep.bufs.data(), prep.bufs.size());
+
+  std::ostringstream oss;
+  oss << "enc-" << std::hex << std::setfill('0') << std::setw(16) << hash;
+  return oss.str();
+}
+
+std::unique_ptr<MemImageCache::Entry> MemImageCache::Load(
+    const std::string &key, const std::vector<uint32_t> &region_words) const {
+  size_t num_regions = region_words.size();
+
+  int fd = open(GetPath(key).c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  std::unique_ptr<Entry> entry(new Entry(map, st.st_size));
+  EntryReader reader(static_cast<const uint8_t *>(map), st.st_size);
+
+  // Check the header matches. We compare the whole key (not just the hash
+  // that gives the file name).
+  uint32_t version, width_bytes, key_len, file_regions;
+  const uint8_t *magic = reader.Get(sizeof kMagic);
+  if (!magic || memcmp(magic, kMagic, sizeof kMagic) != 0 ||
+      !reader.GetU32(&version) || version != kVersion ||
+      !reader.GetU32(&width_bytes) || width_bytes != SV_MEM_WIDTH_BYTES ||
+      !reader.GetU32(&key_len) || key_len != key.size())
+    return nullptr;
+  const uint8_t *file_key = reader.Get(key_len);
+  if (!file_key || memcmp(file_key, key.data(), key_len) != 0 ||
+      !reader.GetU32(&file_regions) || file_regions != num_regions)
+    return nullptr;
+
+  entry->regions_.resize(num_regions);
+  for (size_t r = 0; r < num_regions; ++r) {
+    std::vector<Words> &runs = entry->regions_[r];
+    uint32_t num_runs;
+    if (!reader.GetU32(&num_runs))
+      return nullptr;
+    for (uint32_t i = 0; i < num_runs; ++i) {
+      Words words;
+      if (!reader.GetU32(&words.word_offset) || !reader.GetU32(&words.count) ||
+          words.word_offset > region_words[r] ||
+          words.count > region_words[r] - words.word_offset)
+        return nullptr;
+      const uint8_t *phys_addrs = reader.Get((size_t)words.count * 4);
+      words.bufs = reader.Get((size_t)words.count * SV_MEM_WIDTH_BYTES);
+      if (!phys_addrs || !words.bufs)
+        return nullptr;
+      words.phys_addrs = reinterpret_cast<const uint32_t *>(phys_addrs);
+      runs.push_back(words);
+    }
+  }
+
+  if (!reader.AtEnd())
+    return nullptr;
+
+  return entry;
+}
+
+void MemImageCache::Store(
+    const std::string &key,
+    const std::vector<const std::vector<MemArea::PreparedWrite> *> &regions)
+    const {
+  std::string header(kMagic, sizeof kMagic);
+  PutU32(&header, kVersion);
+  PutU32(&header, SV_MEM_WIDTH_BYTES);
+  PutU32(&header, key.size());
+  header.append(key);
+  header.append((4 - key.size() % 4) % 4, '\0');
+  PutU32(&header, regions.size());
+
+  // Write to a temporary file and then rename it into place, so that other
+  // simulations using the same cache never see a partial entry.
+  std::string path = GetPath(key);
+  std::ostringstream tmp_path;
+  tmp_path << path << ".tmp." << getpid();
+
+  FILE *file = fopen(tmp_path.str().c_str(), "wb");
+  bool ok = file && fwrite(header.data(), 1, header.size(), file) ==
+                        header.size();
+  for (const std::vector<MemArea::PreparedWrite> *writes : regions) {
+    if (!ok)
+      break;
+
+    std::string run_header;
+    PutU32(&run_header, writes->size());
+    ok = fwrite(run_header.data(), 1, run_header.size(), file) == 4;
+
+    for (const MemArea::PreparedWrite &prep : *writes) {
+      if (!ok)
+        break;
+
+      assert(prep.bufs.size() ==
+             prep.phys_addrs.size() * SV_MEM_WIDTH_BYTES);
+      run_header.clear();
+      PutU32(&run_header, prep.word_offset);
+      PutU32(&run_header, prep.phys_addrs.size());
+      size_t addrs_len = prep.phys_addrs.size() * 4;
+      ok = fwrite(run_header.data(), 1, run_header.size(), file) == 8 &&
+           fwrite(prep.phys_addrs.data(), 1, addrs_len, file) == addrs_len &&
+           fwrite(prep.bufs.data(), 1, prep.bufs.size(), file) ==
+               prep.bufs.size();
+    }
+  }
+
+  if (file && fclose(file) != 0)
+    ok = false;
+
+  if (!ok || rename(tmp_path.str().c_str(), path.c_str()) != 0) {
+    std::cerr << "WARNING: Could not write memory image cache entry `" << path
+              << "': " << strerror(errno) << std::endl;
+    unlink(tmp_path.str().c_str());
+  }
+}
+
+std::string MemImageCache::GetPath(const std::string &key) const {
+  uint64_t hash = Fnv1a(kFnv1aInit, reinterpret_cast<const uint8_t *>(
+                                        key.data()),
+                        key.size());
+  std::ostringstream oss;
+  oss << dir_ << "/" << std::hex << std::setfill('0') << std::setw(16) << hash
+      << ".img";
+  return oss.str();
+}
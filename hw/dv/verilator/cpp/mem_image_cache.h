@@ -0,0 +1,116 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_VERILATOR_CPP_MEM_IMAGE_CACHE_H_
+#define OPENTITAN_HW_DV_VERILATOR_CPP_MEM_IMAGE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mem_area.h"
+
+/**
+ * An on-disk cache of the physical memory words for loaded images
+ *
+ * Turning an image into the words that are written to a memory can mean
+ * adding ECC bits and scrambling every word. Regressions load the same images
+ * (such as the ROM) over and over, so we can save the result and reuse it.
+ *
+ * Each entry holds the prepared writes for one or more memory areas. It is
+ * keyed by a hash of the image file's contents and a description of the
+ * memories it was loaded into, including their layout IDs (see
+ * MemArea::GetLayoutId()) and encoding digests (see EncodingDigest()).
+ * Entries are in the host's byte order and are memory-mapped when they are
+ * loaded, so that their words can be passed straight to
+ * MemArea::CommitWords().
+ */
+class MemImageCache {
+ public:
+  /** A run of prepared words in a cache entry */
+  struct Words {
+    uint32_t word_offset;
+    uint32_t count;
+    const uint32_t *phys_addrs;
+    // count buffers of SV_MEM_WIDTH_BYTES bytes
+    const uint8_t *bufs;
+  };
+
+  /** A cache entry, mapped into memory */
+  class Entry {
+   public:
+    ~Entry();
+
+    /** The runs of words for each memory, in the order passed to Store() */
+    const std::vector<std::vector<Words>> &GetRegions() const {
+      return regions_;
+    }
+
+   private:
+    friend class MemImageCache;
+    Entry(void *map, size_t map_size) : map_(map), map_size_(map_size) {}
+
+    void *map_;
+    size_t map_size_;
+    std::vector<std::vector<Words>> regions_;
+  };
+
+  /**
+   * Constructor
+   *
+   * Entries are stored as files in dir, which is created if it doesn't
+   * already exist.
+   */
+  explicit MemImageCache(const std::string &dir);
+
+  /**
+   * Make the key for loading the image at image_path into the memories
+   * described by params.
+   *
+   * Throws a std::runtime_error if the image can't be read.
+   */
+  std::string MakeKey(const std::string &image_path,
+                      const std::string &params) const;
+
+  /**
+   * Return a fingerprint of the code that turns data into physical words for
+   * mem_area, to be included in the params passed to MakeKey().
+   *
+   * This is a hash of the words that mem_area prepares for a fixed test
+   * vector, so entries made before a change to the ECC or scrambling code
+   * aren't used by a simulator built after it. Like MemArea::PrepareWrite(),
+   * this must be called after MemArea::StartAccess().
+   */
+  static std::string EncodingDigest(const MemArea &mem_area);
+
+  /**
+   * Look up the entry for key, which should have data for one memory for
+   * each element of region_words, giving the size of that memory in words.
+   *
+   * Returns null if there is no such entry (or it can't be read or doesn't
+   * look right, for example because a run of words doesn't fit in its
+   * memory).
+   */
+  std::unique_ptr<Entry> Load(const std::string &key,
+                              const std::vector<uint32_t> &region_words) const;
+
+  /**
+   * Store an entry for key, with a vector of prepared writes for each memory.
+   *
+   * Failing to write the entry isn't fatal (the cache is just an
+   * optimisation), so this prints a warning rather than throwing.
+   */
+  void Store(
+      const std::string &key,
+      const std::vector<const std::vector<MemArea::PreparedWrite> *> &regions)
+      const;
+
+ private:
+  std::string GetPath(const std::string &key) const;
+
+  std::string dir_;
+};
+
+#endif  // OPENTITAN_HW_DV_VERILATOR_CPP_MEM_IMAGE_CACHE_H_
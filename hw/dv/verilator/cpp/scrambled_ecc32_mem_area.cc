@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 
@@ -17,33 +18,10 @@
 static const uint32_t kScrMaxNonceWidth = 320;
 static const uint32_t kScrMaxNonceWidthByte = (kScrMaxNonceWidth + 7) / 8;
 
-// Functions to convert from integer address to/from a little-endian vector of
-// bytes, addr_width is given in bits
-static std::vector<uint8_t> AddrIntToBytes(uint32_t addr, uint32_t addr_width) {
-  uint32_t addr_width_bytes = (addr_width + 7) / 8;
-  std::vector<uint8_t> addr_bytes(addr_width_bytes);
-
-  for (uint32_t i = 0; i < addr_width_bytes; ++i) {
-    addr_bytes[i] = addr & 0xff;
-    addr >>= 8;
-  }
-
-  return addr_bytes;
-}
-
-static uint32_t AddrBytesToInt(const std::vector<uint8_t> &addr) {
-  assert(addr.size() <= 4);
-
-  uint32_t addr_out = 0;
-  int cur_shift = 0;
-
-  for (uint8_t byte : addr) {
-    addr_out |= ((uint32_t)byte << cur_shift);
-    cur_shift += 8;
-  }
-
-  return addr_out;
-}
+// Marks an entry in phys_addrs_ that hasn't been computed yet. This can't be
+// a real physical address because addresses are less than size, which is at
+// most 0xffffffff.
+static const uint32_t kNoPhysAddr = 0xffffffff;
 
 // Converts svBitVecVal (bit[m:n] SV type) into a byte vector
 static std::vector<uint8_t> ByteVecFromSV(svBitVecVal sv_val[],
@@ -159,28 +137,31 @@ void ScrambledEcc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
   ScrambleBuffer(buf, dst_word);
 }
 
-std::vector<uint8_t> ScrambledEcc32MemArea::ReadUnscrambled(
-    const uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t src_word) const {
-  std::vector<uint8_t> scrambled_data(buf, buf + GetPhysWidthByte());
-  return scramble_decrypt_data(scrambled_data, GetPhysWidth(), 39,
-                               AddrIntToBytes(src_word, addr_width_),
-                               addr_width_, GetScrambleNonce(),
-                               GetScrambleKey(), repeat_keystream_, false);
+void ScrambledEcc32MemArea::ReadUnscrambled(
+    uint8_t dst[SV_MEM_WIDTH_BYTES], const uint8_t buf[SV_MEM_WIDTH_BYTES],
+    uint32_t src_word) const {
+  const uint8_t *keystream = GetKeystream(src_word);
+  uint32_t phys_width_byte = GetPhysWidthByte();
+  for (uint32_t i = 0; i < phys_width_byte; ++i) {
+    dst[i] = buf[i] ^ keystream[i];
+  }
 }
 
 void ScrambledEcc32MemArea::ReadBuffer(std::vector<uint8_t> &data,
                                        const uint8_t buf[SV_MEM_WIDTH_BYTES],
                                        uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word);
   // Strip integrity to give final result
-  Ecc32MemArea::ReadBuffer(data, &unscrambled_data[0], src_word);
+  Ecc32MemArea::ReadBuffer(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::ReadBufferWithIntegrity(
     EccWords &data, const uint8_t buf[SV_MEM_WIDTH_BYTES],
     uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
-  Ecc32MemArea::ReadBufferWithIntegrity(data, &unscrambled_data[0], src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word);
+  Ecc32MemArea::ReadBufferWithIntegrity(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
@@ -192,21 +173,74 @@ void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
 
 void ScrambledEcc32MemArea::ScrambleBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                            uint32_t dst_word) const {
-  std::vector<uint8_t> scramble_buf(buf, buf + GetPhysWidthByte());
+  // Scramble data with integrity. With the S&P layer disabled, this is just
+  // an XOR with the keystream.
+  const uint8_t *keystream = GetKeystream(dst_word);
+  uint32_t phys_width_byte = GetPhysWidthByte();
+  for (uint32_t i = 0; i < phys_width_byte; ++i) {
+    buf[i] ^= keystream[i];
+  }
+}
+
+void ScrambledEcc32MemArea::StartAccess() const {
+  std::vector<uint8_t> key = GetScrambleKey();
+  std::vector<uint8_t> nonce = GetScrambleNonce();
+  if (key == key_ && nonce == nonce_) {
+    return;
+  }
 
-  // Scramble data with integrity
-  scramble_buf = scramble_encrypt_data(
-      scramble_buf, GetPhysWidth(), 39, AddrIntToBytes(dst_word, addr_width_),
-      addr_width_, GetScrambleNonce(), GetScrambleKey(), repeat_keystream_,
-      false);
+  // The key or nonce has changed (or this is the first access), so any cached
+  // addresses and keystreams are stale.
+  key_.swap(key);
+  nonce_.swap(nonce);
+  phys_addrs_.assign(num_words_, kNoPhysAddr);
+  keystreams_.assign((size_t)num_words_ * GetPhysWidthByte(), 0);
+  keystream_valid_.assign(num_words_, false);
+}
+
+std::string ScrambledEcc32MemArea::GetLayoutId() const {
+  assert(!key_.empty() && "StartAccess() must be called first.");
 
-  // Copy scrambled data to write buffer
-  std::copy(scramble_buf.begin(), scramble_buf.end(), &buf[0]);
+  // The physical words also depend on the scrambling key and nonce
+  std::ostringstream oss;
+  oss << Ecc32MemArea::GetLayoutId() << " repeat=" << repeat_keystream_
+      << " key=" << std::hex << std::setfill('0');
+  for (uint8_t byte : key_) {
+    oss << std::setw(2) << (unsigned)byte;
+  }
+  oss << " nonce=";
+  for (uint8_t byte : nonce_) {
+    oss << std::setw(2) << (unsigned)byte;
+  }
+  return oss.str();
 }
 
 uint32_t ScrambledEcc32MemArea::ToPhysAddr(uint32_t logical_addr) const {
-  // Scramble logical address to get physical address
-  return AddrBytesToInt(scramble_addr(AddrIntToBytes(logical_addr, addr_width_),
-                                      addr_width_, GetScrambleNonce(),
-                                      GetNonceWidth()));
+  assert(!nonce_.empty() && "StartAccess() must be called first.");
+  assert(logical_addr < num_words_);
+
+  uint32_t &phys_addr = phys_addrs_[logical_addr];
+  if (phys_addr == kNoPhysAddr) {
+    // Scramble logical address to get physical address
+    uint64_t addr_in = logical_addr, addr_out;
+    scramble_addr_batch(&addr_in, &addr_out, 1, addr_width_, nonce_,
+                        GetNonceWidth());
+    phys_addr = addr_out;
+  }
+  return phys_addr;
+}
+
+const uint8_t *ScrambledEcc32MemArea::GetKeystream(uint32_t word) const {
+  assert(!key_.empty() && "StartAccess() must be called first.");
+  assert(word < num_words_);
+
+  uint32_t phys_width_byte = GetPhysWidthByte();
+  uint8_t *keystream = &keystreams_[(size_t)word * phys_width_byte];
+  if (!keystream_valid_[word]) {
+    uint64_t addr = word;
+    scramble_data_keystream_batch(keystream, &addr, 1, addr_width_, nonce_,
+                                  key_, GetPhysWidth(), repeat_keystream_);
+    keystream_valid_[word] = true;
+  }
+  return keystream;
 }
@@ -32,13 +32,18 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
   ScrambledEcc32MemArea(const std::string &scope, uint32_t size,
                         uint32_t width_32, bool repeat_keystream = true);
 
+  void StartAccess() const override;
+
+  std::string GetLayoutId() const override;
+
  private:
   void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                    const std::vector<uint8_t> &data, size_t start_idx,
                    uint32_t dst_word) const override;
 
-  std::vector<uint8_t> ReadUnscrambled(const uint8_t buf[SV_MEM_WIDTH_BYTES],
-                                       uint32_t src_word) const;
+  void ReadUnscrambled(uint8_t dst[SV_MEM_WIDTH_BYTES],
+                       const uint8_t buf[SV_MEM_WIDTH_BYTES],
+                       uint32_t src_word) const;
 
   void ReadBuffer(std::vector<uint8_t> &data,
                   const uint8_t buf[SV_MEM_WIDTH_BYTES],
@@ -56,6 +61,9 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
 
   uint32_t ToPhysAddr(uint32_t logical_addr) const override;
 
+  // Return the keystream for the given logical word (GetPhysWidthByte() bytes)
+  const uint8_t *GetKeystream(uint32_t word) const;
+
   uint32_t GetPhysWidth() const;
   uint32_t GetPhysWidthByte() const;
   uint32_t GetPrinceReplications() const;
@@ -68,6 +76,19 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
   std::string scr_scope_;
   uint32_t addr_width_;
   bool repeat_keystream_;
+
+  // The scrambling key and nonce, fetched from the design by StartAccess().
+  // Fetching these over DPI is relatively slow, so we do it once per access
+  // rather than once per word.
+  mutable std::vector<uint8_t> key_;
+  mutable std::vector<uint8_t> nonce_;
+
+  // Per-word tables of physical addresses and keystreams for key_ and nonce_.
+  // These are filled in the first time each word is accessed and thrown away
+  // by StartAccess() if the key or nonce changes.
+  mutable std::vector<uint32_t> phys_addrs_;
+  mutable std::vector<uint8_t> keystreams_;
+  mutable std::vector<bool> keystream_valid_;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_SCRAMBLED_ECC32_MEM_AREA_H_
@@ -39,6 +39,29 @@ class SimCtrlExtension {
    */
   virtual void OnClock(unsigned long sim_time) {}
 
+  /**
+   * Does this extension need OnClock() to be called?
+   *
+   * If no registered extension needs it (and tracing is disabled),
+   * VerilatorSimCtrl runs the clock in batches without calling OnClock() at
+   * all, which is noticeably faster for long simulations. Extensions that
+   * don't override OnClock() should override this to return false.
+   *
+   * An extension that only needs to act occasionally can return false here
+   * and use VerilatorSimCtrl::ScheduleWakeup() to get OnWakeup() calls at the
+   * cycles it cares about instead.
+   */
+  virtual bool NeedsOnClock() const { return true; }
+
+  /**
+   * Function to be called on the rising clock edge of a cycle requested with
+   * VerilatorSimCtrl::ScheduleWakeup()
+   *
+   * An extension that wants to be woken up periodically can schedule its
+   * next wakeup from here.
+   */
+  virtual void OnWakeup(unsigned long sim_time) {}
+
   /**
    * Function to be called after executing the simulation
    */
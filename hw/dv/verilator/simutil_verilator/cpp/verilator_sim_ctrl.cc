@@ -15,6 +15,10 @@
 #define VM_TRACE 0
 #endif
 
+// The number of clock cycles to run between checks for stop requests when
+// using the fast path in VerilatorSimCtrl::Run().
+static const unsigned long kFastPathBatchCycles = 1024;
+
 /**
  * Get the current simulation time
  *
@@ -226,6 +230,19 @@ void VerilatorSimCtrl::RegisterExtension(SimCtrlExtension *ext) {
   extension_array_.push_back(ext);
 }
 
+void VerilatorSimCtrl::ScheduleWakeup(SimCtrlExtension *ext,
+                                      unsigned long cycle) {
+  assert(ext);
+
+  // We might be part way through the current cycle (or calling OnWakeup() for
+  // it), so the earliest we can promise is the next one.
+  unsigned long next_cycle = time_ / 2 + 1;
+  if (cycle < next_cycle) {
+    cycle = next_cycle;
+  }
+  wakeups_.push({cycle, wakeup_seq_++, ext});
+}
+
 VerilatorSimCtrl::VerilatorSimCtrl()
     : top_(nullptr),
       time_(0),
@@ -243,7 +260,10 @@ VerilatorSimCtrl::VerilatorSimCtrl()
       request_stop_(false),
       simulation_success_(true),
       tracer_(VerilatedTracer()),
-      term_after_cycles_(0) {
+      term_after_cycles_(0),
+      start_reset_cycle_(0),
+      end_reset_cycle_(0),
+      wakeup_seq_(0) {
 }
 
 void VerilatorSimCtrl::RegisterSignalHandler() {
@@ -351,56 +371,141 @@ void VerilatorSimCtrl::Run() {
   UnsetReset();
   Trace();
 
-  unsigned long start_reset_cycle_ = initial_reset_delay_cycles_;
-  unsigned long end_reset_cycle_ = start_reset_cycle_ + reset_duration_cycles_;
+  start_reset_cycle_ = initial_reset_delay_cycles_;
+  end_reset_cycle_ = start_reset_cycle_ + reset_duration_cycles_;
+
+  bool fast_path_possible = CanUseFastPath();
 
   while (1) {
-    unsigned long cycle_ = time_ / 2;
+    // Tracing can be toggled at runtime, so check whether we can use the fast
+    // path before each batch. Checking tracing_enabled_changed_ as well means
+    // we go through Trace() to print a message when tracing is turned off.
+    if (fast_path_possible && !TracingEnabled() && !tracing_enabled_changed_ &&
+        time_ % 2 == 0 && !WakeupDue()) {
+      RunBatch();
+    } else {
+      RunHalfCycle();
+    }
 
-    if (cycle_ == start_reset_cycle_) {
-      SetReset();
-    } else if (cycle_ == end_reset_cycle_) {
-      UnsetReset();
+    if (ShouldStop()) {
+      break;
     }
+  }
 
-    *sig_clk_ = !*sig_clk_;
+  top_->final();
+  time_end_ = std::chrono::steady_clock::now();
 
-    // Call all extension on-clock methods
-    if (*sig_clk_) {
-      for (auto it = extension_array_.begin(); it != extension_array_.end();
-           ++it) {
-        (*it)->OnClock(time_);
-      }
+  if (TracingEverEnabled()) {
+    tracer_.close();
+  }
+}
+
+bool VerilatorSimCtrl::CanUseFastPath() const {
+  for (auto it = extension_array_.begin(); it != extension_array_.end(); ++it) {
+    if ((*it)->NeedsOnClock()) {
+      return false;
     }
+  }
+  return true;
+}
 
-    top_->eval();
-    time_++;
+void VerilatorSimCtrl::RunHalfCycle() {
+  unsigned long cycle_ = time_ / 2;
 
-    Trace();
+  if (cycle_ == start_reset_cycle_) {
+    SetReset();
+  } else if (cycle_ == end_reset_cycle_) {
+    UnsetReset();
+  }
 
-    if (request_stop_) {
-      std::cout << "Received stop request, shutting down simulation."
-                << std::endl;
-      break;
-    }
-    if (Verilated::gotFinish()) {
-      std::cout << "Received $finish() from Verilog, shutting down simulation."
-                << std::endl;
-      break;
-    }
-    if (term_after_cycles_ && (time_ / 2 >= term_after_cycles_)) {
-      std::cout << "Simulation timeout of " << term_after_cycles_
-                << " cycles reached, shutting down simulation." << std::endl;
-      break;
+  *sig_clk_ = !*sig_clk_;
+
+  // Call all extension on-clock methods
+  if (*sig_clk_) {
+    for (auto it = extension_array_.begin(); it != extension_array_.end();
+         ++it) {
+      (*it)->OnClock(time_);
     }
+    RunWakeups();
   }
 
-  top_->final();
-  time_end_ = std::chrono::steady_clock::now();
+  top_->eval();
+  time_++;
 
-  if (TracingEverEnabled()) {
-    tracer_.close();
+  Trace();
+}
+
+bool VerilatorSimCtrl::WakeupDue() const {
+  return !wakeups_.empty() && wakeups_.top().cycle <= time_ / 2;
+}
+
+void VerilatorSimCtrl::RunWakeups() {
+  // ScheduleWakeup() never schedules anything for the current cycle, so this
+  // terminates even if an extension reschedules itself.
+  while (WakeupDue()) {
+    SimCtrlExtension *ext = wakeups_.top().ext;
+    wakeups_.pop();
+    ext->OnWakeup(time_);
+  }
+}
+
+void VerilatorSimCtrl::RunBatch() {
+  assert(time_ % 2 == 0);
+
+  unsigned long cycle = time_ / 2;
+  unsigned long end_cycle = cycle + kFastPathBatchCycles;
+
+  // Stop the batch before any cycle where something needs to happen
+  if (cycle < start_reset_cycle_ && start_reset_cycle_ < end_cycle) {
+    end_cycle = start_reset_cycle_;
+  }
+  if (cycle < end_reset_cycle_ && end_reset_cycle_ < end_cycle) {
+    end_cycle = end_reset_cycle_;
+  }
+  if (cycle < term_after_cycles_ && term_after_cycles_ < end_cycle) {
+    end_cycle = term_after_cycles_;
+  }
+  if (!wakeups_.empty() && wakeups_.top().cycle < end_cycle) {
+    end_cycle = wakeups_.top().cycle;
+  }
+
+  if (cycle == start_reset_cycle_) {
+    SetReset();
+  } else if (cycle == end_reset_cycle_) {
+    UnsetReset();
+  }
+
+  // The time needs updating after every eval() because it can be read by the
+  // design (through sc_time_stamp()). We check for $finish() on every cycle
+  // because the design shouldn't be evaluated after it.
+  for (; cycle < end_cycle && !Verilated::gotFinish(); ++cycle) {
+    *sig_clk_ = !*sig_clk_;
+    top_->eval();
+    time_++;
+
+    *sig_clk_ = !*sig_clk_;
+    top_->eval();
+    time_++;
+  }
+}
+
+bool VerilatorSimCtrl::ShouldStop() const {
+  if (request_stop_) {
+    std::cout << "Received stop request, shutting down simulation."
+              << std::endl;
+    return true;
+  }
+  if (Verilated::gotFinish()) {
+    std::cout << "Received $finish() from Verilog, shutting down simulation."
+              << std::endl;
+    return true;
+  }
+  if (term_after_cycles_ && (time_ / 2 >= term_after_cycles_)) {
+    std::cout << "Simulation timeout of " << term_after_cycles_
+              << " cycles reached, shutting down simulation." << std::endl;
+    return true;
   }
+  return false;
 }
 
 std::string VerilatorSimCtrl::GetName() const {
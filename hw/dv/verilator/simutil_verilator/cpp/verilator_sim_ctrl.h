@@ -6,6 +6,8 @@
 #define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_SIM_CTRL_H_
 
 #include <chrono>
+#include <functional>
+#include <queue>
 #include <string>
 #include <vector>
 
@@ -116,6 +118,17 @@ class VerilatorSimCtrl {
    */
   void RegisterExtension(SimCtrlExtension *ext);
 
+  /**
+   * Ask for ext->OnWakeup() to be called on the rising clock edge of the given
+   * clock cycle
+   *
+   * Scheduled wakeups are kept in a min-heap, so extensions that are waiting
+   * for a wakeup cost nothing on other cycles. If cycle is not after the
+   * current cycle, the wakeup happens on the next cycle. Wakeups for the same
+   * cycle happen in the order that they were scheduled.
+   */
+  void ScheduleWakeup(SimCtrlExtension *ext, unsigned long cycle);
+
   /**
    * Get the current time in ticks
    */
@@ -141,6 +154,23 @@ class VerilatorSimCtrl {
   VerilatedTracer tracer_;
   unsigned long term_after_cycles_;
   std::vector<SimCtrlExtension *> extension_array_;
+  unsigned long start_reset_cycle_;
+  unsigned long end_reset_cycle_;
+
+  struct Wakeup {
+    unsigned long cycle;
+    // Used to break ties, so that wakeups for the same cycle happen in the
+    // order they were scheduled
+    unsigned long seq;
+    SimCtrlExtension *ext;
+
+    bool operator>(const Wakeup &other) const {
+      return cycle != other.cycle ? cycle > other.cycle : seq > other.seq;
+    }
+  };
+  std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup>>
+      wakeups_;
+  unsigned long wakeup_seq_;
 
   /**
    * Default constructor
@@ -214,9 +244,54 @@ class VerilatorSimCtrl {
    * Run the main loop of the simulation
    *
    * This function blocks until the simulation finishes.
+   *
+   * If tracing is disabled and no extension needs OnClock() (see
+   * SimCtrlExtension::NeedsOnClock()), this uses a fast path that runs the
+   * clock in batches of cycles (see RunBatch()).
    */
   void Run();
 
+  /**
+   * Can Run() use its fast path?
+   */
+  bool CanUseFastPath() const;
+
+  /**
+   * Run a single half clock cycle, including reset handling, extension
+   * callbacks and tracing.
+   */
+  void RunHalfCycle();
+
+  /**
+   * Is there a scheduled wakeup for the current cycle (or earlier)?
+   */
+  bool WakeupDue() const;
+
+  /**
+   * Call OnWakeup() for all scheduled wakeups that are due
+   */
+  void RunWakeups();
+
+  /**
+   * Run a batch of full clock cycles for the fast path in Run().
+   *
+   * Nothing is traced and no extensions are called. The batch stops early
+   * at the cycles where the reset signal changes, the simulation times out
+   * or an extension has a scheduled wakeup, so these happen on exactly the
+   * same cycles as in RunHalfCycle().
+   * Stop requests (from RequestStop() or a signal) are only noticed between
+   * batches, so the simulation may run for up to a batch of cycles after one.
+   * A $finish() stops the batch at the end of the cycle.
+   *
+   * Must be called at the start of a clock cycle.
+   */
+  void RunBatch();
+
+  /**
+   * Check whether the simulation should stop, printing a message if so
+   */
+  bool ShouldStop() const;
+
   /**
    * Get a name for this simulation
    *
@@ -7,6 +7,7 @@
 #include <cassert>
 #include <cstring>
 #include <fcntl.h>
+#include <fstream>
 #include <ftw.h>
 #include <iomanip>
 #include <iostream>
@@ -17,6 +18,7 @@
 #include <regex>
 #include <signal.h>
 #include <sstream>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
@@ -105,6 +107,73 @@ struct TmpDir {
   }
 };
 
+// Guard class for a memory buffer that is shared with the ISS process. This is
+// an anonymous file, created with memfd_create, that the child inherits and
+// maps with mmap. Where memfd_create isn't available (or if the
+// OTBN_MODEL_SHARED_MEM environment variable is set to 0), fd is -1 and the
+// model exchanges memory contents through files in the temporary directory.
+struct SharedMem {
+  int fd;
+  uint8_t *ptr;
+  size_t size;
+
+  SharedMem() : fd(-1), ptr(nullptr), size(0) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    if (SharedMem::should_use_shared_mem()) {
+      // If this fails, fd will be -1 and we'll fall back to using files.
+      fd = memfd_create("otbn_mem", MFD_CLOEXEC);
+    }
+#endif
+  }
+
+  ~SharedMem() {
+    if (ptr)
+      munmap(ptr, size);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // Make sure the buffer is at least len bytes long and return a pointer to
+  // its start. On failure, throws a std::runtime_error.
+  uint8_t *reserve(size_t len) {
+    assert(fd >= 0);
+    if (len <= size)
+      return ptr;
+
+    if (ptr) {
+      munmap(ptr, size);
+      ptr = nullptr;
+      size = 0;
+    }
+
+    if (ftruncate(fd, len) != 0) {
+      std::ostringstream oss;
+      oss << "Failed to resize shared memory buffer to " << len
+          << " bytes: " << strerror(errno);
+      throw std::runtime_error(oss.str());
+    }
+
+    void *new_ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (new_ptr == MAP_FAILED) {
+      std::ostringstream oss;
+      oss << "Failed to map shared memory buffer: " << strerror(errno);
+      throw std::runtime_error(oss.str());
+    }
+
+    ptr = static_cast<uint8_t *>(new_ptr);
+    size = len;
+    return ptr;
+  }
+
+ private:
+  // Return false if the OTBN_MODEL_SHARED_MEM environment variable is set to
+  // 0 (to force the model to use files instead).
+  static bool should_use_shared_mem() {
+    const char *shm_str = getenv("OTBN_MODEL_SHARED_MEM");
+    return !(shm_str && strcmp(shm_str, "0") == 0);
+  }
+};
+
 // Find the top of the OpenTitan repository
 //
 // If REPO_TOP is defined, use that. Otherwise, this will only work if we're
@@ -202,6 +271,63 @@ static std::string find_otbn_model() {
   return std::string(abs_path.get());
 }
 
+// Read the maximum number of cycles to run per exchange with the ISS from the
+// OTBN_MODEL_STEP_BATCH environment variable. This defaults to 1 (so we send a
+// "step" command on every cycle). On a malformed value, throw a
+// std::runtime_error.
+//
+// Larger values let the ISS run ahead during execution, which is much faster.
+// If the simulation sends some asynchronous stimulus (such as an error
+// escalation) while the ISS is ahead, the wrapper has to rewind the ISS to a
+// checkpoint and replay everything since then to catch up (see
+// ISSWrapper::reconcile), so this works best when such stimulus is rare.
+static unsigned get_step_batch() {
+  const char *batch_str = getenv("OTBN_MODEL_STEP_BATCH");
+  if (!batch_str)
+    return 1;
+
+  char *end;
+  unsigned long batch = strtoul(batch_str, &end, 0);
+  if (*batch_str == '\0' || *end != '\0' || batch == 0 || batch > 0xffff) {
+    std::ostringstream oss;
+    oss << "Invalid value for OTBN_MODEL_STEP_BATCH (`" << batch_str
+        << "'): expected an integer between 1 and 65535.";
+    throw std::runtime_error(oss.str());
+  }
+  return batch;
+}
+
+// Return true if the OTBN_MODEL_STEP_PIPELINE environment variable is set to
+// 1. In this case, step() asks the ISS for the next cycle before returning, so
+// that the ISS and the RTL simulation run in parallel. As with batching, the
+// wrapper replays if some asynchronous stimulus arrives in the meantime.
+static bool should_pipeline_steps() {
+  const char *pipeline_str = getenv("OTBN_MODEL_STEP_PIPELINE");
+  return pipeline_str && strcmp(pipeline_str, "1") == 0;
+}
+
+// Read the number of idle ISS processes to keep in ISSPool from the
+// OTBN_MODEL_ISS_POOL_SIZE environment variable. The pool starts this many
+// processes the first time a model leases an ISS and starts a replacement
+// after each lease. This is zero by default (so nothing is started in advance
+// and each OtbnModel kills its ISS when it is destroyed). On a malformed
+// value, throw a std::runtime_error.
+static size_t get_iss_pool_size() {
+  const char *size_str = getenv("OTBN_MODEL_ISS_POOL_SIZE");
+  if (!size_str)
+    return 0;
+
+  char *end;
+  unsigned long size = strtoul(size_str, &end, 0);
+  if (*size_str == '\0' || *end != '\0' || size > 64) {
+    std::ostringstream oss;
+    oss << "Invalid value for OTBN_MODEL_ISS_POOL_SIZE (`" << size_str
+        << "'): expected an integer between 0 and 64.";
+    throw std::runtime_error(oss.str());
+  }
+  return size;
+}
+
 // Read 8 hex characters from str as a uint32_t.
 static uint32_t read_hex_32(const char *str) {
   char buf[9];
@@ -210,51 +336,67 @@ static uint32_t read_hex_32(const char *str) {
   return strtoul(buf, nullptr, 16);
 }
 
-// Read through trace output (in the lines argument) to pick up any write to
-// the named CSR register, updating *dest.
-static void read_ext_reg(const std::string &reg_name,
-                         const std::vector<std::string> &lines,
-                         uint32_t *dest) {
-  assert(dest);
-
-  // We're interested in lines that show an update to the external register
-  // called reg_name. These look something like this:
-  //
-  //   ! otbn.$REG_NAME: 0x00000000
-  std::regex re("! otbn\\." + reg_name + ": 0x([0-9a-f]{8})");
-  std::smatch match;
+// Names of the external registers in ISSWrapper::ext_reg_t, indexed by ID
+static const char *const ext_reg_names[] = {
+    "STATUS",  "INSN_CNT",   "ERR_BITS",      "STOP_PC",
+    "RND_REQ", "WIPE_START", "LOAD_CHECKSUM",
+};
+static_assert(sizeof(ext_reg_names) / sizeof(ext_reg_names[0]) ==
+                  ISSWrapper::ExtRegCount,
+              "ext_reg_names doesn't match ext_reg_t");
+
+// Tags for records in the binary protocol. These must match the FRAME_*
+// values in stepped.py.
+enum frame_tag_t {
+  FrameLine = 1,
+  FrameExtReg = 2,
+  FrameRegs = 3,
+  FrameCallStack = 4,
+  FrameCycle = 5,
+  FrameStepped = 6,
+};
 
-  for (const auto &line : lines) {
-    if (std::regex_match(line, match, re)) {
-      // Ahah! We have a match. We have captured exactly 8 hex digits, so know
-      // that we can safely parse them to a uint32_t without risking a parse
-      // failure or overflow.
-      assert(match.size() == 2);
-      *dest = (uint32_t)strtoul(match[1].str().c_str(), nullptr, 16);
-    }
-  }
+// Return true if the OTBN_MODEL_BINARY_PROTOCOL environment variable is set
+// to 1.
+static bool should_use_binary_protocol() {
+  const char *binary_str = getenv("OTBN_MODEL_BINARY_PROTOCOL");
+  return binary_str && strcmp(binary_str, "1") == 0;
 }
 
-// A specialized version of read_ext_reg that updates a boolean flag
-// (assuming that the ISS will always signal the register as having
-// value 0 or 1). Prints a message to stderr and returns false on
-// error.
-static bool read_ext_flag(const std::string &reg_name,
-                          const std::vector<std::string> &lines, bool *dest) {
-  assert(dest);
-
-  uint32_t dest32 = *dest ? 1 : 0;
-  read_ext_reg(reg_name, lines, &dest32);
+// Check whether line shows an update to an external register. These lines
+// look something like this:
+//
+//   ! otbn.$REG_NAME: 0x00000000
+//
+// If line has this format and names a register in ISSWrapper::ext_reg_t,
+// write the register and its new value to *reg and *value and return true.
+static bool parse_ext_reg_line(const std::string &line,
+                               ISSWrapper::ext_reg_t *reg, uint32_t *value) {
+  assert(reg && value);
+
+  static const char prefix[] = "! otbn.";
+  static const size_t prefix_len = sizeof prefix - 1;
+  if (line.compare(0, prefix_len, prefix) != 0)
+    return false;
 
-  if (dest32 > 1) {
-    std::cerr << "ERROR: Unexpected update to " << reg_name << " with value 0x"
-              << std::hex << dest32 << std::dec
-              << " when we expected a boolean flag.";
+  size_t colon = line.find(": 0x", prefix_len);
+  if (colon == std::string::npos || line.size() != colon + 4 + 8)
     return false;
+
+  for (size_t i = colon + 4; i < line.size(); ++i) {
+    char c = line[i];
+    if (!(('0' <= c && c <= '9') || ('a' <= c && c <= 'f')))
+      return false;
   }
 
-  *dest = dest32 != 0;
-  return true;
+  for (int i = 0; i < ISSWrapper::ExtRegCount; ++i) {
+    if (line.compare(prefix_len, colon - prefix_len, ext_reg_names[i]) == 0) {
+      *reg = static_cast<ISSWrapper::ext_reg_t>(i);
+      *value = read_hex_32(&line[colon + 4]);
+      return true;
+    }
+  }
+  return false;
 }
 
 void MirroredRegs::reset() {
@@ -266,7 +408,17 @@ void MirroredRegs::reset() {
   wipe_start = false;
 }
 
-ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
+ISSWrapper::ISSWrapper()
+    : tmpdir(new TmpDir()),
+      shared_mem_(new SharedMem()),
+      step_batch_(get_step_batch()),
+      pipeline_(should_pipeline_steps()),
+      step_in_flight_(false),
+      keep_replay_log_(step_batch_ > 1 || pipeline_),
+      has_checkpoint_(false),
+      want_binary_protocol_(should_use_binary_protocol()),
+      startup_pending_(false),
+      binary_protocol_(false) {
   std::string model_path(find_otbn_model());
 
   // We want two pipes: one for writing to the child process, and the other for
@@ -314,6 +466,10 @@ ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
                 << "\n";
       abort();
     }
+    // Let the ISS inherit the shared memory buffer, if there is one.
+    if (shared_mem_->fd >= 0) {
+      fcntl(shared_mem_->fd, F_SETFD, 0);
+    }
     // Finally, exec the ISS
     execl("/usr/bin/env", "/usr/bin/env", "python3", "-u", model_path.c_str(),
           NULL);
@@ -335,6 +491,23 @@ ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
   // valid). Add an assertion to make sure nothing weird happens.
   assert(child_write_file);
   assert(child_read_file);
+
+  // Send any setup commands now, but don't wait for the responses. The child
+  // is probably still starting up (and importing lots of Python) so we'd
+  // rather not block until we actually need it. finish_startup() reads the
+  // responses before the next command.
+  std::ostringstream setup;
+  if (want_binary_protocol_) {
+    setup << "set_protocol binary\n";
+  }
+  if (shared_mem_->fd >= 0) {
+    setup << "set_shared_mem " << shared_mem_->fd << "\n";
+  }
+  if (!setup.str().empty()) {
+    fputs(setup.str().c_str(), child_write_file);
+    fflush(child_write_file);
+    startup_pending_ = true;
+  }
 }
 
 ISSWrapper::~ISSWrapper() {
@@ -351,16 +524,39 @@ ISSWrapper::~ISSWrapper() {
   fclose(child_read_file);
 }
 
+// Read the contents of the file at path, or throw a std::runtime_error on
+// failure.
+static std::vector<uint8_t> read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::ostringstream oss;
+    oss << "Failed to open `" << path << "' to log a memory load.";
+    throw std::runtime_error(oss.str());
+  }
+  return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+}
+
 void ISSWrapper::load_d(const std::string &path) {
   std::ostringstream oss;
   oss << "load_d " << path << "\n";
-  run_command(oss.str(), nullptr);
+  if (!keep_replay_log_) {
+    run_command(oss.str(), nullptr);
+    return;
+  }
+  std::vector<uint8_t> data = read_file(path);
+  run_load_command(oss.str(), false, data.data(), data.size());
 }
 
 void ISSWrapper::load_i(const std::string &path) {
   std::ostringstream oss;
   oss << "load_i " << path << "\n";
-  run_command(oss.str(), nullptr);
+  if (!keep_replay_log_) {
+    run_command(oss.str(), nullptr);
+    return;
+  }
+  std::vector<uint8_t> data = read_file(path);
+  run_load_command(oss.str(), true, data.data(), data.size());
 }
 
 void ISSWrapper::add_loop_warp(uint32_t addr, uint32_t from_cnt,
@@ -375,10 +571,69 @@ void ISSWrapper::clear_loop_warps() {
   run_command("clear_loop_warps\n", nullptr);
 }
 
-void ISSWrapper::dump_d(const std::string &path) const {
+void ISSWrapper::dump_d(const std::string &path) {
   std::ostringstream oss;
   oss << "dump_d " << path << "\n";
-  run_command(oss.str(), nullptr);
+  run_command(oss.str(), nullptr, false);
+}
+
+std::vector<ISSWrapper::DmemWord> ISSWrapper::get_dirty_dmem(
+    const std::set<uint32_t> &extra) {
+  std::ostringstream oss;
+  oss << "dump_d_dirty";
+  for (uint32_t idx : extra) {
+    oss << " " << idx;
+  }
+  oss << "\n";
+
+  Response resp;
+  run_command(oss.str(), &resp, false);
+
+  // Each line should be of the form "0xIDX VLD 0xVALUE"
+  static const std::regex re("0x([0-9a-f]+) ([01]) 0x([0-9a-f]{8})");
+  std::smatch match;
+
+  std::vector<DmemWord> ret;
+  for (const auto &line : resp.single_cycle().lines) {
+    if (!std::regex_match(line, match, re)) {
+      std::ostringstream err;
+      err << "Unexpected output from dump_d_dirty: `" << line << "'.";
+      throw std::runtime_error(err.str());
+    }
+    DmemWord word;
+    word.idx = strtoul(match[1].str().c_str(), nullptr, 16);
+    word.valid = match[2].str() == "1";
+    word.value = read_hex_32(match[3].str().c_str());
+    ret.push_back(word);
+  }
+  return ret;
+}
+
+uint8_t *ISSWrapper::get_shared_buf(size_t len) {
+  if (shared_mem_->fd < 0)
+    return nullptr;
+  return shared_mem_->reserve(len);
+}
+
+void ISSWrapper::load_d_shared(size_t len) {
+  assert(shared_mem_->size >= len);
+  std::ostringstream oss;
+  oss << "load_d_shm " << len << "\n";
+  run_load_command(oss.str(), false, shared_mem_->ptr, len);
+}
+
+void ISSWrapper::load_i_shared(size_t len) {
+  assert(shared_mem_->size >= len);
+  std::ostringstream oss;
+  oss << "load_i_shm " << len << "\n";
+  run_load_command(oss.str(), true, shared_mem_->ptr, len);
+}
+
+void ISSWrapper::dump_d_shared(size_t len) {
+  assert(shared_mem_->size >= len);
+  std::ostringstream oss;
+  oss << "dump_d_shm " << len << "\n";
+  run_command(oss.str(), nullptr, false);
 }
 
 void ISSWrapper::start_operation(command_t command) {
@@ -451,34 +706,69 @@ void ISSWrapper::set_keymgr_value(const std::array<uint32_t, 12> &key0_arr,
 }
 
 int ISSWrapper::step(bool gen_trace) {
-  std::vector<std::string> lines;
+  if (pending_cycles_.empty())
+    fetch_cycles();
 
-  run_command("step\n", &lines);
-  if (gen_trace && lines.size()) {
-    if (!OtbnTraceChecker::get().OnIssTrace(lines)) {
+  assert(!pending_cycles_.empty());
+  CycleOutput cycle = std::move(pending_cycles_.front());
+  pending_cycles_.pop_front();
+
+  if (keep_replay_log_) {
+    if (replay_log_.empty() || !replay_log_.back().cmd.empty())
+      replay_log_.emplace_back();
+    ++replay_log_.back().num_steps;
+  }
+
+  if (gen_trace && cycle.lines.size()) {
+    if (!OtbnTraceChecker::get().OnIssTrace(cycle.lines)) {
       return -1;
     }
   }
 
-  // Try to read STATUS, which is written when execution ends. Execution has
-  // finished if status_ is either 0 (IDLE) or 0xff (LOCKED)
+  // Execution has finished if STATUS has just changed to either 0 (IDLE) or
+  // 0xff (LOCKED). Some of the other registers and flags only get updated
+  // around the end of an operation but the precise timing is slightly fiddly,
+  // so it's easiest to just allow updates whenever they arrive.
   bool was_stopped = mirrored_.stopped();
-  read_ext_reg("STATUS", lines, &mirrored_.status);
-  bool is_stopped = mirrored_.stopped();
-  bool done = is_stopped && !was_stopped;
 
-  // Also try to read INSN_CNT, ERR_BITS and STOP_PC plus some associated
-  // flags. Some of these flags only get updated around the end of an operation
-  // but the precise timing is slightly fiddly, so it's easiest to just allow
-  // updates whenever they arrive.
-  read_ext_reg("INSN_CNT", lines, &mirrored_.insn_cnt);
-  read_ext_reg("ERR_BITS", lines, &mirrored_.err_bits);
-  read_ext_reg("STOP_PC", lines, &mirrored_.stop_pc);
+  for (const auto &update : cycle.ext_regs) {
+    uint32_t value = update.second;
+    switch (update.first) {
+      case ExtRegStatus:
+        mirrored_.status = value;
+        break;
+      case ExtRegInsnCnt:
+        mirrored_.insn_cnt = value;
+        break;
+      case ExtRegErrBits:
+        mirrored_.err_bits = value;
+        break;
+      case ExtRegStopPc:
+        mirrored_.stop_pc = value;
+        break;
+      case ExtRegRndReq:
+      case ExtRegWipeStart:
+        // These should always be signalled as having value 0 or 1.
+        if (value > 1) {
+          std::cerr << "ERROR: Unexpected update to "
+                    << ext_reg_names[update.first] << " with value 0x"
+                    << std::hex << value << std::dec
+                    << " when we expected a boolean flag.";
+          return -1;
+        }
+        if (update.first == ExtRegRndReq) {
+          mirrored_.rnd_req = value != 0;
+        } else {
+          mirrored_.wipe_start = value != 0;
+        }
+        break;
+      default:
+        break;
+    }
+  }
 
-  if (!read_ext_flag("RND_REQ", lines, &mirrored_.rnd_req))
-    return -1;
-  if (!read_ext_flag("WIPE_START", lines, &mirrored_.wipe_start))
-    return -1;
+  bool is_stopped = mirrored_.stopped();
+  bool done = is_stopped && !was_stopped;
 
   return done ? 1 : 0;
 }
@@ -504,8 +794,8 @@ void ISSWrapper::initial_secure_wipe() {
 }
 
 uint32_t ISSWrapper::step_crc(const std::array<uint8_t, 6> &item,
-                              uint32_t state) const {
-  std::vector<std::string> lines;
+                              uint32_t state) {
+  Response resp;
 
   std::ostringstream oss;
   oss << std::hex << "step_crc 0x" << std::setfill('0');
@@ -513,9 +803,15 @@ uint32_t ISSWrapper::step_crc(const std::array<uint8_t, 6> &item,
     oss << std::setw(2) << (int)item[5 - i];
   }
   oss << " 0x" << std::setw(8) << state << "\n";
-  run_command(oss.str(), &lines);
 
-  read_ext_reg("LOAD_CHECKSUM", lines, &state);
+  // This is a pure function, so it's fine to run even if the ISS has run
+  // ahead of us.
+  run_raw_command(oss.str(), &resp);
+
+  for (const auto &update : resp.single_cycle().ext_regs) {
+    if (update.first == ExtRegLoadChecksum)
+      state = update.second;
+  }
   return state;
 }
 
@@ -523,7 +819,13 @@ void ISSWrapper::reset(bool gen_trace) {
   if (gen_trace)
     OtbnTraceChecker::get().Flush();
 
-  run_command("reset\n", nullptr);
+  // Any cycles that we haven't consumed yet are thrown away with the rest of
+  // the ISS state, and there's nothing before this point that we might need
+  // to replay.
+  run_raw_command("reset\n", nullptr);
+  pending_cycles_.clear();
+  replay_log_.clear();
+  has_checkpoint_ = false;
 
   // Reset all mirrored registers.
   mirrored_.reset();
@@ -546,8 +848,21 @@ void ISSWrapper::get_regs(std::array<uint32_t, 32> *gprs,
                           std::array<u256_t, 32> *wdrs) {
   assert(gprs && wdrs);
 
-  std::vector<std::string> lines;
-  run_command("print_regs\n", &lines);
+  Response resp;
+  run_command("print_regs\n", &resp, false);
+
+  // With the binary protocol, the ISS sends the register contents in a
+  // fixed-layout record, so there's nothing to parse.
+  if (binary_protocol_) {
+    if (!resp.has_regs) {
+      throw std::runtime_error("No register record in print_regs output.");
+    }
+    *gprs = resp.gprs;
+    *wdrs = resp.wdrs;
+    return;
+  }
+
+  const std::vector<std::string> &lines = resp.single_cycle().lines;
 
   // A record of which registers we've seen (to check we see each
   // register exactly once). GPR i sets bit i. WDR i sets bit 32 + i.
@@ -558,7 +873,7 @@ void ISSWrapper::get_regs(std::array<uint32_t, 32> *gprs,
   //  x3  = 0x12345678
   //  w10 = 0x0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef
 
-  std::regex re("\\s*([wx][0-9]{1,2})\\s*=\\s*0x([0-9a-f]+)");
+  static const std::regex re("\\s*([wx][0-9]{1,2})\\s*=\\s*0x([0-9a-f]+)");
   std::smatch match;
 
   for (const std::string &line : lines) {
@@ -624,10 +939,20 @@ void ISSWrapper::get_regs(std::array<uint32_t, 32> *gprs,
 }
 
 std::vector<uint32_t> ISSWrapper::get_call_stack() {
-  std::vector<std::string> lines;
-  run_command("print_call_stack\n", &lines);
+  Response resp;
+  run_command("print_call_stack\n", &resp, false);
+
+  if (binary_protocol_) {
+    if (!resp.has_call_stack) {
+      throw std::runtime_error(
+          "No call stack record in print_call_stack output.");
+    }
+    return resp.call_stack;
+  }
 
-  std::regex re("\\s*0x([0-9a-f]+)");
+  const std::vector<std::string> &lines = resp.single_cycle().lines;
+
+  static const std::regex re("\\s*0x([0-9a-f]+)");
   std::smatch match;
   std::vector<uint32_t> call_stack;
 
@@ -713,17 +1038,462 @@ bool ISSWrapper::read_child_response(std::vector<std::string> *dst) const {
   }
 }
 
-void ISSWrapper::run_command(const std::string &cmd,
-                             std::vector<std::string> *dst) const {
+void ISSWrapper::run_command(const std::string &cmd, Response *dst,
+                             bool changes_state) {
+  if (has_run_ahead())
+    reconcile();
+
+  run_raw_command(cmd, dst);
+
+  if (changes_state)
+    log_command(cmd);
+}
+
+void ISSWrapper::run_load_command(const std::string &cmd, bool is_imem,
+                                  const uint8_t *data, size_t len) {
+  // Take a copy of the data before calling run_command: it might come from
+  // the shared buffer, which could be overwritten by a replay.
+  std::vector<uint8_t> copy;
+  if (keep_replay_log_)
+    copy.assign(data, data + len);
+
+  run_command(cmd, nullptr, false);
+
+  LoggedCommand *entry = log_command(cmd);
+  if (entry) {
+    entry->is_load = true;
+    entry->is_imem = is_imem;
+    entry->data = std::move(copy);
+  }
+}
+
+void ISSWrapper::run_raw_command(const std::string &cmd, Response *dst) {
+  // If there's a step in flight, its response comes first.
+  if (step_in_flight_) {
+    step_in_flight_ = false;
+    read_step_response();
+  }
+
+  send_and_receive(cmd, dst);
+}
+
+void ISSWrapper::send_and_receive(const std::string &cmd, Response *dst) {
   assert(cmd.size() > 0);
   assert(cmd.back() == '\n');
 
+  finish_startup();
+
   fputs(cmd.c_str(), child_write_file);
   fflush(child_write_file);
-  if (!read_child_response(dst)) {
+
+  bool got_response;
+  if (binary_protocol_) {
+    got_response = read_child_frame(dst);
+  } else {
+    std::vector<std::string> lines;
+    got_response = read_child_response(dst ? &lines : nullptr);
+    if (got_response && dst) {
+      for (std::string &line : lines) {
+        dst->take_text_line(std::move(line));
+      }
+    }
+  }
+
+  if (!got_response) {
     std::ostringstream oss;
     std::string cmd_line = cmd.substr(0, cmd.size() - 1);
     oss << "Failed to run command '" << cmd_line << "': EOF from ISS.";
     throw std::runtime_error(oss.str());
   }
 }
+
+std::string ISSWrapper::step_command() const {
+  // We need step_batch when pipelining, even for a single cycle, because it
+  // tells us whether the cycle was an event.
+  if (step_batch_ <= 1 && !pipeline_)
+    return "step\n";
+
+  std::ostringstream oss;
+  oss << "step_batch " << step_batch_ << "\n";
+  return oss.str();
+}
+
+void ISSWrapper::fetch_cycles() {
+  assert(pending_cycles_.empty());
+
+  bool is_event;
+  if (step_in_flight_) {
+    step_in_flight_ = false;
+    is_event = read_step_response();
+  } else {
+    finish_startup();
+    fputs(step_command().c_str(), child_write_file);
+    fflush(child_write_file);
+    is_event = read_step_response();
+  }
+
+  // If the ISS is still running and nothing is expected from the
+  // simulation, ask for the next cycles now. The ISS will run them while the
+  // simulation is busy evaluating the RTL for this one.
+  if (pipeline_ && !is_event) {
+    fputs(step_command().c_str(), child_write_file);
+    fflush(child_write_file);
+    step_in_flight_ = true;
+  }
+}
+
+bool ISSWrapper::read_step_response() {
+  Response resp;
+  bool got_response;
+  if (binary_protocol_) {
+    got_response = read_child_frame(&resp);
+  } else {
+    std::vector<std::string> lines;
+    got_response = read_child_response(&lines);
+    for (std::string &line : lines) {
+      resp.take_text_line(std::move(line));
+    }
+  }
+  if (!got_response) {
+    throw std::runtime_error("Failed to step the ISS: EOF from ISS.");
+  }
+
+  if (step_batch_ <= 1 && !pipeline_) {
+    pending_cycles_.push_back(std::move(resp.single_cycle()));
+    return false;
+  }
+
+  // Cycles with no output don't appear in resp.cycles, except as padding
+  // before a later cycle that did have output. The trailing count tells us
+  // how many cycles actually ran.
+  if (resp.stepped == 0 || resp.stepped > step_batch_ ||
+      resp.cycles.size() > resp.stepped) {
+    std::ostringstream err;
+    err << "Bad cycle count in step_batch output: the ISS reported "
+        << resp.stepped << " cycles, with output for " << resp.cycles.size()
+        << ", from a maximum of " << step_batch_ << ".";
+    throw std::runtime_error(err.str());
+  }
+
+  resp.cycles.resize(resp.stepped);
+  for (CycleOutput &cycle : resp.cycles) {
+    pending_cycles_.push_back(std::move(cycle));
+  }
+  return resp.stopped_at_event;
+}
+
+void ISSWrapper::reconcile() {
+  if (!keep_replay_log_) {
+    throw std::runtime_error(
+        "Cannot reconcile the ISS with the simulation: no replay log.");
+  }
+
+  // Collect (and then drop) the output from any step in flight
+  if (step_in_flight_) {
+    step_in_flight_ = false;
+    read_step_response();
+  }
+  pending_cycles_.clear();
+
+  // Go back to the last checkpoint (or to the last reset, if there isn't one)
+  send_and_receive(has_checkpoint_ ? "restore\n" : "reset\n", nullptr);
+
+  std::string replay_path = make_tmp_path("replay");
+  for (const LoggedCommand &entry : replay_log_) {
+    if (entry.cmd.empty()) {
+      // Replay the steps in batches. A batch can stop early on an event, so
+      // we might need several.
+      unsigned left = entry.num_steps;
+      while (left > 0) {
+        std::ostringstream oss;
+        oss << "step_batch " << left << "\n";
+        Response resp;
+        send_and_receive(oss.str(), &resp);
+        if (resp.stepped == 0 || resp.stepped > left) {
+          std::ostringstream err;
+          err << "Bad cycle count in step_batch output when replaying: the "
+                 "ISS reported "
+              << resp.stepped << " cycles, from a maximum of " << left << ".";
+          throw std::runtime_error(err.str());
+        }
+        left -= resp.stepped;
+      }
+    } else if (entry.is_load) {
+      // Replay a memory load through a file: the data in the shared buffer
+      // (or the file that we loaded from originally) might have changed.
+      std::ofstream file(replay_path, std::ios::binary);
+      file.write(reinterpret_cast<const char *>(entry.data.data()),
+                 entry.data.size());
+      file.close();
+      if (!file) {
+        std::ostringstream oss;
+        oss << "Failed to write `" << replay_path << "' to replay a load.";
+        throw std::runtime_error(oss.str());
+      }
+      std::ostringstream oss;
+      oss << (entry.is_imem ? "load_i " : "load_d ") << replay_path << "\n";
+      send_and_receive(oss.str(), nullptr);
+    } else {
+      send_and_receive(entry.cmd, nullptr);
+    }
+  }
+
+  // The ISS has now caught up with the caller. Take a new checkpoint, so that
+  // the next reconcile() only has to replay what happens after this point.
+  // The ISS can't take one part way through a multi-cycle instruction. In
+  // that case, we keep the log and the old checkpoint, and try again next
+  // time.
+  Response resp;
+  send_and_receive("checkpoint\n", &resp);
+  const std::vector<std::string> &lines = resp.single_cycle().lines;
+  if (lines.size() == 1 && lines[0] == "CHECKPOINT 1") {
+    has_checkpoint_ = true;
+    replay_log_.clear();
+  }
+}
+
+ISSWrapper::LoggedCommand *ISSWrapper::log_command(const std::string &cmd) {
+  if (!keep_replay_log_)
+    return nullptr;
+
+  replay_log_.emplace_back();
+  replay_log_.back().cmd = cmd;
+  return &replay_log_.back();
+}
+
+void ISSWrapper::finish_startup() const {
+  if (!startup_pending_)
+    return;
+  startup_pending_ = false;
+
+  // The response to set_protocol is in the text protocol.
+  if (want_binary_protocol_) {
+    std::vector<std::string> lines;
+    if (!read_child_response(&lines)) {
+      throw std::runtime_error(
+          "Failed to switch the ISS to the binary protocol: EOF from ISS.");
+    }
+    if (lines.size() == 1 && lines[0] == "PROTOCOL binary") {
+      binary_protocol_ = true;
+    } else {
+      std::cerr << "WARNING: The ISS didn't accept the binary protocol. "
+                   "Falling back to the text protocol.\n";
+    }
+  }
+
+  if (shared_mem_->fd >= 0) {
+    bool got_response = binary_protocol_ ? read_child_frame(nullptr)
+                                          : read_child_response(nullptr);
+    if (!got_response) {
+      throw std::runtime_error(
+          "Failed to set up shared memory with the ISS: EOF from ISS.");
+    }
+  }
+}
+
+bool ISSWrapper::read_child_frame(Response *dst) const {
+  uint8_t len_buf[4];
+  if (fread(len_buf, 1, sizeof len_buf, child_read_file) != sizeof len_buf)
+    return false;
+
+  uint32_t len = 0;
+  for (int i = 0; i < 4; ++i) {
+    len |= (uint32_t)len_buf[i] << (8 * i);
+  }
+
+  std::vector<uint8_t> frame(len);
+  if (len && fread(frame.data(), 1, len, child_read_file) != len)
+    return false;
+
+  if (!dst)
+    return true;
+
+  // Walk through the records in the frame. take(n) returns a pointer to the
+  // next n bytes, throwing an error if the frame is too short.
+  size_t pos = 0;
+  auto take = [&](size_t n) -> const uint8_t * {
+    if (len - pos < n) {
+      throw std::runtime_error("Truncated record in binary ISS response.");
+    }
+    const uint8_t *ret = frame.data() + pos;
+    pos += n;
+    return ret;
+  };
+  auto take_u32 = [&]() -> uint32_t {
+    const uint8_t *p = take(4);
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+  };
+
+  while (pos < len) {
+    uint8_t tag = *take(1);
+    switch (tag) {
+      case FrameLine: {
+        const uint8_t *p = take(2);
+        size_t line_len = p[0] | (p[1] << 8);
+        const char *text = reinterpret_cast<const char *>(take(line_len));
+        dst->single_cycle().lines.emplace_back(text, line_len);
+      } break;
+
+      case FrameExtReg: {
+        uint8_t reg = *take(1);
+        uint32_t value = take_u32();
+        if (reg >= ExtRegCount) {
+          std::ostringstream oss;
+          oss << "Unknown external register ID in binary ISS response: "
+              << (int)reg << ".";
+          throw std::runtime_error(oss.str());
+        }
+        dst->single_cycle().ext_regs.emplace_back(static_cast<ext_reg_t>(reg),
+                                                  value);
+      } break;
+
+      case FrameRegs:
+        for (int i = 0; i < 32; ++i) {
+          dst->gprs[i] = take_u32();
+        }
+        for (int i = 0; i < 32; ++i) {
+          for (int j = 0; j < 8; ++j) {
+            dst->wdrs[i].words[j] = take_u32();
+          }
+        }
+        dst->has_regs = true;
+        break;
+
+      case FrameCallStack: {
+        uint8_t count = *take(1);
+        dst->call_stack.clear();
+        for (unsigned i = 0; i < count; ++i) {
+          dst->call_stack.push_back(take_u32());
+        }
+        dst->has_call_stack = true;
+      } break;
+
+      case FrameCycle:
+        dst->start_cycle(take_u32());
+        break;
+
+      case FrameStepped:
+        dst->stepped = take_u32();
+        dst->stopped_at_event = *take(1) != 0;
+        break;
+
+      default: {
+        std::ostringstream oss;
+        oss << "Unknown record tag in binary ISS response: " << (int)tag
+            << ".";
+        throw std::runtime_error(oss.str());
+      }
+    }
+  }
+
+  return true;
+}
+
+ISSWrapper::CycleOutput &ISSWrapper::Response::single_cycle() {
+  if (cycles.empty())
+    cycles.emplace_back();
+  return cycles.back();
+}
+
+ISSWrapper::CycleOutput &ISSWrapper::Response::start_cycle(unsigned idx) {
+  // Cycle markers must appear in increasing order and can't follow output
+  // that wasn't preceded by a marker.
+  if (idx < cycles.size() || stepped) {
+    std::ostringstream oss;
+    oss << "Out of order cycle marker (" << idx
+        << ") in response from ISS.";
+    throw std::runtime_error(oss.str());
+  }
+  cycles.resize(idx + 1);
+  return cycles.back();
+}
+
+void ISSWrapper::Response::take_text_line(std::string line) {
+  // Lines of the form "@IDX" and "STEPPED N E" only appear in the response to a
+  // step_batch command. No trace or other output line starts with '@' or
+  // "STEPPED ".
+  if (!line.empty() && line[0] == '@') {
+    start_cycle(strtoul(line.c_str() + 1, nullptr, 10));
+    return;
+  }
+  if (line.compare(0, 8, "STEPPED ") == 0) {
+    char *end;
+    stepped = strtoul(line.c_str() + 8, &end, 10);
+    stopped_at_event = strtoul(end, nullptr, 10) != 0;
+    return;
+  }
+
+  CycleOutput &cycle = single_cycle();
+
+  ext_reg_t reg;
+  uint32_t value;
+  if (parse_ext_reg_line(line, &reg, &value))
+    cycle.ext_regs.emplace_back(reg, value);
+
+  cycle.lines.push_back(std::move(line));
+}
+
+static std::unique_ptr<ISSPool> iss_pool;
+
+// Set when iss_pool is destroyed at exit. This has no destructor, so it can
+// still be read by models that are freed after that.
+static bool iss_pool_destroyed = false;
+
+ISSPool::~ISSPool() { iss_pool_destroyed = true; }
+
+ISSPool *ISSPool::get() {
+  if (iss_pool_destroyed)
+    return nullptr;
+  if (!iss_pool) {
+    iss_pool.reset(new ISSPool(get_iss_pool_size()));
+  }
+  return iss_pool.get();
+}
+
+std::unique_ptr<ISSWrapper> ISSPool::lease() {
+  std::unique_ptr<ISSWrapper> ret;
+  if (idle_.empty()) {
+    ret.reset(new ISSWrapper());
+  } else {
+    ret = std::move(idle_.front());
+    idle_.pop_front();
+  }
+
+  top_up();
+  return ret;
+}
+
+void ISSPool::top_up() {
+  // The ISSWrapper constructor doesn't wait for the ISS to finish starting,
+  // so the new processes start up in the background while the caller gets on
+  // with the wrapper it leased. Failing to start one isn't fatal: the next
+  // lease just has to start its own.
+  try {
+    while (idle_.size() < size_) {
+      idle_.emplace_back(new ISSWrapper());
+    }
+  } catch (const std::runtime_error &err) {
+    std::cerr << "WARNING: Failed to start an ISS for the pool: " << err.what()
+              << "\n";
+  }
+}
+
+void ISSPool::release(std::unique_ptr<ISSWrapper> iss) {
+  assert(iss);
+  if (idle_.size() >= size_)
+    return;
+
+  // Reset the ISS so that the next user sees the same state as they would
+  // have with a new process. If something goes wrong, the process is
+  // probably in a bad way, so just drop it.
+  try {
+    iss->reset(false);
+  } catch (const std::exception &err) {
+    std::cerr << "WARNING: Failed to reset ISS to return it to the pool: "
+              << err.what() << "\n";
+    return;
+  }
+
+  idle_.push_back(std::move(iss));
+}
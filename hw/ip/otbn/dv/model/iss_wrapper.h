@@ -7,13 +7,17 @@
 #include <array>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
 #include <memory>
+#include <set>
 #include <string>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
-// Forward declaration (the implementation is private in iss_wrapper.cc)
+// Forward declarations (the implementations are private in iss_wrapper.cc)
 struct TmpDir;
+struct SharedMem;
 
 // OTBN has some externally visible CSRs that can be updated by hardware
 // (without explicit writes from software). The ISSWrapper mirrors the ISS's
@@ -54,6 +58,28 @@ struct ISSWrapper {
 
   enum command_t { Execute, DmemWipe, ImemWipe };
 
+  // A 32-bit word of DMEM, together with its index and validity
+  struct DmemWord {
+    uint32_t idx;
+    bool valid;
+    uint32_t value;
+  };
+
+  // External registers that the ISS reports changes to. These are the ones
+  // that we either mirror or need to read back from a command. The order
+  // matches the IDs used by the ISS in its binary protocol (see
+  // EXT_REG_IDS in stepped.py).
+  enum ext_reg_t {
+    ExtRegStatus,
+    ExtRegInsnCnt,
+    ExtRegErrBits,
+    ExtRegStopPc,
+    ExtRegRndReq,
+    ExtRegWipeStart,
+    ExtRegLoadChecksum,
+    ExtRegCount
+  };
+
   ISSWrapper();
   ~ISSWrapper();
 
@@ -68,7 +94,23 @@ struct ISSWrapper {
   void clear_loop_warps();
 
   // Dump the contents of DMEM to a file
-  void dump_d(const std::string &path) const;
+  void dump_d(const std::string &path);
+
+  // Read the DMEM words that the ISS has written since DMEM was last loaded,
+  // together with the words whose indices are in extra. The result is sorted
+  // by index.
+  std::vector<DmemWord> get_dirty_dmem(const std::set<uint32_t> &extra);
+
+  // Return a pointer to a buffer of at least len bytes that is shared with the
+  // ISS process, or null if there isn't one. In the latter case, use load_d,
+  // load_i and dump_d to exchange memory contents through files instead.
+  uint8_t *get_shared_buf(size_t len);
+
+  // Like load_d, load_i and dump_d, but using the first len bytes of the
+  // shared buffer (see get_shared_buf)
+  void load_d_shared(size_t len);
+  void load_i_shared(size_t len);
+  void dump_d_shared(size_t len);
 
   // Start an operation (execute, dmem wipe or imem wipe)
   void start_operation(command_t command);
@@ -104,6 +146,16 @@ struct ISSWrapper {
   // If gen_trace is true, pass trace data to the (singleton) OtbnTraceChecker
   // object.
   //
+  // If the wrapper was constructed with a step batch size above one (see
+  // OTBN_MODEL_STEP_BATCH in iss_wrapper.cc), the ISS might actually run
+  // several cycles in one go. The output for the extra cycles is buffered and
+  // handed out, one cycle at a time, by subsequent calls to this function.
+  //
+  // If step pipelining is enabled (see OTBN_MODEL_STEP_PIPELINE in
+  // iss_wrapper.cc), this function also asks the ISS for the next cycle (or
+  // batch of cycles) before returning, but doesn't wait for the answer. The
+  // ISS computes it while the caller evaluates the RTL.
+  //
   // The return code describes the state of the simulation. It is 1 if the
   // simulation just stopped (on ECALL or an architectural error); it is 0 if
   // the simulation is still running. It is -1 if something went wrong (such as
@@ -126,7 +178,7 @@ struct ISSWrapper {
   void initial_secure_wipe();
 
   // Step a CRC calculation with 48 bits of data
-  uint32_t step_crc(const std::array<uint8_t, 6> &item, uint32_t state) const;
+  uint32_t step_crc(const std::array<uint8_t, 6> &item, uint32_t state);
 
   // Reset simulation
   //
@@ -155,14 +207,142 @@ struct ISSWrapper {
   std::string make_tmp_path(const std::string &relative) const;
 
  private:
+  // The output from the ISS for a single cycle (or for a command that isn't
+  // a step)
+  struct CycleOutput {
+    // Lines of output (trace entries and so on)
+    std::vector<std::string> lines;
+
+    // Updates to external registers, in the order that they were reported
+    std::vector<std::pair<ext_reg_t, uint32_t>> ext_regs;
+  };
+
+  // The parsed response to a command
+  struct Response {
+    Response()
+        : stepped(0),
+          stopped_at_event(false),
+          has_regs(false),
+          has_call_stack(false) {}
+
+    // The output from the command. Only step_batch can generate output for
+    // more than one cycle: for other commands, this is empty or has a single
+    // entry.
+    std::vector<CycleOutput> cycles;
+
+    // The number of cycles that a step_batch command reported it had run and
+    // whether it stopped because of an event (a cycle after which the ISS
+    // shouldn't run ahead of the simulation)
+    unsigned stepped;
+    bool stopped_at_event;
+
+    // Register and call stack contents (from print_regs and print_call_stack
+    // when using the binary protocol)
+    bool has_regs;
+    std::array<uint32_t, 32> gprs;
+    std::array<u256_t, 32> wdrs;
+
+    bool has_call_stack;
+    std::vector<uint32_t> call_stack;
+
+    // Return the output for the current cycle in the response (inserting an
+    // empty one if necessary)
+    CycleOutput &single_cycle();
+
+    // Start the output for the cycle with index idx in a step_batch response.
+    // Throws a runtime_error if idx is out of order.
+    CycleOutput &start_cycle(unsigned idx);
+
+    // Add a line of text protocol output to the response, handling cycle
+    // markers and picking out updates to external registers.
+    void take_text_line(std::string line);
+  };
+
+  // Read the responses to the setup commands that the constructor sent to the
+  // ISS, if we haven't done so already. Throws a runtime_error on failure.
+  void finish_startup() const;
+
   // Read line by line from the child process until we get ".\n".
   // Return true if we got the ".\n" terminator, false if EOF. If dst
   // is not null, append to it each line that was read.
   bool read_child_response(std::vector<std::string> *dst) const;
 
+  // Read a single length-prefixed frame from the child process (used for the
+  // binary protocol). Return true on success, false on EOF. If dst is not
+  // null, parse the frame into it. Throws a runtime_error if the frame is
+  // malformed.
+  bool read_child_frame(Response *dst) const;
+
+  // A command that changed the state of the ISS since the last checkpoint (see
+  // replay_log_). If cmd is empty, the entry stands for num_steps cycles that
+  // step() handed to the caller. If is_load is true, cmd loaded data into
+  // IMEM or DMEM (depending on is_imem).
+  struct LoggedCommand {
+    LoggedCommand() : num_steps(0), is_load(false), is_imem(false) {}
+
+    std::string cmd;
+    unsigned num_steps;
+    bool is_load;
+    bool is_imem;
+    std::vector<uint8_t> data;
+  };
+
   // Send a command to the child and wait for its response. If no
   // response, raise a runtime_error.
-  void run_command(const std::string &cmd, std::vector<std::string> *dst) const;
+  //
+  // Commands sent with this function might read or change the state of the
+  // ISS, so if the ISS has run ahead of the caller (with buffered cycles from
+  // a batched step or a pipelined step in flight), this first calls
+  // reconcile(). If changes_state is true, the command is also added to
+  // replay_log_.
+  void run_command(const std::string &cmd, Response *dst,
+                   bool changes_state = true);
+
+  // Like run_command, but for a command that loads memory from data (in the
+  // format read by the ISS's load_d and load_i commands). If the command gets
+  // replayed, the replay loads data through a file.
+  void run_load_command(const std::string &cmd, bool is_imem,
+                        const uint8_t *data, size_t len);
+
+  // Like run_command, but doesn't check whether the ISS has run ahead and
+  // doesn't log the command. If there is a pipelined step in flight, its
+  // output is collected first (and appended to pending_cycles_).
+  void run_raw_command(const std::string &cmd, Response *dst);
+
+  // Write cmd to the child and wait for its response, without looking at any
+  // other state.
+  void send_and_receive(const std::string &cmd, Response *dst);
+
+  // Ask the ISS to run one or more cycles, appending the output for each cycle
+  // to pending_cycles_. If there is a pipelined step in flight, this collects
+  // its output rather than sending a new request.
+  void fetch_cycles();
+
+  // The command that asks the ISS to run one or more cycles
+  std::string step_command() const;
+
+  // Read the response to a step command (which has already been sent) and
+  // append the output for each cycle to pending_cycles_. Returns true if the
+  // last cycle was an event, after which we shouldn't run ahead.
+  bool read_step_response();
+
+  // True if the ISS has run ahead of the cycles that step() has returned.
+  bool has_run_ahead() const {
+    return step_in_flight_ || !pending_cycles_.empty();
+  }
+
+  // Throw away any cycles that the ISS has run ahead of the caller by
+  // rewinding the ISS to its last checkpoint (or resetting it) and replaying
+  // replay_log_. This works because the ISS is deterministic: given the same
+  // sequence of commands, it ends up in the same state. Afterwards, this
+  // takes a new checkpoint and clears the log if it can. Throws a
+  // runtime_error if the ISS can't run ahead (so there is no log) or if
+  // something goes wrong with the replay.
+  void reconcile();
+
+  // Add an entry to the end of replay_log_ and return it (or return null if
+  // we aren't keeping a log).
+  LoggedCommand *log_command(const std::string &cmd);
 
   pid_t child_pid;
   FILE *child_write_file;
@@ -171,8 +351,89 @@ struct ISSWrapper {
   // A temporary directory for communicating with the child process
   std::unique_ptr<TmpDir> tmpdir;
 
+  // A memory buffer shared with the child process (see OTBN_MODEL_SHARED_MEM
+  // in iss_wrapper.cc)
+  std::unique_ptr<SharedMem> shared_mem_;
+
   // Mirrored copies of registers
   MirroredRegs mirrored_;
+
+  // The maximum number of cycles to run in a single exchange with the ISS.
+  // If this is 1, we use the plain "step" command (unless pipelining).
+  unsigned step_batch_;
+
+  // True if step() should send the next step request to the ISS without
+  // waiting for the response (see OTBN_MODEL_STEP_PIPELINE in
+  // iss_wrapper.cc), and whether there is currently such a request in flight
+  bool pipeline_;
+  bool step_in_flight_;
+
+  // If the ISS can run ahead of the caller (with batching or pipelining),
+  // the commands that have changed its state since the last checkpoint (or
+  // reset), together with the number of cycles that the caller consumed
+  // between them. This is what reconcile() replays.
+  bool keep_replay_log_;
+  std::vector<LoggedCommand> replay_log_;
+
+  // True if reconcile() has saved a checkpoint in the ISS since the last
+  // reset. If so, replay_log_ starts from there.
+  bool has_checkpoint_;
+
+  // True if the constructor asked the ISS to switch to the binary protocol
+  // (see OTBN_MODEL_BINARY_PROTOCOL in iss_wrapper.cc)
+  bool want_binary_protocol_;
+
+  // True if the constructor has sent setup commands to the ISS whose
+  // responses haven't been read yet (see finish_startup). This and
+  // binary_protocol_ are mutable because the responses are read on demand,
+  // by whichever command is sent first.
+  mutable bool startup_pending_;
+
+  // True if we have switched the ISS to the binary protocol
+  mutable bool binary_protocol_;
+
+  // Output from cycles that the ISS has already run, but which haven't been
+  // consumed by step() yet.
+  std::deque<CycleOutput> pending_cycles_;
+};
+
+// A pool of idle ISS processes, shared by all OtbnModel objects (see
+// OTBN_MODEL_ISS_POOL_SIZE in iss_wrapper.cc).
+//
+// Starting an ISS means starting a Python interpreter and importing the
+// simulator, which takes a noticeable fraction of the run time of a short
+// test. The first lease fills the pool with processes that start up in the
+// background, and each lease after that starts a replacement for the one it
+// took, so the next model to need an ISS (after a re-init) finds one ready.
+// When a model is finished with its wrapper, the wrapper is reset and handed
+// back to the pool if there is room, rather than killing the ISS process.
+class ISSPool {
+ public:
+  ~ISSPool();
+
+  // Get the singleton object, or null if it has already been destroyed at
+  // exit. Throws a runtime_error if the pool size is malformed.
+  static ISSPool *get();
+
+  // Take a wrapper from the pool, starting a new one if the pool is empty,
+  // and then top the pool back up. Throws a runtime_error on failure.
+  std::unique_ptr<ISSWrapper> lease();
+
+  // Reset iss and hand it back to the pool. If the pool is already full or
+  // the reset fails, destroy iss instead (which kills the ISS process).
+  void release(std::unique_ptr<ISSWrapper> iss);
+
+ private:
+  explicit ISSPool(size_t size) : size_(size) {}
+
+  // Start new wrappers until there are size_ idle ones. Prints a warning (but
+  // doesn't throw) if an ISS can't be started.
+  void top_up();
+
+  // The number of idle wrappers to keep
+  size_t size_;
+
+  std::deque<std::unique_ptr<ISSWrapper>> idle_;
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_ISS_WRAPPER_H_
@@ -0,0 +1,80 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_dmem_write_tracker.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "otbn_trace_source.h"
+
+OtbnDmemWriteTracker::OtbnDmemWriteTracker() : seen_trace_(false) {
+  OtbnTraceSource::get().AddListener(this);
+}
+
+OtbnDmemWriteTracker::~OtbnDmemWriteTracker() {
+  OtbnTraceSource::get().RemoveListener(this);
+}
+
+void OtbnDmemWriteTracker::AcceptTraceString(const std::string &trace,
+                                             unsigned int cycle_count) {
+  seen_trace_ = true;
+
+  // Memory writes are rare compared to the other lines in the trace, so skip
+  // the split into lines unless there's something to find.
+  if (trace.find("\nW ") == std::string::npos)
+    return;
+
+  for (const std::string &line : SplitTraceLines(trace)) {
+    if (line.size() > 0 && line[0] == 'W')
+      TakeWriteLine(line);
+  }
+}
+
+void OtbnDmemWriteTracker::Clear() {
+  seen_trace_ = false;
+  written_words_.clear();
+}
+
+void OtbnDmemWriteTracker::TakeWriteLine(const std::string &line) {
+  // A write line looks like one of the following (see otbn_tracer.sv):
+  //
+  //   W [0xADDRADDR]: 0xDATADATA
+  //   W [0xADDRADDR]: 0xDATADATA_DATADATA_..._DATADATA
+  //   W [0xADDRADDR]: Mask ERR Mask: ... Data: ...
+  //
+  // The first is a 32-bit write at ADDRADDR; the second is a 256-bit write
+  // (with 8 words of data). The third is a write with an unexpected mask. We
+  // don't know which words that touches, so treat it as a write to all 256
+  // bits at ADDRADDR (which is aligned in this case).
+  static const char prefix[] = "W [0x";
+  static const size_t prefix_len = sizeof prefix - 1;
+  if (line.compare(0, prefix_len, prefix) != 0) {
+    std::cerr << "WARNING: Ignoring malformed memory write line in trace: `"
+              << line << "'.\n";
+    return;
+  }
+
+  char *end;
+  uint32_t addr = strtoul(line.c_str() + prefix_len, &end, 16);
+  if (strncmp(end, "]: ", 3) != 0) {
+    std::cerr << "WARNING: Ignoring malformed memory write line in trace: `"
+              << line << "'.\n";
+    return;
+  }
+
+  const char *data = end + 3;
+  unsigned num_words = 256 / 32;
+  if (!strstr(data, "ERR")) {
+    num_words = 1;
+    for (const char *p = data; *p; ++p) {
+      num_words += (*p == '_');
+    }
+  }
+
+  for (unsigned i = 0; i < num_words; ++i) {
+    written_words_.insert(addr / 4 + i);
+  }
+}
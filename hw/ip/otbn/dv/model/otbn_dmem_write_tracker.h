@@ -0,0 +1,49 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_DMEM_WRITE_TRACKER_H_
+#define OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_DMEM_WRITE_TRACKER_H_
+
+// A class that listens to trace entries from the simulated core (as an
+// OtbnTraceListener) and keeps track of which 32-bit words of DMEM it has
+// written, using the memory write ('W') lines from otbn_tracer.
+//
+// OtbnModel uses this to check just the parts of DMEM that might have changed
+// since it last gave the contents of DMEM to the ISS.
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include "otbn_trace_listener.h"
+
+class OtbnDmemWriteTracker : public OtbnTraceListener {
+ public:
+  OtbnDmemWriteTracker();
+  ~OtbnDmemWriteTracker();
+
+  void AcceptTraceString(const std::string &trace,
+                         unsigned int cycle_count) override;
+
+  // Forget about any writes seen so far.
+  void Clear();
+
+  // True if we have seen any trace entries since the last call to Clear(). If
+  // not, the tracer is probably not connected, so WrittenWords() might be
+  // missing some writes.
+  bool SeenTrace() const { return seen_trace_; }
+
+  // The indices of the 32-bit words that have been written since the last
+  // call to Clear().
+  const std::set<uint32_t> &WrittenWords() const { return written_words_; }
+
+ private:
+  // Parse a memory write line from the tracer, adding the words it touches to
+  // written_words_.
+  void TakeWriteLine(const std::string &line);
+
+  bool seen_trace_;
+  std::set<uint32_t> written_words_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_DMEM_WRITE_TRACKER_H_
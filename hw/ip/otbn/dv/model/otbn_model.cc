@@ -13,6 +13,7 @@
 #include <sstream>
 
 #include "iss_wrapper.h"
+#include "otbn_dmem_write_tracker.h"
 #include "otbn_model_dpi.h"
 #include "otbn_trace_checker.h"
 #include "sv_scoped.h"
@@ -40,36 +41,27 @@ int otbn_stack_element_peek(int index, svBitVecVal *val);
 #define STATUS_BUSY_SEC_WIPE_INT 0x04
 #define STATUS_LOCKED 0xFF
 
-// Read (the start of) the contents of a file at path as a vector of bytes.
-// Expects num_bytes bytes of data. On failure, throws a std::runtime_error.
-static Ecc32MemArea::EccWords read_words_from_file(const std::string &path,
-                                                   size_t num_words) {
-  std::filebuf fb;
-  if (!fb.open(path.c_str(), std::ios::in | std::ios::binary)) {
-    std::ostringstream oss;
-    oss << "Cannot open the file '" << path << "'.";
-    throw std::runtime_error(oss.str());
-  }
-
+// Memory contents are exchanged with the ISS with 5 bytes per 32-bit word: a
+// validity byte (either 0 or 1), followed by 4 bytes with a little-endian
+// 32-bit word.
+static const size_t bytes_per_iss_word = 5;
+
+// Parse num_words words from src, which should be in the format above. desc
+// describes where the data came from (for error messages). On failure, throws
+// a std::runtime_error.
+static Ecc32MemArea::EccWords read_words_from_bytes(const uint8_t *src,
+                                                    size_t num_words,
+                                                    const std::string &desc) {
   Ecc32MemArea::EccWords ret;
   ret.reserve(num_words);
 
-  char minibuf[5];
   for (size_t i = 0; i < num_words; ++i) {
-    std::streamsize chars_in = fb.sgetn(minibuf, 5);
-    if (chars_in != 5) {
-      std::ostringstream oss;
-      oss << "Cannot read word " << i << " from " << path
-          << " (expected 5 bytes, but actually got " << chars_in << ").";
-      throw std::runtime_error(oss.str());
-    }
+    const uint8_t *minibuf = src + bytes_per_iss_word * i;
 
-    // The layout should be a validity byte (either 0 or 1), followed
-    // by 4 bytes with a little-endian 32-bit word.
     uint8_t vld_byte = minibuf[0];
     if (vld_byte > 2) {
       std::ostringstream oss;
-      oss << "Word " << i << " at " << path
+      oss << "Word " << i << " at " << desc
           << " had a validity byte with value " << (int)vld_byte
           << "; not 0 or 1.";
       throw std::runtime_error(oss.str());
@@ -78,7 +70,7 @@ static Ecc32MemArea::EccWords read_words_from_file(const std::string &path,
 
     uint32_t word = 0;
     for (int j = 0; j < 4; ++j) {
-      word |= (uint32_t)(uint8_t)minibuf[j + 1] << 8 * j;
+      word |= (uint32_t)minibuf[j + 1] << 8 * j;
     }
 
     ret.push_back(std::make_pair(valid, word));
@@ -87,6 +79,47 @@ static Ecc32MemArea::EccWords read_words_from_file(const std::string &path,
   return ret;
 }
 
+// Write words to dst in the format above. dst must have space for
+// bytes_per_iss_word bytes per word.
+static void write_words_to_bytes(uint8_t *dst,
+                                 const Ecc32MemArea::EccWords &words) {
+  for (const Ecc32MemArea::EccWord &word : words) {
+    bool valid = word.first;
+    uint32_t w32 = word.second;
+
+    dst[0] = valid ? 1 : 0;
+    for (int j = 0; j < 4; ++j) {
+      dst[j + 1] = (w32 >> (8 * j)) & 0xff;
+    }
+    dst += bytes_per_iss_word;
+  }
+}
+
+// Read (the start of) the contents of a file at path as a vector of words.
+// Expects num_words words of data. On failure, throws a std::runtime_error.
+static Ecc32MemArea::EccWords read_words_from_file(const std::string &path,
+                                                   size_t num_words) {
+  std::filebuf fb;
+  if (!fb.open(path.c_str(), std::ios::in | std::ios::binary)) {
+    std::ostringstream oss;
+    oss << "Cannot open the file '" << path << "'.";
+    throw std::runtime_error(oss.str());
+  }
+
+  std::vector<uint8_t> bytes(bytes_per_iss_word * num_words);
+  std::streamsize chars_in =
+      fb.sgetn(reinterpret_cast<char *>(bytes.data()), bytes.size());
+  if (chars_in != (std::streamsize)bytes.size()) {
+    std::ostringstream oss;
+    oss << "Cannot read " << num_words << " words from " << path
+        << " (expected " << bytes.size() << " bytes, but actually got "
+        << chars_in << ").";
+    throw std::runtime_error(oss.str());
+  }
+
+  return read_words_from_bytes(bytes.data(), num_words, path);
+}
+
 // Write some words to a new file at path. On failure, throws a
 // std::runtime_error.
 static void write_words_to_file(const std::string &path,
@@ -98,24 +131,99 @@ static void write_words_to_file(const std::string &path,
     throw std::runtime_error(oss.str());
   }
 
-  for (const Ecc32MemArea::EccWord &word : words) {
-    uint8_t bytes[5];
+  std::vector<uint8_t> bytes(bytes_per_iss_word * words.size());
+  write_words_to_bytes(bytes.data(), words);
 
-    bool valid = word.first;
-    uint32_t w32 = word.second;
+  std::streamsize chars_out =
+      fb.sputn(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  if (chars_out != (std::streamsize)bytes.size()) {
+    std::ostringstream oss;
+    oss << "Failed to write to " << path << ".";
+    throw std::runtime_error(oss.str());
+  }
+}
 
-    bytes[0] = valid ? 1 : 0;
-    for (int j = 0; j < 4; ++j) {
-      bytes[j + 1] = (w32 >> (8 * j)) & 0xff;
-    }
+// Return true if the OTBN_MODEL_DMEM_CHECK environment variable asks for
+// incremental DMEM checks. Throws a std::runtime_error if it has an
+// unrecognised value.
+static bool get_incremental_dmem_check() {
+  const char *mode_str = getenv("OTBN_MODEL_DMEM_CHECK");
+  if (!mode_str || strcmp(mode_str, "full") == 0)
+    return false;
+  if (strcmp(mode_str, "incremental") == 0)
+    return true;
+
+  std::ostringstream oss;
+  oss << "Invalid value for OTBN_MODEL_DMEM_CHECK: `" << mode_str
+      << "' (expected `full' or `incremental').";
+  throw std::runtime_error(oss.str());
+}
 
-    std::streamsize chars_out =
-        fb.sputn(reinterpret_cast<const char *>(&bytes), 5);
-    if (chars_out != 5) {
-      std::ostringstream oss;
-      oss << "Failed to write to " << path << ".";
-      throw std::runtime_error(oss.str());
-    }
+// Read the OTBN_MODEL_DMEM_FULL_CHECK_PERIOD environment variable. Throws a
+// std::runtime_error if it is set but isn't a positive integer.
+static unsigned get_dmem_full_check_period() {
+  const char *period_str = getenv("OTBN_MODEL_DMEM_FULL_CHECK_PERIOD");
+  if (!period_str)
+    return 16;
+
+  char *end;
+  unsigned long period = strtoul(period_str, &end, 10);
+  if (*period_str == '\0' || *end != '\0' || period == 0 ||
+      period > 0xffffffff) {
+    std::ostringstream oss;
+    oss << "Invalid value for OTBN_MODEL_DMEM_FULL_CHECK_PERIOD: `"
+        << period_str << "' (expected a positive integer).";
+    throw std::runtime_error(oss.str());
+  }
+  return period;
+}
+
+// Compare a word from the ISS and RTL versions of DMEM, where idx is the index
+// of the word. On a mismatch, print a message to stderr (preceded by a banner
+// if this is the first mismatch) and increment *bad_count.
+static void check_dmem_word(size_t idx, const Ecc32MemArea::EccWord &iss_word,
+                            const Ecc32MemArea::EccWord &rtl_word,
+                            int *bad_count) {
+  bool iss_valid = iss_word.first;
+  bool rtl_valid = rtl_word.first;
+  uint32_t iss_w32 = iss_word.second;
+  uint32_t rtl_w32 = rtl_word.second;
+
+  // If neither word has valid checksum bits, all is well.
+  if (!iss_valid && !rtl_valid)
+    return;
+
+  // If both words have valid checksum bits and equal data, all is well.
+  if (iss_valid && rtl_valid && iss_w32 == rtl_w32)
+    return;
+
+  // TODO: At the moment, the ISS doesn't track validity bits properly in
+  //       DMEM, which means that we might have a situation where RTL says a
+  //       word is invalid, but the ISS doesn't. To avoid spurious failures
+  //       until we've implemented things, skip the check in this case. Once
+  //       the ISS handles validity bits properly, delete this block.
+  if (iss_valid && !rtl_valid)
+    return;
+
+  // Otherwise, something has gone wrong. Print out a banner if this is the
+  // first mismatch.
+  if (*bad_count == 0) {
+    std::cerr << "ERROR: Mismatches in dmem data:\n"
+              << std::hex << std::setfill('0');
+  }
+
+  std::cerr << " @offset 0x" << std::setw(3) << 4 * idx << ": ";
+  if (iss_valid != rtl_valid) {
+    std::cerr << "mismatching validity bits (rtl = " << rtl_valid
+              << "; iss = " << iss_valid << ")\n";
+  } else {
+    assert(iss_valid && rtl_valid && iss_w32 != rtl_w32);
+    std::cerr << "rtl has 0x" << std::setw(8) << rtl_w32 << "; iss has 0x"
+              << std::setw(8) << iss_w32 << "\n";
+  }
+  ++*bad_count;
+  if (*bad_count == 10) {
+    std::cerr << " (skipping further errors...)\n";
   }
 }
 
@@ -193,9 +301,35 @@ OtbnModel::OtbnModel(const std::string &mem_scope,
                      const std::string &design_scope)
     : mem_util_(mem_scope), design_scope_(design_scope) {
   assert(mem_scope.size() && design_scope.size());
+
+  try {
+    incremental_dmem_check_ = get_incremental_dmem_check();
+    dmem_full_check_period_ = get_dmem_full_check_period();
+  } catch (const std::runtime_error &err) {
+    std::cerr << "ERROR: " << err.what()
+              << " Falling back to full DMEM checks.\n";
+    incremental_dmem_check_ = false;
+  }
+
+  if (incremental_dmem_check_ && has_rtl()) {
+    dmem_tracker_.reset(new OtbnDmemWriteTracker());
+  }
 }
 
-OtbnModel::~OtbnModel() {}
+OtbnModel::~OtbnModel() {
+  if (iss_) {
+    try {
+      // The simulator might free the model after static objects have been
+      // destroyed. In that case there's no pool and the wrapper just gets
+      // destroyed.
+      ISSPool *pool = ISSPool::get();
+      if (pool)
+        pool->release(std::move(iss_));
+    } catch (const std::runtime_error &) {
+      // If we can't get at the pool, the wrapper just gets destroyed.
+    }
+  }
+}
 
 int OtbnModel::take_loop_warps(const OtbnMemUtil &memutil) {
   ISSWrapper *iss = ensure_wrapper();
@@ -239,19 +373,21 @@ int OtbnModel::start_operation(command_t command) {
         cmd_desc = "execute";
         iss_command = ISSWrapper::Execute;
 
-        std::string dfname(iss->make_tmp_path("dmem"));
-        std::string ifname(iss->make_tmp_path("imem"));
+        send_sim_memory(*iss, false);
+        send_sim_memory(*iss, true);
 
-        write_words_to_file(dfname, get_sim_memory(false));
-        write_words_to_file(ifname, get_sim_memory(true));
-
-        iss->load_d(dfname);
-        iss->load_i(ifname);
+        // The ISS now has the same DMEM contents as the simulation, so we
+        // only need to track writes from here on.
+        dmem_synced_ = true;
+        if (dmem_tracker_) {
+          dmem_tracker_->Clear();
+        }
       } break;
 
       case DmemWipe:
         cmd_desc = "DMEM wipe";
         iss_command = ISSWrapper::DmemWipe;
+        dmem_synced_ = false;
         break;
 
       case ImemWipe:
@@ -448,7 +584,7 @@ int OtbnModel::step(svBitVecVal *status /* bit [7:0] */,
   return finished ? 1 : 0;
 }
 
-int OtbnModel::check() const {
+int OtbnModel::check() {
   if (!has_rtl())
     return 1;
 
@@ -500,14 +636,9 @@ int OtbnModel::load_dmem() {
     return -1;
   }
 
-  const MemArea &dmem = mem_util_.GetMemArea(false);
-
-  std::string dfname(iss->make_tmp_path("dmem_out"));
   try {
     // Read DMEM from the ISS
-    iss->dump_d(dfname);
-    set_sim_memory(false,
-                   read_words_from_file(dfname, dmem.GetSizeBytes() / 4));
+    set_sim_memory(false, read_iss_dmem(*iss));
   } catch (const std::exception &err) {
     std::cerr << "Error when loading dmem from ISS: " << err.what() << "\n";
     return -1;
@@ -535,6 +666,10 @@ int OtbnModel::invalidate_dmem() {
   if (!iss)
     return -1;
 
+  // This changes every word of DMEM, so the next DMEM check will have to look
+  // at all of it.
+  dmem_synced_ = false;
+
   try {
     iss->invalidate_dmem();
   } catch (const std::exception &err) {
@@ -605,6 +740,8 @@ int OtbnModel::reset(svBitVecVal *status /* bit [7:0] */,
   if (!iss)
     return 0;
 
+  dmem_synced_ = false;
+
   try {
     iss->reset(has_rtl());
   } catch (const std::runtime_error &err) {
@@ -661,7 +798,12 @@ bool OtbnModel::is_at_start_of_wipe() const {
 ISSWrapper *OtbnModel::ensure_wrapper() {
   if (!iss_) {
     try {
-      iss_.reset(new ISSWrapper());
+      ISSPool *pool = ISSPool::get();
+      if (pool) {
+        iss_ = pool->lease();
+      } else {
+        iss_.reset(new ISSWrapper());
+      }
     } catch (const std::runtime_error &err) {
       std::cerr << "Error when constructing ISS wrapper: " << err.what()
                 << "\n";
@@ -682,15 +824,69 @@ void OtbnModel::set_sim_memory(bool is_imem,
   mem_util_.GetMemArea(is_imem).WriteWithIntegrity(0, words);
 }
 
-bool OtbnModel::check_dmem(ISSWrapper &iss) const {
+void OtbnModel::send_sim_memory(ISSWrapper &iss, bool is_imem) const {
+  Ecc32MemArea::EccWords words = get_sim_memory(is_imem);
+  size_t num_bytes = bytes_per_iss_word * words.size();
+
+  // If we have a buffer that is shared with the ISS, write the words straight
+  // into it. Otherwise, go through a file in the temporary directory.
+  uint8_t *buf = iss.get_shared_buf(num_bytes);
+  if (buf) {
+    write_words_to_bytes(buf, words);
+    if (is_imem) {
+      iss.load_i_shared(num_bytes);
+    } else {
+      iss.load_d_shared(num_bytes);
+    }
+    return;
+  }
+
+  std::string path(iss.make_tmp_path(is_imem ? "imem" : "dmem"));
+  write_words_to_file(path, words);
+  if (is_imem) {
+    iss.load_i(path);
+  } else {
+    iss.load_d(path);
+  }
+}
+
+Ecc32MemArea::EccWords OtbnModel::read_iss_dmem(ISSWrapper &iss) const {
+  size_t num_words = mem_util_.GetMemArea(false).GetSizeBytes() / 4;
+  size_t num_bytes = bytes_per_iss_word * num_words;
+
+  uint8_t *buf = iss.get_shared_buf(num_bytes);
+  if (buf) {
+    iss.dump_d_shared(num_bytes);
+    return read_words_from_bytes(buf, num_words, "shared memory");
+  }
+
+  std::string path(iss.make_tmp_path("dmem_out"));
+  iss.dump_d(path);
+  return read_words_from_file(path, num_words);
+}
+
+bool OtbnModel::check_dmem(ISSWrapper &iss) {
+  // We can only do an incremental check if the ISS and the simulation had the
+  // same DMEM contents when the operation started and we have seen the RTL's
+  // writes since then.
+  bool can_check_dirty = incremental_dmem_check_ && dmem_tracker_ &&
+                         dmem_synced_ && dmem_tracker_->SeenTrace();
+
+  if (can_check_dirty &&
+      dmem_checks_since_full_ + 1 < dmem_full_check_period_) {
+    ++dmem_checks_since_full_;
+    return check_dirty_dmem(iss);
+  }
+
+  dmem_checks_since_full_ = 0;
+  return check_all_dmem(iss);
+}
+
+bool OtbnModel::check_all_dmem(ISSWrapper &iss) const {
   const MemArea &dmem = mem_util_.GetMemArea(false);
   uint32_t dmem_bytes = dmem.GetSizeBytes();
 
-  std::string dfname(iss.make_tmp_path("dmem_out"));
-
-  iss.dump_d(dfname);
-  Ecc32MemArea::EccWords iss_words =
-      read_words_from_file(dfname, dmem_bytes / 4);
+  Ecc32MemArea::EccWords iss_words = read_iss_dmem(iss);
   assert(iss_words.size() == dmem_bytes / 4);
 
   Ecc32MemArea::EccWords rtl_words = get_sim_memory(false);
@@ -700,49 +896,55 @@ bool OtbnModel::check_dmem(ISSWrapper &iss) const {
   old_state.copyfmt(std::cerr);
 
   int bad_count = 0;
-  for (size_t i = 0; i < dmem_bytes / 4; ++i) {
-    bool iss_valid = iss_words[i].first;
-    bool rtl_valid = rtl_words[i].first;
-    uint32_t iss_w32 = iss_words[i].second;
-    uint32_t rtl_w32 = rtl_words[i].second;
-
-    // If neither word has valid checksum bits, all is well.
-    if (!iss_valid && !rtl_valid)
-      continue;
+  for (size_t i = 0; i < dmem_bytes / 4 && bad_count < 10; ++i) {
+    check_dmem_word(i, iss_words[i], rtl_words[i], &bad_count);
+  }
+  std::cerr.copyfmt(old_state);
+  return bad_count == 0;
+}
 
-    // If both words have valid checksum bits and equal data, all is well.
-    if (iss_valid && rtl_valid && iss_w32 == rtl_w32)
-      continue;
+bool OtbnModel::check_dirty_dmem(ISSWrapper &iss) const {
+  assert(dmem_tracker_);
 
-    // TODO: At the moment, the ISS doesn't track validity bits properly in
-    //       DMEM, which means that we might have a situation where RTL says a
-    //       word is invalid, but the ISS doesn't. To avoid spurious failures
-    //       until we've implemented things, skip the check in this case. Once
-    //       the ISS handles validity bits properly, delete this block.
-    if (iss_valid && !rtl_valid)
-      continue;
+  // Ask the ISS for the words that it has written, together with those that
+  // the RTL has written.
+  std::vector<ISSWrapper::DmemWord> iss_words =
+      iss.get_dirty_dmem(dmem_tracker_->WrittenWords());
 
-    // Otherwise, something has gone wrong. Print out a banner if this is the
-    // first mismatch.
-    if (bad_count == 0) {
-      std::cerr << "ERROR: Mismatches in dmem data:\n"
-                << std::hex << std::setfill('0');
-    }
+  // Each word in the DMEM memory area contains several 32-bit words. Read
+  // from the RTL a memory word at a time (iss_words is sorted, so we only
+  // need to read each memory word once).
+  const Ecc32MemArea &dmem = mem_util_.GetMemArea(false);
+  uint32_t words_per_row = dmem.GetWidthByte() / 4;
+  uint32_t num_rows = dmem.GetSizeWords();
+  uint32_t cur_row = num_rows;
+  Ecc32MemArea::EccWords rtl_row;
 
-    std::cerr << " @offset 0x" << std::setw(3) << 4 * i << ": ";
-    if (iss_valid != rtl_valid) {
-      std::cerr << "mismatching validity bits (rtl = " << rtl_valid
-                << "; iss = " << iss_valid << ")\n";
-    } else {
-      assert(iss_valid && rtl_valid && iss_w32 != rtl_w32);
-      std::cerr << "rtl has 0x" << std::setw(8) << rtl_w32 << "; iss has 0x"
-                << std::setw(8) << iss_w32 << "\n";
-    }
-    ++bad_count;
-    if (bad_count == 10) {
-      std::cerr << " (skipping further errors...)\n";
+  std::ios old_state(nullptr);
+  old_state.copyfmt(std::cerr);
+
+  int bad_count = 0;
+  for (const ISSWrapper::DmemWord &iss_word : iss_words) {
+    if (bad_count >= 10)
       break;
+
+    uint32_t row = iss_word.idx / words_per_row;
+    if (row >= num_rows) {
+      std::cerr.copyfmt(old_state);
+      std::ostringstream oss;
+      oss << "ISS reported a write to DMEM word " << iss_word.idx
+          << ", which is out of range.";
+      throw std::runtime_error(oss.str());
+    }
+    if (row != cur_row) {
+      rtl_row = dmem.ReadWithIntegrity(row, 1);
+      cur_row = row;
     }
+    assert(rtl_row.size() == words_per_row);
+
+    check_dmem_word(iss_word.idx,
+                    std::make_pair(iss_word.valid, iss_word.value),
+                    rtl_row[iss_word.idx % words_per_row], &bad_count);
   }
   std::cerr.copyfmt(old_state);
   return bad_count == 0;
@@ -848,6 +1050,7 @@ int OtbnModel::initial_secure_wipe() {
   if (!iss)
     return -1;
 
+  dmem_synced_ = false;
   iss->initial_secure_wipe();
 
   return 0;
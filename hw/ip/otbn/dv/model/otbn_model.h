@@ -13,6 +13,7 @@
 #include "otbn_memutil.h"
 
 struct ISSWrapper;
+class OtbnDmemWriteTracker;
 
 class OtbnModel {
  public:
@@ -75,7 +76,13 @@ class OtbnModel {
   // Check model against RTL (if there is any) when a run has finished. Prints
   // messages to stderr on failure or mismatch. Returns 1 for a match, 0 for a
   // mismatch, -1 for some other failure.
-  int check() const;
+  //
+  // If the OTBN_MODEL_DMEM_CHECK environment variable is set to
+  // "incremental", the DMEM check only compares words that the RTL or the ISS
+  // have written since the ISS was given the contents of DMEM. Every Nth
+  // check is still a full comparison, where N is given by the
+  // OTBN_MODEL_DMEM_FULL_CHECK_PERIOD environment variable (default 16).
+  int check();
 
   // Grab contents of dmem from the model and load it back into the RTL
   // simulation. This is used when there's no RTL model of the design. Returns
@@ -142,10 +149,26 @@ class OtbnModel {
   // Set the contents of the ISS's memory
   void set_sim_memory(bool is_imem, const Ecc32MemArea::EccWords &words);
 
+  // Send the contents of IMEM or DMEM from the simulation to the ISS. This
+  // uses a shared memory buffer if possible and falls back to a temporary file
+  // otherwise. Throws a std::runtime_error on failure.
+  void send_sim_memory(ISSWrapper &iss, bool is_imem) const;
+
+  // Read the contents of DMEM from the ISS (in the same way as
+  // send_sim_memory). Throws a std::runtime_error on failure.
+  Ecc32MemArea::EccWords read_iss_dmem(ISSWrapper &iss) const;
+
   // Grab contents of dmem from the model and compare them with the RTL. Prints
   // messages to stderr on failure or mismatch. Returns true on success; false
   // on mismatch. Throws a std::runtime_error on failure.
-  bool check_dmem(ISSWrapper &iss) const;
+  bool check_dmem(ISSWrapper &iss);
+
+  // Compare all of DMEM (used by check_dmem)
+  bool check_all_dmem(ISSWrapper &iss) const;
+
+  // Compare just the words of DMEM that have been written by the RTL or the
+  // ISS since the last time DMEM was sent to the ISS (used by check_dmem)
+  bool check_dirty_dmem(ISSWrapper &iss) const;
 
   // Compare contents of ISS registers with those from the design. Prints
   // messages to stderr on failure or mismatch. Returns true on success; false
@@ -160,13 +183,32 @@ class OtbnModel {
   // We want to create the model in an initial block in the SystemVerilog
   // simulation, but might not actually want to spawn the ISS. To handle that
   // in a non-racy way, the most convenient thing is to spawn the ISS the first
-  // time it's actually needed. Use ensure_wrapper() to create as needed.
+  // time it's actually needed. Use ensure_wrapper() to create as needed. The
+  // wrapper is leased from ISSPool and goes back there when the model is
+  // destroyed.
   std::unique_ptr<ISSWrapper> iss_;
 
   OtbnMemUtil mem_util_;
   std::string design_scope_;
 
   bool stack_check_enabled_ = true;
+
+  // True if we should only check the parts of DMEM that have been written
+  // (see check()). In this case, dmem_tracker_ is non-null if we have an RTL
+  // implementation.
+  bool incremental_dmem_check_ = false;
+  std::unique_ptr<OtbnDmemWriteTracker> dmem_tracker_;
+
+  // With incremental DMEM checks, every dmem_full_check_period_'th check
+  // compares all of DMEM. dmem_checks_since_full_ counts the incremental
+  // checks since the last full one.
+  unsigned dmem_full_check_period_ = 1;
+  unsigned dmem_checks_since_full_ = 0;
+
+  // True if the ISS has been given the contents of DMEM from the simulation
+  // and nothing has changed either version other than the code that is
+  // running. If not, an incremental check is not possible.
+  bool dmem_synced_ = false;
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_MODEL_H_
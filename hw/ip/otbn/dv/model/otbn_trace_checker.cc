@@ -21,7 +21,8 @@ OtbnTraceChecker::OtbnTraceChecker()
       iss_pending_(false),
       done_(true),
       seen_err_(false),
-      last_data_vld_(false) {
+      last_data_vld_(false),
+      no_sec_wipe_data_chk_(false) {
   OtbnTraceSource::get().AddListener(this);
 }
 
@@ -48,7 +49,9 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
     return;
 
   done_ = false;
-  OtbnTraceEntry trace_entry;
+  // Parse into rtl_scratch_, reusing its storage from earlier entries. This
+  // is called on every cycle, so we try not to allocate memory.
+  OtbnTraceEntry &trace_entry = rtl_scratch_;
   if (!trace_entry.from_rtl_trace(trace)) {
     seen_err_ = true;
     return;
@@ -118,7 +121,7 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
       // This is the first partial entry. Set the rtl_started_ flag and save
       // trace_entry.
       rtl_started_ = true;
-      rtl_entry_ = trace_entry;
+      rtl_entry_.swap(trace_entry);
     }
     return;
   }
@@ -146,7 +149,7 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
 
   rtl_pending_ = true;
   rtl_started_ = false;
-  rtl_entry_ = trace_entry;
+  rtl_entry_.swap(trace_entry);
 
   if (!MatchPair()) {
     seen_err_ = true;
@@ -160,7 +163,7 @@ bool OtbnTraceChecker::OnIssTrace(const std::vector<std::string> &lines) {
     return false;
   }
 
-  OtbnIssTraceEntry trace_entry;
+  OtbnIssTraceEntry &trace_entry = iss_scratch_;
   if (!trace_entry.from_iss_trace(lines)) {
     // Error parsing ISS trace. This has already printed a message to stderr.
     // Just return false to pass the error code along.
@@ -192,7 +195,7 @@ bool OtbnTraceChecker::OnIssTrace(const std::vector<std::string> &lines) {
   }
 
   iss_started_ = true;
-  iss_entry_ = trace_entry;
+  iss_entry_.swap(trace_entry);
 
   // Set the pending flag if we've got the end of an event (either E or V).
   if (iss_entry_.is_final()) {
@@ -270,7 +273,8 @@ bool OtbnTraceChecker::MatchPair() {
   // We've got a matching pair of entries. Move the ISS data out of the (now
   // defunct) iss_entry_ and into last_data_.
   if (rtl_entry_.trace_type() == OtbnTraceEntry::Exec) {
-    last_data_ = std::move(iss_entry_.data_);
+    last_data_.insn_addr = iss_entry_.data_.insn_addr;
+    last_data_.mnemonic.swap(iss_entry_.data_.mnemonic);
     last_data_vld_ = true;
   }
 
@@ -95,6 +95,12 @@ class OtbnTraceChecker : public OtbnTraceListener {
   bool iss_pending_;
   OtbnIssTraceEntry iss_entry_;
 
+  // Entries that new traces get parsed into. These are kept between calls
+  // (and swapped with rtl_entry_ and iss_entry_) so that the strings and
+  // vectors inside them can be reused.
+  OtbnTraceEntry rtl_scratch_;
+  OtbnIssTraceEntry iss_scratch_;
+
   bool done_;
   bool seen_err_;
 
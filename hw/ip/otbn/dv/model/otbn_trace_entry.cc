@@ -4,29 +4,36 @@
 
 #include "otbn_trace_entry.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <regex>
 #include <sstream>
 
 bool OtbnTraceBodyLine::fill_from_string(const std::string &src,
-                                         const std::string &line) {
-  // A valid line matches the following regex
-  std::regex re("(.) ([^:]+): (.+)");
-  std::smatch match;
-
-  if (!std::regex_match(line, match, re)) {
+                                         const char *line, size_t len) {
+  // A valid line matches the regex "(.) ([^:]+): (.+)". That is, a type
+  // character and a space, then a non-empty location up to the first colon,
+  // then a colon, a space and a non-empty value.
+  const char *colon =
+      len > 2 ? static_cast<const char *>(memchr(line + 2, ':', len - 2))
+              : nullptr;
+  size_t colon_pos = colon ? colon - line : 0;
+
+  if (!colon || line[1] != ' ' || colon_pos < 3 || colon_pos + 2 >= len ||
+      line[colon_pos + 1] != ' ' || memchr(line, '\n', len) ||
+      memchr(line, '\r', len)) {
     std::cerr << "OTBN trace body line from " << src
-              << " does not have expected format. Saw: `" << line << "'.\n";
+              << " does not have expected format. Saw: `"
+              << std::string(line, len) << "'.\n";
     return false;
   }
 
-  assert(match.size() == 4);
-
-  raw_ = line;
-  type_ = match[1].str()[0];
-  loc_ = match[2].str();
-  value_ = match[3].str();
+  raw_.assign(line, len);
+  type_ = line[0];
+  loc_len_ = colon_pos - 2;
+  value_pos_ = colon_pos + 2;
   return true;
 }
 
@@ -41,49 +48,65 @@ bool OtbnTraceBodyLine::operator==(const OtbnTraceBodyLine &other) const {
   // of them contains unknown values.
 
   // Type and location have to be identical, though.
-  if (type_ != other.type_ || loc_ != other.loc_) {
+  if (type_ != other.type_ || compare_loc(other) != 0) {
     return false;
   }
 
   // The values have to be of identical length.
-  if (value_.size() != other.value_.size()) {
+  size_t value_len = raw_.size() - value_pos_;
+  if (value_len != other.raw_.size() - other.value_pos_) {
     return false;
   }
 
   // Compare values digit by digit and treat `x` as unknown value, which is
   // identical to any other value.
-  std::string::const_iterator other_it = other.value_.begin();
-  for (std::string::const_iterator it = value_.begin(); it != value_.end();
-       it++) {
-    if (*it != *other_it && !(*it == 'x' || *other_it == 'x')) {
+  const char *value = raw_.data() + value_pos_;
+  const char *other_value = other.raw_.data() + other.value_pos_;
+  for (size_t i = 0; i < value_len; ++i) {
+    if (value[i] != other_value[i] &&
+        !(value[i] == 'x' || other_value[i] == 'x')) {
       return false;
     }
-    other_it++;
   }
   return true;
 }
 
+int OtbnTraceBodyLine::compare_loc(const OtbnTraceBodyLine &other) const {
+  // This gives the same order as comparing the locations as std::string
+  // objects.
+  int cmp = memcmp(raw_.data() + 2, other.raw_.data() + 2,
+                   std::min(loc_len_, other.loc_len_));
+  if (cmp != 0)
+    return cmp;
+  return (loc_len_ < other.loc_len_) ? -1 : (loc_len_ > other.loc_len_);
+}
+
+bool OtbnTraceBodyLine::loc_is(const char *loc) const {
+  return strlen(loc) == loc_len_ && 0 == memcmp(raw_.data() + 2, loc, loc_len_);
+}
+
 bool OtbnTraceEntry::from_rtl_trace(const std::string &trace) {
+  clear();
+
   size_t eol = trace.find('\n');
-  hdr_ = trace.substr(0, eol);
+  hdr_.assign(trace, 0, eol);
   trace_type_ = hdr_to_trace_type(hdr_);
 
   while (eol != std::string::npos) {
     size_t bol = eol + 1;
     eol = trace.find('\n', bol);
     size_t line_len =
-        (eol == std::string::npos) ? std::string::npos : eol - bol;
-    std::string line = trace.substr(bol, line_len);
+        (eol == std::string::npos) ? trace.size() - bol : eol - bol;
 
     // We're only interested in register writes
-    if (!(line.size() > 0 && line[0] == '>'))
+    if (!(line_len > 0 && trace[bol] == '>'))
       continue;
 
-    OtbnTraceBodyLine parsed_line;
-    if (!parsed_line.fill_from_string("RTL", line)) {
+    if (!next_write_slot().fill_from_string("RTL", trace.data() + bol,
+                                            line_len)) {
       return false;
     }
-    writes_[parsed_line.get_loc()].push_back(parsed_line);
+    commit_write(false);
   }
   return true;
 }
@@ -98,26 +121,44 @@ bool OtbnTraceEntry::compare_rtl_iss_entries(const OtbnTraceEntry &other,
     return false;
   }
 
-  for (const auto &rtlptr : writes_) {
-    auto isskey = other.writes_.find(rtlptr.first);
-    if (isskey == other.writes_.end()) {
+  auto loc_less = [](const OtbnTraceBodyLine &a, const OtbnTraceBodyLine &b) {
+    return a.compare_loc(b) < 0;
+  };
+  const OtbnTraceBodyLine *iss_begin = other.writes_.data();
+  const OtbnTraceBodyLine *iss_end = iss_begin + other.num_writes_;
+
+  // Both lists of writes are sorted by location, so walk through the RTL
+  // writes one location at a time and look up the matching ISS writes.
+  size_t rtl_idx = 0;
+  while (rtl_idx < num_writes_) {
+    const OtbnTraceBodyLine &first = writes_[rtl_idx];
+    size_t rtl_end = rtl_idx + 1;
+    while (rtl_end < num_writes_ && writes_[rtl_end].compare_loc(first) == 0)
+      ++rtl_end;
+
+    auto iss_range = std::equal_range(iss_begin, iss_end, first, loc_less);
+    if (iss_range.first == iss_range.second) {
       std::ostringstream oss;
-      oss << "RTL had a write to `" << rtlptr.first
+      oss << "RTL had a write to `" << first.get_loc()
           << "', but the ISS doesn't have a write to that location.";
       *err_desc = oss.str();
       return false;
     }
-    // compare rtlptr.second and isskey.second
-    if (!check_entries_compatible(trace_type_, rtlptr.first, rtlptr.second,
-                                  isskey->second, no_sec_wipe_data_chk,
-                                  err_desc))
+    // compare the RTL writes with the last ISS write
+    if (!check_entries_compatible(trace_type_, &first, rtl_end - rtl_idx,
+                                  *(iss_range.second - 1),
+                                  no_sec_wipe_data_chk, err_desc))
       return false;
+
+    rtl_idx = rtl_end;
   }
 
-  if (writes_.size() != other.writes_.size()) {
+  size_t rtl_locs = count_write_locs();
+  size_t iss_locs = other.count_write_locs();
+  if (rtl_locs != iss_locs) {
     std::ostringstream oss;
-    oss << "RTL wrote to " << writes_.size() << " locations; the ISS wrote to "
-        << other.writes_.size() << ".";
+    oss << "RTL wrote to " << rtl_locs << " locations; the ISS wrote to "
+        << iss_locs << ".";
     *err_desc = oss.str();
     return false;
   }
@@ -127,32 +168,39 @@ bool OtbnTraceEntry::compare_rtl_iss_entries(const OtbnTraceEntry &other,
 
 void OtbnTraceEntry::print(const std::string &indent, std::ostream &os) const {
   os << indent << hdr_ << "\n";
-  for (const auto &pr : writes_) {
-    for (const auto &line : pr.second) {
-      os << indent << line.get_string() << "\n";
-    }
+  for (size_t i = 0; i < num_writes_; ++i) {
+    os << indent << writes_[i].get_string() << "\n";
   }
 }
 
 void OtbnTraceEntry::take_writes(const OtbnTraceEntry &other,
                                  bool other_first) {
-  for (const auto &pr : other.writes_) {
-    std::vector<OtbnTraceBodyLine> &so_far = writes_[pr.first];
-    if (other_first) {
-      // If other_first is true, we should prepend the writes from other. We do
-      // so by creating a temporary vector (with a copy of the writes from
-      // other) and then appending any writes we had before.
-      std::vector<OtbnTraceBodyLine> tmp(pr.second);
-      tmp.insert(tmp.end(), so_far.begin(), so_far.end());
-      writes_[pr.first] = tmp;
-    } else {
-      // If other_first is false, we should append the writes from other. We
-      // can do that with just a call to insert.
-      so_far.insert(so_far.end(), pr.second.begin(), pr.second.end());
+  assert(&other != this);
+  if (other_first) {
+    // If other_first is true, we should prepend the writes from other. We do
+    // so by adding them in reverse order, each before any writes we already
+    // have to the same location.
+    for (size_t i = other.num_writes_; i > 0; --i) {
+      next_write_slot() = other.writes_[i - 1];
+      commit_write(true);
+    }
+  } else {
+    // If other_first is false, we should append the writes from other, each
+    // after any writes we already have to the same location.
+    for (size_t i = 0; i < other.num_writes_; ++i) {
+      next_write_slot() = other.writes_[i];
+      commit_write(false);
     }
   }
 }
 
+void OtbnTraceEntry::swap(OtbnTraceEntry &other) {
+  std::swap(trace_type_, other.trace_type_);
+  hdr_.swap(other.hdr_);
+  writes_.swap(other.writes_);
+  std::swap(num_writes_, other.num_writes_);
+}
+
 bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
   // Two entries are compatible if they might both come from the multi-cycle
   // execution of one instruction. For example, you might expect to see these
@@ -221,24 +269,63 @@ bool OtbnTraceEntry::is_final() const {
           (trace_type_ == OtbnTraceEntry::Stray));
 }
 
+void OtbnTraceEntry::clear() {
+  trace_type_ = Invalid;
+  hdr_.clear();
+  num_writes_ = 0;
+}
+
+OtbnTraceBodyLine &OtbnTraceEntry::next_write_slot() {
+  if (writes_.size() == num_writes_)
+    writes_.emplace_back();
+  return writes_[num_writes_];
+}
+
+void OtbnTraceEntry::commit_write(bool before_same_loc) {
+  assert(num_writes_ < writes_.size());
+  auto loc_less = [](const OtbnTraceBodyLine &a, const OtbnTraceBodyLine &b) {
+    return a.compare_loc(b) < 0;
+  };
+
+  // The new line is at writes_[num_writes_], just after the lines in use.
+  // Find where it should go and rotate it into place (which swaps strings
+  // rather than copying them).
+  auto begin = writes_.begin();
+  auto last = begin + num_writes_;
+  auto pos = before_same_loc ? std::lower_bound(begin, last, *last, loc_less)
+                             : std::upper_bound(begin, last, *last, loc_less);
+  std::rotate(pos, last, last + 1);
+  ++num_writes_;
+}
+
+size_t OtbnTraceEntry::count_write_locs() const {
+  size_t count = 0;
+  for (size_t i = 0; i < num_writes_; ++i) {
+    if (i == 0 || writes_[i].compare_loc(writes_[i - 1]) != 0)
+      ++count;
+  }
+  return count;
+}
+
 bool OtbnTraceEntry::check_entries_compatible(
-    trace_type_t type, const std::string &key,
-    const std::vector<OtbnTraceBodyLine> &rtl_lines,
-    const std::vector<OtbnTraceBodyLine> &iss_lines, bool no_sec_wipe_data_chk,
-    std::string *err_desc) {
-  assert(rtl_lines.size() && iss_lines.size());
+    trace_type_t type, const OtbnTraceBodyLine *rtl_lines,
+    size_t num_rtl_lines, const OtbnTraceBodyLine &iss_line,
+    bool no_sec_wipe_data_chk, std::string *err_desc) {
+  assert(num_rtl_lines);
   assert(type == WipeComplete || type == Exec);
   assert(err_desc);
 
-  if (type == WipeComplete && key != "FLAGS0" && key != "FLAGS1") {
+  const OtbnTraceBodyLine &key_line = rtl_lines[0];
+  if (type == WipeComplete && !key_line.loc_is("FLAGS0") &&
+      !key_line.loc_is("FLAGS1")) {
     // As a quick check: make sure that there are at least 2 lines for
     // the key. We will also check that they are different, but
     // debugging is probably easier if the error message comments that
     // there aren't two lines *to* be different.
-    if (rtl_lines.size() < 2) {
+    if (num_rtl_lines < 2) {
       std::ostringstream oss;
-      oss << "There are " << rtl_lines.size() << " RTL lines for key `" << key
-          << "'; we expected at least 2.";
+      oss << "There are " << num_rtl_lines << " RTL lines for key `"
+          << key_line.get_loc() << "'; we expected at least 2.";
       *err_desc = oss.str();
       return false;
     }
@@ -247,7 +334,7 @@ bool OtbnTraceEntry::check_entries_compatible(
     // different values. This checks that we don't (e.g.) just write
     // zero to the key many times.
     bool seen_change = false;
-    for (size_t i = 1; i < rtl_lines.size(); i++) {
+    for (size_t i = 1; i < num_rtl_lines; i++) {
       if (!(rtl_lines[i] == rtl_lines[0])) {
         seen_change = true;
         break;
@@ -256,15 +343,17 @@ bool OtbnTraceEntry::check_entries_compatible(
 
     if (!seen_change && !no_sec_wipe_data_chk) {
       std::ostringstream oss;
-      oss << "All RTL lines for key `" << key << "' are identical.";
+      oss << "All RTL lines for key `" << key_line.get_loc()
+          << "' are identical.";
       *err_desc = oss.str();
       return false;
     }
   }
 
-  if (!(rtl_lines.back() == iss_lines.back())) {
+  if (!(rtl_lines[num_rtl_lines - 1] == iss_line)) {
     std::ostringstream oss;
-    oss << "Final values of ISS and RTL don't match for key `" << key << "'.";
+    oss << "Final values of ISS and RTL don't match for key `"
+        << key_line.get_loc() << "'.";
     *err_desc = oss.str();
     return false;
   }
@@ -294,14 +383,45 @@ OtbnTraceEntry::trace_type_t OtbnTraceEntry::hdr_to_trace_type(
   }
 }
 
+// Parse a "special" line from the ISS, which should be of the form
+//
+//  # @ADDR: MNEMONIC
+//
+// where ADDR is an 8-digit instruction address (in lower-case hex) and
+// MNEMONIC is the string mnemonic. On success, write the results to *data and
+// return true.
+static bool parse_special_line(const std::string &line,
+                               OtbnIssTraceEntry::IssData *data) {
+  static const char prefix[] = "# @0x";
+  static const size_t prefix_len = sizeof prefix - 1;
+  static const size_t mnemonic_pos = prefix_len + 8 + 2;
+
+  if (line.size() < mnemonic_pos || line.compare(0, prefix_len, prefix) != 0 ||
+      line.compare(prefix_len + 8, 2, ": ") != 0)
+    return false;
+
+  for (size_t i = prefix_len; i < prefix_len + 8; ++i) {
+    char c = line[i];
+    if (!(('0' <= c && c <= '9') || ('a' <= c && c <= 'f')))
+      return false;
+  }
+  if (line.find_first_of("\r\n", mnemonic_pos) != std::string::npos)
+    return false;
+
+  data->insn_addr = (uint32_t)strtoul(line.c_str() + prefix_len, nullptr, 16);
+  data->mnemonic.assign(line, mnemonic_pos, std::string::npos);
+  return true;
+}
+
 bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
+  clear();
+  data_.insn_addr = 0;
+  data_.mnemonic.clear();
+
   // Read FSM. state 0 = read header; state 1 = read mnemonic (for E
   // lines); state 2 = read writes
   int state = 0;
 
-  std::regex re("# @0x([0-9a-f]{8}): (.*)");
-  std::smatch match;
-
   for (const std::string &line : lines) {
     switch (state) {
       case 0:
@@ -312,21 +432,12 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
 
       case 1:
         // This some "special" extra data from the ISS that we use for
-        // functional coverage calculations. The line should be of the form
-        //
-        //  # @ADDR: MNEMONIC
-        //
-        // where ADDR is an 8-digit instruction address (in hex) and mnemonic
-        // is the string mnemonic.
-        if (!std::regex_match(line, match, re)) {
+        // functional coverage calculations (see parse_special_line).
+        if (!parse_special_line(line, &data_)) {
           std::cerr << "Bad 'special' line for ISS trace with header `" << hdr_
                     << "': `" << line << "'.\n";
           return false;
         }
-        assert(match.size() == 3);
-        data_.insn_addr =
-            (uint32_t)strtoul(match[1].str().c_str(), nullptr, 16);
-        data_.mnemonic = match[2].str();
         state = 2;
         break;
 
@@ -336,11 +447,11 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
         // external register changes, not tracked by the RTL core simulation)
         bool is_bang = (line.size() > 0 && line[0] == '!');
         if (!is_bang) {
-          OtbnTraceBodyLine parsed_line;
-          if (!parsed_line.fill_from_string("ISS", line)) {
+          if (!next_write_slot().fill_from_string("ISS", line.data(),
+                                                  line.size())) {
             return false;
           }
-          writes_[parsed_line.get_loc()].push_back(parsed_line);
+          commit_write(false);
         }
         break;
       }
@@ -357,3 +468,9 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
 
   return true;
 }
+
+void OtbnIssTraceEntry::swap(OtbnIssTraceEntry &other) {
+  OtbnTraceEntry::swap(other);
+  std::swap(data_.insn_addr, other.data_.insn_addr);
+  data_.mnemonic.swap(other.data_.mnemonic);
+}
@@ -4,8 +4,9 @@
 #ifndef OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 #define OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 
+#include <cstddef>
 #include <cstdint>
-#include <map>
+#include <iosfwd>
 #include <string>
 #include <vector>
 
@@ -17,17 +18,31 @@
 // and we parse them accordingly here. The point is that we want to merge
 // successive writes to the same location and thus need to unpack things enough
 // to see them.
+//
+// LOC and VALUE are stored as positions in the raw line, so refilling an
+// existing object doesn't need to allocate memory unless the line is longer
+// than any that the object has held before.
 class OtbnTraceBodyLine {
  public:
-  // Parse a line into this object, based on the format above. On success,
-  // return true. On failure, write an error message to stderr (using src to
-  // say where the line came from) and return false.
-  bool fill_from_string(const std::string &src, const std::string &line);
+  OtbnTraceBodyLine() : type_('\0'), loc_len_(0), value_pos_(0) {}
+
+  // Parse a line (of len characters, starting at line) into this object,
+  // based on the format above. On success, return true. On failure, write an
+  // error message to stderr (using src to say where the line came from) and
+  // return false.
+  bool fill_from_string(const std::string &src, const char *line, size_t len);
 
   bool operator==(const OtbnTraceBodyLine &other) const;
 
+  // Compare the location that is being read or written with the one in other.
+  // Returns a negative number, zero or a positive number (like strcmp).
+  int compare_loc(const OtbnTraceBodyLine &other) const;
+
+  // True if the location that is being read or written is loc
+  bool loc_is(const char *loc) const;
+
   // Return the location that is being read or written
-  const std::string &get_loc() const { return loc_; }
+  std::string get_loc() const { return raw_.substr(2, loc_len_); }
 
   // Return the original string format for the entry
   const std::string &get_string() const { return raw_; }
@@ -35,8 +50,11 @@ class OtbnTraceBodyLine {
  private:
   std::string raw_;
   char type_;
-  std::string loc_;
-  std::string value_;
+
+  // LOC is the loc_len_ characters starting at raw_[2]. VALUE is everything
+  // from raw_[value_pos_] onwards.
+  size_t loc_len_;
+  size_t value_pos_;
 };
 
 class OtbnTraceEntry {
@@ -50,10 +68,11 @@ class OtbnTraceEntry {
     Stray,
   };
 
+  OtbnTraceEntry() : trace_type_(Invalid), num_writes_(0) {}
   virtual ~OtbnTraceEntry(){};
 
-  // Parse a trace entry from the RTL into this object. On an error, print a
-  // message to stderr and return false.
+  // Parse a trace entry from the RTL into this object, replacing its previous
+  // contents. On an error, print a message to stderr and return false.
   bool from_rtl_trace(const std::string &trace);
 
   bool compare_rtl_iss_entries(const OtbnTraceEntry &other,
@@ -64,6 +83,10 @@ class OtbnTraceEntry {
 
   void take_writes(const OtbnTraceEntry &other, bool other_first);
 
+  // Swap contents with other. This doesn't copy any strings, so the trace
+  // checker uses it to move entries around.
+  void swap(OtbnTraceEntry &other);
+
   trace_type_t trace_type() const { return trace_type_; }
 
   // True if this is an acceptable line to follow other (assumed to
@@ -77,26 +100,55 @@ class OtbnTraceEntry {
   bool is_final() const;
 
  protected:
-  static bool check_entries_compatible(
-      trace_type_t type, const std::string &key,
-      const std::vector<OtbnTraceBodyLine> &rtl_lines,
-      const std::vector<OtbnTraceBodyLine> &iss_lines,
-      bool no_sec_wipe_data_chk, std::string *err_desc);
+  // Clear the header and writes (keeping any allocated storage to reuse)
+  void clear();
+
+  // Return an unused entry at the end of writes_ to be filled in and then
+  // added with commit_write.
+  OtbnTraceBodyLine &next_write_slot();
+
+  // Add the line returned by the last call to next_write_slot to the writes
+  // for this entry. If before_same_loc is true, it goes before any existing
+  // writes to the same location. Otherwise, it goes after them.
+  void commit_write(bool before_same_loc);
+
+  // Return the number of different locations written by this entry
+  size_t count_write_locs() const;
+
+  // Check the num_rtl_lines RTL writes to a location (starting at rtl_lines)
+  // against the last ISS write to the same location.
+  static bool check_entries_compatible(trace_type_t type,
+                                       const OtbnTraceBodyLine *rtl_lines,
+                                       size_t num_rtl_lines,
+                                       const OtbnTraceBodyLine &iss_line,
+                                       bool no_sec_wipe_data_chk,
+                                       std::string *err_desc);
 
   static trace_type_t hdr_to_trace_type(const std::string &hdr);
 
   trace_type_t trace_type_;
   std::string hdr_;
-  // The register writes for this trace entry, keyed by destination
-  std::map<std::string, std::vector<OtbnTraceBodyLine>> writes_;
+
+  // The register writes for this trace entry, sorted by destination and then
+  // in the order they were seen. Only the first num_writes_ lines are in use:
+  // the rest are left over from earlier contents and get refilled by
+  // next_write_slot (reusing their strings).
+  std::vector<OtbnTraceBodyLine> writes_;
+  size_t num_writes_;
 };
 
 class OtbnIssTraceEntry : public OtbnTraceEntry {
  public:
+  // Parse a trace entry from the ISS into this object, replacing its previous
+  // contents. On an error, print a message to stderr and return false.
   bool from_iss_trace(const std::vector<std::string> &lines);
 
+  void swap(OtbnIssTraceEntry &other);
+
   // Fields that are populated from the "special" line for ISS entries
   struct IssData {
+    IssData() : insn_addr(0) {}
+
     uint32_t insn_addr;
     std::string mnemonic;
   };
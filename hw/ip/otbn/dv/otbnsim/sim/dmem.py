@@ -3,7 +3,7 @@
 # SPDX-License-Identifier: Apache-2.0
 
 import struct
-from typing import Dict, List, Sequence, Optional
+from typing import Dict, Iterable, List, Sequence, Optional, Set, Tuple
 
 from shared.mem_layout import get_memory_layout
 
@@ -66,6 +66,11 @@ class Dmem:
         self.trace: List[TraceDmemStore] = []
         self.pending: Dict[int, int] = {}
 
+        # The indices of the 32-bit words that have been written since DMEM
+        # was last loaded. A checker can use this to compare only the words
+        # that might have changed.
+        self.dirty: Set[int] = set()
+
     def _load_5byte_le_words(self, data: bytes) -> None:
         '''Replace the start of memory with data
 
@@ -129,6 +134,7 @@ class Dmem:
             self._load_5byte_le_words(data)
         else:
             self._load_4byte_le_words(data)
+        self.dirty = set()
 
     def dump_le_words(self) -> bytes:
         '''Return the contents of memory as bytes.
@@ -137,18 +143,38 @@ class Dmem:
         words are themselves packed little-endian into 256-bit words.
 
         '''
-        ret = b''
+        # Start with all-zero bytes, which is the encoding of an invalid word,
+        # and fill in the valid ones. This avoids repeatedly concatenating
+        # bytes objects (which is quadratic in the size of DMEM).
+        ret = bytearray(5 * len(self.data))
         for idx, u32 in enumerate(self.data):
             # If there's a pending store, apply it. This matches the RTL, where
             # we only observe the memory after that store has landed.
             u32 = self.pending.get(idx, u32)
 
-            if u32 is None:
-                ret += struct.pack('<BI', 0, 0)
-            else:
-                ret += struct.pack('<BI', 1, u32)
+            if u32 is not None:
+                struct.pack_into('<BI', ret, 5 * idx, 1, u32)
+
+        return bytes(ret)
+
+    def dirty_words(self,
+                    extra: Iterable[int]) -> List[Tuple[int, Optional[int]]]:
+        '''Return the 32-bit words written since DMEM was last loaded.
+
+        Also includes the words whose indices are in extra. The result is a
+        list of pairs (idx, value), sorted by idx, where value is None if the
+        word is invalid. As with dump_le_words, pending stores are applied.
+
+        '''
+        idxs = self.dirty.union(extra)
+        for idx in idxs:
+            if not 0 <= idx < len(self.data):
+                raise ValueError('Word index {} is out of range for DMEM, '
+                                 'which has {} words.'
+                                 .format(idx, len(self.data)))
 
-        return ret
+        return [(idx, self.pending.get(idx, self.data[idx]))
+                for idx in sorted(idxs)]
 
     def is_valid_256b_addr(self, addr: int) -> bool:
         '''Return true if this is a valid address for a BN.LID/BN.SID'''
@@ -236,10 +262,12 @@ class Dmem:
             for i in range(256 // 32):
                 wr_data = (item.value >> (i * 32)) & mask
                 self.pending[(item.addr // 4) + i] = wr_data
+                self.dirty.add((item.addr // 4) + i)
 
         else:
             assert 0 <= item.value <= (1 << 32) - 1
             self.pending[item.addr // 4] = item.value
+            self.dirty.add(item.addr // 4)
 
     def commit(self) -> None:
         # Move items from self.pending to self.data
@@ -2,6 +2,7 @@
 # Licensed under the Apache License, Version 2.0, see LICENSE for details.
 # SPDX-License-Identifier: Apache-2.0
 
+import copy
 from typing import Dict, Iterator, List, Optional, Tuple
 
 from .constants import ErrBits, LcTx, Status, read_lc_tx_t
@@ -31,6 +32,26 @@ class OTBNSim:
         self._execute_generator: Optional[Iterator[None]] = None
         self._next_insn: Optional[OTBNInsn] = None
 
+    def copy(self) -> 'OTBNSim':
+        '''Return an independent copy of the simulator state.
+
+        The program is shared with the copy, since it's never changed in
+        place. This can't be used part way through an instruction that takes
+        several cycles (see can_copy()).
+
+        '''
+        assert self.can_copy()
+        return copy.deepcopy(self, {id(self.program): self.program})
+
+    def can_copy(self) -> bool:
+        '''Return true if copy() can be used now.
+
+        An instruction that takes several cycles runs as a Python generator,
+        which can't be copied.
+
+        '''
+        return self._execute_generator is None
+
     def load_program(self, program: List[OTBNInsn]) -> None:
         self.program = program.copy()
         self.state.clear_imem_invalidation()
@@ -17,6 +17,18 @@ prefixed with "0x" if they are hexadecimal.
     step                    Run one instruction. Print trace information to
                             stdout.
 
+    step_batch <max>        Run up to <max> cycles, stopping early after a
+                            cycle that ends outside of the EXEC state, that
+                            changes an external register other than INSN_CNT
+                            or that leaves an RND request pending. The trace
+                            output for each cycle that has some is preceded
+                            by a line "@<idx>" (where <idx> is the index of
+                            the cycle in the batch, counting from zero). The
+                            response ends with "STEPPED <n> <event>", where
+                            <n> is the number of cycles that actually ran and
+                            <event> is 1 if the batch stopped early because of
+                            one of the conditions above (and 0 otherwise).
+
     load_elf <path>         Load the ELF file at <path>, replacing current
                             contents of DMEM and IMEM.
 
@@ -37,6 +49,28 @@ prefixed with "0x" if they are hexadecimal.
     dump_d <path>           Write the current contents of DMEM to <path> (same
                             format as for load).
 
+    dump_d_dirty [<idx> ...]
+
+                            Print the DMEM words that have been written since
+                            DMEM was last loaded, together with any words
+                            whose indices are given as arguments. Each word is
+                            printed as a line "<idx> <vld> <value>", where
+                            <vld> is 1 if the word is valid (and 0 otherwise).
+
+    set_shared_mem <fd>     Use the file descriptor <fd> (inherited from the
+                            parent process) as a shared memory buffer for the
+                            load_d_shm, load_i_shm and dump_d_shm commands.
+
+    load_d_shm <len>        Like load_d, but read <len> bytes from the start
+                            of the shared memory buffer.
+
+    load_i_shm <len>        Like load_i, but read <len> bytes from the start
+                            of the shared memory buffer.
+
+    dump_d_shm <len>        Like dump_d, but write to the start of the shared
+                            memory buffer. <len> must match the size of the
+                            dumped data.
+
     print_regs              Write the hex contents of all registers to stdout
 
     edn_rnd_step            Send 32b RND Data to the model.
@@ -70,15 +104,186 @@ prefixed with "0x" if they are hexadecimal.
     send_err_escalation     React to an injected error.
 
     set_software_errs_fatal Set software_errs_fatal bit.
+
+    set_protocol <proto>    Switch the output protocol to <proto>, which is
+                            either "text" or "binary". The response to this
+                            command is a line "PROTOCOL <proto>" in the old
+                            protocol and later responses use the new one.
+
+    checkpoint              Save a copy of the simulator state, replacing any
+                            earlier checkpoint. The response is a line
+                            "CHECKPOINT <ok>", where <ok> is 0 if the state
+                            couldn't be saved because an instruction that
+                            takes several cycles is in progress (in which case
+                            any earlier checkpoint is kept).
+
+    restore                 Go back to the state saved by the last checkpoint.
+
+By default, the response to each command is some lines of text, followed by a
+line containing a single '.'.
+
+With the binary protocol, the response to each command is a single frame,
+consisting of a 32-bit little-endian length, followed by that many bytes of
+records. Each record starts with a tag byte. All integers are little-endian.
+
+    FRAME_LINE          u16 length, then that many bytes of text. This is a
+                        line that would have been printed in text mode.
+
+    FRAME_EXT_REG       u8 register ID, u32 value. An update to the external
+                        register with that ID (see EXT_REG_IDS). Updates to
+                        other external registers are not reported.
+
+    FRAME_REGS          32 u32 GPR values, then 32 WDR values. Each WDR value
+                        is 8 u32 words, least significant first.
+
+    FRAME_CALL_STACK    u8 count, then that many u32 values, starting at the
+                        bottom of the stack.
+
+    FRAME_CYCLE         u32 index. Equivalent to the "@<idx>" line from
+                        step_batch.
+
+    FRAME_STEPPED       u32 count, u8 event flag. Equivalent to the
+                        "STEPPED <n> <event>" line from step_batch.
 '''
 
 import binascii
+import mmap
+import os
+import struct
 import sys
-from typing import List, Optional
+from typing import List, Optional, Tuple
 
-from sim.decode import decode_file
+from sim.decode import decode_bytes, decode_file
+from sim.ext_regs import TraceExtRegChange
 from sim.load_elf import load_elf
 from sim.sim import OTBNSim
+from sim.state import FsmState
+from sim.trace import Trace
+
+# Tags for records in the binary protocol. These must match the values in
+# iss_wrapper.cc.
+FRAME_LINE = 1
+FRAME_EXT_REG = 2
+FRAME_REGS = 3
+FRAME_CALL_STACK = 4
+FRAME_CYCLE = 5
+FRAME_STEPPED = 6
+
+# IDs for the external registers that are reported in binary mode. These must
+# match the order of ISSWrapper::ext_reg_t in iss_wrapper.h.
+EXT_REG_IDS = {
+    'STATUS': 0,
+    'INSN_CNT': 1,
+    'ERR_BITS': 2,
+    'STOP_PC': 3,
+    'RND_REQ': 4,
+    'WIPE_START': 5,
+    'LOAD_CHECKSUM': 6
+}
+
+
+class Output:
+    '''Collects the response to a command, writing it out at the end'''
+    def line(self, text: str) -> None:
+        raise NotImplementedError()
+
+    def ext_reg(self, name: str, value: int) -> None:
+        raise NotImplementedError()
+
+    def regs(self, gprs: List[int], wdrs: List[int]) -> None:
+        raise NotImplementedError()
+
+    def call_stack(self, values: List[int]) -> None:
+        raise NotImplementedError()
+
+    def cycle(self, idx: int) -> None:
+        raise NotImplementedError()
+
+    def stepped(self, count: int, is_event: bool) -> None:
+        raise NotImplementedError()
+
+    def end(self) -> None:
+        '''Write out the response and flush stdout'''
+        raise NotImplementedError()
+
+
+class TextOutput(Output):
+    '''The default, line-based, protocol'''
+    def __init__(self) -> None:
+        self._lines: List[str] = []
+
+    def line(self, text: str) -> None:
+        self._lines.append(text)
+
+    def ext_reg(self, name: str, value: int) -> None:
+        self._lines.append(f'! otbn.{name}: {value:#010x}')
+
+    def regs(self, gprs: List[int], wdrs: List[int]) -> None:
+        self._lines.append('PRINT_REGS')
+        for idx, value in enumerate(gprs):
+            self._lines.append(' x{:<2} = 0x{:08x}'.format(idx, value))
+        for idx, value in enumerate(wdrs):
+            self._lines.append(' w{:<2} = 0x{:064x}'.format(idx, value))
+
+    def call_stack(self, values: List[int]) -> None:
+        self._lines.append('PRINT_CALL_STACK')
+        for value in values:
+            self._lines.append('0x{:08x}'.format(value))
+
+    def cycle(self, idx: int) -> None:
+        self._lines.append(f'@{idx}')
+
+    def stepped(self, count: int, is_event: bool) -> None:
+        self._lines.append(f'STEPPED {count} {int(is_event)}')
+
+    def end(self) -> None:
+        self._lines.append('.\n')
+        sys.stdout.write('\n'.join(self._lines))
+        sys.stdout.flush()
+        self._lines = []
+
+
+class BinaryOutput(Output):
+    '''The length-prefixed binary protocol'''
+    def __init__(self) -> None:
+        self._buf = bytearray()
+
+    def line(self, text: str) -> None:
+        data = text.encode()
+        self._buf += struct.pack('<BH', FRAME_LINE, len(data))
+        self._buf += data
+
+    def ext_reg(self, name: str, value: int) -> None:
+        reg_id = EXT_REG_IDS.get(name)
+        if reg_id is not None:
+            self._buf += struct.pack('<BBI', FRAME_EXT_REG, reg_id, value)
+
+    def regs(self, gprs: List[int], wdrs: List[int]) -> None:
+        assert len(gprs) == 32 and len(wdrs) == 32
+        self._buf += struct.pack('<B32I', FRAME_REGS, *gprs)
+        for value in wdrs:
+            self._buf += value.to_bytes(32, 'little')
+
+    def call_stack(self, values: List[int]) -> None:
+        self._buf += struct.pack(f'<BB{len(values)}I',
+                                 FRAME_CALL_STACK, len(values), *values)
+
+    def cycle(self, idx: int) -> None:
+        self._buf += struct.pack('<BI', FRAME_CYCLE, idx)
+
+    def stepped(self, count: int, is_event: bool) -> None:
+        self._buf += struct.pack('<BIB', FRAME_STEPPED, count, int(is_event))
+
+    def end(self) -> None:
+        sys.stdout.buffer.write(struct.pack('<I', len(self._buf)) + self._buf)
+        sys.stdout.buffer.flush()
+        self._buf = bytearray()
+
+
+# The object that collects output for the current command and, if a
+# set_protocol command has been seen, the object to use after it.
+_OUTPUT: Output = TextOutput()
+_NEXT_OUTPUT: Optional[Output] = None
 
 
 def read_word(arg_name: str, word_data: str, bits: int) -> int:
@@ -98,9 +303,12 @@ def read_word(arg_name: str, word_data: str, bits: int) -> int:
 
 
 def end_command() -> None:
-    '''Print a single '.' to stdout and flush, ending the output for command'''
-    print('.')
-    sys.stdout.flush()
+    '''Write out the output for the current command and flush stdout'''
+    global _OUTPUT, _NEXT_OUTPUT
+    _OUTPUT.end()
+    if _NEXT_OUTPUT is not None:
+        _OUTPUT = _NEXT_OUTPUT
+        _NEXT_OUTPUT = None
 
 
 def check_arg_count(cmd: str, cnt: int, args: List[str]) -> None:
@@ -120,7 +328,7 @@ def on_start_operation(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     command = args[0]
 
     if command == 'Execute':
-        print('START')
+        _OUTPUT.line('START')
         sim.start(collect_stats=False)
     elif command == 'DmemWipe':
         sim.start_mem_wipe(False)
@@ -132,10 +340,14 @@ def on_start_operation(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
-def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
-    '''Step one instruction'''
-    check_arg_count('step', 0, args)
+def step_cycle(sim: OTBNSim) -> Tuple[Optional[str], List[Trace], bool]:
+    '''Step one cycle, returning the trace that it generated
+
+    The result is a header line (or None if there is nothing to trace), the
+    changes to trace after the header and a flag that is true if the cycle
+    should end a batched step (see on_step_batch).
 
+    '''
     pc = sim.state.pc
     assert 0 == pc & 3
 
@@ -160,10 +372,12 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
         hdr = None
 
     rtl_changes = []
+    is_event = False
     for c in changes:
-        rt = c.rtl_trace()
-        if rt is not None:
-            rtl_changes.append(rt)
+        if c.rtl_trace() is not None:
+            rtl_changes.append(c)
+        if isinstance(c, TraceExtRegChange) and c.name != 'INSN_CNT':
+            is_event = True
 
     # This is a bit of a hack. Very occasionally, we'll see traced changes when
     # there's not actually an instruction in flight. For example, this happens
@@ -174,10 +388,57 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     if hdr is None and rtl_changes:
         hdr = 'STALL'
 
+    # Outside of the EXEC state, or with an RND request pending, the
+    # SystemVerilog side is expected to poke at the model (sending EDN data,
+    # starting operations and so on), so we mustn't run ahead of it.
+    if (sim.state.get_fsm_state() != FsmState.EXEC or
+            sim.state.ext_regs.read('RND_REQ', True) != 0):
+        is_event = True
+
+    return (hdr, rtl_changes, is_event)
+
+
+def emit_cycle(hdr: str, changes: List[Trace]) -> None:
+    '''Write the trace for a cycle, as returned by step_cycle'''
+    _OUTPUT.line(hdr)
+    for c in changes:
+        if isinstance(c, TraceExtRegChange):
+            _OUTPUT.ext_reg(c.name, c.erc.new_value)
+        else:
+            rt = c.rtl_trace()
+            assert rt is not None
+            _OUTPUT.line(rt)
+
+
+def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Step one instruction'''
+    check_arg_count('step', 0, args)
+
+    hdr, changes, _ = step_cycle(sim)
     if hdr is not None:
-        print(hdr)
-        for rt in rtl_changes:
-            print(rt)
+        emit_cycle(hdr, changes)
+
+    return None
+
+
+def on_step_batch(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Step up to a given number of cycles, stopping early on an event'''
+    check_arg_count('step_batch', 1, args)
+
+    max_cycles = read_word('max', args[0], 32)
+    if max_cycles == 0:
+        raise ValueError('step_batch needs to run at least one cycle.')
+
+    cycles = 0
+    is_event = False
+    while cycles < max_cycles and not is_event:
+        hdr, changes, is_event = step_cycle(sim)
+        if hdr is not None:
+            _OUTPUT.cycle(cycles)
+            emit_cycle(hdr, changes)
+        cycles += 1
+
+    _OUTPUT.stepped(cycles, is_event)
 
     return None
 
@@ -188,7 +449,7 @@ def on_load_elf(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
 
     path = args[0]
 
-    print('LOAD_ELF {!r}'.format(path))
+    _OUTPUT.line('LOAD_ELF {!r}'.format(path))
     load_elf(sim, path)
 
     return None
@@ -212,7 +473,7 @@ def on_add_loop_warp(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
         raise ValueError('Bad argument to add_loop_warp: {}'
                          .format(err)) from None
 
-    print('ADD_LOOP_WARP {:#x} {} {}'.format(addr, from_cnt, to_cnt))
+    _OUTPUT.line('ADD_LOOP_WARP {:#x} {} {}'.format(addr, from_cnt, to_cnt))
     sim.add_loop_warp(addr, from_cnt, to_cnt)
 
     return None
@@ -233,7 +494,7 @@ def on_load_d(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
 
     path = args[0]
 
-    print('LOAD_D {!r}'.format(path))
+    _OUTPUT.line('LOAD_D {!r}'.format(path))
     with open(path, 'rb') as handle:
         sim.load_data(handle.read(), has_validity=True)
 
@@ -246,7 +507,7 @@ def on_load_i(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
 
     path = args[0]
 
-    print('LOAD_I {!r}'.format(path))
+    _OUTPUT.line('LOAD_I {!r}'.format(path))
     sim.load_program(decode_file(0, path))
 
     return None
@@ -258,7 +519,7 @@ def on_dump_d(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
 
     path = args[0]
 
-    print('DUMP_D {!r}'.format(path))
+    _OUTPUT.line('DUMP_D {!r}'.format(path))
 
     with open(path, 'wb') as handle:
         handle.write(sim.state.dmem.dump_le_words())
@@ -266,15 +527,104 @@ def on_dump_d(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
+def on_dump_d_dirty(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Print DMEM words written since the last load, plus any listed'''
+    extra = [read_word('idx', arg, 32) for arg in args]
+
+    for idx, u32 in sim.state.dmem.dirty_words(extra):
+        if u32 is None:
+            _OUTPUT.line(f'{idx:#x} 0 0x00000000')
+        else:
+            _OUTPUT.line(f'{idx:#x} 1 {u32:#010x}')
+
+    return None
+
+
+# The simulator state saved by the checkpoint command
+_CHECKPOINT: Optional[OTBNSim] = None
+
+# The shared memory buffer set up with set_shared_mem. _SHM_MAP is a mapping of
+# the start of the buffer, which gets recreated if a command needs more bytes
+# than it covers.
+_SHM_FD: Optional[int] = None
+_SHM_MAP: Optional[mmap.mmap] = None
+
+
+def get_shared_mem(cmd: str, args: List[str]) -> Tuple[int, mmap.mmap]:
+    '''Parse the length argument for cmd and map that much shared memory'''
+    check_arg_count(cmd, 1, args)
+
+    global _SHM_MAP
+    if _SHM_FD is None:
+        raise RuntimeError(f'Cannot run {cmd}: no shared memory buffer has '
+                           'been set up with set_shared_mem.')
+
+    length = read_word('len', args[0], 32)
+    if _SHM_MAP is None or len(_SHM_MAP) < length:
+        if _SHM_MAP is not None:
+            _SHM_MAP.close()
+        _SHM_MAP = mmap.mmap(_SHM_FD, max(length, 1))
+
+    return (length, _SHM_MAP)
+
+
+def on_set_shared_mem(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Use an inherited file descriptor as a shared memory buffer'''
+    check_arg_count('set_shared_mem', 1, args)
+
+    global _SHM_FD, _SHM_MAP
+    if _SHM_MAP is not None:
+        _SHM_MAP.close()
+        _SHM_MAP = None
+    if _SHM_FD is not None:
+        os.close(_SHM_FD)
+
+    _SHM_FD = read_word('fd', args[0], 32)
+    _OUTPUT.line(f'SHARED_MEM {_SHM_FD}')
+    return None
+
+
+def on_load_d_shm(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Load contents of data memory from the shared memory buffer'''
+    length, buf = get_shared_mem('load_d_shm', args)
+
+    _OUTPUT.line(f'LOAD_D_SHM {length}')
+    sim.load_data(buf[:length], has_validity=True)
+
+    return None
+
+
+def on_load_i_shm(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Load contents of insn memory from the shared memory buffer'''
+    length, buf = get_shared_mem('load_i_shm', args)
+
+    _OUTPUT.line(f'LOAD_I_SHM {length}')
+    sim.load_program(decode_bytes(0, buf[:length], 'shared memory'))
+
+    return None
+
+
+def on_dump_d_shm(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Dump contents of data memory to the shared memory buffer'''
+    length, buf = get_shared_mem('dump_d_shm', args)
+
+    _OUTPUT.line(f'DUMP_D_SHM {length}')
+
+    data = sim.state.dmem.dump_le_words()
+    if len(data) != length:
+        raise ValueError(f'Cannot dump {len(data)} bytes of DMEM to a '
+                         f'shared memory buffer of {length} bytes.')
+    buf[:length] = data
+
+    return None
+
+
 def on_print_regs(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     '''Print registers to stdout'''
     check_arg_count('print_regs', 0, args)
 
-    print('PRINT_REGS')
-    for idx, value in enumerate(sim.state.gprs.peek_unsigned_values()):
-        print(' x{:<2} = 0x{:08x}'.format(idx, value))
-    for idx, value in enumerate(sim.state.wdrs.peek_unsigned_values()):
-        print(' w{:<2} = 0x{:064x}'.format(idx, value))
+    _OUTPUT.regs(sim.state.gprs.peek_unsigned_values(),
+                 sim.state.wdrs.peek_unsigned_values())
 
     return None
 
@@ -283,18 +633,43 @@ def on_print_call_stack(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     '''Print call stack to stdout. First element is the bottom of the stack'''
     check_arg_count('print_call_stack', 0, args)
 
-    print('PRINT_CALL_STACK')
-    for value in sim.state.peek_call_stack():
-        print('0x{:08x}'.format(value))
+    _OUTPUT.call_stack(sim.state.peek_call_stack())
 
     return None
 
 
 def on_reset(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     check_arg_count('reset', 0, args)
+
+    global _CHECKPOINT
+    _CHECKPOINT = None
     return OTBNSim()
 
 
+def on_checkpoint(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Save a copy of the simulator state for a later restore'''
+    check_arg_count('checkpoint', 0, args)
+
+    global _CHECKPOINT
+    ok = sim.can_copy()
+    if ok:
+        _CHECKPOINT = sim.copy()
+
+    _OUTPUT.line(f'CHECKPOINT {int(ok)}')
+    return None
+
+
+def on_restore(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Go back to the state saved by the last checkpoint'''
+    check_arg_count('restore', 0, args)
+
+    if _CHECKPOINT is None:
+        raise ValueError('No checkpoint to restore.')
+
+    # Copy the checkpoint again, so that we can go back to it more than once.
+    return _CHECKPOINT.copy()
+
+
 def on_edn_rnd_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     check_arg_count('edn_rnd_step', 2, args)
     edn_rnd_data = read_word('edn_rnd_step', args[0], 32)
@@ -370,7 +745,7 @@ def on_step_crc(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     state = read_word('state', args[1], 32)
 
     new_state = binascii.crc32(item.to_bytes(6, 'little'), state)
-    print(f'! otbn.LOAD_CHECKSUM: 0x{new_state:08x}')
+    _OUTPUT.ext_reg('LOAD_CHECKSUM', new_state)
 
     return None
 
@@ -396,6 +771,21 @@ def on_initial_secure_wipe(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
+def on_set_protocol(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    check_arg_count('set_protocol', 1, args)
+
+    global _NEXT_OUTPUT
+    if args[0] == 'text':
+        _NEXT_OUTPUT = TextOutput()
+    elif args[0] == 'binary':
+        _NEXT_OUTPUT = BinaryOutput()
+    else:
+        raise ValueError(f'Unknown protocol for set_protocol: {args[0]}.')
+
+    _OUTPUT.line(f'PROTOCOL {args[0]}')
+    return None
+
+
 def on_otp_cdc_done(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     check_arg_count('otp_key_cdc_done', 0, args)
 
@@ -407,15 +797,23 @@ _HANDLERS = {
     'start_operation': on_start_operation,
     'otp_key_cdc_done': on_otp_cdc_done,
     'step': on_step,
+    'step_batch': on_step_batch,
     'load_elf': on_load_elf,
     'add_loop_warp': on_add_loop_warp,
     'clear_loop_warps': on_clear_loop_warps,
     'load_d': on_load_d,
     'load_i': on_load_i,
     'dump_d': on_dump_d,
+    'dump_d_dirty': on_dump_d_dirty,
+    'set_shared_mem': on_set_shared_mem,
+    'load_d_shm': on_load_d_shm,
+    'load_i_shm': on_load_i_shm,
+    'dump_d_shm': on_dump_d_shm,
     'print_regs': on_print_regs,
     'print_call_stack': on_print_call_stack,
     'reset': on_reset,
+    'checkpoint': on_checkpoint,
+    'restore': on_restore,
     'edn_rnd_step': on_edn_rnd_step,
     'edn_urnd_step': on_edn_urnd_step,
     'edn_rnd_cdc_done': on_edn_rnd_cdc_done,
@@ -428,7 +826,8 @@ _HANDLERS = {
     'send_err_escalation': on_send_err_escalation,
     'set_rma_req': on_set_rma_req,
     'initial_secure_wipe': on_initial_secure_wipe,
-    'set_software_errs_fatal': on_set_software_errs_fatal
+    'set_software_errs_fatal': on_set_software_errs_fatal,
+    'set_protocol': on_set_protocol
 }
 
 
@@ -446,8 +845,7 @@ def on_input(sim: OTBNSim, line: str) -> Optional[OTBNSim]:
         raise RuntimeError('Unknown command: {!r}'.format(verb))
 
     ret = handler(sim, words[1:])
-    print('.')
-    sys.stdout.flush()
+    end_command()
 
     return ret
 
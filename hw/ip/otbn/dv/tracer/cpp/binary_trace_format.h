@@ -0,0 +1,110 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_FORMAT_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_FORMAT_H_
+
+/**
+ * Constants and helpers shared by BinaryTraceListener (which writes binary
+ * trace files) and BinaryTraceReader (which reads them back).
+ *
+ * A binary trace file starts with a 16 byte file header:
+ *
+ *   magic "OTBNTRC\0", u32 version, u32 block size
+ *
+ * followed by blocks of exactly the block size (except that the last block
+ * may be shorter). Each block starts with a 12 byte block header:
+ *
+ *   u32 block magic, u32 offset of first record, u32 cycle of first record
+ *
+ * where the offset is from the start of the block and is 0xffffffff if no
+ * record starts in the block. The rest of each block is a stream of records.
+ * Records may be split across blocks: the block header just gets spliced into
+ * the middle of the record.
+ *
+ * A record holds one trace string from the tracer. It starts with a varint
+ * giving the cycle count minus that of the previous record (mod 2^32) and is
+ * followed by a sequence of items (each starting with a one-byte tag from
+ * item_tag_t). Most items encode a line from the trace string, followed by a
+ * newline. The first record that starts in each block is a sync point: it
+ * gives the cycle count relative to zero and forgets any names that were
+ * defined before. This means that a reader can start decoding at any block.
+ *
+ * All fixed-width integers are little-endian and varints are LEB128 (7 bits
+ * per byte, least significant first, with the top bit set on all but the
+ * last byte).
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace otbn_binary_trace {
+
+static const char kFileMagic[8] = {'O', 'T', 'B', 'N', 'T', 'R', 'C', '\0'};
+static const uint32_t kVersion = 1;
+static const size_t kFileHeaderSize = 16;
+
+static const uint32_t kBlockMagic = 0x4b4c4254;  // "TBLK"
+static const size_t kBlockHeaderSize = 12;
+static const uint32_t kNoRecord = 0xffffffff;
+static const uint32_t kDefaultBlockSize = 64 * 1024;
+
+enum item_tag_t {
+  // End of the record
+  ItemEnd = 0,
+  // varint length, then that many bytes: a line with no special encoding
+  ItemRaw = 1,
+  // varint length, then that many bytes: a final line with no trailing
+  // newline (this is always followed by ItemEnd)
+  ItemTail = 2,
+  // One character c, then varint PC and varint instruction bits:
+  // "c PC: 0x%08x, insn: 0x%08x"
+  ItemInsn = 3,
+  // One character c, then varint PC: "c PC: 0x%08x, insn: ??"
+  ItemInsnFetchErr = 4,
+  // One character c: "c " (the header for wipes and stray changes)
+  ItemBare = 5,
+  // One character c, then varint name ID and a value: "c NAME: VALUE"
+  ItemReg = 6,
+  // One character c, then varint address and a value: "c [0x%08x]: VALUE"
+  ItemMem = 7,
+  // varint name ID, varint length, then that many bytes: define a name for
+  // ItemReg (this doesn't correspond to a line)
+  ItemName = 8,
+};
+
+// Values for ItemReg and ItemMem start with a one-byte kind. A kind between 1
+// and kMaxValueWords is that number of 32-bit words (each a varint, most
+// significant first), printed as "0x%08x_%08x...". kValueFlags is followed by
+// one byte with C, M, L, Z in bits 3 to 0, printed as
+// "{C: %d, M: %d, L: %d, Z: %d}".
+static const unsigned kMaxValueWords = 16;
+static const uint8_t kValueFlags = 0x80;
+
+// Append x to buf as a varint
+template <typename Buf>
+inline void PutVarint(Buf *buf, uint32_t x) {
+  while (x >= 0x80) {
+    buf->push_back(static_cast<uint8_t>(x | 0x80));
+    x >>= 7;
+  }
+  buf->push_back(static_cast<uint8_t>(x));
+}
+
+// Write x to dst as a little-endian u32
+inline void PutU32(uint8_t *dst, uint32_t x) {
+  for (int i = 0; i < 4; ++i) {
+    dst[i] = static_cast<uint8_t>(x >> (8 * i));
+  }
+}
+
+// Read a little-endian u32 from src
+inline uint32_t GetU32(const uint8_t *src) {
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+}  // namespace otbn_binary_trace
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_FORMAT_H_
@@ -0,0 +1,295 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "binary_trace_listener.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace otbn_binary_trace;
+
+// Parse exactly 8 lower-case hex digits at str, as printed by "%08x". Returns
+// false if they aren't there.
+static bool ParseHex8(const char *str, uint32_t *value) {
+  uint32_t acc = 0;
+  for (int i = 0; i < 8; ++i) {
+    char c = str[i];
+    uint32_t digit;
+    if ('0' <= c && c <= '9') {
+      digit = c - '0';
+    } else if ('a' <= c && c <= 'f') {
+      digit = 10 + c - 'a';
+    } else {
+      return false;
+    }
+    acc = (acc << 4) | digit;
+  }
+  *value = acc;
+  return true;
+}
+
+namespace {
+// A value from a register or memory line, in one of the formats described in
+// binary_trace_format.h
+struct TraceValue {
+  uint8_t kind;
+  uint8_t flags;
+  uint32_t words[kMaxValueWords];
+
+  // Parse the len characters at str into this object. Returns false if they
+  // aren't in one of the formats that we understand.
+  bool Parse(const char *str, size_t len);
+
+  template <typename Buf>
+  void Put(Buf *buf) const;
+};
+}  // namespace
+
+bool TraceValue::Parse(const char *str, size_t len) {
+  // Flags look like "{C: 1, M: 0, L: 1, Z: 0}"
+  static const char flags_template[] = "{C: ?, M: ?, L: ?, Z: ?}";
+  if (len == sizeof flags_template - 1 && str[0] == '{') {
+    flags = 0;
+    for (size_t i = 0; i < len; ++i) {
+      if (flags_template[i] != '?') {
+        if (str[i] != flags_template[i])
+          return false;
+      } else {
+        if (str[i] != '0' && str[i] != '1')
+          return false;
+        flags = (flags << 1) | (str[i] - '0');
+      }
+    }
+    kind = kValueFlags;
+    return true;
+  }
+
+  // Otherwise, we expect "0x" followed by N groups of 8 hex digits, separated
+  // by underscores. The length of this is 2 + 8N + (N - 1) = 9N + 1.
+  if (len < 10 || (len - 1) % 9 != 0 || str[0] != '0' || str[1] != 'x')
+    return false;
+  unsigned num_words = (len - 1) / 9;
+  if (num_words > kMaxValueWords)
+    return false;
+
+  for (unsigned i = 0; i < num_words; ++i) {
+    const char *word = str + 2 + 9 * i;
+    if (i > 0 && word[-1] != '_')
+      return false;
+    if (!ParseHex8(word, &words[i]))
+      return false;
+  }
+  kind = num_words;
+  return true;
+}
+
+template <typename Buf>
+void TraceValue::Put(Buf *buf) const {
+  buf->push_back(kind);
+  if (kind == kValueFlags) {
+    buf->push_back(flags);
+    return;
+  }
+  for (unsigned i = 0; i < kind; ++i) {
+    PutVarint(buf, words[i]);
+  }
+}
+
+BinaryTraceListener::BinaryTraceListener(const std::string &filename,
+                                         uint32_t block_size)
+    : file_(fopen(filename.c_str(), "wb")),
+      block_size_(block_size),
+      block_(block_size),
+      block_pos_(0),
+      first_record_(true),
+      prev_cycle_(0) {
+  if (!file_) {
+    std::ostringstream oss;
+    oss << "Could not open binary trace file: " << filename << ": "
+        << strerror(errno);
+    throw std::runtime_error(oss.str());
+  }
+  assert(block_size_ > kBlockHeaderSize);
+
+  uint8_t header[kFileHeaderSize];
+  memcpy(header, kFileMagic, sizeof kFileMagic);
+  PutU32(header + 8, kVersion);
+  PutU32(header + 12, block_size_);
+  fwrite(header, 1, sizeof header, file_);
+
+  FlushBlock();
+}
+
+BinaryTraceListener::~BinaryTraceListener() {
+  // Write out the partial block at the end of the file
+  if (block_pos_ > kBlockHeaderSize) {
+    fwrite(block_.data(), 1, block_pos_, file_);
+  }
+  if (fclose(file_) != 0) {
+    std::cerr << "WARNING: Error when closing binary trace file: "
+              << strerror(errno) << "\n";
+  }
+}
+
+void BinaryTraceListener::AcceptTraceString(const std::string &trace,
+                                            unsigned int cycle_count) {
+  // If the current block is full, the record will start in the next one.
+  if (block_pos_ == block_size_)
+    FlushBlock();
+
+  // The first record that starts in a block is a sync point.
+  if (first_record_) {
+    first_record_ = false;
+    PutU32(&block_[4], block_pos_);
+    PutU32(&block_[8], cycle_count);
+    prev_cycle_ = 0;
+    names_.clear();
+  }
+
+  record_.clear();
+  PutVarint(&record_, cycle_count - prev_cycle_);
+  prev_cycle_ = cycle_count;
+
+  size_t bol = 0;
+  while (bol < trace.size()) {
+    size_t eol = trace.find('\n', bol);
+    if (eol == std::string::npos) {
+      EncodeRaw(trace.data() + bol, trace.size() - bol, true);
+      break;
+    }
+    EncodeLine(trace.data() + bol, eol - bol);
+    bol = eol + 1;
+  }
+  record_.push_back(ItemEnd);
+
+  Append(record_.data(), record_.size());
+}
+
+void BinaryTraceListener::EncodeLine(const char *line, size_t len) {
+  static const char insn_mid[] = " PC: 0x";
+  static const size_t insn_mid_len = sizeof insn_mid - 1;
+  static const char insn_bits[] = ", insn: 0x";
+  static const size_t insn_bits_len = sizeof insn_bits - 1;
+  static const char insn_err[] = ", insn: ??";
+  static const size_t insn_err_len = sizeof insn_err - 1;
+  static const size_t insn_pc_pos = 1 + insn_mid_len;
+  static const size_t insn_tail_pos = insn_pc_pos + 8;
+
+  uint32_t x, y;
+
+  // Instruction headers: "c PC: 0x%08x, insn: 0x%08x" or "c PC: 0x%08x,
+  // insn: ??"
+  if (len > insn_tail_pos &&
+      0 == memcmp(line + 1, insn_mid, insn_mid_len) &&
+      ParseHex8(line + insn_pc_pos, &x)) {
+    const char *tail = line + insn_tail_pos;
+    size_t tail_len = len - insn_tail_pos;
+    if (tail_len == insn_bits_len + 8 &&
+        0 == memcmp(tail, insn_bits, insn_bits_len) &&
+        ParseHex8(tail + insn_bits_len, &y)) {
+      record_.push_back(ItemInsn);
+      record_.push_back(line[0]);
+      PutVarint(&record_, x);
+      PutVarint(&record_, y);
+      return;
+    }
+    if (tail_len == insn_err_len && 0 == memcmp(tail, insn_err, insn_err_len)) {
+      record_.push_back(ItemInsnFetchErr);
+      record_.push_back(line[0]);
+      PutVarint(&record_, x);
+      return;
+    }
+  }
+
+  // Bare headers: "c "
+  if (len == 2 && line[1] == ' ') {
+    record_.push_back(ItemBare);
+    record_.push_back(line[0]);
+    return;
+  }
+
+  TraceValue value;
+
+  // Memory accesses: "c [0x%08x]: VALUE"
+  if (len > 16 && (line[0] == 'R' || line[0] == 'W') &&
+      0 == memcmp(line + 1, " [0x", 4) && ParseHex8(line + 5, &x) &&
+      0 == memcmp(line + 13, "]: ", 3) && value.Parse(line + 16, len - 16)) {
+    record_.push_back(ItemMem);
+    record_.push_back(line[0]);
+    PutVarint(&record_, x);
+    value.Put(&record_);
+    return;
+  }
+
+  // Register accesses: "c NAME: VALUE"
+  if (len > 2 && (line[0] == '<' || line[0] == '>') && line[1] == ' ') {
+    const char *name = line + 2;
+    const char *colon =
+        static_cast<const char *>(memchr(name, ':', len - 2));
+    if (colon && colon > name && colon + 2 <= line + len && colon[1] == ' ' &&
+        value.Parse(colon + 2, line + len - (colon + 2))) {
+      uint32_t name_id = GetNameId(name, colon - name);
+      record_.push_back(ItemReg);
+      record_.push_back(line[0]);
+      PutVarint(&record_, name_id);
+      value.Put(&record_);
+      return;
+    }
+  }
+
+  EncodeRaw(line, len, false);
+}
+
+void BinaryTraceListener::EncodeRaw(const char *line, size_t len,
+                                    bool is_tail) {
+  record_.push_back(is_tail ? ItemTail : ItemRaw);
+  PutVarint(&record_, len);
+  record_.insert(record_.end(), line, line + len);
+}
+
+uint32_t BinaryTraceListener::GetNameId(const char *name, size_t len) {
+  name_key_.assign(name, len);
+  auto it = names_.find(name_key_);
+  if (it != names_.end())
+    return it->second;
+
+  uint32_t id = names_.size();
+  names_.emplace(name_key_, id);
+
+  record_.push_back(ItemName);
+  PutVarint(&record_, id);
+  PutVarint(&record_, len);
+  record_.insert(record_.end(), name, name + len);
+  return id;
+}
+
+void BinaryTraceListener::Append(const uint8_t *data, size_t len) {
+  while (len > 0) {
+    if (block_pos_ == block_size_)
+      FlushBlock();
+
+    size_t chunk = std::min(len, block_size_ - block_pos_);
+    memcpy(&block_[block_pos_], data, chunk);
+    block_pos_ += chunk;
+    data += chunk;
+    len -= chunk;
+  }
+}
+
+void BinaryTraceListener::FlushBlock() {
+  if (block_pos_ > 0) {
+    fwrite(block_.data(), 1, block_pos_, file_);
+  }
+
+  PutU32(&block_[0], kBlockMagic);
+  PutU32(&block_[4], kNoRecord);
+  PutU32(&block_[8], 0);
+  block_pos_ = kBlockHeaderSize;
+  first_record_ = true;
+}
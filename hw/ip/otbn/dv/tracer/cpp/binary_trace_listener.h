@@ -0,0 +1,80 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "binary_trace_format.h"
+#include "otbn_trace_listener.h"
+
+/**
+ * An OtbnTraceListener that writes the trace to a compact binary file (see
+ * binary_trace_format.h for the format).
+ *
+ * The lines that the tracer usually generates (instruction headers, register
+ * and memory accesses) are stored as binary fields, which are much smaller
+ * than the text and cheaper to write. Anything else is stored as text, so the
+ * original trace can always be recovered exactly. Use BinaryTraceReader or the
+ * otbn_trace_decode tool to read the file back.
+ */
+class BinaryTraceListener : public OtbnTraceListener {
+ public:
+  /**
+   * Constructor that takes a filename to write trace output to. It throws
+   * std::runtime_error if the file cannot be opened.
+   */
+  BinaryTraceListener(
+      const std::string &filename,
+      uint32_t block_size = otbn_binary_trace::kDefaultBlockSize);
+  ~BinaryTraceListener();
+
+  void AcceptTraceString(const std::string &trace,
+                         unsigned int cycle_count) override;
+
+ private:
+  // Append an encoding of the len characters at line (not including the
+  // newline) to record_.
+  void EncodeLine(const char *line, size_t len);
+
+  // Append an ItemRaw (or ItemTail if is_tail) item for line to record_
+  void EncodeRaw(const char *line, size_t len, bool is_tail);
+
+  // Return the ID for the given register name, first appending an ItemName
+  // item to record_ if it hasn't been defined since the last sync point.
+  uint32_t GetNameId(const char *name, size_t len);
+
+  // Append data to the stream of blocks, writing out blocks as they fill up.
+  void Append(const uint8_t *data, size_t len);
+
+  // Write out the current block, which might be partial if this is the end
+  // of the file, and start a new one.
+  void FlushBlock();
+
+  std::FILE *file_;
+  uint32_t block_size_;
+
+  // The current block and how much of it has been filled. first_record_ is
+  // true if no record has started in the block yet.
+  std::vector<uint8_t> block_;
+  size_t block_pos_;
+  bool first_record_;
+
+  // The encoding of the current record, kept to reuse its storage
+  std::vector<uint8_t> record_;
+
+  uint32_t prev_cycle_;
+
+  // Register names defined since the last sync point, and a string that is
+  // reused to look them up.
+  std::unordered_map<std::string, uint32_t> names_;
+  std::string name_key_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
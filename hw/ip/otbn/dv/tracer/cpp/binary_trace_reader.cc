@@ -0,0 +1,312 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "binary_trace_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "binary_trace_format.h"
+
+using namespace otbn_binary_trace;
+
+BinaryTraceReader::BinaryTraceReader(const std::string &filename)
+    : filename_(filename),
+      file_(fopen(filename.c_str(), "rb")),
+      block_size_(0),
+      num_blocks_(0),
+      block_len_(0),
+      block_idx_(0),
+      block_pos_(0),
+      prev_cycle_(0) {
+  if (!file_) {
+    std::ostringstream oss;
+    oss << "Could not open binary trace file: " << filename << ": "
+        << strerror(errno);
+    throw std::runtime_error(oss.str());
+  }
+
+  uint8_t header[kFileHeaderSize];
+  if (fread(header, 1, sizeof header, file_) != sizeof header ||
+      memcmp(header, kFileMagic, sizeof kFileMagic) != 0) {
+    fclose(file_);
+    std::ostringstream oss;
+    oss << "Binary trace file " << filename << " has a bad header.";
+    throw std::runtime_error(oss.str());
+  }
+  if (GetU32(header + 8) != kVersion) {
+    fclose(file_);
+    std::ostringstream oss;
+    oss << "Binary trace file " << filename << " has version "
+        << GetU32(header + 8) << ", but we only support version " << kVersion
+        << ".";
+    throw std::runtime_error(oss.str());
+  }
+  block_size_ = GetU32(header + 12);
+  if (block_size_ <= kBlockHeaderSize) {
+    fclose(file_);
+    std::ostringstream oss;
+    oss << "Binary trace file " << filename << " has a bad block size ("
+        << block_size_ << ").";
+    throw std::runtime_error(oss.str());
+  }
+
+  fseek(file_, 0, SEEK_END);
+  long file_size = ftell(file_);
+  if (file_size > (long)kFileHeaderSize) {
+    num_blocks_ =
+        (file_size - kFileHeaderSize + block_size_ - 1) / block_size_;
+  }
+  block_.resize(block_size_);
+
+  if (num_blocks_ > 0)
+    MoveTo(0, kBlockHeaderSize);
+}
+
+BinaryTraceReader::~BinaryTraceReader() { fclose(file_); }
+
+bool BinaryTraceReader::Next(std::string *trace, unsigned int *cycle_count) {
+  uint8_t byte;
+  bool is_sync = false;
+  if (!GetByte(&byte, true, &is_sync))
+    return false;
+
+  if (is_sync) {
+    prev_cycle_ = 0;
+    names_.clear();
+  }
+
+  // The first byte we read is the start of the cycle delta
+  uint32_t delta = byte & 0x7f;
+  for (unsigned shift = 7; byte & 0x80; shift += 7) {
+    if (shift > 28)
+      Malformed("over-long varint");
+    byte = NeedByte();
+    delta |= (uint32_t)(byte & 0x7f) << shift;
+  }
+  prev_cycle_ += delta;
+  *cycle_count = prev_cycle_;
+
+  trace->clear();
+  char buf[64];
+  for (;;) {
+    uint8_t tag = NeedByte();
+    switch (tag) {
+      case ItemEnd:
+        return true;
+
+      case ItemRaw:
+      case ItemTail:
+        NeedBytes(NeedVarint(), trace);
+        if (tag == ItemRaw)
+          trace->push_back('\n');
+        break;
+
+      case ItemInsn: {
+        char c = NeedByte();
+        uint32_t pc = NeedVarint();
+        uint32_t insn = NeedVarint();
+        snprintf(buf, sizeof buf, "%c PC: 0x%08x, insn: 0x%08x\n", c, pc,
+                 insn);
+        trace->append(buf);
+        break;
+      }
+
+      case ItemInsnFetchErr: {
+        char c = NeedByte();
+        uint32_t pc = NeedVarint();
+        snprintf(buf, sizeof buf, "%c PC: 0x%08x, insn: ??\n", c, pc);
+        trace->append(buf);
+        break;
+      }
+
+      case ItemBare:
+        trace->push_back(NeedByte());
+        trace->append(" \n");
+        break;
+
+      case ItemReg: {
+        char c = NeedByte();
+        uint32_t id = NeedVarint();
+        if (id >= names_.size())
+          Malformed("undefined register name");
+        trace->push_back(c);
+        trace->push_back(' ');
+        trace->append(names_[id]);
+        trace->append(": ");
+        ReadValue(trace);
+        trace->push_back('\n');
+        break;
+      }
+
+      case ItemMem: {
+        char c = NeedByte();
+        uint32_t addr = NeedVarint();
+        snprintf(buf, sizeof buf, "%c [0x%08x]: ", c, addr);
+        trace->append(buf);
+        ReadValue(trace);
+        trace->push_back('\n');
+        break;
+      }
+
+      case ItemName: {
+        uint32_t id = NeedVarint();
+        if (id != names_.size())
+          Malformed("out-of-order register name");
+        names_.emplace_back();
+        NeedBytes(NeedVarint(), &names_.back());
+        break;
+      }
+
+      default:
+        Malformed("unknown item tag");
+    }
+  }
+}
+
+void BinaryTraceReader::Seek(unsigned int cycle_count) {
+  // Binary search for the last sync point at or before cycle_count. Each
+  // probe looks at the first block at or after mid that has a sync point
+  // (almost always mid itself, since records are much smaller than blocks).
+  uint64_t best_idx = 0;
+  uint32_t best_offset = kBlockHeaderSize;
+
+  uint64_t lo = 0, hi = num_blocks_;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    uint64_t idx = mid;
+    uint32_t first_record = kNoRecord, first_cycle = 0;
+    bool has_sync = false;
+    for (; idx < hi; ++idx) {
+      if (!ReadBlockHeader(idx, &first_record, &first_cycle))
+        break;
+      if (first_record != kNoRecord) {
+        has_sync = true;
+        break;
+      }
+    }
+
+    if (has_sync && first_cycle <= cycle_count) {
+      best_idx = idx;
+      best_offset = first_record;
+      lo = idx + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (num_blocks_ > 0)
+    MoveTo(best_idx, best_offset);
+}
+
+bool BinaryTraceReader::ReadBlockHeader(uint64_t idx, uint32_t *first_record,
+                                        uint32_t *first_cycle) {
+  uint8_t header[kBlockHeaderSize];
+  if (idx >= num_blocks_ ||
+      fseek(file_, kFileHeaderSize + idx * block_size_, SEEK_SET) != 0 ||
+      fread(header, 1, sizeof header, file_) != sizeof header)
+    return false;
+
+  if (GetU32(header) != kBlockMagic)
+    Malformed("bad block magic");
+
+  *first_record = GetU32(header + 4);
+  *first_cycle = GetU32(header + 8);
+  return true;
+}
+
+void BinaryTraceReader::MoveTo(uint64_t idx, uint32_t offset) {
+  if (fseek(file_, kFileHeaderSize + idx * block_size_, SEEK_SET) != 0)
+    Malformed("cannot seek to block");
+
+  block_len_ = fread(block_.data(), 1, block_size_, file_);
+  if (block_len_ < kBlockHeaderSize || GetU32(block_.data()) != kBlockMagic)
+    Malformed("bad block header");
+  if (offset < kBlockHeaderSize || offset > block_len_)
+    Malformed("bad record offset");
+
+  block_idx_ = idx;
+  block_pos_ = offset;
+}
+
+bool BinaryTraceReader::GetByte(uint8_t *byte, bool at_record_start,
+                                bool *is_sync) {
+  if (block_pos_ >= block_len_) {
+    if (block_idx_ + 1 >= num_blocks_)
+      return false;
+    MoveTo(block_idx_ + 1, kBlockHeaderSize);
+  }
+
+  if (at_record_start) {
+    *is_sync = block_pos_ == GetU32(&block_[4]);
+  }
+  *byte = block_[block_pos_++];
+  return true;
+}
+
+uint8_t BinaryTraceReader::NeedByte() {
+  uint8_t byte;
+  if (!GetByte(&byte))
+    Malformed("unexpected end of file");
+  return byte;
+}
+
+uint32_t BinaryTraceReader::NeedVarint() {
+  uint32_t x = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    if (shift > 28)
+      Malformed("over-long varint");
+    uint8_t byte = NeedByte();
+    x |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return x;
+  }
+}
+
+void BinaryTraceReader::NeedBytes(size_t len, std::string *dst) {
+  while (len > 0) {
+    if (block_pos_ >= block_len_) {
+      uint8_t byte = NeedByte();
+      dst->push_back(byte);
+      --len;
+      continue;
+    }
+    size_t chunk = std::min(len, block_len_ - block_pos_);
+    dst->append(reinterpret_cast<const char *>(&block_[block_pos_]), chunk);
+    block_pos_ += chunk;
+    len -= chunk;
+  }
+}
+
+void BinaryTraceReader::ReadValue(std::string *dst) {
+  uint8_t kind = NeedByte();
+  char buf[32];
+
+  if (kind == kValueFlags) {
+    uint8_t flags = NeedByte();
+    snprintf(buf, sizeof buf, "{C: %d, M: %d, L: %d, Z: %d}", (flags >> 3) & 1,
+             (flags >> 2) & 1, (flags >> 1) & 1, flags & 1);
+    dst->append(buf);
+    return;
+  }
+
+  if (kind == 0 || kind > kMaxValueWords)
+    Malformed("bad value kind");
+
+  dst->append("0x");
+  for (unsigned i = 0; i < kind; ++i) {
+    snprintf(buf, sizeof buf, i ? "_%08x" : "%08x", NeedVarint());
+    dst->append(buf);
+  }
+}
+
+void BinaryTraceReader::Malformed(const char *what) const {
+  std::ostringstream oss;
+  oss << "Malformed binary trace file " << filename_ << ": " << what << ".";
+  throw std::runtime_error(oss.str());
+}
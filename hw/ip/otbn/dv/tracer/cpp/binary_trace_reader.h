@@ -0,0 +1,82 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_READER_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_READER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Reads back a binary trace file written by BinaryTraceListener, producing
+ * the same trace strings (and cycle counts) that the listener was given.
+ */
+class BinaryTraceReader {
+ public:
+  /**
+   * Constructor that takes the filename of a binary trace. It throws
+   * std::runtime_error if the file cannot be opened or has a bad header.
+   */
+  BinaryTraceReader(const std::string &filename);
+  ~BinaryTraceReader();
+
+  /**
+   * Read the next trace string from the file. Returns false at the end of the
+   * file. Throws std::runtime_error if the file is malformed.
+   */
+  bool Next(std::string *trace, unsigned int *cycle_count);
+
+  /**
+   * Move to the last sync point at or before cycle_count (or the start of the
+   * file if there isn't one). A following call to Next() will return the
+   * first trace string at or after that point, which might still be before
+   * cycle_count. This uses a binary search, so assumes that cycle counts in
+   * the file never decrease.
+   */
+  void Seek(unsigned int cycle_count);
+
+ private:
+  // Read the header of block idx. Returns false if there is no such block.
+  bool ReadBlockHeader(uint64_t idx, uint32_t *first_record,
+                       uint32_t *first_cycle);
+
+  // Move to the given offset in block idx, discarding any buffered data.
+  void MoveTo(uint64_t idx, uint32_t offset);
+
+  // Return the next byte of record data, skipping over block headers. If
+  // at_record_start is true, this is the first byte of a record and the
+  // caller wants to know whether it is a sync point (in which case *is_sync is
+  // set). Returns false at the end of the file.
+  bool GetByte(uint8_t *byte, bool at_record_start = false,
+               bool *is_sync = nullptr);
+
+  // Like GetByte, but throws if we are at the end of the file.
+  uint8_t NeedByte();
+  uint32_t NeedVarint();
+  void NeedBytes(size_t len, std::string *dst);
+
+  // Append the rendering of a value from an ItemReg or ItemMem item.
+  void ReadValue(std::string *dst);
+
+  [[noreturn]] void Malformed(const char *what) const;
+
+  std::string filename_;
+  std::FILE *file_;
+  uint32_t block_size_;
+  uint64_t num_blocks_;
+
+  // The current block (as much of it as exists in the file), its index, and
+  // our position in it.
+  std::vector<uint8_t> block_;
+  size_t block_len_;
+  uint64_t block_idx_;
+  size_t block_pos_;
+
+  uint32_t prev_cycle_;
+  std::vector<std::string> names_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_READER_H_
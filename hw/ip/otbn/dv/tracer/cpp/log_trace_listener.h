@@ -6,6 +6,7 @@
 #define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_LOG_TRACE_LISTENER_H_
 
 #include <fstream>
+#include <ostream>
 #include <string>
 
 #include "otbn_trace_listener.h"
@@ -35,6 +36,13 @@ class LogTraceListener : public OtbnTraceListener {
   LogTraceListener(const std::string &log_filename);
   void AcceptTraceString(const std::string &trace,
                          unsigned int cycle_count) override;
+
+  /**
+   * Pretty print a trace string in the format described above to os. This is
+   * also used by otbn_trace_decode to render binary traces.
+   */
+  static void WriteTrace(std::ostream &os, const std::string &trace,
+                         unsigned int cycle_count);
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_LOG_TRACE_LISTENER_H_
@@ -0,0 +1,139 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// A tool to decode a binary trace written by BinaryTraceListener, printing it
+// in the same format as LogTraceListener.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "binary_trace_reader.h"
+#include "log_trace_listener.h"
+
+static void PrintUsage(const char *prog) {
+  std::cerr
+      << "Usage: " << prog << " [options] <trace.bin>\n\n"
+      << "Decode a binary OTBN trace, printing it in the text format used by\n"
+      << "--otbn-trace-file.\n\n"
+      << "Options:\n"
+      << "  --start-cycle=N  Skip records before cycle N\n"
+      << "  --end-cycle=N    Stop after records for cycle N\n"
+      << "  --pc=LO[:HI]     Only print E and S records with a PC between LO\n"
+      << "                   and HI (inclusive). HI defaults to LO.\n"
+      << "  -h, --help       Show this help\n";
+}
+
+// Parse a non-negative number (in any base accepted by strtoul) that fits in
+// 32 bits, returning false on failure.
+static bool ParseU32(const char *str, uint32_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long x = strtoul(str, &end, 0);
+  if (end == str || *end != '\0' || errno || x > 0xffffffffUL)
+    return false;
+  *value = x;
+  return true;
+}
+
+// Extract the PC from the header line of an 'E' or 'S' record
+static bool GetTracePC(const std::string &trace, uint32_t *pc) {
+  static const char pc_prefix[] = " PC: 0x";
+  if (trace.size() < sizeof pc_prefix ||
+      (trace[0] != 'E' && trace[0] != 'S') ||
+      trace.compare(1, sizeof pc_prefix - 1, pc_prefix) != 0)
+    return false;
+
+  *pc = strtoul(trace.c_str() + sizeof pc_prefix, nullptr, 16);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const struct option long_options[] = {
+      {"start-cycle", required_argument, nullptr, 's'},
+      {"end-cycle", required_argument, nullptr, 'e'},
+      {"pc", required_argument, nullptr, 'p'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  uint32_t start_cycle = 0, end_cycle = 0xffffffff;
+  bool filter_pc = false;
+  uint32_t pc_lo = 0, pc_hi = 0;
+
+  for (;;) {
+    int c = getopt_long(argc, argv, "h", long_options, nullptr);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 's':
+        if (!ParseU32(optarg, &start_cycle)) {
+          std::cerr << "ERROR: Bad start cycle: `" << optarg << "'.\n";
+          return 1;
+        }
+        break;
+      case 'e':
+        if (!ParseU32(optarg, &end_cycle)) {
+          std::cerr << "ERROR: Bad end cycle: `" << optarg << "'.\n";
+          return 1;
+        }
+        break;
+      case 'p': {
+        std::string arg(optarg);
+        size_t colon = arg.find(':');
+        std::string lo = arg.substr(0, colon);
+        std::string hi =
+            colon == std::string::npos ? lo : arg.substr(colon + 1);
+        if (!ParseU32(lo.c_str(), &pc_lo) || !ParseU32(hi.c_str(), &pc_hi)) {
+          std::cerr << "ERROR: Bad PC range: `" << optarg << "'.\n";
+          return 1;
+        }
+        filter_pc = true;
+        break;
+      }
+      case 'h':
+        PrintUsage(argv[0]);
+        return 0;
+      default:
+        PrintUsage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  try {
+    BinaryTraceReader reader(argv[optind]);
+    if (start_cycle > 0)
+      reader.Seek(start_cycle);
+
+    std::string trace;
+    unsigned int cycle;
+    while (reader.Next(&trace, &cycle)) {
+      if (cycle < start_cycle)
+        continue;
+      if (cycle > end_cycle)
+        break;
+
+      uint32_t pc;
+      if (filter_pc &&
+          !(GetTracePC(trace, &pc) && pc_lo <= pc && pc <= pc_hi))
+        continue;
+
+      LogTraceListener::WriteTrace(std::cout, trace, cycle);
+    }
+  } catch (const std::runtime_error &err) {
+    std::cerr << "ERROR: " << err.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -6,295 +6,491 @@
 
 #include <algorithm>
 #include <cassert>
-#include <functional>
-#include <iostream>
 #include <stdint.h>
 #include <vector>
 
-#include "prince_ref.h"
-
-uint8_t PRESENT_SBOX4[] = {0xc, 0x5, 0x6, 0xb, 0x9, 0x0, 0xa, 0xd,
-                           0x3, 0xe, 0xf, 0x8, 0x4, 0x7, 0x1, 0x2};
-
-uint8_t PRESENT_SBOX4_INV[] = {0x5, 0xe, 0xf, 0x8, 0xc, 0x1, 0x2, 0xd,
-                               0xb, 0x4, 0x6, 0x3, 0x0, 0x7, 0x9, 0xa};
+// The substitution/permutation network and PRINCE below all work on a single
+// 64-bit word (with narrower values held in the low bits), so scrambling a
+// word doesn't need any heap allocation. The byte vector functions at the
+// bottom of the file are thin wrappers around the batch functions.
+
+static const uint8_t PRESENT_SBOX4[] = {0xc, 0x5, 0x6, 0xb, 0x9, 0x0,
+                                        0xa, 0xd, 0x3, 0xe, 0xf, 0x8,
+                                        0x4, 0x7, 0x1, 0x2};
+
+static const uint8_t PRESENT_SBOX4_INV[] = {0x5, 0xe, 0xf, 0x8, 0xc, 0x1,
+                                            0x2, 0xd, 0xb, 0x4, 0x6, 0x3,
+                                            0x0, 0x7, 0x9, 0xa};
+
+static const uint8_t PRINCE_SBOX4[] = {0xb, 0xf, 0x3, 0x2, 0xa, 0xc,
+                                       0x9, 0x1, 0x6, 0x7, 0x8, 0x0,
+                                       0xe, 0x5, 0xd, 0x4};
+
+static const uint8_t PRINCE_SBOX4_INV[] = {0xb, 0x7, 0x3, 0x2, 0xf, 0xd,
+                                           0x8, 0x9, 0xa, 0x6, 0x4, 0x0,
+                                           0x5, 0xe, 0xc, 0x1};
+
+static const uint64_t kPrinceRoundConstants[] = {
+    0x0000000000000000, 0x13198a2e03707344, 0xa4093822299f31d0,
+    0x082efa98ec4e6c89, 0x452821e638d01377, 0xbe5466cf34e90c6c,
+    0x7ef84f78fd955cb1, 0x85840851f1ac43aa, 0xc882d32f25323c54,
+    0x64a51195e0e3610d, 0xd3b5a399ca0c2399, 0xc0ac29b7c97c50dd};
+
+// The 16 bit matrices M0 and M1 used by the M' step of PRINCE (see
+// prince_m16_matrices() in the PRINCE reference model)
+static const uint16_t kPrinceM16[2][16] = {
+    {0x0111, 0x2220, 0x4404, 0x8088, 0x1011, 0x0222, 0x4440, 0x8808, 0x1101,
+     0x2022, 0x0444, 0x8880, 0x1110, 0x2202, 0x4044, 0x0888},
+    {0x1110, 0x2202, 0x4044, 0x0888, 0x0111, 0x2220, 0x4404, 0x8088, 0x1011,
+     0x0222, 0x4440, 0x8808, 0x1101, 0x2022, 0x0444, 0x8880}};
 
 static const uint32_t kNumAddrSubstPermRounds = 2;
 static const uint32_t kNumDataSubstPermRounds = 2;
 static const uint32_t kNumPrinceHalfRounds = 3;
 
-static std::vector<uint8_t> byte_reverse_vector(
-    const std::vector<uint8_t> &vec_in) {
-  std::vector<uint8_t> vec_out(vec_in.size());
+// Byte-wide lookup tables for the PRINCE S and M' steps, so that each step is
+// 8 table lookups on a 64-bit state.
+struct PrinceTables {
+  uint8_t sbox[256];
+  uint8_t sbox_inv[256];
+  // m_prime[i][b] is the contribution to the M' output of byte i of the input
+  // having value b.
+  uint64_t m_prime[8][256];
+
+  PrinceTables() {
+    for (uint32_t b = 0; b < 256; ++b) {
+      sbox[b] = PRINCE_SBOX4[b & 0xf] | (PRINCE_SBOX4[b >> 4] << 4);
+      sbox_inv[b] = PRINCE_SBOX4_INV[b & 0xf] | (PRINCE_SBOX4_INV[b >> 4] << 4);
+    }
 
-  std::reverse_copy(std::begin(vec_in), std::end(vec_in), std::begin(vec_out));
+    for (uint32_t i = 0; i < 8; ++i) {
+      // Each 16 bit chunk is multiplied by M0 (chunks 0 and 3) or M1 (chunks 1
+      // and 2).
+      uint32_t chunk = i / 2;
+      const uint16_t *mat = kPrinceM16[(chunk == 0 || chunk == 3) ? 0 : 1];
+      for (uint32_t b = 0; b < 256; ++b) {
+        uint64_t out = 0;
+        for (uint32_t j = 0; j < 8; ++j) {
+          if ((b >> j) & 1) {
+            out ^= mat[(i % 2) * 8 + j];
+          }
+        }
+        m_prime[i][b] = out << (chunk * 16);
+      }
+    }
+  }
+};
 
-  return vec_out;
+static const PrinceTables &get_prince_tables() {
+  static const PrinceTables tables;
+  return tables;
 }
 
-static uint8_t read_vector_bit(const std::vector<uint8_t> &vec,
-                               uint32_t bit_pos) {
-  assert(bit_pos / 8 < vec.size());
+static uint64_t width_mask(uint32_t width) {
+  return width >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+}
 
-  return (vec[bit_pos / 8] >> (bit_pos % 8)) & 1;
+static uint64_t rotr64(uint64_t x, uint32_t shift) {
+  return shift ? (x >> shift) | (x << (64 - shift)) : x;
 }
 
-static void or_vector_bit(std::vector<uint8_t> &vec, uint32_t bit_pos,
-                          uint8_t bit) {
-  assert(bit_pos / 8 < vec.size());
+// Read `width` (at most 64) bits starting at bit `pos` of a little endian
+// byte array
+static uint64_t read_bits(const uint8_t *buf, uint32_t pos, uint32_t width) {
+  uint64_t out = 0;
+  for (uint32_t i = 0; i < width;) {
+    uint32_t bit = pos + i;
+    uint32_t offset = bit % 8;
+    uint32_t n = std::min(8 - offset, width - i);
+    out |= (uint64_t)((buf[bit / 8] >> offset) & ((1u << n) - 1)) << i;
+    i += n;
+  }
 
-  vec[bit_pos / 8] |= bit << (bit_pos % 8);
+  return out;
 }
 
-static std::vector<uint8_t> xor_vectors(const std::vector<uint8_t> &vec_a,
-                                        const std::vector<uint8_t> &vec_b) {
-  assert(vec_a.size() == vec_b.size());
-
-  std::vector<uint8_t> vec_out(vec_a.size());
+// Write the bottom `width` (at most 64) bits of `val` to the little endian
+// byte array starting at bit `pos`, leaving the other bits unchanged
+static void write_bits(uint8_t *buf, uint32_t pos, uint32_t width,
+                       uint64_t val) {
+  for (uint32_t i = 0; i < width;) {
+    uint32_t bit = pos + i;
+    uint32_t offset = bit % 8;
+    uint32_t n = std::min(8 - offset, width - i);
+    uint8_t mask = ((1u << n) - 1) << offset;
+    buf[bit / 8] = (buf[bit / 8] & ~mask) | ((val >> i) << offset & mask);
+    i += n;
+  }
+}
 
-  std::transform(vec_a.begin(), vec_a.end(), vec_b.begin(), vec_out.begin(),
-                 std::bit_xor<uint8_t>{});
+// Read `width` bits from a byte vector, checking they are all in range
+static uint64_t read_vector_bits(const std::vector<uint8_t> &vec, uint32_t pos,
+                                 uint32_t width) {
+  assert(pos + width <= vec.size() * 8);
 
-  return vec_out;
+  return read_bits(vec.data(), pos, width);
 }
 
-// Run each 4-bit chunk of bytes from `in` through the SBOX. Where `bit_width`
-// isn't a multiple of 4 the remaining bits are just copied straight through.
-// `invert` choose whether to use the inverted SBOX or not.
-static std::vector<uint8_t> scramble_sbox_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width,
-                                                uint8_t sbox[16]) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
+static std::vector<uint8_t> word_to_vector(uint64_t word, uint32_t bit_width) {
+  std::vector<uint8_t> vec((bit_width + 7) / 8, 0);
+  write_bits(vec.data(), 0, bit_width, word);
 
-  // Iterate through each 4 bit chunk of the data and apply the appropriate SBOX
-  for (uint32_t i = 0; i < bit_width / 4; ++i) {
-    uint8_t sbox_in, sbox_out;
+  return vec;
+}
 
-    sbox_in = in[i / 2];
+// Run each 4-bit chunk of `in` through the SBOX. Where `bit_width` isn't a
+// multiple of 4 the remaining bits are just copied straight through.
+static uint64_t scramble_sbox_layer(uint64_t in, uint32_t bit_width,
+                                    const uint8_t sbox[16]) {
+  uint32_t num_nibbles = bit_width / 4;
+  uint64_t out = in & ~width_mask(num_nibbles * 4);
 
-    int shift = (i % 2) ? 4 : 0;
-    sbox_in = (sbox_in >> shift) & 0xf;
+  for (uint32_t i = 0; i < num_nibbles; ++i) {
+    out |= (uint64_t)sbox[(in >> (i * 4)) & 0xf] << (i * 4);
+  }
 
-    sbox_out = sbox[sbox_in];
+  return out;
+}
 
-    out[i / 2] |= sbox_out << shift;
+// Reverse the bottom `bit_width` bits of `in`
+static uint64_t scramble_flip_layer(uint64_t in, uint32_t bit_width) {
+  if (bit_width == 0) {
+    return 0;
   }
 
-  // Where bit_width is not a multiple of 4 copy over the remaining bits
-  if (bit_width % 4) {
-    int shift = ((bit_width % 8) >= 4) ? 4 : 0;
-    uint8_t nibble = (in[bit_width / 8] >> shift) & 0xf;
-    out[bit_width / 8] |= nibble << shift;
-  }
+  uint64_t x = in;
+  x = ((x >> 1) & 0x5555555555555555) | ((x & 0x5555555555555555) << 1);
+  x = ((x >> 2) & 0x3333333333333333) | ((x & 0x3333333333333333) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0f) | ((x & 0x0f0f0f0f0f0f0f0f) << 4);
+  x = ((x >> 8) & 0x00ff00ff00ff00ff) | ((x & 0x00ff00ff00ff00ff) << 8);
+  x = ((x >> 16) & 0x0000ffff0000ffff) | ((x & 0x0000ffff0000ffff) << 16);
+  x = (x >> 32) | (x << 32);
 
-  return out;
+  return x >> (64 - bit_width);
 }
 
-// Reverse bits from incoming byte vector
-static std::vector<uint8_t> scramble_flip_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
+// Gather the even bits of `x` into the bottom 32 bits
+static uint64_t gather_even_bits(uint64_t x) {
+  x &= 0x5555555555555555;
+  x = (x | (x >> 1)) & 0x3333333333333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff0000ffff;
+  x = (x | (x >> 16)) & 0x00000000ffffffff;
 
-  for (uint32_t i = 0; i < bit_width; ++i) {
-    or_vector_bit(out, bit_width - i - 1, read_vector_bit(in, i));
-  }
+  return x;
+}
 
-  return out;
+// Spread the bottom 32 bits of `x` out to the even bits (the inverse of
+// gather_even_bits)
+static uint64_t scatter_even_bits(uint64_t x) {
+  x &= 0x00000000ffffffff;
+  x = (x | (x << 16)) & 0x0000ffff0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0f;
+  x = (x | (x << 2)) & 0x3333333333333333;
+  x = (x | (x << 1)) & 0x5555555555555555;
+
+  return x;
 }
 
-// Apply butterfly to incoming byte vector. Even bits are placed in the lower
-// half of the output, odd bits are placed in the upper half of the output.
-static std::vector<uint8_t> scramble_perm_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width,
-                                                bool invert) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
-
-  for (uint32_t i = 0; i < bit_width / 2; ++i) {
-    if (invert) {
-      or_vector_bit(out, i * 2, read_vector_bit(in, i));
-      or_vector_bit(out, i * 2 + 1, read_vector_bit(in, i + (bit_width / 2)));
-    } else {
-      or_vector_bit(out, i, read_vector_bit(in, i * 2));
-      or_vector_bit(out, i + (bit_width / 2), read_vector_bit(in, i * 2 + 1));
-    }
+// Apply butterfly to `in`. Even bits are placed in the lower half of the
+// output, odd bits are placed in the upper half of the output.
+static uint64_t scramble_perm_layer(uint64_t in, uint32_t bit_width,
+                                    bool invert) {
+  uint32_t half_width = bit_width / 2;
+  uint64_t half_mask = width_mask(half_width);
+  uint64_t out;
+
+  if (invert) {
+    out = scatter_even_bits(in & half_mask) |
+          (scatter_even_bits((in >> half_width) & half_mask) << 1);
+  } else {
+    out = (gather_even_bits(in) & half_mask) |
+          ((gather_even_bits(in >> 1) & half_mask) << half_width);
   }
 
   if (bit_width % 2) {
     // Where bit_width isn't even, the final bit is copied across to the same
     // position
-    or_vector_bit(out, bit_width - 1, read_vector_bit(in, bit_width - 1));
+    out |= in & ((uint64_t)1 << (bit_width - 1));
   }
 
   return out;
 }
 
-// Apply a full set of subsitution/permutation rounds for encrypt to the
-// incoming byte vector
-static std::vector<uint8_t> scramble_subst_perm_enc(
-    const std::vector<uint8_t> &in, const std::vector<uint8_t> &key,
-    uint32_t bit_width, uint32_t num_rounds) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  assert(key.size() == ((bit_width + 7) / 8));
+// Apply a full set of subsitution/permutation rounds for encrypt to `in`
+static uint64_t scramble_subst_perm_enc(uint64_t in, uint64_t key,
+                                        uint32_t bit_width,
+                                        uint32_t num_rounds) {
+  assert(bit_width <= 64);
 
-  std::vector<uint8_t> state(in);
+  uint64_t state = in;
 
   for (uint32_t i = 0; i < num_rounds; ++i) {
-    state = xor_vectors(state, key);
+    state ^= key;
 
     state = scramble_sbox_layer(state, bit_width, PRESENT_SBOX4);
     state = scramble_flip_layer(state, bit_width);
     state = scramble_perm_layer(state, bit_width, false);
   }
 
-  state = xor_vectors(state, key);
-
-  return state;
+  return state ^ key;
 }
 
-// Apply a full set of substitution/permutation rounds for decrypt to the
-// incoming byte vector
-static std::vector<uint8_t> scramble_subst_perm_dec(
-    const std::vector<uint8_t> &in, const std::vector<uint8_t> &key,
-    uint32_t bit_width, uint32_t num_rounds) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  assert(key.size() == ((bit_width + 7) / 8));
+// Apply a full set of substitution/permutation rounds for decrypt to `in`
+static uint64_t scramble_subst_perm_dec(uint64_t in, uint64_t key,
+                                        uint32_t bit_width,
+                                        uint32_t num_rounds) {
+  assert(bit_width <= 64);
 
-  std::vector<uint8_t> state(in);
+  uint64_t state = in;
 
   for (uint32_t i = 0; i < num_rounds; ++i) {
-    state = xor_vectors(state, key);
+    state ^= key;
 
     state = scramble_perm_layer(state, bit_width, true);
     state = scramble_flip_layer(state, bit_width);
     state = scramble_sbox_layer(state, bit_width, PRESENT_SBOX4_INV);
   }
 
-  state = xor_vectors(state, key);
-
-  return state;
+  return state ^ key;
 }
 
-// Generate a keystream for XORing with data using PRINCE.
-// If repeat_keystream is set to true, the output from one PRINCE instance is
-// repeated when the keystream is greater than a single PRINCE width (64bit).
-// Otherwise, multiple PRINCEs are instantiated to form the keystream.
-static std::vector<uint8_t> scramble_gen_keystream(
-    const std::vector<uint8_t> &addr, uint32_t addr_width,
-    const std::vector<uint8_t> &nonce, const std::vector<uint8_t> &key,
-    uint32_t keystream_width, uint32_t num_half_rounds, bool repeat_keystream) {
-  assert(key.size() == (kPrinceWidthByte * 2));
+static uint64_t prince_s_layer(const PrinceTables &tables, uint64_t in,
+                               bool invert) {
+  const uint8_t *sbox = invert ? tables.sbox_inv : tables.sbox;
+  uint64_t out = 0;
+  for (uint32_t i = 0; i < 8; ++i) {
+    out |= (uint64_t)sbox[(in >> (i * 8)) & 0xff] << (i * 8);
+  }
 
-  // Determine how many PRINCE replications are required
-  uint32_t num_princes, num_repetitions;
-  if (repeat_keystream) {
-    num_princes = 1;
-    num_repetitions = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
-  } else {
-    num_princes = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
-    num_repetitions = 1;
+  return out;
+}
+
+static uint64_t prince_m_prime_layer(const PrinceTables &tables, uint64_t in) {
+  uint64_t out = 0;
+  for (uint32_t i = 0; i < 8; ++i) {
+    out ^= tables.m_prime[i][(in >> (i * 8)) & 0xff];
   }
 
-  std::vector<uint8_t> keystream;
-
-  for (uint32_t i = 0; i < num_princes; ++i) {
-    // Initial vector is data for PRINCE to encrypt. Formed from nonce and data
-    // address
-    std::vector<uint8_t> iv(8, 0);
-
-    for (uint32_t j = 0; j < kPrinceWidth; ++j) {
-      if (j < addr_width) {
-        // Bottom addr_width bits of IV are address
-        or_vector_bit(iv, j, read_vector_bit(addr, j));
-      } else {
-        // Other bits are taken from nonce. Each PRINCE instantiation will use
-        // different nonce bits.
-        int nonce_bit = (j - addr_width) + i * (kPrinceWidth - addr_width);
-        or_vector_bit(iv, j, read_vector_bit(nonce, nonce_bit));
-      }
-    }
+  return out;
+}
 
-    // PRINCE C reference model works on big-endian byte order
-    iv = byte_reverse_vector(iv);
-    auto key_be = byte_reverse_vector(key);
-
-    // Apply PRINCE to IV to produce keystream
-    std::vector<uint8_t> keystream_block(kPrinceWidthByte);
-    prince_enc_dec(&iv[0], &key_be[0], &keystream_block[0], 0, num_half_rounds,
-                   0);
-
-    // Flip keystream into little endian order and add to keystream vector
-    keystream_block = byte_reverse_vector(keystream_block);
-    // Repeat the output of a single PRINCE instance if needed
-    for (uint32_t k = 0; k < num_repetitions; ++k) {
-      keystream.insert(keystream.end(), keystream_block.begin(),
-                       keystream_block.end());
-    }
+// The shift rows step of PRINCE: row i (nibbles at positions i, i + 4, ...,
+// counting from the top) is rotated left by 16 * i bits.
+static uint64_t prince_shift_rows(uint64_t in, bool invert) {
+  const uint64_t row_mask = 0xf000f000f000f000;
+  uint64_t out = 0;
+  for (uint32_t i = 0; i < 4; ++i) {
+    uint64_t row = in & (row_mask >> (4 * i));
+    out |= rotr64(row, invert ? i * 16 : (64 - i * 16) % 64);
   }
 
-  // Total keystream bits generated are some multiple of kPrinceWidth. This can
-  // result in unused keystream bits. Remove the unused bytes from the keystream
-  // vector and zero out top unused bits in the final byte if required.
-  uint32_t keystream_bytes = (keystream_width + 7) / 8;
-  uint32_t keystream_bytes_to_erase = keystream.size() - keystream_bytes;
-  if (keystream_bytes_to_erase) {
-    keystream.erase(keystream.end() - keystream_bytes_to_erase,
-                    keystream.end());
+  return out;
+}
+
+// PRINCE encryption with the new (non-legacy) key schedule, matching
+// prince_enc_dec_uint64() in the PRINCE reference model with decrypt and
+// old_key_schedule both zero.
+static uint64_t prince_encrypt(uint64_t in, uint64_t k0, uint64_t k1,
+                               uint32_t num_half_rounds) {
+  const PrinceTables &tables = get_prince_tables();
+  const uint64_t k0_prime = rotr64(k0, 1) ^ (k0 >> 63);
+
+  uint64_t state = in ^ k0 ^ k1 ^ kPrinceRoundConstants[0];
+  for (uint32_t round = 1; round <= num_half_rounds; ++round) {
+    state = prince_s_layer(tables, state, false);
+    state = prince_shift_rows(prince_m_prime_layer(tables, state), false);
+    state ^= ((round % 2 == 1) ? k0 : k1) ^ kPrinceRoundConstants[round];
   }
 
-  if (keystream_width % 8) {
-    keystream[keystream.size() - 1] &= (1 << (keystream_width % 8)) - 1;
+  state = prince_s_layer(tables, state, false);
+  state = prince_m_prime_layer(tables, state);
+  state = prince_s_layer(tables, state, true);
+
+  for (uint32_t round = 1; round <= num_half_rounds; ++round) {
+    uint32_t constant_idx = 10 - num_half_rounds + round;
+    state ^= (((num_half_rounds + round + 1) % 2 == 1) ? k0 : k1) ^
+             kPrinceRoundConstants[constant_idx];
+    state = prince_m_prime_layer(tables, prince_shift_rows(state, true));
+    state = prince_s_layer(tables, state, true);
   }
 
-  return keystream;
+  return state ^ k1 ^ kPrinceRoundConstants[11] ^ k0_prime;
 }
 
-// Split incoming data into subst_perm_width chunks and individually apply the
-// substitution/permutation layer to each
-static std::vector<uint8_t> scramble_subst_perm_full_width(
-    const std::vector<uint8_t> &in, uint32_t bit_width,
-    uint32_t subst_perm_width, bool enc) {
-  assert(in.size() == ((bit_width + 7) / 8));
+// Generate the keystream for the data at `addr` using PRINCE and XOR it into
+// `buf` ((keystream_width + 7) / 8 bytes).
+// If repeat_keystream is set to true, the output from one PRINCE instance is
+// repeated when the keystream is greater than a single PRINCE width (64bit).
+// Otherwise, multiple PRINCEs are instantiated to form the keystream.
+static void scramble_xor_keystream(uint8_t *buf, uint64_t addr,
+                                   uint32_t addr_width,
+                                   const std::vector<uint8_t> &nonce,
+                                   uint64_t k0, uint64_t k1,
+                                   uint32_t keystream_width,
+                                   uint32_t num_half_rounds,
+                                   bool repeat_keystream) {
+  assert(addr_width <= kPrinceWidth);
+
+  uint32_t nonce_bits_per_prince = kPrinceWidth - addr_width;
+  uint32_t num_blocks = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
+  uint64_t keystream_block = 0;
+
+  for (uint32_t i = 0; i < num_blocks; ++i) {
+    if (i == 0 || !repeat_keystream) {
+      // Initial vector is data for PRINCE to encrypt. The bottom addr_width
+      // bits are the address and the other bits are taken from nonce. Each
+      // PRINCE instantiation will use different nonce bits.
+      uint64_t iv = addr & width_mask(addr_width);
+      if (nonce_bits_per_prince) {
+        iv |= read_vector_bits(nonce, i * nonce_bits_per_prince,
+                               nonce_bits_per_prince)
+              << addr_width;
+      }
 
-  // Determine how many bytes each subst_perm_width chunk is and how many
-  // chunks are needed to cover the full bit_width.
-  uint32_t subst_perm_bytes = (subst_perm_width + 7) / 8;
-  uint32_t subst_perm_blocks =
-      (bit_width + subst_perm_width - 1) / subst_perm_width;
+      keystream_block = prince_encrypt(iv, k0, k1, num_half_rounds);
+    }
 
-  std::vector<uint8_t> out(in.size(), 0);
-  std::vector<uint8_t> zero_key(subst_perm_bytes, 0);
+    // Total keystream bits generated are some multiple of kPrinceWidth. Drop
+    // any unused bits from the final block.
+    uint32_t block_width =
+        std::min(kPrinceWidth, keystream_width - i * kPrinceWidth);
+    uint32_t block_bytes = (block_width + 7) / 8;
+    keystream_block &= width_mask(block_width);
+    for (uint32_t j = 0; j < block_bytes; ++j) {
+      buf[i * kPrinceWidthByte + j] ^= keystream_block >> (j * 8);
+    }
+  }
+}
 
-  auto sp_scrambler = enc ? scramble_subst_perm_enc : scramble_subst_perm_dec;
+// Split the data in `buf` into subst_perm_width chunks and individually apply
+// the substitution/permutation layer to each
+static void scramble_subst_perm_full_width(uint8_t *buf, uint32_t bit_width,
+                                           uint32_t subst_perm_width,
+                                           bool enc) {
+  assert(0 < subst_perm_width && subst_perm_width <= 64);
 
-  for (uint32_t i = 0; i < subst_perm_blocks; ++i) {
+  for (uint32_t pos = 0; pos < bit_width; pos += subst_perm_width) {
     // Where bit_width does not evenly divide into subst_perm_width the
     // final block is smaller.
-    uint32_t bits_so_far = subst_perm_width * i;
-    uint32_t block_width = std::min(subst_perm_width, bit_width - bits_so_far);
+    uint32_t block_width = std::min(subst_perm_width, bit_width - pos);
+
+    uint64_t block = read_bits(buf, pos, block_width);
+    block = enc ? scramble_subst_perm_enc(block, 0, block_width,
+                                          kNumDataSubstPermRounds)
+                : scramble_subst_perm_dec(block, 0, block_width,
+                                          kNumDataSubstPermRounds);
+    write_bits(buf, pos, block_width, block);
+  }
+
+  // Any unused top bits of the final byte are cleared
+  if (bit_width % 8) {
+    buf[bit_width / 8] &= (1 << (bit_width % 8)) - 1;
+  }
+}
+
+// Split a 128-bit PRINCE key (as a little endian byte vector) into K0 (the top
+// half) and K1 (the bottom half)
+static void split_prince_key(const std::vector<uint8_t> &key, uint64_t *k0,
+                             uint64_t *k1) {
+  assert(key.size() == (kPrinceWidthByte * 2));
 
-    std::vector<uint8_t> subst_perm_data(subst_perm_bytes, 0);
+  *k0 = read_bits(key.data(), kPrinceWidth, kPrinceWidth);
+  *k1 = read_bits(key.data(), 0, kPrinceWidth);
+}
 
-    // Extract bits from in for this chunk
-    for (uint32_t j = 0; j < block_width; ++j) {
-      or_vector_bit(subst_perm_data, j,
-                    read_vector_bit(in, j + i * subst_perm_width));
+// Encrypt or decrypt num_words words of data in place
+static void scramble_data_batch(uint8_t *data, size_t num_words,
+                                uint32_t data_width, uint32_t subst_perm_width,
+                                const uint64_t *addrs, uint32_t addr_width,
+                                const std::vector<uint8_t> &nonce,
+                                const std::vector<uint8_t> &key,
+                                bool repeat_keystream, bool use_sp_layer,
+                                bool enc) {
+  uint64_t k0, k1;
+  split_prince_key(key, &k0, &k1);
+
+  uint32_t data_bytes = (data_width + 7) / 8;
+  for (size_t i = 0; i < num_words; ++i) {
+    uint8_t *word = data + i * data_bytes;
+
+    // Data is encrypted by XORing with keystream then applying the
+    // substitution/permutation layer. Decryption does the reverse.
+    if (use_sp_layer && !enc) {
+      scramble_subst_perm_full_width(word, data_width, subst_perm_width,
+                                     false);
     }
 
-    // Apply the substitution/permutation layer to the chunk
-    auto subst_perm_out = sp_scrambler(subst_perm_data, zero_key, block_width,
-                                       kNumDataSubstPermRounds);
+    scramble_xor_keystream(word, addrs[i], addr_width, nonce, k0, k1,
+                           data_width, kNumPrinceHalfRounds,
+                           repeat_keystream);
 
-    // Write the result to the `out` vector
-    for (uint32_t j = 0; j < block_width; ++j) {
-      or_vector_bit(out, j + i * subst_perm_width,
-                    read_vector_bit(subst_perm_out, j));
+    if (use_sp_layer && enc) {
+      scramble_subst_perm_full_width(word, data_width, subst_perm_width, true);
     }
   }
+}
 
-  return out;
+void scramble_addr_batch(const uint64_t *addrs_in, uint64_t *addrs_out,
+                         size_t num_addrs, uint32_t addr_width,
+                         const std::vector<uint8_t> &nonce,
+                         uint32_t nonce_width) {
+  assert(addr_width <= 64 && addr_width <= nonce_width);
+
+  // Address is scrambled by using substitution/permutation layer with the
+  // top addr_width bits of the nonce used as a key.
+  uint64_t key =
+      read_vector_bits(nonce, nonce_width - addr_width, addr_width);
+  uint64_t mask = width_mask(addr_width);
+
+  for (size_t i = 0; i < num_addrs; ++i) {
+    addrs_out[i] = scramble_subst_perm_enc(addrs_in[i] & mask, key,
+                                           addr_width, kNumAddrSubstPermRounds);
+  }
+}
+
+void scramble_data_keystream_batch(uint8_t *keystreams, const uint64_t *addrs,
+                                   size_t num_addrs, uint32_t addr_width,
+                                   const std::vector<uint8_t> &nonce,
+                                   const std::vector<uint8_t> &key,
+                                   uint32_t data_width,
+                                   bool repeat_keystream) {
+  uint64_t k0, k1;
+  split_prince_key(key, &k0, &k1);
+
+  uint32_t data_bytes = (data_width + 7) / 8;
+  std::fill(keystreams, keystreams + num_addrs * data_bytes, 0);
+  for (size_t i = 0; i < num_addrs; ++i) {
+    scramble_xor_keystream(keystreams + i * data_bytes, addrs[i], addr_width,
+                           nonce, k0, k1, data_width, kNumPrinceHalfRounds,
+                           repeat_keystream);
+  }
+}
+
+void scramble_encrypt_data_batch(uint8_t *data, size_t num_words,
+                                 uint32_t data_width,
+                                 uint32_t subst_perm_width,
+                                 const uint64_t *addrs, uint32_t addr_width,
+                                 const std::vector<uint8_t> &nonce,
+                                 const std::vector<uint8_t> &key,
+                                 bool repeat_keystream, bool use_sp_layer) {
+  scramble_data_batch(data, num_words, data_width, subst_perm_width, addrs,
+                      addr_width, nonce, key, repeat_keystream, use_sp_layer,
+                      true);
+}
+
+void scramble_decrypt_data_batch(uint8_t *data, size_t num_words,
+                                 uint32_t data_width,
+                                 uint32_t subst_perm_width,
+                                 const uint64_t *addrs, uint32_t addr_width,
+                                 const std::vector<uint8_t> &nonce,
+                                 const std::vector<uint8_t> &key,
+                                 bool repeat_keystream, bool use_sp_layer) {
+  scramble_data_batch(data, num_words, data_width, subst_perm_width, addrs,
+                      addr_width, nonce, key, repeat_keystream, use_sp_layer,
+                      false);
 }
 
 std::vector<uint8_t> scramble_addr(const std::vector<uint8_t> &addr_in,
@@ -303,19 +499,27 @@ std::vector<uint8_t> scramble_addr(const std::vector<uint8_t> &addr_in,
                                    uint32_t nonce_width) {
   assert(addr_in.size() == ((addr_width + 7) / 8));
 
-  std::vector<uint8_t> addr_enc_nonce(addr_in.size(), 0);
+  uint64_t addr = read_vector_bits(addr_in, 0, addr_width);
+  uint64_t addr_out;
+  scramble_addr_batch(&addr, &addr_out, 1, addr_width, nonce, nonce_width);
 
-  // Address is scrambled by using substitution/permutation layer with the nonce
-  // used as a key.
-  // Extract relevant nonce bits for key
-  for (uint32_t i = 0; i < addr_width; ++i) {
-    or_vector_bit(addr_enc_nonce, i,
-                  read_vector_bit(nonce, nonce_width - addr_width + i));
-  }
+  return word_to_vector(addr_out, addr_width);
+}
 
-  // Apply substitution/permutation layer
-  return scramble_subst_perm_enc(addr_in, addr_enc_nonce, addr_width,
-                                 kNumAddrSubstPermRounds);
+std::vector<uint8_t> scramble_data_keystream(const std::vector<uint8_t> &addr,
+                                             uint32_t addr_width,
+                                             const std::vector<uint8_t> &nonce,
+                                             const std::vector<uint8_t> &key,
+                                             uint32_t data_width,
+                                             bool repeat_keystream) {
+  assert(addr.size() == ((addr_width + 7) / 8));
+
+  uint64_t addr_word = read_vector_bits(addr, 0, addr_width);
+  std::vector<uint8_t> keystream((data_width + 7) / 8);
+  scramble_data_keystream_batch(keystream.data(), &addr_word, 1, addr_width,
+                                nonce, key, data_width, repeat_keystream);
+
+  return keystream;
 }
 
 std::vector<uint8_t> scramble_encrypt_data(
@@ -326,21 +530,13 @@ std::vector<uint8_t> scramble_encrypt_data(
   assert(data_in.size() == ((data_width + 7) / 8));
   assert(addr.size() == ((addr_width + 7) / 8));
 
-  // Data is encrypted by XORing with keystream then applying
-  // substitution/permutation layer
-
-  auto keystream =
-      scramble_gen_keystream(addr, addr_width, nonce, key, data_width,
-                             kNumPrinceHalfRounds, repeat_keystream);
-
-  auto data_enc = xor_vectors(data_in, keystream);
+  uint64_t addr_word = read_vector_bits(addr, 0, addr_width);
+  std::vector<uint8_t> data_out(data_in);
+  scramble_encrypt_data_batch(data_out.data(), 1, data_width, subst_perm_width,
+                              &addr_word, addr_width, nonce, key,
+                              repeat_keystream, use_sp_layer);
 
-  if (use_sp_layer) {
-    return scramble_subst_perm_full_width(data_enc, data_width,
-                                          subst_perm_width, true);
-  } else {
-    return data_enc;
-  }
+  return data_out;
 }
 
 std::vector<uint8_t> scramble_decrypt_data(
@@ -351,16 +547,11 @@ std::vector<uint8_t> scramble_decrypt_data(
   assert(data_in.size() == ((data_width + 7) / 8));
   assert(addr.size() == ((addr_width + 7) / 8));
 
-  auto keystream =
-      scramble_gen_keystream(addr, addr_width, nonce, key, data_width,
-                             kNumPrinceHalfRounds, repeat_keystream);
-  if (use_sp_layer) {
-    // Data is decrypted by reversing substitution/permutation layer then XORing
-    // with keystream
-    auto data_sp_out = scramble_subst_perm_full_width(data_in, data_width,
-                                                      subst_perm_width, false);
-    return xor_vectors(data_sp_out, keystream);
-  } else {
-    return xor_vectors(data_in, keystream);
-  }
+  uint64_t addr_word = read_vector_bits(addr, 0, addr_width);
+  std::vector<uint8_t> data_out(data_in);
+  scramble_decrypt_data_batch(data_out.data(), 1, data_width, subst_perm_width,
+                              &addr_word, addr_width, nonce, key,
+                              repeat_keystream, use_sp_layer);
+
+  return data_out;
 }
@@ -5,6 +5,7 @@
 #ifndef OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
 #define OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
@@ -12,7 +13,8 @@ const uint32_t kPrinceWidth = 64;
 const uint32_t kPrinceWidthByte = kPrinceWidth / 8;
 
 // C++ model of memory scrambling. All byte vectors are in little endian byte
-// order (least significant byte at index 0).
+// order (least significant byte at index 0). Addresses and the
+// substitution/permutation width are at most 64 bits.
 
 /** Scramble an address to give the physical address used to access the
  * scrambled memory. Return vector of scrambled address bytes
@@ -28,6 +30,29 @@ std::vector<uint8_t> scramble_addr(const std::vector<uint8_t> &addr_in,
                                    const std::vector<uint8_t> &nonce,
                                    uint32_t nonce_width);
 
+/** Generate the keystream used to scramble data at an address
+ *
+ * When use_sp_layer is false, scramble_encrypt_data and scramble_decrypt_data
+ * just XOR the data with this keystream. Callers that scramble a lot of data
+ * with the same key and nonce can cache it.
+ *
+ * @param addr             Byte vector of data address
+ * @param addr_width       Width of the address in bits
+ * @param nonce            Byte vector of scrambling nonce
+ * @param key              Byte vector of scrambling key
+ * @param data_width       Width of data (and so the keystream) in bits
+ * @param repeat_keystream Repeat the keystream of one single PRINCE instance if
+ *                         set to true. Otherwise multiple PRINCE instances are
+ *                         used.
+ * @return Byte vector with the keystream (with any unused top bits zero)
+ */
+std::vector<uint8_t> scramble_data_keystream(const std::vector<uint8_t> &addr,
+                                             uint32_t addr_width,
+                                             const std::vector<uint8_t> &nonce,
+                                             const std::vector<uint8_t> &key,
+                                             uint32_t data_width,
+                                             bool repeat_keystream);
+
 /** Decrypt scrambled data
  * @param data_in          Byte vector of data to decrypt
  * @param data_width       Width of data in bits
@@ -76,4 +101,72 @@ std::vector<uint8_t> scramble_encrypt_data(
     uint32_t addr_width, const std::vector<uint8_t> &nonce,
     const std::vector<uint8_t> &key, bool repeat_keystream, bool use_sp_layer);
 
+/** Scramble a batch of addresses
+ *
+ * This is equivalent to calling scramble_addr on each address, but doesn't
+ * allocate any memory.
+ *
+ * @param addrs_in     Array of num_addrs addresses
+ * @param addrs_out    Array of num_addrs words that get the scrambled addresses
+ * @param num_addrs    Number of addresses to scramble
+ * @param addr_width   Width of the addresses in bits
+ * @param nonce        Byte vector of scrambling nonce
+ * @param nonce_width  Width of scramble nonce in bits
+ */
+void scramble_addr_batch(const uint64_t *addrs_in, uint64_t *addrs_out,
+                         size_t num_addrs, uint32_t addr_width,
+                         const std::vector<uint8_t> &nonce,
+                         uint32_t nonce_width);
+
+/** Generate the keystreams for a batch of addresses
+ *
+ * This is equivalent to calling scramble_data_keystream on each address. The
+ * keystream for addrs[i] is written to the (data_width + 7) / 8 bytes starting
+ * at keystreams + i * ((data_width + 7) / 8).
+ *
+ * @param keystreams       Buffer for the generated keystreams
+ * @param addrs            Array of num_addrs data addresses
+ * @param num_addrs        Number of keystreams to generate
+ * @param addr_width       Width of the addresses in bits
+ * @param nonce            Byte vector of scrambling nonce
+ * @param key              Byte vector of scrambling key
+ * @param data_width       Width of data (and so each keystream) in bits
+ * @param repeat_keystream As for scramble_data_keystream
+ */
+void scramble_data_keystream_batch(uint8_t *keystreams, const uint64_t *addrs,
+                                   size_t num_addrs, uint32_t addr_width,
+                                   const std::vector<uint8_t> &nonce,
+                                   const std::vector<uint8_t> &key,
+                                   uint32_t data_width, bool repeat_keystream);
+
+/** Decrypt a batch of scrambled data words in place
+ *
+ * This is equivalent to calling scramble_decrypt_data on each word. Word i is
+ * the (data_width + 7) / 8 bytes starting at data + i * ((data_width + 7) / 8)
+ * and was stored at addrs[i]. The other parameters are as for
+ * scramble_decrypt_data.
+ */
+void scramble_decrypt_data_batch(uint8_t *data, size_t num_words,
+                                 uint32_t data_width,
+                                 uint32_t subst_perm_width,
+                                 const uint64_t *addrs, uint32_t addr_width,
+                                 const std::vector<uint8_t> &nonce,
+                                 const std::vector<uint8_t> &key,
+                                 bool repeat_keystream, bool use_sp_layer);
+
+/** Encrypt a batch of data words in place
+ *
+ * This is equivalent to calling scramble_encrypt_data on each word. Word i is
+ * the (data_width + 7) / 8 bytes starting at data + i * ((data_width + 7) / 8)
+ * and will be stored at addrs[i]. The other parameters are as for
+ * scramble_encrypt_data.
+ */
+void scramble_encrypt_data_batch(uint8_t *data, size_t num_words,
+                                 uint32_t data_width,
+                                 uint32_t subst_perm_width,
+                                 const uint64_t *addrs, uint32_t addr_width,
+                                 const std::vector<uint8_t> &nonce,
+                                 const std::vector<uint8_t> &key,
+                                 bool repeat_keystream, bool use_sp_layer);
+
 #endif  // OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
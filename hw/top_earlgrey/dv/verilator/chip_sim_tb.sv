@@ -13,8 +13,8 @@ module chip_sim_tb (
   logic cio_uart_rx_p2d, cio_uart_tx_d2p, cio_uart_tx_en_d2p;
 
   logic cio_spi_device_sck_p2d, cio_spi_device_csb_p2d;
-  logic cio_spi_device_sdi_p2d;
-  logic cio_spi_device_sdo_d2p, cio_spi_device_sdo_en_d2p;
+  logic [3:0] cio_spi_device_sd_p2d;
+  logic [3:0] cio_spi_device_sd_d2p, cio_spi_device_sd_en_d2p;
 
   logic cio_usbdev_sense_p2d;
   logic cio_usbdev_se0_d2p;
@@ -44,9 +44,9 @@ module chip_sim_tb (
     // communication with SPI
     .cio_spi_device_sck_p2d_i(cio_spi_device_sck_p2d),
     .cio_spi_device_csb_p2d_i(cio_spi_device_csb_p2d),
-    .cio_spi_device_sdi_p2d_i(cio_spi_device_sdi_p2d),
-    .cio_spi_device_sdo_d2p_o(cio_spi_device_sdo_d2p),
-    .cio_spi_device_sdo_en_d2p_o(cio_spi_device_sdo_en_d2p),
+    .cio_spi_device_sd_p2d_i(cio_spi_device_sd_p2d),
+    .cio_spi_device_sd_d2p_o(cio_spi_device_sd_d2p),
+    .cio_spi_device_sd_en_d2p_o(cio_spi_device_sd_en_d2p),
 
     // communication with USB
     .cio_usbdev_sense_p2d_i(cio_usbdev_sense_p2d),
@@ -135,9 +135,9 @@ module chip_sim_tb (
     .rst_ni (rst_ni),
     .spi_device_sck_o     (cio_spi_device_sck_p2d),
     .spi_device_csb_o     (cio_spi_device_csb_p2d),
-    .spi_device_sdi_o     (cio_spi_device_sdi_p2d),
-    .spi_device_sdo_i     (cio_spi_device_sdo_d2p),
-    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p)
+    .spi_device_sd_o      (cio_spi_device_sd_p2d),
+    .spi_device_sd_i      (cio_spi_device_sd_d2p),
+    .spi_device_sd_en_i   (cio_spi_device_sd_en_d2p)
   );
 
   // USB DPI
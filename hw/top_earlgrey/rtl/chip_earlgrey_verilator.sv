@@ -22,9 +22,9 @@ module chip_earlgrey_verilator (
   // communication with SPI
   input cio_spi_device_sck_p2d_i,
   input cio_spi_device_csb_p2d_i,
-  input cio_spi_device_sdi_p2d_i,
-  output logic cio_spi_device_sdo_d2p_o,
-  output logic cio_spi_device_sdo_en_d2p_o,
+  input [3:0] cio_spi_device_sd_p2d_i,
+  output logic [3:0] cio_spi_device_sd_d2p_o,
+  output logic [3:0] cio_spi_device_sd_en_d2p_o,
 
   // communication with USB
   input cio_usbdev_sense_p2d_i,
@@ -58,7 +58,7 @@ module chip_earlgrey_verilator (
     dio_in = '0;
     dio_in[DioSpiDeviceSck] = cio_spi_device_sck_p2d_i;
     dio_in[DioSpiDeviceCsb] = cio_spi_device_csb_p2d_i;
-    dio_in[DioSpiDeviceSd0] = cio_spi_device_sdi_p2d_i;
+    dio_in[DioSpiDeviceSd3:DioSpiDeviceSd0] = cio_spi_device_sd_p2d_i;
     dio_in[DioUsbdevUsbDp] = cio_usbdev_dp_p2d_i;
     dio_in[DioUsbdevUsbDn] = cio_usbdev_dn_p2d_i;
   end
@@ -86,8 +86,8 @@ module chip_earlgrey_verilator (
   assign cio_usbdev_dn_d2p_o = dio_out[DioUsbdevUsbDn];
   assign cio_usbdev_dn_en_d2p_o = dio_oe[DioUsbdevUsbDn];
 
-  assign cio_spi_device_sdo_d2p_o = dio_out[DioSpiDeviceSd1];
-  assign cio_spi_device_sdo_en_d2p_o = dio_oe[DioSpiDeviceSd1];
+  assign cio_spi_device_sd_d2p_o = dio_out[DioSpiDeviceSd3:DioSpiDeviceSd0];
+  assign cio_spi_device_sd_en_d2p_o = dio_oe[DioSpiDeviceSd3:DioSpiDeviceSd0];
 
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_in;
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_out;
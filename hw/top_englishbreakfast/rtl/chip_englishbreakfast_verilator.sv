@@ -14,8 +14,8 @@ module chip_englishbreakfast_verilator (
   logic cio_uart_rx_p2d, cio_uart_tx_d2p, cio_uart_tx_en_d2p;
 
   logic cio_spi_device_sck_p2d, cio_spi_device_csb_p2d;
-  logic cio_spi_device_sdi_p2d;
-  logic cio_spi_device_sdo_d2p, cio_spi_device_sdo_en_d2p;
+  logic [3:0] cio_spi_device_sd_p2d;
+  logic [3:0] cio_spi_device_sd_d2p, cio_spi_device_sd_en_d2p;
 
   logic cio_usbdev_sense_p2d;
   logic cio_usbdev_se0_d2p;
@@ -38,7 +38,7 @@ module chip_englishbreakfast_verilator (
     dio_in = '0;
     dio_in[DioSpiDeviceSck] = cio_spi_device_sck_p2d;
     dio_in[DioSpiDeviceCsb] = cio_spi_device_csb_p2d;
-    dio_in[DioSpiDeviceSd0] = cio_spi_device_sdi_p2d;
+    dio_in[DioSpiDeviceSd3:DioSpiDeviceSd0] = cio_spi_device_sd_p2d;
     dio_in[DioUsbdevUsbDp] = cio_usbdev_dp_p2d;
     dio_in[DioUsbdevUsbDn] = cio_usbdev_dn_p2d;
   end
@@ -60,12 +60,12 @@ module chip_englishbreakfast_verilator (
   assign cio_usbdev_dn_pullup_d2p = usb_dn_pullup;
   assign cio_usbdev_dp_pullup_d2p = usb_dp_pullup;
   assign cio_usbdev_se0_d2p = usb_tx_se0;
-  assign cio_spi_device_sdo_d2p = dio_out[DioSpiDeviceSd1];
+  assign cio_spi_device_sd_d2p = dio_out[DioSpiDeviceSd3:DioSpiDeviceSd0];
 
   assign cio_usbdev_dn_en_d2p = dio_oe[DioUsbdevUsbDn];
   assign cio_usbdev_dp_en_d2p = dio_oe[DioUsbdevUsbDp];
   assign cio_usbdev_d_en_d2p  = dio_oe[DioUsbdevUsbDp];
-  assign cio_spi_device_sdo_en_d2p = dio_oe[DioSpiDeviceSd1];
+  assign cio_spi_device_sd_en_d2p = dio_oe[DioSpiDeviceSd3:DioSpiDeviceSd0];
 
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_in;
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_out;
@@ -292,9 +292,9 @@ module chip_englishbreakfast_verilator (
     .rst_ni (rst_ni),
     .spi_device_sck_o     (cio_spi_device_sck_p2d),
     .spi_device_csb_o     (cio_spi_device_csb_p2d),
-    .spi_device_sdi_o     (cio_spi_device_sdi_p2d),
-    .spi_device_sdo_i     (cio_spi_device_sdo_d2p),
-    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p)
+    .spi_device_sd_o      (cio_spi_device_sd_p2d),
+    .spi_device_sd_i      (cio_spi_device_sd_d2p),
+    .spi_device_sd_en_i   (cio_spi_device_sd_en_d2p)
   );
 
   // USB DPI